@@ -20,6 +20,9 @@
 lh_value   _channel_async_handler(channel_t* channel, lh_actionfun* action, lh_value arg);
 void       _channel_async_req_resume(lh_resume r, lh_value local, uv_req_t* req, uverr_t err);
 
+// Interleave `n` actions; exceptions are returned in `exceptions` instead of being rethrown
+void       asyncx_interleave(size_t n, lh_actionfun* actions[], lh_value arg_results[], lh_exception* exceptions[]);
+
 // These are callback functions to resume requests:
 // Calling this will resume the `async_await` call on that request. 
 // A call to these will resume at most once! (and be ignored after that)
@@ -55,10 +58,14 @@ uv_errno_t   asyncx_await_fs(uv_fs_t* req);
 // Set a timeout callback 
 typedef void uv_timeoutfun(void* arg);
 uv_errno_t   _uv_set_timeout(uv_loop_t* loop, uv_timeoutfun* cb, void* arg, uint64_t timeout);
+uv_timer_t*  nodec_timer_alloc();
 void         nodec_timer_free(uv_timer_t* timer, bool owner_release);
 
 int          channel_receive_nocancel(channel_t* channel, lh_value* data, lh_value* arg);
 
+void         nodec_handle_free(uv_handle_t* h);
+void         check_uv_err_addr(int err, const struct sockaddr* addr);
+
 #define UV_ETHROWCANCEL   (-10000)
 #define UV_EHTTP          (-20000)
 
@@ -106,6 +113,166 @@ void     nodec_log_shutdown();
     using_implicit_defer_exit(nodec_log_shutdown(),_nodec_log_freev,_nodec_log_allocv(level),log)
 
 
+// ---------------------------------------------------------------------------------
+// Pool of initialized zlib streams (per event loop)
+// ---------------------------------------------------------------------------------
+
+#ifdef USE_ZLIB
+implicit_declare(zpool)
+
+lh_value _nodec_zpool_allocv();
+void     _nodec_zpool_freev(lh_value poolv);
+
+#define using_zstream_pool()  \
+    using_implicit_defer(_nodec_zpool_freev,_nodec_zpool_allocv(),zpool)
+#else
+#define using_zstream_pool()
+#endif
+
+
+// ---------------------------------------------------------------------------------
+// Resolver cache (per event loop)
+// ---------------------------------------------------------------------------------
+
+implicit_declare(dns_cache)
+
+lh_value _nodec_dns_cache_allocv();
+void     _nodec_dns_cache_freev(lh_value cachev);
+
+#define using_dns_cache()  \
+    using_implicit_defer(_nodec_dns_cache_freev,_nodec_dns_cache_allocv(),dns_cache)
+
+
+// ---------------------------------------------------------------------------------
+// Admission control, idle connections, and statistics of TCP servers (per event loop)
+// ---------------------------------------------------------------------------------
+
+implicit_declare(tcp_servers)
+
+lh_value _nodec_tcp_servers_allocv();
+void     _nodec_tcp_servers_freev(lh_value serversv);
+
+#define using_tcp_servers()  \
+    using_implicit_defer(_nodec_tcp_servers_freev,_nodec_tcp_servers_allocv(),tcp_servers)
+
+
+// ---------------------------------------------------------------------------------
+// Pool of client connections (per event loop)
+// ---------------------------------------------------------------------------------
+
+implicit_declare(http_pool)
+
+lh_value _nodec_http_pool_allocv();
+void     _nodec_http_pool_freev(lh_value poolv);
+
+#define using_http_pool()  \
+    using_implicit_defer(_nodec_http_pool_freev,_nodec_http_pool_allocv(),http_pool)
+
+
+// ---------------------------------------------------------------------------------
+// Pool of request arena blocks (per event loop)
+// ---------------------------------------------------------------------------------
+
+implicit_declare(http_arenas)
+
+lh_value _nodec_http_arenas_allocv();
+void     _nodec_http_arenas_freev(lh_value arenasv);
+
+#define using_http_arenas()  \
+    using_implicit_defer(_nodec_http_arenas_freev,_nodec_http_arenas_allocv(),http_arenas)
+
+// Connect and drain the response afterwards; `keep_alive` is set if the connection can be reused
+lh_value async_http_connect_on_ex(const char* host, nodec_bstream_t* connection, http_connect_fun* connectfun, lh_value arg, bool* keep_alive);
+
+// Parse a request target at a host without intermediate copies; returns NULL on error
+nodec_url_t* nodecx_parse_url_at(const char* host, const char* target);
+
+
+// ---------------------------------------------------------------------------------
+// HTTP servers and HTTP/2 
+// ---------------------------------------------------------------------------------
+
+// Settings of an HTTP server passed to each connection
+typedef struct _http_server_args_t {
+  nodec_http_servefun* servefun;
+  int                  pipeline;   // maximal pipelined HTTP/1.1 requests served concurrently
+  bool                 http2;      // accept HTTP/2 connections
+} http_server_args_t;
+
+void nodec_http_serve_with(int id, nodec_bstream_t* client, lh_value sargsv);
+
+// Send the response headers of a framed request; `head` contains the 
+// headers as `Field: value\r\n` lines, and `body` is the full body or null.
+typedef void (http_framed_headers_fun)(lh_value arg, http_status_t status, uv_buf_t head, uv_buf_t body);
+
+// A request that arrived over an HTTP/2 stream
+typedef struct _http_framed_t {
+  const char* const* fields;     // header names and values (`fields[2*i]` and `fields[2*i+1]`), including pseudo headers
+  size_t             count;      // number of headers
+  nodec_bstream_t*   body;       // request body or NULL; owned by the request
+  nodec_stream_t*    out;        // response body stream
+  http_framed_headers_fun* send_headers;
+  lh_value           arg;
+} http_framed_t;
+
+// Serve a framed request with the regular server function; the request and 
+// response are bound to `http_req()` and `http_resp()` as usual.
+void http_serve_framed(int id, nodec_http_servefun* servefun, const http_framed_t* framed);
+
+// A response recorded for the response cache
+typedef struct _http_capture_t {
+  http_out_t*   out;        // the response being captured
+  http_status_t status;
+  bool          sent;       // true once the headers were sent
+  size_t        head_start; // offset of the first header line to capture
+  uv_buf_t      head;       // the header lines (`Field: value\r\n`) added while capturing
+  uv_buf_t      body;
+  size_t        body_len;
+  size_t        max_len;    // stop capturing a body larger than this
+  bool          overflow;   // the body was too large
+} http_capture_t;
+
+void http_out_capture(http_out_t* out, http_capture_t* capture);
+void http_capture_clear(http_capture_t* capture);
+void http_capture_clearv(lh_value capturev);
+void http_out_send_cached(http_out_t* out, http_status_t status, uv_buf_t status_line, uv_buf_t lines, uint64_t age, uv_buf_t body);
+
+// Return true if the first data on a connection is the HTTP/2 connection preface
+bool async_http2_detect(nodec_bstream_t* client);
+
+// Serve all streams of an HTTP/2 connection
+void async_http2_serve(int id, nodec_bstream_t* client, nodec_http_servefun* servefun);
+
+// HPACK header decoding (RFC 7541); used by the tests
+typedef struct _hpack_table_t hpack_table_t;
+
+hpack_table_t* hpack_decoder_alloc(size_t max_size);
+void           hpack_decoder_free(hpack_table_t* t);
+
+// Decode a header block into consecutive `name\0value\0` strings in `*fields` (to be freed by the caller);
+// returns 0 on success or an HTTP/2 error code.
+int            hpack_decoder_decode(hpack_table_t* t, const uint8_t* block, size_t len, char** fields, size_t* count);
+
+// The size of the dynamic table, and its entry `i` (where 0 is the newest).
+size_t         hpack_decoder_size(hpack_table_t* t);
+bool           hpack_decoder_entry(hpack_table_t* t, size_t i, const char** name, const char** value);
+
+
+// ---------------------------------------------------------------------------------
+// Stream servers over TCP or pipes
+// ---------------------------------------------------------------------------------
+
+tcp_channel_t* nodec_stream_listen_ex(uv_stream_t* server, int backlog, int accept_queue, bool channel_owns_server);
+
+void async_stream_server_on(tcp_channel_t* ch,
+  const tcp_server_config_t* config,
+  nodec_tcp_connection_fun_t* servefun,
+  nodec_tcp_connection_wrap_t* wrapfun,
+  lh_actionfun* on_exn,
+  lh_value serve_arg,
+  lh_value wrap_arg);
+
+
 // ---------------------------------------------------------------------------------
 // LibUV streams 
 // ---------------------------------------------------------------------------------
@@ -87,12 +87,16 @@ typedef void     (nodec_stream_free_fun)(nodec_stream_t* stream);
 typedef void     (async_shutdown_fun)(nodec_stream_t* stream);
 typedef uv_buf_t (async_read_bufx_fun)(nodec_stream_t* stream, bool* buf_owned);
 typedef void     (async_write_bufs_fun)(nodec_stream_t* stream, uv_buf_t bufs[], size_t count);
+typedef void     (async_flush_fun)(nodec_stream_t* stream);
+typedef size_t   (nodec_write_queued_fun)(nodec_stream_t* stream);
 
 struct _nodec_stream_t {
   async_read_bufx_fun*    read_bufx;
   async_write_bufs_fun*   write_bufs;
   async_shutdown_fun*     shutdown;
   nodec_stream_free_fun*  stream_free;
+  async_flush_fun*        flush;          // can be NULL if writes are not buffered
+  nodec_write_queued_fun* write_queued;   // can be NULL if the queued bytes are unknown
 };
 
 void nodec_stream_init(nodec_stream_t* stream,
@@ -101,6 +105,8 @@ void nodec_stream_init(nodec_stream_t* stream,
   async_shutdown_fun*   shutdown,
   nodec_stream_free_fun* stream_free);
 void nodec_stream_release(nodec_stream_t* stream);
+void nodec_stream_set_flush(nodec_stream_t* stream, async_flush_fun* flush);
+void nodec_stream_set_write_queued(nodec_stream_t* stream, nodec_write_queued_fun* write_queued);
 
 typedef struct _chunk_t {
   struct _chunk_t* next;
@@ -161,10 +167,28 @@ nodec_uv_stream_t* nodec_uv_stream_alloc(uv_stream_t* stream);
 void nodec_uv_stream_read_start(nodec_uv_stream_t* rs, size_t alloc_init, size_t alloc_max);
 void nodec_uv_stream_read_restart(nodec_uv_stream_t* rs);
 void nodec_uv_stream_read_stop(nodec_uv_stream_t* rs);
+// Stop reading when `high_water` bytes are read but not yet consumed; reading
+// resumes once a reader awaits more data. Use 0 to never stop (the default).
+void nodec_uv_stream_read_high_water(nodec_uv_stream_t* rs, size_t high_water);
 
 // Used to implement keep-alive in tcp.c
 uv_errno_t asyncx_uv_stream_await_available(nodec_uv_stream_t* stream, int64_t timeout);
 
+// Check without waiting if an idle stream is still usable; returns an error if 
+// it was closed, has an error, or has unexpected data available. Used for connection pooling.
+uv_errno_t nodecx_uv_stream_check_idle(nodec_uv_stream_t* stream);
+
+// Called once when data or eof arrives on a stream that no strand awaits.
+// This allows idle streams to be parked without a strand.
+typedef void (nodec_uv_stream_ready_fun)(uv_stream_t* stream, void* arg);
+void nodec_uv_stream_on_ready(nodec_uv_stream_t* stream, nodec_uv_stream_ready_fun* fun, void* arg);
+
+// Free a stream that no strand awaits; can be called from a libuv callback.
+void nodec_uv_stream_close(nodec_uv_stream_t* stream);
+
+
+typedef struct _tcp_admission_t tcp_admission_t;
+typedef struct _tcp_reaper_t    tcp_reaper_t;
 
 typedef struct _tcp_connection_args {
   nodec_tcp_connection_fun_t* connection_fun;
@@ -175,6 +199,9 @@ typedef struct _tcp_connection_args {
   uint64_t            timeout_keepalive;
   lh_actionfun*       on_exn;
   nodec_uv_stream_t*  uvclient;
+  tcp_admission_t*    admission;    // used to sample request latency
+  tcp_reaper_t*       reaper;       // if not NULL, idle keep-alive connections are parked here
+  bool*               parked;       // set to true if the connection was parked
 } tcp_connection_args;
 
 typedef void (nodec_tcp_connection_wrap_t)(const tcp_connection_args* args, lh_value arg );
@@ -100,6 +100,11 @@ bool nodec_ends_withi(const char* s, const char* postfix);
 /// for example `Thu, 01 Jan 1972 00:00:00 GMT`.
 const char* nodec_inet_date_now();
 
+/// Get the current time as a RFC1123 internet date, formatted only once per second.
+/// The date is refreshed as soon as the wall-clock second changes.
+/// \returns The current time in RFC1123 format (do not free).
+const char* nodec_inet_date_cached();
+
 /// Format a time as a RFC1123 internet date.
 /// Caches previous results to increase efficiency.
 /// \param now The time to convert.
@@ -176,7 +181,8 @@ uv_buf_t nodec_buf_fit(uv_buf_t buf, size_t needed);
 /// Append the contents of `buf2` into `buf1`.
 /// \param buf1 the destination buffer.
 /// \param buf2 the source buffer.
-/// \returns a potentially resized `buf1` that contains the contents of both.
+/// \returns a potentially resized `buf1` that contains the contents of both;
+/// its length is the length of the contents so it can be appended into again.
 uv_buf_t nodec_buf_append_into(uv_buf_t buf1, uv_buf_t buf2);
 
 
@@ -406,8 +412,8 @@ void        async_fs_close(uv_file file);
 /// Read a file into a buffer.
 /// \param file The file handle
 /// \param buf  The buffer to read into.
-/// \param file_offset The offset to read from in the file.
-/// \returns The number of bytes read.
+/// \param file_offset The offset to read from in the file, or -1 to read from the current position.
+/// \returns The number of bytes read; this is less than `buf.len` only at the end of the file.
 size_t      async_fs_read_into(uv_file file, uv_buf_t buf, int64_t file_offset);
 
 /// Read part of a file.
@@ -415,7 +421,7 @@ size_t      async_fs_read_into(uv_file file, uv_buf_t buf, int64_t file_offset);
 /// \param file The file to read from.
 /// \param max  The maximum number of bytes to read.
 /// \param file_offset The offset to read from in the file.
-/// \returns a buffer contiaining the bytes read.
+/// \returns a buffer contiaining the bytes read; it is shorter than `max` only at the end of the file.
 uv_buf_t    async_fs_read_buf(uv_file file, size_t max, int64_t file_offset);
 
 /// Read an entire file (or up to `max` bytes)
@@ -424,6 +430,17 @@ uv_buf_t    async_fs_read_buf(uv_file file, size_t max, int64_t file_offset);
 /// \returns A buffer with the file contents.
 uv_buf_t    async_fs_read_buf_all(uv_file file, size_t max);
 
+/// Write a buffer to a file.
+/// \param file The file to write to.
+/// \param buf  The buffer to write; it is always written entirely.
+/// \param file_offset The offset to write at in the file, or -1 to write at the current position.
+void        async_fs_write(uv_file file, uv_buf_t buf, int64_t file_offset);
+
+/// Create and open a new temporary file for reading and writing.
+/// The file is deleted when it is closed.
+/// \returns The file handle.
+uv_file     async_fs_open_temp();
+
 /// Used to iterate over the contents of a directory.
 typedef uv_fs_t nodec_scandir_t;
 
@@ -592,6 +609,19 @@ void      async_write_buf(nodec_stream_t* stream, uv_buf_t buf);
 /// \param s      the string to write.
 void      async_write(nodec_stream_t* stream, const char* s);
 
+/// Write out any data that a stream buffered internally.
+/// Streams that do not buffer ignore this. For example, a chunked
+/// HTTP response body collects small writes into larger chunks and
+/// only sends them once enough data is written, on shutdown, or when flushed.
+/// \param stream the stream to flush.
+void      async_flush(nodec_stream_t* stream);
+
+/// Return the bytes written to a stream that are not yet sent by the connection.
+/// Wrapping streams report the queue of the connection they write to.
+/// \param stream the stream.
+/// \returns the queued bytes, or 0 if unknown.
+size_t    nodec_stream_write_queued(nodec_stream_t* stream);
+
 /// Write a formatted string to a stream.
 /// Writes at most 511 bytes after formatting.
 /// \param stream stream to write to.
@@ -697,6 +727,17 @@ void nodec_pushback_buf(nodec_bstream_t* bstream, uv_buf_t buf);
 /// Create a buffered stream from a plain stream
 nodec_bstream_t* nodec_bstream_alloc_on(nodec_stream_t* source);
 
+/// Create a buffered read stream over a buffer.
+/// The stream takes ownership of the buffer.
+nodec_bstream_t* nodec_bstream_alloc_buf(uv_buf_t buf);
+
+/// Create a read stream over a file.
+/// The stream takes ownership of the file and closes it when the stream is freed.
+/// \param file The file to read from.
+/// \param file_offset The offset to start reading from.
+/// \returns A read stream.
+nodec_stream_t* nodec_fs_stream_alloc(uv_file file, int64_t file_offset);
+
 
 /// Low level: Create a buffered stream from an internal `uv_stream_t`.
 ///
@@ -739,12 +780,73 @@ nodec_bstream_t* nodec_zstream_alloc(nodec_stream_t* stream, bool own_stream);
 ///               owns the input `stream` and takes care of shutdown and free.
 /// \param compress_level  the compression level to use between 1 and 9 (6 by default, which
 ///                         is a good balance between speed and compression ratio).
+///                         Use #NODEC_ZLEVEL_ADAPTIVE to pick a level based on the current load.
 /// \param gzip   if `true` uses the gzip format for compression while reading both
 ///               deflate and gzip streams. If false, uses deflate for both compression
 ///               and decompression.
 /// \returns a new buffered stream that automatically (de)compresses.
 nodec_bstream_t* nodec_zstream_alloc_ex(nodec_stream_t* stream, bool own_stream, int compress_level, bool gzip);
 
+/// Compress a complete buffer in one go.
+/// This is more efficient than using a zstream for bodies that are fully in memory
+/// and the result has a known length (so it can be sent with a `Content-Length`).
+/// \param src  the buffer to compress.
+/// \param compress_level  the compression level to use between 1 and 9 (or #NODEC_ZLEVEL_ADAPTIVE).
+/// \param gzip if `true` uses the gzip format, otherwise the zlib deflate format.
+/// \returns a newly allocated buffer with the compressed data; its length is
+///          exactly the compressed size.
+uv_buf_t nodec_zstream_compress_buf(uv_buf_t src, int compress_level, bool gzip);
+
+/// Use as a compression level to adapt the level to the current load.
+/// See nodec_zstream_adaptive_set() to configure the policy.
+#define NODEC_ZLEVEL_ADAPTIVE  (-2)
+
+/// Configuration for adaptive compression levels.
+/// The load is determined from the measured event loop lag and the
+/// bytes queued for the connection that is written to; under no load `level_max` is used and
+/// as the load increases the level goes linearly down to `level_min`.
+typedef struct _nodec_zadaptive_config_t {
+  int      level_min;          ///< Compression level under high load (1 by default).
+  int      level_max;          ///< Compression level under low load (6 by default).
+  uint64_t lag_low;            ///< Event loop lag (in ms) below which there is no load (5 by default).
+  uint64_t lag_high;           ///< Event loop lag (in ms) considered high load (100 by default).
+  size_t   queued_low;         ///< Queued write bytes of a connection below which there is no load (1MB by default).
+  size_t   queued_high;        ///< Queued write bytes of a connection considered high load (16MB by default).
+} nodec_zadaptive_config_t;
+
+/// Return the default adaptive compression configuration.
+#define nodec_zadaptive_default_config()  { 1, 6, 5, 100, 1024*1024, 16*1024*1024 }
+
+/// Set the adaptive compression policy for the current event loop.
+/// \param config the new configuration; use NULL to restore the default configuration.
+void nodec_zstream_adaptive_set(const nodec_zadaptive_config_t* config);
+
+/// Return the compression level the adaptive policy would use now
+/// for writing to `stream`.
+/// \param stream the stream the compressed data is written to; can be NULL
+///               to only take the event loop lag into account.
+int nodec_zstream_adaptive_level(nodec_stream_t* stream);
+
+/// Compression statistics per compression level.
+typedef struct _nodec_zlevel_stats_t {
+  uint64_t streams;            ///< Number of compressed streams or buffers.
+  uint64_t bytes_in;           ///< Total uncompressed bytes.
+  uint64_t bytes_out;          ///< Total compressed bytes.
+  uint64_t elapsed_usecs;      ///< Total (wall clock) time spent compressing in micro seconds.
+} nodec_zlevel_stats_t;
+
+/// Get the compression statistics of the current event loop for a given level.
+/// \param level the compression level (between 0 and 9).
+/// \param[out] stats the statistics for that level.
+void nodec_zstream_level_stats(int level, nodec_zlevel_stats_t* stats);
+
+/// Set the maximal memory used for pooling zlib state in the current event loop.
+/// Initialized (de)compression state is reused between zstreams with the same
+/// compression level and format. Released state is discarded once the pool 
+/// exceeds `max_size` bytes (4MB by default). Use 0 to disable pooling.
+/// \param max_size the maximal estimated memory in bytes held by the pool.
+void nodec_zstream_pool_set_max(size_t max_size);
+
 #endif
 
 /// \}
@@ -773,8 +875,35 @@ void nodec_ip6_addr(const char* ip, int port, struct sockaddr_in6* addr);
 void nodec_sockname(const struct sockaddr* addr, char* buf, size_t bufsize);
 
 void async_getnameinfo(const struct sockaddr* addr, int flags, char** node, char** service);
+/// Resolve a host name.
+/// Results are cached per event loop (see nodec_dns_cache_set()) and concurrent
+/// lookups for the same name share one request.
+/// \param node    the host name.
+/// \param service the service name or port, can be `NULL`.
+/// \param hints   optional hints (only `ai_flags`, `ai_family`, `ai_socktype`, and `ai_protocol` are used).
+/// \returns the address info (to be freed with nodec_free_addrinfo()), or `NULL` if the name is unknown.
 struct addrinfo* async_getaddrinfo(const char* node, const char* service, const struct addrinfo* hints);
 
+/// Statistics of the resolver cache.
+typedef struct _nodec_dns_stats_t {
+  uint64_t hits;            ///< Lookups answered from the cache.
+  uint64_t negative_hits;   ///< Lookups answered from a cached unknown name.
+  uint64_t stale_hits;      ///< Lookups answered with an expired entry while it is refreshed.
+  uint64_t misses;          ///< Lookups that started a new request.
+  uint64_t coalesced;       ///< Lookups that waited for a request already in flight.
+} nodec_dns_stats_t;
+
+/// Configure the resolver cache of the current event loop.
+/// This expires all current entries.
+/// \param ttl           milliseconds a resolved name is cached (default 60000).
+/// \param negative_ttl  milliseconds an unknown name is cached (default 5000).
+/// \param stale_ttl     milliseconds an expired name is still returned while it is refreshed (default 30000).
+/// Use 0 for both `ttl` and `negative_ttl` to disable the cache.
+void nodec_dns_cache_set(uint64_t ttl, uint64_t negative_ttl, uint64_t stale_ttl);
+
+/// Get the resolver cache statistics of the current event loop.
+void nodec_dns_cache_stats(nodec_dns_stats_t* stats);
+
 void nodec_free_addrinfo(struct addrinfo* info);
 void nodec_free_addrinfov(lh_value infov);
 #define using_addrinfo(name)  defer(nodec_free_addrinfov,lh_value_ptr(name))
@@ -874,17 +1003,66 @@ void            nodec_tcp_freev(lh_value tcp);
 
 void            nodec_tcp_bind(uv_tcp_t* handle, const struct sockaddr* addr, unsigned int flags);
 tcp_channel_t*  nodec_tcp_listen(uv_tcp_t* tcp, int backlog, bool channel_owns_tcp);
+tcp_channel_t*  nodec_tcp_listen_ex(uv_tcp_t* tcp, int backlog, int accept_queue, bool channel_owns_tcp);
 uv_stream_t*    async_tcp_channel_receive(tcp_channel_t* ch);
 
+/// Statistics on accepting TCP connections (for all listeners of the current event loop).
+typedef struct _nodec_tcp_accept_stats_t {
+  uint64_t accepted;           ///< Total accepted connections.
+  uint64_t deferred;           ///< Number of times accepting was deferred because the accept queue was full.
+  uint64_t dropped;            ///< Connections that failed or were dropped while accepting.
+} nodec_tcp_accept_stats_t;
+
+/// Get the current statistics on accepting TCP connections.
+void            nodec_tcp_accept_stats(nodec_tcp_accept_stats_t* stats);
+
 /// \}
 
 
+/// TCP socket options for accepted and connected sockets.
+typedef struct _tcp_socket_options_t {
+  bool      nodelay;           ///< disable Nagle's algorithm (`TCP_NODELAY`) for lower latency (default true).
+  unsigned  keepalive;         ///< enable TCP keep-alive probes after this many seconds idle; 0 = disabled (default 0).
+  int       send_buf_size;     ///< socket send buffer size (`SO_SNDBUF`); 0 = OS default.
+  int       recv_buf_size;     ///< socket receive buffer size (`SO_RCVBUF`); 0 = OS default.
+} tcp_socket_options_t;
+
+/// Default TCP socket options.
+#define tcp_socket_options()   { true, 0, 0, 0 }
+
+/// Set socket options on a TCP handle.
+/// \param tcp     The TCP handle; should be connected or accepted.
+/// \param options The options to set, or `NULL` for the defaults (see tcp_socket_options()).
+/// \returns 0 on success, or the first error encountered.
+uv_errno_t nodecx_tcp_set_options(uv_tcp_t* tcp, const tcp_socket_options_t* options);
+
 /// Establish a TCP connection.
 /// \param addr   Connection address. 
 /// \param host   Host name, only used for error messages and can be `NULL`.
 nodec_bstream_t* async_tcp_connect_at(const struct sockaddr* addr, const char* host /* can be NULL, used for errors */);
 
+/// Establish a TCP connection with specific socket options.
+/// \param addr    Connection address. 
+/// \param host    Host name, only used for error messages and can be `NULL`.
+/// \param options Socket options, can be `NULL` for the defaults (see tcp_socket_options()).
+nodec_bstream_t* async_tcp_connect_at_ex(const struct sockaddr* addr, const char* host, const tcp_socket_options_t* options);
+
+/// Default delay in milli-seconds between connection attempts to different addresses.
+#define NODEC_CONNECT_ATTEMPT_DELAY  (250)
+
+/// Establish a TCP connection to the first address that accepts it.
+/// Connection attempts alternate between IPv6 and IPv4 addresses, starting with IPv6.
+/// Each attempt starts after `attempt_delay` or as soon as the previous attempt fails,
+/// and the remaining attempts are canceled once one connects ("happy eyeballs").
+/// \param info          The addresses to try.
+/// \param host          Host name, only used for error messages and can be `NULL`.
+/// \param attempt_delay Milli-seconds between starting attempts (see #NODEC_CONNECT_ATTEMPT_DELAY).
+/// \param options       Socket options, can be `NULL` for the defaults (see tcp_socket_options()).
+/// \returns the connection of the first attempt that succeeded; throws the first error if all fail.
+nodec_bstream_t* async_tcp_connect_at_addrs(const struct addrinfo* info, const char* host, uint64_t attempt_delay, const tcp_socket_options_t* options);
+
 /// Establish a TCP connection.
+/// Tries all resolved addresses using async_tcp_connect_at_addrs().
 /// \param host     Host address. 
 /// \param service  Can be a port (`"8080"`) or service (`"https"`). Uses `"http"` when `NULL`.
 nodec_bstream_t* async_tcp_connect_at_host(const char* host, const char* service /*NULL="http"*/);
@@ -901,10 +1079,60 @@ typedef struct _tcp_server_config_t {
   int       max_interleaving;  ///< maximal number concurrent requests (default 1000).
   uint64_t  timeout;           ///< ms between connection requests allowed; 0 = infinite, default 5000.
   uint64_t  timeout_total;     ///< total allowed connection time in ms; 0 = infinite, default 0.
+  int       accept_queue;      ///< maximal accepted connections waiting to be served (default 64). 
+                               ///< When full, further connections stay pending in the OS backlog.
+  tcp_socket_options_t socket_options; ///< options for accepted sockets (default tcp_socket_options()).
+  bool      defer_accept;      ///< only accept once data arrives (`TCP_DEFER_ACCEPT`, Linux only) (default false).
+  int       fastopen;          ///< queue length for TCP fast open (`TCP_FASTOPEN`); 0 = disabled (default 0).
+  int       wait_queue;        ///< connections held while `max_interleaving` connections are served (default 256).
+  const char* shed_response;   ///< written to connections shed when the wait queue is full, like a `503`; `NULL` = just close (default `NULL`).
+  bool      adaptive_limit;    ///< adjust the concurrency limit (up to `max_interleaving`) to the request latency (default false).
+  int       max_idle;          ///< maximal idle keep-alive connections; the oldest is closed when exceeded. 0 = unlimited (default 0).
+  int       pipeline;          ///< maximal pipelined HTTP requests served concurrently on one connection;
+                               ///< responses are still sent in order (default 1).
+  bool      http2;             ///< accept HTTP/2 connections: with prior knowledge (`h2c`), or negotiated 
+                               ///< with ALPN (`h2`) for HTTPS servers (default false).
+  size_t    read_high_water;   ///< stop reading from a connection while this many bytes are received but not yet
+                               ///< consumed, such that slow handlers push back on clients; 0 = unlimited (default 1MB).
+  uint64_t  wait_timeout;      ///< ms a connection can be in the wait queue before it is shed as the client
+                               ///< has likely given up; 0 = infinite (default 10000).
 } tcp_server_config_t;
 
 /// Default TCP server configuration.
-#define tcp_server_config()    { 64, 1000, 5000, 0 }
+#define tcp_server_config()    { 64, 1000, 5000, 0, 64, tcp_socket_options(), false, 0, 256, NULL, false, 0, 1, false, 1024*1024, 10000 }
+
+/// Statistics on admission control of TCP servers (summed over all servers of the current event loop).
+typedef struct _nodec_tcp_admission_stats_t {
+  size_t   limit;              ///< Current concurrency limit.
+  size_t   active;             ///< Connections currently served.
+  size_t   queue_depth;        ///< Connections currently waiting.
+  uint64_t admitted;           ///< Total connections served.
+  uint64_t queued;             ///< Total connections that had to wait.
+  uint64_t shed;               ///< Total connections shed because the wait queue was full or they expired.
+  uint64_t expired;            ///< Total connections shed because they waited longer than `wait_timeout`.
+} nodec_tcp_admission_stats_t;
+
+/// Get the current admission control statistics.
+void nodec_tcp_admission_stats(nodec_tcp_admission_stats_t* stats);
+
+/// Statistics on idle keep-alive connections (summed over all servers of the current event loop).
+/// Idle connections are parked without a strand until the next request arrives.
+typedef struct _nodec_tcp_idle_stats_t {
+  size_t   idle;               ///< Connections currently parked.
+  uint64_t parked;             ///< Total times a connection was parked.
+  uint64_t resumed;            ///< Total times a parked connection received a new request.
+  uint64_t expired;            ///< Connections closed after the keep-alive `timeout`.
+  uint64_t evicted;            ///< Connections closed early because of `max_idle` or nodec_tcp_idle_evict().
+} nodec_tcp_idle_stats_t;
+
+/// Get the current statistics on idle keep-alive connections.
+void nodec_tcp_idle_stats(nodec_tcp_idle_stats_t* stats);
+
+/// Close the least recently used idle keep-alive connections of the servers of the current
+/// event loop, for example under memory pressure.
+/// \param count  maximal number of connections to close.
+/// \returns the number of connections closed.
+size_t nodec_tcp_idle_evict(size_t count);
 
 /// The server callback when listening on a TCP connection.
 /// \param id       The identity of the current asynchronous strand.
@@ -924,6 +1152,103 @@ void async_tcp_server_at(const struct sockaddr* addr, tcp_server_config_t* confi
 /// \}
 
 
+/* ----------------------------------------------------------------------------
+  Pipes
+-----------------------------------------------------------------------------*/
+
+/// \defgroup pipe Unix Domain Sockets and Named Pipes
+/// Local connections without the TCP overhead.
+/// The `path` is a file system path on Unix (like `"/tmp/app.sock"`), or
+/// a pipe name on Windows (like `"\\\\.\\pipe\\app"`).
+/// \{
+
+uv_pipe_t*  nodec_pipe_alloc();
+void        nodec_pipe_free(uv_pipe_t* pipe);
+void        nodec_pipe_freev(lh_value pipe);
+
+/// Create a server on a Unix domain socket or named pipe.
+/// This uses the same server implementation as async_tcp_server_at();
+/// the TCP specific options of the configuration are ignored.
+/// \param path       The socket path or pipe name to serve.
+/// \param config     The server configuration, can be `NULL` in which case tcp_server_config() is used.
+/// \param servefun   The callback called when a client connects.
+/// \param on_exn     Optional function that is called when an exception happens in `servefun`.
+/// \param arg        Optional argument to pass on to `servefun`, can be `lh_value_null`.
+void async_pipe_server_at(const char* path, tcp_server_config_t* config, nodec_tcp_connection_fun_t* servefun, lh_actionfun* on_exn, lh_value arg);
+
+/// Connect to a Unix domain socket or named pipe.
+/// \param path  The socket path or pipe name.
+/// \returns the connection stream.
+nodec_bstream_t* async_pipe_connect(const char* path);
+
+/// \}
+
+
+/* ----------------------------------------------------------------------------
+  UDP
+-----------------------------------------------------------------------------*/
+
+/// \defgroup udp UDP Sockets
+/// Sending and receiving datagrams.
+/// \{
+
+/// A UDP socket.
+typedef struct _nodec_udp_t nodec_udp_t;
+
+/// A received datagram.
+typedef struct _nodec_udp_msg_t {
+  uv_buf_t                buf;    ///< The datagram data.
+  struct sockaddr_storage addr;   ///< The address of the sender.
+} nodec_udp_msg_t;
+
+/// Statistics of a UDP socket.
+typedef struct _nodec_udp_stats_t {
+  uint64_t received;            ///< Datagrams received.
+  uint64_t dropped;             ///< Datagrams dropped because the receive queue was full.
+  uint64_t truncated;           ///< Datagrams truncated to `max_datagram` bytes.
+  uint64_t sent;                ///< Datagrams sent.
+} nodec_udp_stats_t;
+
+/// Allocate a UDP socket.
+/// \param max_datagram  maximal size of received datagrams; larger ones are truncated (0 = 8kb).
+nodec_udp_t*  nodec_udp_alloc(size_t max_datagram);
+void          nodec_udp_free(nodec_udp_t* udp);
+void          nodec_udp_freev(lh_value udpv);
+#define using_udp(udp)  defer(nodec_udp_freev,lh_value_ptr(udp))
+
+/// Bind a UDP socket to a local address (with `uv_udp_flags`).
+void          nodec_udp_bind(nodec_udp_t* udp, const struct sockaddr* addr, unsigned int flags);
+
+/// Receive a datagram.
+/// Receiving starts on first use; datagrams that arrive while the receive queue
+/// is full are dropped.
+/// \returns a message that should be released with nodec_udp_msg_release().
+nodec_udp_msg_t* async_udp_recv(nodec_udp_t* udp);
+
+/// Release a received message to the buffer pool of the socket.
+void          nodec_udp_msg_release(nodec_udp_t* udp, nodec_udp_msg_t* msg);
+
+/// The channel of received messages, to consume datagrams as a stream of messages.
+/// Each element has a `nodec_udp_msg_t*` as its data, or an error.
+channel_t*    nodec_udp_channel(nodec_udp_t* udp);
+
+/// Send a datagram.
+void          async_udp_send(nodec_udp_t* udp, uv_buf_t buf, const struct sockaddr* addr);
+
+/// Send many datagrams to an address.
+/// Datagrams are sent directly while the socket buffer has room, and only
+/// await when it is full.
+/// \param bufs   The datagrams to send.
+/// \param count  The number of datagrams.
+/// \param addr   The destination address.
+void          async_udp_send_many(nodec_udp_t* udp, const uv_buf_t bufs[], size_t count, const struct sockaddr* addr);
+
+/// Get the statistics of a UDP socket.
+void          nodec_udp_stats(nodec_udp_t* udp, nodec_udp_stats_t* stats);
+
+/// \}
+
+
 
 /* ----------------------------------------------------------------------------
   HTTP
@@ -955,6 +1280,12 @@ void throw_http_err(http_status_t status);
 void throw_http_err_str(http_status_t status, const char* msg);
 void throw_http_err_strdup(http_status_t status, const char* msg);
 const char* nodec_http_status_str(http_status_t code);
+
+/// Return the pre-rendered HTTP/1.1 status line for a status code.
+/// \param code The HTTP status.
+/// \param[out] len Set to the length of the status line; can be `NULL`.
+/// \returns A status line like `HTTP/1.1 200 OK\r\n`, or `NULL` for an unknown status (do not free).
+const char* nodec_http_status_line(http_status_t code, size_t* len);
 const char* nodec_http_method_str(http_method_t method);
 
 
@@ -962,8 +1293,14 @@ const char* nodec_http_method_str(http_method_t method);
 
 typedef void (nodec_http_servefun)();
 
+/// Serve HTTP requests.
+/// If the `shed_response` of the configuration is `NULL`, shed connections get a
+/// pre-rendered `503 Service Unavailable` response with a `Retry-After` header.
 void async_http_server_at(const char* host, tcp_server_config_t* config, nodec_http_servefun* servefun);
 
+/// Serve HTTP requests on a Unix domain socket or named pipe.
+void async_http_server_at_pipe(const char* path, tcp_server_config_t* config, nodec_http_servefun* servefun);
+
 
 // HTTP(S) connection
 
@@ -995,6 +1332,7 @@ size_t async_http_in_init(http_in_t* in, uv_stream_t* stream, bool is_request );
 
 // Query the incoming connection
 const char*   http_in_url(http_in_t* in);            // server
+const nodec_url_t* http_in_parsed_url(http_in_t* in); // server; parsed on first access
 http_method_t http_in_method(http_in_t* in);         // server
 http_status_t   http_in_status(http_in_t* in);       // client
 const char* http_in_status_info(http_in_t* in);    // client
@@ -1011,6 +1349,7 @@ const char* http_header_next_field(const char* header, size_t* len, const char**
 size_t async_http_in_read_headers(http_in_t* in);
 
 /// Get a buffered stream to read the body.
+/// Sends a `100 Continue` first if the client waits for it.
 /// \param in       the HTTP input.
 /// \returns NULL if the stream has no body or was already completely read.
 /// Use async_read_bufx() to read most efficiently without memory copies.
@@ -1020,6 +1359,27 @@ nodec_bstream_t* http_in_body(http_in_t* in);
 /// Uses `Content-Length` when possible to read into a pre-allocated buffer of the right size.
 uv_buf_t async_http_in_read_body(http_in_t* in, size_t read_max);
 
+/// Read the full body into memory if it is at most `mem_max` bytes, or
+/// otherwise into a temporary file that is deleted when the returned stream is freed.
+/// \param in        the HTTP input.
+/// \param mem_max   maximal bytes to keep in memory.
+/// \param read_max  maximal size of the body (or 0 for unlimited); a `413` error is thrown for larger bodies.
+/// \returns a stream over the full body that should be freed by the caller (see using_bstream()).
+nodec_bstream_t* async_http_in_read_body_spooled(http_in_t* in, size_t mem_max, size_t read_max);
+
+/// Return `true` if the client sent `Expect: 100-continue` and waits
+/// for a `100 Continue` response before sending the body.
+bool http_in_expects_continue(http_in_t* in);
+
+/// Send a `100 Continue` response if the client waits for one.
+void async_http_in_continue(http_in_t* in);
+
+/// Read and discard any remaining body.
+/// \param in       the HTTP input.
+/// \returns `true` if the connection can be used for a next message (i.e. it is kept alive
+///          and the body was fully read). 
+bool async_http_in_drain(http_in_t* in);
+
 
 /// Print a response for debugging purposes;
 void http_in_status_print(http_in_t* in);
@@ -1046,8 +1406,18 @@ void http_out_add_header(http_out_t* out, const char* field, const char* value);
 /// in http_out_send_status_body() and http_resp_send_status_body().
 #define NODEC_CHUNKED ((size_t)(-1))
 
+/// The default size up to which writes to a _chunked_ body stream are
+/// buffered before they are sent as one chunk.
+#define NODEC_HTTP_FLUSH_SIZE  (16*1024)
+
+/// Set the size up to which writes to a _chunked_ body stream are buffered.
+/// Use 0 to send every write as a chunk directly. Must be called before the
+/// body stream is created. Use async_flush() to send buffered data early.
+void             http_out_set_flush_size(http_out_t* out, size_t flush_size);
+
 void             http_out_send_status(http_out_t* out, http_status_t status);
 nodec_stream_t*  http_out_send_status_body(http_out_t* out, http_status_t status, size_t content_length, const char* content_type);
+void             http_out_send_status_buf(http_out_t* out, http_status_t status, uv_buf_t body, const char* content_type);
 void             http_out_send_request(http_out_t* out, http_method_t method, const char* url);
 nodec_stream_t*  http_out_send_request_body(http_out_t* out, http_method_t method, const char* url, size_t content_length, const char* content_type);
 
@@ -1082,6 +1452,14 @@ http_out_t* http_resp();
 void            http_resp_add_header(const char* name, const char* value);
 
 
+/// Send a `100 Continue` response if the client waits for one.
+/// Usually not needed as reading the request body does this automatically.
+void http_resp_send_continue();
+
+/// Set the buffer size of a _chunked_ response body stream (#NODEC_HTTP_FLUSH_SIZE by default).
+/// Should be called before http_resp_send_status_body(). See http_out_set_flush_size().
+void http_resp_set_flush_size(size_t flush_size);
+
 /// Return `true` if the HTTP response status was sent.
 bool http_resp_status_sent();
 
@@ -1100,7 +1478,9 @@ void  http_resp_send_status(http_status_t status);
 ///   if the `content_type` is `NULL` no _Content-Type_ header
 ///   is added.
 /// \returns A stream to write the body to; this is automatically chunked if
-///   #NODEC_CHUNKED was passed as the `content_length`.
+///   #NODEC_CHUNKED was passed as the `content_length`. Writes to a chunked
+///   stream are buffered up to #NODEC_HTTP_FLUSH_SIZE bytes; use async_flush()
+///   to send them early.
 nodec_stream_t* http_resp_send_status_body(http_status_t status, size_t content_length, const char* content_type);
 
 /// Send the headers and OK response without a body.
@@ -1120,6 +1500,13 @@ const char*   http_req_url();
 /// Return the parsed full request url, including the path, hash, query etc.
 const nodec_url_t* http_req_parsed_url();
 
+/// Allocate memory that lives as long as the current request.
+/// The memory comes from a per-request arena and is released at once
+/// when the request is done; it should not be freed explicitly.
+/// \param size  the number of bytes to allocate.
+/// \returns a pointer to `size` bytes, aligned to 16 bytes.
+void* http_req_alloc(size_t size);
+
 
 /// Return the current request path.
 const char*   http_req_path();
@@ -1147,9 +1534,19 @@ const char*   http_req_header_next(const char** value, size_t* iter);
 
 /// Return the current HTTP request body as a buffered stream.
 /// Handles chunked bodies, and does automatic decompression if the 
-/// `Content-Encoding` was `gzip`.
+/// `Content-Encoding` was `gzip`. The body is read as it arrives; the 
+/// connection stops reading when the `read_high_water` of the server
+/// configuration is reached, until more of the body is read.
+/// If the client sent `Expect: 100-continue`, a `100 Continue` response is
+/// sent first.
 nodec_bstream_t* http_req_body();
 
+/// Return `true` if the client waits for a `100 Continue` before sending the body.
+/// A handler can reject the body by sending a final response (like a `413` or `417`)
+/// without reading it, in which case the connection is closed afterwards.
+/// Reading the body sends `100 Continue` automatically. 
+bool http_req_expects_continue();
+
 /// Read the full HTTP request body.
 /// The returned buffer should be deallocated by the caller.
 /// \param read_max   maximum bytes to read (or 0 for unlimited reading)
@@ -1167,6 +1564,25 @@ uv_buf_t      async_req_read_body(size_t read_max);
 /// if the request body had a Content-Encoding of `gzip`.
 const char*   async_req_read_body_str(size_t read_max);
 
+/// Read the full HTTP request body into memory or, if it is larger than `mem_max`
+/// bytes, into a temporary file. This keeps memory bounded for large uploads.
+/// \param mem_max    maximal bytes kept in memory (like 1MB)
+/// \param read_max   maximum bytes to read (or 0 for unlimited reading); a `413` error
+///                   is thrown for larger bodies (before sending a `100 Continue`).
+/// \returns a stream over the full body that should be freed by the caller.
+///
+/// \b Example
+/// ```
+/// nodec_bstream_t* body = async_req_read_body_spooled(1024*1024, 0);
+/// {using_bstream(body){
+///   uv_buf_t buf;
+///   while( !nodec_buf_is_null(buf = async_read_buf(as_stream(body))) ) {
+///     ...
+///   }
+/// }}
+/// ```
+nodec_bstream_t* async_req_read_body_spooled(size_t mem_max, size_t read_max);
+
 /// Print a request for debugging purposes.
 void http_req_print();
 
@@ -1195,6 +1611,7 @@ typedef struct _http_static_config_t {
   size_t gzip_min_size;        ///< Enable gzip compression above this file size (default is 1KB) (if the MIME type is compressible). Set to `SIZE_MAX` to disable compression.
   size_t content_max_size;     ///< Maximum size of content to serve (by default `SIZE_MAX`).
   size_t read_buf_size;        ///< Read buffer chunk size, by default 64KB.
+  int    gzip_level;           ///< Compression level between 1 and 9, or `NODEC_ZLEVEL_ADAPTIVE` to adapt to the load. Use 0 for the default (6).
 } http_static_config_t;
 
 /// Default file extensions for the static content server.
@@ -1202,7 +1619,7 @@ typedef struct _http_static_config_t {
 extern const char* http_static_implicit_exts[];
 
 /// Return the default static server configuration.
-#define http_static_default_config() { true, true, "public, max-age=604800", http_static_implicit_exts, "index", true, 1024, SIZE_MAX, 64*1024 }
+#define http_static_default_config() { true, true, "public, max-age=604800", http_static_implicit_exts, "index", true, 1024, SIZE_MAX, 64*1024, 6 }
 
 /// Serve static files under a `root` directory. 
 /// \param config The configuration. Can be NULL for the default configuration.
@@ -1213,6 +1630,243 @@ void http_serve_static(const char* root, const http_static_config_t* config);
 /// \}
 
 
+/* ----------------------------------------------------------------------------
+  HTTP Router
+-----------------------------------------------------------------------------*/
+/// \defgroup nodec_router HTTP Request Router.
+/// Dispatch requests on their method and path.
+/// Routes are patterns like `/users/:id/posts` where a `:name` segment
+/// matches one path segment, and a final `*name` matches the rest of the path.
+/// The routes are compiled into a radix tree so dispatching takes time
+/// proportional to the path length, independent of the number of routes.
+/// Static segments take precedence over parameters, and parameters over wildcards.
+///
+/// \b Example
+/// ```
+/// static nodec_router_t* router;
+///
+/// static void get_user() {
+///   size_t len;
+///   const char* id = http_req_param("id", &len);
+///   ...
+/// }
+///
+/// static void serve() {
+///   if (!http_router_serve(router)) http_serve_static("./public", NULL);
+/// }
+///
+/// static void entry() {
+///   router = nodec_router_alloc();
+///   {using_router(router) {
+///     nodec_router_route(router, HTTP_GET, "/users/:id", &get_user);
+///     nodec_router_compile(router);
+///     async_http_server_at("127.0.0.1:8080", NULL, &serve);
+///   }}
+/// }
+/// ```
+/// \{
+
+/// Maximal number of parameters captured by a route.
+#define NODEC_ROUTE_PARAMS_MAX  (16)
+
+typedef struct _nodec_router_t nodec_router_t;
+
+/// A parameter captured by a route.
+/// The value is a slice of the request URL and not zero terminated or decoded.
+typedef struct _nodec_route_param_t {
+  const char* name;    ///< The parameter name (zero terminated).
+  const char* value;   ///< The start of the value in the path.
+  size_t      len;     ///< The length of the value.
+} nodec_route_param_t;
+
+/// Allocate a new router without routes.
+nodec_router_t* nodec_router_alloc();
+void nodec_router_free(nodec_router_t* router);
+void nodec_router_freev(lh_value routerv);
+#define using_router(r)   defer(nodec_router_freev,lh_value_ptr(r))
+
+/// Add a route.
+/// \param router   the router.
+/// \param method   the HTTP method that is served.
+/// \param pattern  the path pattern, starting with a `/`, like `/users/:id` or `/files/*path`.
+/// \param servefun the function serving requests on this route; use http_req_param() to get the parameters.
+/// Throws `UV_EINVAL` on an invalid pattern, a duplicate route, or a parameter
+/// name that conflicts with the name used at the same position in another route.
+void nodec_router_route(nodec_router_t* router, http_method_t method, const char* pattern, nodec_http_servefun* servefun);
+
+/// Add a route for any HTTP method.
+/// Routes for a specific method take precedence.
+void nodec_router_route_any(nodec_router_t* router, const char* pattern, nodec_http_servefun* servefun);
+
+/// Compile the routes into a compact radix tree.
+/// Call this once at startup after adding all routes; otherwise the
+/// router is compiled on the first match. A compiled router can be shared
+/// between event loops.
+void nodec_router_compile(nodec_router_t* router);
+
+/// Match a method and path.
+/// \param router the router.
+/// \param method the request method.
+/// \param path   the path (without the query); does not need to be zero terminated.
+/// \param path_len the length of the path.
+/// \param[out] params receives the captured parameters as slices of `path`; can be `NULL`.
+/// \param[in,out] param_count  the capacity of `params`; set to the number of captured parameters.
+/// \returns the serve function of the matching route, or `NULL` if no route matched.
+nodec_http_servefun* nodec_router_match(nodec_router_t* router, http_method_t method, const char* path, size_t path_len,
+                                        nodec_route_param_t* params, size_t* param_count);
+
+/// Serve the current request with the matching route.
+/// \returns `false` if no route matched the path; throws an HTTP `405 Method Not Allowed`
+/// error if a route matched the path but not the method.
+bool http_router_serve(nodec_router_t* router);
+
+/// Return a parameter of the route that is serving the current request.
+/// Can only be called while serving a route through http_router_serve().
+/// \param name the parameter name (without the `:` or `*`).
+/// \param[out] len set to the length of the value; can be `NULL`.
+/// \returns a pointer to the value in the request URL (which is not zero terminated),
+/// or `NULL` if there is no such parameter.
+const char* http_req_param(const char* name, size_t* len);
+
+/// \}
+
+
+/* ----------------------------------------------------------------------------
+  HTTP Response Cache
+-----------------------------------------------------------------------------*/
+/// \defgroup nodec_http_cache HTTP Response Cache.
+/// Cache responses of a server function in memory.
+/// `GET` and `HEAD` responses are stored under the method, the host, the URL, and the
+/// request headers named by the `Vary` header of the response. A response
+/// is only cached if its `Cache-Control` allows it: responses with `no-store`,
+/// `no-cache`, `private`, a `Set-Cookie` header, or `Vary: *` are never cached.
+/// Responses to requests with an `Authorization` header are only cached if
+/// they are marked `public`, `must-revalidate`, or have an `s-maxage`.
+/// The lifetime is `s-maxage` or `max-age`, or otherwise the default maximal age.
+/// A hit is sent in one write without calling the server function.
+/// The least recently used entries are evicted to stay within the byte budget.
+///
+/// \b Example
+/// ```
+/// static nodec_http_cache_t* cache;
+///
+/// static void render_page() { ... }
+///
+/// static void serve() {
+///   http_cache_serve(cache, &render_page);
+/// }
+/// ```
+/// \{
+
+typedef struct _nodec_http_cache_t nodec_http_cache_t;
+
+/// Statistics of a response cache.
+typedef struct _nodec_http_cache_stats_t {
+  uint64_t hits;            ///< Requests answered from the cache.
+  uint64_t misses;          ///< Requests served by the server function.
+  uint64_t stores;          ///< Responses that were stored.
+  uint64_t evictions;       ///< Entries evicted to stay within the byte budget.
+  size_t   entries;         ///< Current number of entries.
+  size_t   bytes;           ///< Current size of all entries.
+} nodec_http_cache_stats_t;
+
+/// Allocate a response cache.
+/// A cache should only be used from one event loop.
+/// \param max_bytes        the byte budget; a single response can use at most a quarter of it.
+/// \param default_max_age  seconds to cache a response without an explicit `max-age`; use 0
+///                         to only cache responses with an explicit `max-age`.
+nodec_http_cache_t* nodec_http_cache_alloc(size_t max_bytes, uint64_t default_max_age);
+void nodec_http_cache_free(nodec_http_cache_t* cache);
+void nodec_http_cache_freev(lh_value cachev);
+#define using_http_cache(c)   defer(nodec_http_cache_freev,lh_value_ptr(c))
+
+/// Remove all entries.
+void nodec_http_cache_clear(nodec_http_cache_t* cache);
+
+/// Get the statistics of a cache.
+void nodec_http_cache_stats(nodec_http_cache_t* cache, nodec_http_cache_stats_t* stats);
+
+/// Serve the current request from the cache, or call `servefun` and cache its response.
+/// Requests with a `Cache-Control: no-store` header bypass the cache, and
+/// requests with `no-cache` are always served by `servefun`.
+void http_cache_serve(nodec_http_cache_t* cache, nodec_http_servefun* servefun);
+
+/// \}
+
+
+/* ----------------------------------------------------------------------------
+  HTTP Multipart Forms
+-----------------------------------------------------------------------------*/
+/// \defgroup nodec_http_multipart HTTP Multipart Form Data.
+/// Read `multipart/form-data` request bodies part by part as they arrive.
+/// Each part has headers and a body stream that ends at the next boundary.
+/// Only a small tail of each read is held back to find a boundary that is split
+/// over two reads, so large uploads can be streamed to a file in constant memory.
+///
+/// \b Example
+/// ```
+/// static void upload() {
+///   http_multipart_t* form = http_req_multipart();
+///   {using_http_multipart(form) {
+///     while (async_http_multipart_next(form)) {
+///       if (http_multipart_filename(form) == NULL) continue;  // skip plain fields
+///       uv_file file = async_fs_open_temp();
+///       int64_t offset = 0;
+///       bool owned = false;
+///       uv_buf_t buf;
+///       while (!nodec_buf_is_null(buf = async_read_bufx(as_stream(http_multipart_body(form)), &owned))) {
+///         {using_buf_owned(owned, &buf) {
+///           async_fs_write(file, buf, offset);
+///           offset += buf.len;
+///         }}
+///       }
+///       ...
+///       async_fs_close(file);
+///     }
+///   }}
+///   http_resp_send_ok();
+/// }
+/// ```
+/// \{
+
+typedef struct _http_multipart_t http_multipart_t;
+
+/// Start reading a multipart body.
+/// \param body          the body stream; not owned by the multipart reader.
+/// \param content_type  the `Content-Type` header of the body with a `boundary` parameter
+///                      of at most 70 characters. Throws a `415` error if it is not a `multipart` type.
+/// \returns a multipart reader that should be freed by the caller (see using_http_multipart()).
+http_multipart_t* http_multipart_alloc(nodec_bstream_t* body, const char* content_type);
+void http_multipart_free(http_multipart_t* mp);
+void http_multipart_freev(lh_value mpv);
+#define using_http_multipart(mp)   defer(http_multipart_freev,lh_value_ptr(mp))
+
+/// Start reading the multipart body of the current request.
+http_multipart_t* http_req_multipart();
+
+/// Advance to the next part, skipping any unread data of the current part.
+/// \returns `false` after the last part. Throws a `400` error on a malformed body.
+bool async_http_multipart_next(http_multipart_t* mp);
+
+/// Return a header of the current part, or `NULL` if not present.
+const char* http_multipart_header(http_multipart_t* mp, const char* name);
+
+/// Return the `name` parameter of the `Content-Disposition` of the current part, or `NULL`.
+const char* http_multipart_name(http_multipart_t* mp);
+
+/// Return the `filename` parameter of the `Content-Disposition` of the current part, or `NULL`.
+const char* http_multipart_filename(http_multipart_t* mp);
+
+/// Return the `Content-Type` of the current part, which is `text/plain` by default.
+const char* http_multipart_content_type(http_multipart_t* mp);
+
+/// Return the body stream of the current part. 
+/// The stream is owned by the reader and valid until the next call to async_http_multipart_next().
+nodec_bstream_t* http_multipart_body(http_multipart_t* mp);
+
+/// \}
+
+
 /* ----------------------------------------------------------------------------
   HTTPS
 -----------------------------------------------------------------------------*/
@@ -1237,16 +1891,67 @@ nodec_errno_t nodecx_ssl_config_add_ca(nodec_ssl_config_t* config, uv_buf_t cert
 void async_ssl_config_add_system_certs(nodec_ssl_config_t* config);
 
 
+/// Set the protocols offered for application layer protocol negotiation (ALPN).
+/// \param config     the SSL configuration.
+/// \param protocols  a `NULL` terminated array of protocol names in order of preference, like `"h2"`;
+///                   it must stay valid as long as the configuration is used.
+void nodec_ssl_config_alpn(nodec_ssl_config_t* config, const char** protocols);
+
 typedef struct _nodec_tls_stream_t nodec_tls_stream_t;
 
 nodec_bstream_t* nodec_tls_stream_alloc(nodec_bstream_t* stream, const nodec_ssl_config_t* config);
 
+/// Return the protocol negotiated with ALPN after the handshake, or `NULL` if none was negotiated.
+const char* nodec_tls_stream_alpn(nodec_tls_stream_t* ts);
+
 void async_https_server_at(const char* host, tcp_server_config_t* tcp_config, nodec_ssl_config_t* ssl_config, nodec_http_servefun* servefun);
 lh_value async_https_connect(nodec_ssl_config_t* config, const char* url, http_connect_fun* connectfun, lh_value arg);
 
 /// \} HTTPS
 
 
+/* ----------------------------------------------------------------------------
+  HTTP(S) connection pool
+-----------------------------------------------------------------------------*/
+
+/// \defgroup nodec_http_pool HTTP(S) connection pool
+/// Reuse client connections to the same host.
+/// \{
+
+/// Statistics of the client connection pool.
+typedef struct _http_pool_stats_t {
+  uint64_t created;            ///< Newly created connections.
+  uint64_t reused;             ///< Connections reused from the pool.
+  uint64_t stale;              ///< Idle connections found closed (or unusable) on checkout.
+  uint64_t expired;            ///< Idle connections closed after the idle timeout.
+  uint64_t discarded;          ///< Connections closed because the pool for that host was full.
+} http_pool_stats_t;
+
+/// Make an HTTP(S) request over a pooled connection.
+/// Connections are pooled per event loop and keyed by schema, host, port, and SSL configuration.
+/// An idle connection is checked on checkout and discarded if it was closed by the server.
+/// When `connectfun` returns, any remaining response body is drained and the connection
+/// is returned to the pool if it can be kept alive.
+/// The `connectfun` should not send a `Connection: close` header, and it should either read the full
+/// response body with async_http_in_read_body() or not read the body at all.
+/// \param ssl_config  the SSL configuration for HTTPS, or `NULL` for plain HTTP.
+/// \param url         the url to connect to, like `"http://www.bing.com"`.
+/// \param connectfun  called with the connection to send a request and read the response.
+/// \param arg         argument passed to `connectfun`.
+/// \returns the result of `connectfun`.
+lh_value async_http_request_pooled(nodec_ssl_config_t* ssl_config, const char* url, http_connect_fun* connectfun, lh_value arg);
+
+/// Configure the connection pool of the current event loop.
+/// \param max_idle_per_host  maximal idle connections kept per host (default 8). Use 0 to disable pooling.
+/// \param idle_timeout       idle connections are closed after this many milliseconds (default 30000). 
+void nodec_http_pool_set(size_t max_idle_per_host, uint64_t idle_timeout);
+
+/// Get the connection pool statistics of the current event loop.
+void nodec_http_pool_stats(http_pool_stats_t* stats);
+
+/// \}
+
+
 /// \}  HTTP Connections
 
 /* ----------------------------------------------------------------------------
@@ -655,7 +655,17 @@ static lh_value uv_main_action(lh_value ventry) {
   nodec_main_fun_t* entry = (nodec_main_fun_t*)lh_fun_ptr_value(ventry);
   {using_tty() {
     {using_log(LOG_DEFAULT) {
-      entry();
+      {using_zstream_pool() {
+        {using_dns_cache() {
+          {using_tcp_servers() {
+            {using_http_pool() {
+              {using_http_arenas() {
+                entry();
+              }}
+            }}
+          }}
+        }}
+      }}
     }}
   }}
   return lh_value_null;
@@ -9,11 +9,278 @@
 #include "nodec-internal.h"
 #include <assert.h>
 
+/*-----------------------------------------------------------------
+  Resolver cache
+  Lookups are cached per event loop, keyed by (node, service, hints).
+  Since `getaddrinfo` does not return record TTL's, entries expire
+  after a configurable positive or negative (`UV_EAI_NONAME`) TTL.
+  Concurrent lookups for the same key share a single request, and
+  an expired entry is still returned for a while (`stale_ttl`)
+  while it is refreshed in the background.
+  Results are reference counted so a refresh never frees an
+  `addrinfo` that a caller still uses; `nodec_free_addrinfo`
+  releases the reference.
+-----------------------------------------------------------------*/
+
+typedef struct _dns_info_t {
+  struct _dns_info_t* next;
+  struct addrinfo*    info;
+  size_t              refcount;     // references by callers, +1 while it is the result of an entry
+} dns_info_t;
+
+struct _dns_cache_t;
+
+typedef struct _dns_entry_t {
+  struct _dns_entry_t*  next;
+  struct _dns_cache_t*  cache;
+  char*             node;
+  char*             service;
+  bool              has_hints;
+  struct addrinfo   hints;          // only flags, family, socktype, and protocol are used
+  bool              resolved;       // true if `info` or `err` is valid
+  dns_info_t*       info;           // the result, or NULL if `err != 0`
+  uv_errno_t        err;            // `UV_EAI_NONAME` for a negative entry
+  uint64_t          expires;        // loop time when the result becomes stale
+  uv_getaddrinfo_t* req;            // the lookup in flight (if any)
+  channel_t*        waiters;        // strands waiting for the lookup
+  size_t            waiting;
+  bool              waking;
+} dns_entry_t;
+
+typedef struct _dns_cache_t {
+  dns_entry_t*      entries;
+  size_t            count;
+  dns_info_t*       infos;          // all results still referenced
+  uint64_t          ttl;
+  uint64_t          negative_ttl;
+  uint64_t          stale_ttl;
+  nodec_dns_stats_t stats;
+} dns_cache_t;
+
+#define DNS_CACHE_MAX  (1024)
+
+implicit_define(dns_cache)
+
+static dns_cache_t* dns_cache_get() {
+  return (dns_cache_t*)lh_ptr_value(implicit_get(dns_cache));
+}
+
+static void dns_info_release(dns_cache_t* cache, dns_info_t* info) {
+  if (info == NULL) return;
+  assert(info->refcount > 0);
+  info->refcount--;
+  if (info->refcount > 0) return;
+  for (dns_info_t** p = &cache->infos; *p != NULL; p = &(*p)->next) {
+    if (*p == info) {
+      *p = info->next;
+      break;
+    }
+  }
+  uv_freeaddrinfo(info->info);
+  nodec_free(info);
+}
+
+static void dns_entry_free(dns_cache_t* cache, dns_entry_t* e) {
+  if (e->req != NULL) {
+    // the callback frees the request and result
+    e->req->data = NULL;
+    uv_cancel((uv_req_t*)e->req);
+  }
+  if (e->waiters != NULL) channel_free(e->waiters);
+  dns_info_release(cache, e->info);
+  if (e->node != NULL) nodec_free(e->node);
+  if (e->service != NULL) nodec_free(e->service);
+  nodec_free(e);
+}
+
+lh_value _nodec_dns_cache_allocv() {
+  dns_cache_t* cache = nodec_zero_alloc(dns_cache_t);
+  cache->ttl = 60000;
+  cache->negative_ttl = 5000;
+  cache->stale_ttl = 30000;
+  return lh_value_ptr(cache);
+}
+
+void _nodec_dns_cache_freev(lh_value cachev) {
+  dns_cache_t* cache = (dns_cache_t*)lh_ptr_value(cachev);
+  dns_entry_t* e = cache->entries;
+  while (e != NULL) {
+    dns_entry_t* next = e->next;
+    dns_entry_free(cache, e);
+    e = next;
+  }
+  dns_info_t* info = cache->infos;
+  while (info != NULL) {
+    dns_info_t* next = info->next;
+    uv_freeaddrinfo(info->info);
+    nodec_free(info);
+    info = next;
+  }
+  nodec_free(cache);
+}
+
+// Remove entries that are stale and not in use
+static void dns_cache_purge(dns_cache_t* cache, uint64_t now) {
+  dns_entry_t** pe = &cache->entries;
+  while (*pe != NULL) {
+    dns_entry_t* e = *pe;
+    if (e->resolved && e->req == NULL && e->waiting == 0 && !e->waking &&
+        now >= e->expires + (e->err == 0 ? cache->stale_ttl : 0)) {
+      *pe = e->next;
+      cache->count--;
+      dns_entry_free(cache, e);
+    }
+    else {
+      pe = &e->next;
+    }
+  }
+}
+
+void nodec_dns_cache_set(uint64_t ttl, uint64_t negative_ttl, uint64_t stale_ttl) {
+  dns_cache_t* cache = dns_cache_get();
+  cache->ttl = ttl;
+  cache->negative_ttl = negative_ttl;
+  cache->stale_ttl = stale_ttl;
+  // expire everything cached so far; lookups in flight are kept
+  for (dns_entry_t* e = cache->entries; e != NULL; e = e->next) {
+    e->expires = 0;
+  }
+  dns_cache_purge(cache, uv_now(async_loop()));
+}
+
+void nodec_dns_cache_stats(nodec_dns_stats_t* stats) {
+  if (stats != NULL) *stats = dns_cache_get()->stats;
+}
+
+static bool dns_str_eq(const char* s, const char* t) {
+  if (s == NULL || t == NULL) return (s == t);
+  return (strcmp(s, t) == 0);
+}
+
+static dns_entry_t* dns_entry_get(dns_cache_t* cache, const char* node, const char* service, const struct addrinfo* hints) {
+  for (dns_entry_t* e = cache->entries; e != NULL; e = e->next) {
+    if (dns_str_eq(e->node, node) && dns_str_eq(e->service, service) &&
+        e->has_hints == (hints != NULL) &&
+        (hints == NULL || (e->hints.ai_flags == hints->ai_flags && e->hints.ai_family == hints->ai_family &&
+                           e->hints.ai_socktype == hints->ai_socktype && e->hints.ai_protocol == hints->ai_protocol)))
+    {
+      return e;
+    }
+  }
+  if (cache->count >= DNS_CACHE_MAX) dns_cache_purge(cache, uv_now(async_loop()));
+  dns_entry_t* e = nodec_zero_alloc(dns_entry_t);
+  e->cache = cache;
+  e->node = (node == NULL ? NULL : nodec_strdup(node));
+  e->service = (service == NULL ? NULL : nodec_strdup(service));
+  if (hints != NULL) {
+    e->has_hints = true;
+    e->hints.ai_flags = hints->ai_flags;
+    e->hints.ai_family = hints->ai_family;
+    e->hints.ai_socktype = hints->ai_socktype;
+    e->hints.ai_protocol = hints->ai_protocol;
+  }
+  e->next = cache->entries;
+  cache->entries = e;
+  cache->count++;
+  return e;
+}
+
+static void dns_entry_wake(dns_entry_t* e) {
+  if (e->waiters == NULL) return;
+  // resuming a waiter may run it up to its next await, so guard the channel
+  e->waking = true;
+  channel_t* ch = e->waiters;
+  for (size_t n = e->waiting; n > 0; n--) {
+    channel_emit(ch, lh_value_null, lh_value_null, 0);
+  }
+  e->waking = false;
+  if (e->waiting == 0 && e->req == NULL) {
+    channel_free(ch);
+    e->waiters = NULL;
+  }
+}
+
+static void dns_lookup_cb(uv_getaddrinfo_t* req, int status, struct addrinfo* res) {
+  dns_entry_t* e = (dns_entry_t*)req->data;
+  uint64_t now = uv_now(req->loop);
+  nodec_free(req);
+  if (e == NULL) {
+    // the cache was freed
+    if (status >= 0 && res != NULL) uv_freeaddrinfo(res);
+    return;
+  }
+  dns_cache_t* cache = e->cache;
+  e->req = NULL;
+  if (status >= 0 && res != NULL) {
+    dns_info_t* info = nodec_zero_alloc(dns_info_t);
+    info->info = res;
+    info->refcount = 1;
+    info->next = cache->infos;
+    cache->infos = info;
+    dns_info_release(cache, e->info);
+    e->info = info;
+    e->err = 0;
+    e->expires = now + cache->ttl;
+  }
+  else if (status == UV_EAI_NONAME || (status >= 0 && res == NULL)) {
+    dns_info_release(cache, e->info);
+    e->info = NULL;
+    e->err = UV_EAI_NONAME;
+    e->expires = now + cache->negative_ttl;
+  }
+  else if (e->info == NULL) {
+    // transient errors are not cached
+    e->err = status;
+    e->expires = now;
+  }
+  // else: keep serving the stale result
+  e->resolved = true;
+  dns_entry_wake(e);
+}
+
+static void dns_entry_lookup(dns_entry_t* e) {
+  if (e->req != NULL) return;  // already in flight
+  uv_getaddrinfo_t* req = nodec_zero_alloc(uv_getaddrinfo_t);
+  req->data = e;
+  uv_errno_t err = uv_getaddrinfo(async_loop(), req, &dns_lookup_cb, e->node, e->service, (e->has_hints ? &e->hints : NULL));
+  if (err != 0) {
+    nodec_free(req);
+    nodec_check_msg(err, e->node);
+  }
+  e->req = req;
+}
+
+static void dns_entry_unwaitv(lh_value ev) {
+  dns_entry_t* e = (dns_entry_t*)lh_ptr_value(ev);
+  e->waiting--;
+  if (e->waiting == 0 && e->req == NULL && !e->waking && e->waiters != NULL) {
+    channel_free(e->waiters);
+    e->waiters = NULL;
+  }
+}
+
+static void async_dns_entry_await(dns_entry_t* e) {
+  if (e->waiters == NULL) e->waiters = channel_alloc(-1);
+  e->waiting++;
+  {defer(dns_entry_unwaitv, lh_value_ptr(e)) {
+    channel_receive(e->waiters, NULL, NULL);
+  }}
+}
+
+static struct addrinfo* dns_entry_result(dns_entry_t* e) {
+  if (e->info != NULL) {
+    e->info->refcount++;
+    return e->info->info;
+  }
+  if (e->err != UV_EAI_NONAME) nodec_check_msg(e->err, e->node);
+  return NULL;
+}
+
 static void addrinfo_cb(uv_getaddrinfo_t* req, int status, struct addrinfo* res) {
   async_req_resume((uv_req_t*)req, status >= 0 ? 0 : status);
 }
 
-struct addrinfo* async_getaddrinfo(const char* node, const char* service, const struct addrinfo* hints) {
+static struct addrinfo* async_getaddrinfo_uncached(const char* node, const char* service, const struct addrinfo* hints) {
   struct addrinfo* info = NULL;
   {using_req(uv_getaddrinfo_t,req) {
     nodec_check_msg(uv_getaddrinfo(async_loop(), req, &addrinfo_cb, node, service, hints), node);
@@ -24,8 +291,41 @@ struct addrinfo* async_getaddrinfo(const char* node, const char* service, const
   return info;
 }
 
+struct addrinfo* async_getaddrinfo(const char* node, const char* service, const struct addrinfo* hints) {
+  dns_cache_t* cache = dns_cache_get();
+  if (cache->ttl == 0 && cache->negative_ttl == 0) {
+    return async_getaddrinfo_uncached(node, service, hints);
+  }
+  dns_entry_t* e = dns_entry_get(cache, node, service, hints);
+  uint64_t now = uv_now(async_loop());
+  if (e->resolved && now < e->expires) {
+    if (e->err == 0) cache->stats.hits++;
+              else cache->stats.negative_hits++;
+    return dns_entry_result(e);
+  }
+  if (e->resolved && e->info != NULL && now < e->expires + cache->stale_ttl) {
+    // serve the stale result and refresh in the background
+    cache->stats.stale_hits++;
+    dns_entry_lookup(e);
+    return dns_entry_result(e);
+  }
+  if (e->req != NULL) cache->stats.coalesced++;
+                 else cache->stats.misses++;
+  dns_entry_lookup(e);
+  async_dns_entry_await(e);
+  return dns_entry_result(e);
+}
+
 void nodec_free_addrinfo(struct addrinfo* info) {
-  if (info != NULL) uv_freeaddrinfo(info);
+  if (info == NULL) return;
+  dns_cache_t* cache = dns_cache_get();
+  for (dns_info_t* p = cache->infos; p != NULL; p = p->next) {
+    if (p->info == info) {
+      dns_info_release(cache, p);
+      return;
+    }
+  }
+  uv_freeaddrinfo(info);
 }
 
 void nodec_free_addrinfov(lh_value infov) {
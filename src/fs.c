@@ -182,7 +182,7 @@ size_t async_fs_read_into(uv_file file, uv_buf_t buf , int64_t file_offset) {
   size_t total = 0;
   while (total < buf.len) {
     uv_buf_t view = nodec_buf(buf.base + total, buf.len - total);
-    size_t nread = _async_fs_read_into(file, view, -1);
+    size_t nread = _async_fs_read_into(file, view, (file_offset < 0 ? -1 : file_offset + (int64_t)total));
     if (nread == 0) break;
     total += nread;
     if (total > buf.len) total = buf.len; // paranoia
@@ -213,6 +213,101 @@ uv_buf_t async_fs_read_buf_all(uv_file file, size_t max ) {
   return async_fs_read_buf(file, (max > 0 && size > max ? max : size), -1);
 }
 
+
+/*-----------------------------------------------------------------
+  Writing and temporary files
+-----------------------------------------------------------------*/
+
+void async_fs_write(uv_file file, uv_buf_t buf, int64_t file_offset) {
+  size_t total = 0;
+  while (total < buf.len) {
+    uv_buf_t view = nodec_buf(buf.base + total, buf.len - total);
+    {using_fs_req(req, loop) {
+      nodec_check(uv_fs_write(loop, req, file, &view, 1, (file_offset < 0 ? -1 : file_offset + (int64_t)total), &async_fs_resume));
+      async_await_file(req, file);
+      if (req->result <= 0) nodec_check(UV_EIO);
+      total += (size_t)req->result;
+    }}
+  }
+}
+
+#define TEMP_PATH_MAX  (1024)
+
+uv_file async_fs_open_temp() {
+  static unsigned int counter = 0;
+  char dir[TEMP_PATH_MAX];
+  size_t dir_len = sizeof(dir);
+  nodec_check(uv_os_tmpdir(dir, &dir_len));
+  for (int attempt = 0; attempt < 16; attempt++) {
+    char path[TEMP_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/nodec-%llx-%x.tmp", dir, (unsigned long long)uv_hrtime(), counter++);
+    uv_file file = -1;
+    uv_errno_t err = asyncx_fs_open(path, UV_FS_O_RDWR | UV_FS_O_CREAT | UV_FS_O_EXCL | UV_FS_O_TEMPORARY, 0600, &file);
+    if (err == UV_EEXIST) continue;
+    nodec_check_msg(err, path);
+#ifndef _WIN32
+    // remove the name right away so the file is deleted once it is closed
+    // (on Windows this is done by `UV_FS_O_TEMPORARY`)
+    {using_fs_req(req, loop) {
+      if (uv_fs_unlink(loop, req, path, &async_fs_resume) == 0) asyncx_await_fs(req);
+    }}
+#endif
+    return file;
+  }
+  nodec_check(UV_EEXIST);
+  return -1;
+}
+
+
+/*-----------------------------------------------------------------
+  File read streams
+-----------------------------------------------------------------*/
+
+typedef struct _fs_stream_t {
+  nodec_stream_t stream;
+  uv_file        file;
+  int64_t        offset;
+  size_t         chunk_size;
+} fs_stream_t;
+
+static uv_buf_t async_fs_stream_read_bufx(nodec_stream_t* stream, bool* owned) {
+  fs_stream_t* fs = (fs_stream_t*)stream;
+  if (owned != NULL) *owned = true;
+  uv_buf_t buf = nodec_buf_alloc(fs->chunk_size);
+  size_t nread = 0;
+  {using_buf_on_abort_free(&buf) {
+    nread = _async_fs_read_into(fs->file, buf, fs->offset);
+  }}
+  if (nread == 0) {
+    nodec_buf_free(buf);
+    return nodec_buf_null();
+  }
+  fs->offset += nread;
+  return nodec_buf_fit(buf, nread);
+}
+
+static void nodec_fs_stream_free(nodec_stream_t* stream) {
+  fs_stream_t* fs = (fs_stream_t*)stream;
+  if (fs->file >= 0) {
+    // close synchronously as freeing cannot await
+    uv_fs_t req;
+    uv_fs_close(async_loop(), &req, fs->file, NULL);
+    uv_fs_req_cleanup(&req);
+    nodec_fs_close(fs->file);
+  }
+  nodec_stream_release(&fs->stream);
+  nodec_free(fs);
+}
+
+nodec_stream_t* nodec_fs_stream_alloc(uv_file file, int64_t file_offset) {
+  fs_stream_t* fs = nodec_zero_alloc(fs_stream_t);
+  nodec_stream_init(&fs->stream, &async_fs_stream_read_bufx, NULL, NULL, &nodec_fs_stream_free);
+  fs->file = file;
+  fs->offset = (file_offset < 0 ? 0 : file_offset);
+  fs->chunk_size = 64 * 1024;
+  return &fs->stream;
+}
+
 static lh_value async_fs_read_allv(uv_file file, const char* path, lh_value bufv) {
   uv_buf_t* buf = (uv_buf_t*)(lh_ptr_value(bufv));
   *buf = async_fs_read_buf_all(file, 0);
@@ -39,6 +39,32 @@ const char* nodec_http_status_str(http_status_t code) {
   return http_status_str(code);
 }
 
+
+/*-----------------------------------------------------------------
+  Pre-rendered status lines
+-----------------------------------------------------------------*/
+
+#define HTTP_STATUS_MAX (600)
+
+typedef struct _http_status_line_t {
+  const char* line;
+  size_t      len;
+} http_status_line_t;
+
+#define HTTP_STATUS_LINE(num,string)  "HTTP/1.1 " #num " " #string "\r\n"
+
+static const http_status_line_t http_status_lines[HTTP_STATUS_MAX] = {
+#define XX(num, name, string)  [num] = { HTTP_STATUS_LINE(num,string), sizeof(HTTP_STATUS_LINE(num,string)) - 1 },
+  HTTP_STATUS_MAP(XX)
+#undef XX
+};
+
+const char* nodec_http_status_line(http_status_t code, size_t* len) {
+  const http_status_line_t* sl = ((unsigned)code < HTTP_STATUS_MAX ? &http_status_lines[code] : NULL);
+  if (len != NULL) *len = (sl == NULL ? 0 : sl->len);
+  return (sl == NULL ? NULL : sl->line);
+}
+
 const char* nodec_http_method_str(http_method_t method) {
   return http_method_str(method);
 }
@@ -0,0 +1,1587 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+#include <ctype.h>
+
+/*-----------------------------------------------------------------
+  HTTP/2 server (RFC 7540)
+  One reader per connection decodes the frames and dispatches them
+  to the streams; each stream is served on its own strand by the
+  regular server function through `http_serve_framed`. Writes are
+  serialized per frame under a connection write lock that is
+  handed to the waiting stream with the lowest weighted virtual
+  time, where streams wait for a stream they depend on.
+  Server push is not supported.
+-----------------------------------------------------------------*/
+
+#define H2_PREFACE          "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN      (24)
+#define H2_FRAME_HEADER     (9)
+#define H2_FRAME_SIZE       (16384)         // maximal frame payload we accept
+#define H2_WINDOW_DEFAULT   (65535)
+#define H2_WINDOW_MAX       (0x7FFFFFFF)
+#define H2_STREAM_WINDOW    (128*1024)      // receive window per stream
+#define H2_CONN_WINDOW      (1024*1024)     // receive window of the connection
+#define H2_MAX_STREAMS      (100)           // maximal concurrent streams
+#define H2_MAX_HEADER_LIST  (64*1024)       // maximal size of decoded headers of a request
+#define H2_RESET_RECENT     (16)            // remembered streams that we reset
+
+typedef enum _h2_frame_type_t {
+  H2_DATA = 0,
+  H2_HEADERS,
+  H2_PRIORITY,
+  H2_RST_STREAM,
+  H2_SETTINGS,
+  H2_PUSH_PROMISE,
+  H2_PING,
+  H2_GOAWAY,
+  H2_WINDOW_UPDATE,
+  H2_CONTINUATION
+} h2_frame_type_t;
+
+#define H2_FLAG_END_STREAM  (0x01)
+#define H2_FLAG_ACK         (0x01)
+#define H2_FLAG_END_HEADERS (0x04)
+#define H2_FLAG_PADDED      (0x08)
+#define H2_FLAG_PRIORITY    (0x20)
+
+typedef enum _h2_error_t {
+  H2_NO_ERROR = 0,
+  H2_PROTOCOL_ERROR,
+  H2_INTERNAL_ERROR,
+  H2_FLOW_CONTROL_ERROR,
+  H2_SETTINGS_TIMEOUT,
+  H2_STREAM_CLOSED,
+  H2_FRAME_SIZE_ERROR,
+  H2_REFUSED_STREAM,
+  H2_CANCEL,
+  H2_COMPRESSION_ERROR,
+  H2_CONNECT_ERROR,
+  H2_ENHANCE_YOUR_CALM
+} h2_error_t;
+
+typedef enum _h2_setting_t {
+  H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+  H2_SETTINGS_ENABLE_PUSH,
+  H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+  H2_SETTINGS_INITIAL_WINDOW_SIZE,
+  H2_SETTINGS_MAX_FRAME_SIZE,
+  H2_SETTINGS_MAX_HEADER_LIST_SIZE
+} h2_setting_t;
+
+
+/*-----------------------------------------------------------------
+  HPACK tables (RFC 7541)
+-----------------------------------------------------------------*/
+
+#define HPACK_TABLE_SIZE      (4096)   // maximal dynamic table size for both directions
+#define HPACK_ENTRY_OVERHEAD  (32)
+#define HPACK_TABLE_ENTRIES   (HPACK_TABLE_SIZE/HPACK_ENTRY_OVERHEAD)
+#define HPACK_STATIC_COUNT    (61)
+
+typedef struct _hpack_entry_t {
+  const char* name;
+  const char* value;
+} hpack_entry_t;
+
+static const hpack_entry_t hpack_static_table[HPACK_STATIC_COUNT] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+// Huffman decoding tree of the static HPACK code: each node has two children
+// for bit 0 and 1; a positive child is a node index, a negative child `-(sym+1)`
+// is a leaf with symbol `sym` (where 256 is EOS), and 0 is an invalid code.
+static const int16_t hpack_huffman_tree[256][2] = {
+  {66,1}, {93,2}, {104,3}, {119,4},
+  {144,5}, {75,6}, {123,7}, {71,8},
+  {77,9}, {73,10}, {11,13}, {12,102},
+  {-1,-37}, {127,14}, {128,15}, {98,16},
+  {-124,17}, {124,18}, {150,19}, {20,25},
+  {199,21}, {216,22}, {23,162}, {24,161},
+  {-2,-136}, {167,26}, {41,27}, {191,28},
+  {211,29}, {229,30}, {31,45}, {32,38},
+  {33,35}, {-255,34}, {-3,-4}, {36,37},
+  {-5,-6}, {-7,-8}, {39,52}, {40,51},
+  {-9,-12}, {208,42}, {43,165}, {-240,44},
+  {-10,-143}, {55,46}, {63,47}, {147,48},
+  {-250,49}, {50,59}, {-11,-14}, {-13,-15},
+  {53,54}, {-16,-17}, {-18,-19}, {56,60},
+  {57,58}, {-20,-21}, {-22,-24}, {-23,-257},
+  {61,62}, {-25,-26}, {-27,-28}, {64,65},
+  {-29,-30}, {-31,-32}, {85,67}, {68,82},
+  {143,69}, {70,81}, {-33,-38}, {72,79},
+  {-34,-35}, {-125,74}, {-36,-63}, {76,80},
+  {-39,-43}, {-64,78}, {-40,-44}, {-41,-42},
+  {-45,-60}, {-46,-47}, {83,90}, {84,89},
+  {-48,-52}, {86,130}, {87,88}, {-49,-50},
+  {-51,-98}, {-53,-54}, {91,92}, {-55,-56},
+  {-57,-58}, {99,94}, {138,95}, {142,96},
+  {97,103}, {-59,-67}, {-61,-97}, {100,132},
+  {101,129}, {-62,-66}, {-65,-92}, {-68,-69},
+  {105,112}, {106,109}, {107,108}, {-70,-71},
+  {-72,-73}, {110,111}, {-74,-75}, {-76,-77},
+  {113,116}, {114,115}, {-78,-79}, {-80,-81},
+  {117,118}, {-82,-83}, {-84,-85}, {120,136},
+  {121,122}, {-86,-87}, {-88,-90}, {-89,-91},
+  {125,155}, {126,148}, {-93,-196}, {-94,-127},
+  {-95,-126}, {-96,-99}, {131,135}, {-100,-102},
+  {133,134}, {-101,-103}, {-104,-105}, {-106,-112},
+  {137,141}, {-107,-108}, {139,140}, {-109,-110},
+  {-111,-113}, {-114,-119}, {-115,-118}, {-116,-117},
+  {145,146}, {-120,-121}, {-122,-123}, {-128,-221},
+  {-209,149}, {-129,-131}, {196,151}, {152,178},
+  {153,158}, {-231,154}, {-130,-133}, {156,175},
+  {157,204}, {-132,-163}, {159,160}, {-134,-135},
+  {-137,-147}, {-138,-139}, {163,164}, {-140,-141},
+  {-142,-144}, {166,171}, {-145,-146}, {168,185},
+  {169,173}, {170,172}, {-148,-150}, {-149,-160},
+  {-151,-152}, {174,181}, {-153,-156}, {241,176},
+  {177,188}, {-154,-162}, {179,183}, {180,182},
+  {-155,-157}, {-158,-159}, {-161,-164}, {184,190},
+  {-165,-170}, {186,194}, {187,189}, {-166,-167},
+  {-168,-173}, {-169,-175}, {-171,-174}, {192,218},
+  {193,234}, {-172,-207}, {195,203}, {-176,-181},
+  {197,235}, {198,202}, {-177,-178}, {200,206},
+  {201,205}, {-179,-182}, {-180,-210}, {-183,-184},
+  {-185,-195}, {-186,-187}, {207,210}, {-188,-190},
+  {209,215}, {-189,-192}, {-191,-197}, {212,224},
+  {213,222}, {214,221}, {-193,-194}, {-198,-232},
+  {217,243}, {-199,-229}, {245,219}, {220,244},
+  {-200,-208}, {-201,-202}, {223,228}, {-203,-206},
+  {237,225}, {248,226}, {-256,227}, {-204,-205},
+  {-211,-214}, {230,249}, {231,239}, {232,233},
+  {-212,-213}, {-215,-222}, {-216,-226}, {236,242},
+  {-217,-218}, {238,246}, {-219,-220}, {240,247},
+  {-223,-224}, {-225,-227}, {-228,-230}, {-233,-234},
+  {-235,-236}, {-237,-238}, {-239,-241}, {-242,-245},
+  {-243,-244}, {250,253}, {251,252}, {-246,-247},
+  {-248,-249}, {254,255}, {-251,-252}, {-253,-254},
+};
+
+typedef struct _hpack_field_t {
+  char*   name;       // "name\0value\0"
+  size_t  name_len;
+  size_t  value_len;
+} hpack_field_t;
+
+// The dynamic table as a ring buffer with the newest entry at `first`
+struct _hpack_table_t {
+  hpack_field_t* fields;
+  size_t  capacity;
+  size_t  first;
+  size_t  count;
+  size_t  size;       // sum of the entry sizes (including the overhead)
+  size_t  max_size;
+};
+
+static void hpack_table_init(hpack_table_t* t) {
+  t->fields = nodec_zero_alloc_n(HPACK_TABLE_ENTRIES, hpack_field_t);
+  t->capacity = HPACK_TABLE_ENTRIES;
+  t->first = 0;
+  t->count = 0;
+  t->size = 0;
+  t->max_size = HPACK_TABLE_SIZE;
+}
+
+static hpack_field_t* hpack_table_at(hpack_table_t* t, size_t i) {
+  return &t->fields[(t->first + i) % t->capacity];
+}
+
+static void hpack_table_evict(hpack_table_t* t, size_t max_size) {
+  while (t->count > 0 && t->size > max_size) {
+    hpack_field_t* f = hpack_table_at(t, t->count - 1);
+    t->size -= f->name_len + f->value_len + HPACK_ENTRY_OVERHEAD;
+    nodec_free(f->name);
+    f->name = NULL;
+    t->count--;
+  }
+}
+
+static void hpack_table_free(hpack_table_t* t) {
+  if (t->fields == NULL) return;
+  hpack_table_evict(t, 0);
+  nodec_free(t->fields);
+  t->fields = NULL;
+}
+
+static void hpack_table_resize(hpack_table_t* t, size_t max_size) {
+  t->max_size = max_size;
+  hpack_table_evict(t, max_size);
+}
+
+static void hpack_table_add(hpack_table_t* t, const char* name, size_t name_len, const char* value, size_t value_len) {
+  size_t esize = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+  if (esize > t->max_size) {
+    hpack_table_evict(t, 0);
+    return;
+  }
+  // copy first as the name may refer to an entry that is evicted
+  char* s = nodec_alloc_n(name_len + value_len + 2, char);
+  memcpy(s, name, name_len);
+  s[name_len] = 0;
+  memcpy(s + name_len + 1, value, value_len);
+  s[name_len + 1 + value_len] = 0;
+  hpack_table_evict(t, t->max_size - esize);
+  assert(t->count < t->capacity);
+  t->first = (t->first + t->capacity - 1) % t->capacity;
+  hpack_field_t* f = &t->fields[t->first];
+  f->name = s;
+  f->name_len = name_len;
+  f->value_len = value_len;
+  t->count++;
+  t->size += esize;
+}
+
+// Get an entry by its (1-based) index in the static and dynamic table
+static bool hpack_table_get(hpack_table_t* t, uint64_t index, const char** name, size_t* name_len, const char** value, size_t* value_len) {
+  if (index == 0) return false;
+  if (index <= HPACK_STATIC_COUNT) {
+    const hpack_entry_t* e = &hpack_static_table[index - 1];
+    *name = e->name;
+    *name_len = strlen(e->name);
+    *value = e->value;
+    *value_len = strlen(e->value);
+    return true;
+  }
+  index -= HPACK_STATIC_COUNT + 1;
+  if (index >= t->count) return false;
+  hpack_field_t* f = hpack_table_at(t, (size_t)index);
+  *name = f->name;
+  *name_len = f->name_len;
+  *value = f->name + f->name_len + 1;
+  *value_len = f->value_len;
+  return true;
+}
+
+// Find a field; returns the index of a full match (and sets `*full`),
+// or otherwise the index of an entry with the same name, or 0.
+static uint64_t hpack_table_find(hpack_table_t* t, const char* name, size_t name_len, const char* value, size_t value_len, bool* full) {
+  uint64_t name_index = 0;
+  *full = false;
+  for (size_t i = 0; i < HPACK_STATIC_COUNT; i++) {
+    const hpack_entry_t* e = &hpack_static_table[i];
+    if (strlen(e->name) != name_len || memcmp(e->name, name, name_len) != 0) continue;
+    if (name_index == 0) name_index = i + 1;
+    if (strlen(e->value) == value_len && memcmp(e->value, value, value_len) == 0) {
+      *full = true;
+      return i + 1;
+    }
+  }
+  for (size_t i = 0; i < t->count; i++) {
+    hpack_field_t* f = hpack_table_at(t, i);
+    if (f->name_len != name_len || memcmp(f->name, name, name_len) != 0) continue;
+    if (name_index == 0) name_index = HPACK_STATIC_COUNT + 1 + i;
+    if (f->value_len == value_len && memcmp(f->name + name_len + 1, value, value_len) == 0) {
+      *full = true;
+      return HPACK_STATIC_COUNT + 1 + i;
+    }
+  }
+  return name_index;
+}
+
+
+/*-----------------------------------------------------------------
+  HPACK decoding
+-----------------------------------------------------------------*/
+
+// Decoded header fields as consecutive "name\0value\0" strings
+typedef struct _h2_fields_t {
+  char*   data;
+  size_t  len;
+  size_t  size;
+  size_t  count;
+} h2_fields_t;
+
+static char* h2_fields_reserve(h2_fields_t* fs, size_t extra) {
+  if (fs->len + extra > fs->size) {
+    size_t newsize = (fs->size == 0 ? 1024 : 2 * fs->size);
+    while (newsize < fs->len + extra) newsize *= 2;
+    fs->data = nodec_realloc_n(fs->data, newsize, char);
+    fs->size = newsize;
+  }
+  return fs->data + fs->len;
+}
+
+static void h2_fields_append(h2_fields_t* fs, const char* s, size_t len) {
+  char* dst = h2_fields_reserve(fs, len + 1);
+  memcpy(dst, s, len);
+  dst[len] = 0;
+  fs->len += len + 1;
+}
+
+static void h2_fields_clear(h2_fields_t* fs) {
+  if (fs->data != NULL) nodec_free(fs->data);
+  memset(fs, 0, sizeof(h2_fields_t));
+}
+
+static bool hpack_decode_int(const uint8_t** pp, const uint8_t* end, int prefix, uint64_t* value) {
+  const uint8_t* p = *pp;
+  if (p >= end) return false;
+  uint64_t max = ((uint64_t)1 << prefix) - 1;
+  uint64_t v = *p++ & max;
+  if (v == max) {
+    int shift = 0;
+    uint8_t b;
+    do {
+      if (p >= end || shift > 56) return false;
+      b = *p++;
+      v += (uint64_t)(b & 0x7F) << shift;
+      shift += 7;
+    } while ((b & 0x80) != 0);
+  }
+  *pp = p;
+  *value = v;
+  return true;
+}
+
+// Decode a string literal and append it to the fields
+static h2_error_t hpack_decode_str(const uint8_t** pp, const uint8_t* end, h2_fields_t* fs, size_t* len) {
+  if (*pp >= end) return H2_COMPRESSION_ERROR;
+  bool huffman = ((**pp & 0x80) != 0);
+  uint64_t n;
+  if (!hpack_decode_int(pp, end, 7, &n) || n > (uint64_t)(end - *pp)) return H2_COMPRESSION_ERROR;
+  const uint8_t* s = *pp;
+  *pp += n;
+  if (!huffman) {
+    h2_fields_append(fs, (const char*)s, (size_t)n);
+    *len = (size_t)n;
+    return H2_NO_ERROR;
+  }
+  // the shortest code has 5 bits
+  char* dst = h2_fields_reserve(fs, (size_t)((n * 8) / 5) + 1);
+  size_t dlen = 0;
+  int node = 0;
+  int bits = 0;         // bits since the last symbol
+  bool ones = true;     // are those bits all ones?
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 7; k >= 0; k--) {
+      int bit = (s[i] >> k) & 1;
+      int next = hpack_huffman_tree[node][bit];
+      bits++;
+      if (bit == 0) ones = false;
+      if (next < 0) {
+        int sym = -next - 1;
+        if (sym == 256) return H2_COMPRESSION_ERROR;  // EOS in a string
+        dst[dlen++] = (char)sym;
+        node = 0;
+        bits = 0;
+        ones = true;
+      }
+      else if (next == 0) {
+        return H2_COMPRESSION_ERROR;
+      }
+      else {
+        node = next;
+      }
+    }
+  }
+  if (bits > 7 || !ones) return H2_COMPRESSION_ERROR;  // padding must be a prefix of EOS
+  dst[dlen] = 0;
+  fs->len += dlen + 1;
+  *len = dlen;
+  return H2_NO_ERROR;
+}
+
+static bool h2_field_valid(const char* name, size_t name_len, const char* value, size_t value_len) {
+  if (name_len == 0) return false;
+  for (size_t i = 0; i < name_len; i++) {
+    char c = name[i];
+    if (c == 0 || (c >= 'A' && c <= 'Z') || c == ' ' || c == '\r' || c == '\n') return false;
+  }
+  for (size_t i = 0; i < value_len; i++) {
+    char c = value[i];
+    if (c == 0 || c == '\r' || c == '\n') return false;
+  }
+  return true;
+}
+
+// Decode a header block; returns a connection error on decoding errors, or
+// `H2_PROTOCOL_ERROR` if the block decoded fine but contained malformed fields.
+static h2_error_t hpack_decode(hpack_table_t* t, const uint8_t* p, size_t len, h2_fields_t* fs) {
+  const uint8_t* end = p + len;
+  bool malformed = false;
+  bool fields_seen = false;
+  while (p < end) {
+    uint8_t b = *p;
+    uint64_t index;
+    const char* name;
+    const char* value;
+    size_t name_len;
+    size_t value_len;
+    if ((b & 0x80) != 0) {
+      // indexed field
+      if (!hpack_decode_int(&p, end, 7, &index) ||
+          !hpack_table_get(t, index, &name, &name_len, &value, &value_len)) return H2_COMPRESSION_ERROR;
+      size_t name_ofs = fs->len;
+      h2_fields_append(fs, name, name_len);
+      h2_fields_append(fs, value, value_len);
+      name = fs->data + name_ofs;
+      value = name + name_len + 1;
+    }
+    else if ((b & 0xE0) == 0x20) {
+      // dynamic table size update; only at the start of a block
+      if (fields_seen || !hpack_decode_int(&p, end, 5, &index) || index > HPACK_TABLE_SIZE) return H2_COMPRESSION_ERROR;
+      hpack_table_resize(t, (size_t)index);
+      continue;
+    }
+    else {
+      // literal field, with incremental indexing, without indexing, or never indexed
+      bool indexing = ((b & 0xC0) == 0x40);
+      if (!hpack_decode_int(&p, end, (indexing ? 6 : 4), &index)) return H2_COMPRESSION_ERROR;
+      size_t name_ofs = fs->len;
+      h2_error_t err;
+      if (index == 0) {
+        err = hpack_decode_str(&p, end, fs, &name_len);
+        if (err != H2_NO_ERROR) return err;
+      }
+      else {
+        if (!hpack_table_get(t, index, &name, &name_len, &value, &value_len)) return H2_COMPRESSION_ERROR;
+        h2_fields_append(fs, name, name_len);
+      }
+      size_t value_ofs = fs->len;
+      err = hpack_decode_str(&p, end, fs, &value_len);
+      if (err != H2_NO_ERROR) return err;
+      name = fs->data + name_ofs;  // after decoding as the data may be reallocated
+      value = fs->data + value_ofs;
+      if (indexing) hpack_table_add(t, name, name_len, value, value_len);
+    }
+    fields_seen = true;
+    fs->count++;
+    if (!h2_field_valid(name, name_len, value, value_len)) malformed = true;
+    if (fs->len > H2_MAX_HEADER_LIST) return H2_ENHANCE_YOUR_CALM;
+  }
+  return (malformed ? H2_PROTOCOL_ERROR : H2_NO_ERROR);
+}
+
+// The decoder interface for testing (see `nodec-internal.h`)
+hpack_table_t* hpack_decoder_alloc(size_t max_size) {
+  hpack_table_t* t = nodec_zero_alloc(hpack_table_t);
+  hpack_table_init(t);
+  hpack_table_resize(t, (max_size > HPACK_TABLE_SIZE ? HPACK_TABLE_SIZE : max_size));
+  return t;
+}
+
+void hpack_decoder_free(hpack_table_t* t) {
+  if (t == NULL) return;
+  hpack_table_free(t);
+  nodec_free(t);
+}
+
+int hpack_decoder_decode(hpack_table_t* t, const uint8_t* block, size_t len, char** fields, size_t* count) {
+  h2_fields_t fs = { NULL, 0, 0, 0 };
+  h2_error_t err = hpack_decode(t, block, len, &fs);
+  *fields = fs.data;
+  *count = fs.count;
+  return (int)err;
+}
+
+size_t hpack_decoder_size(hpack_table_t* t) {
+  return t->size;
+}
+
+bool hpack_decoder_entry(hpack_table_t* t, size_t i, const char** name, const char** value) {
+  size_t name_len, value_len;
+  return hpack_table_get(t, HPACK_STATIC_COUNT + 1 + i, name, &name_len, value, &value_len);
+}
+
+
+/*-----------------------------------------------------------------
+  HPACK encoding
+  We use the static and dynamic table but no Huffman coding
+-----------------------------------------------------------------*/
+
+static void hpack_encode_int(uint8_t** pp, uint8_t first, int prefix, uint64_t value) {
+  uint8_t* p = *pp;
+  uint64_t max = ((uint64_t)1 << prefix) - 1;
+  if (value < max) {
+    *p++ = (uint8_t)(first | value);
+  }
+  else {
+    *p++ = (uint8_t)(first | max);
+    value -= max;
+    while (value >= 0x80) {
+      *p++ = (uint8_t)(0x80 | (value & 0x7F));
+      value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+  }
+  *pp = p;
+}
+
+static void hpack_encode_str(uint8_t** pp, const char* s, size_t len) {
+  hpack_encode_int(pp, 0x00, 7, len);
+  memcpy(*pp, s, len);
+  *pp += len;
+}
+
+static void hpack_encode_field(hpack_table_t* t, uint8_t** pp, const char* name, size_t name_len, const char* value, size_t value_len, bool indexing) {
+  bool full;
+  uint64_t index = hpack_table_find(t, name, name_len, value, value_len, &full);
+  if (full) {
+    hpack_encode_int(pp, 0x80, 7, index);
+    return;
+  }
+  if (indexing) {
+    hpack_encode_int(pp, 0x40, 6, index);
+  }
+  else {
+    hpack_encode_int(pp, 0x00, 4, index);
+  }
+  if (index == 0) hpack_encode_str(pp, name, name_len);
+  hpack_encode_str(pp, value, value_len);
+  if (indexing) hpack_table_add(t, name, name_len, value, value_len);
+}
+
+static bool h2_name_in(const char* name, size_t name_len, const char* const* names) {
+  for (const char* const* n = names; *n != NULL; n++) {
+    if (strlen(*n) == name_len && memcmp(*n, name, name_len) == 0) return true;
+  }
+  return false;
+}
+
+// Connection specific headers are not allowed in HTTP/2
+static const char* const h2_connection_headers[] = {
+  "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", NULL
+};
+
+// Headers whose values are (mostly) unique per response are not indexed
+static const char* const h2_unindexed_headers[] = {
+  "date", "content-length", "etag", "last-modified", "set-cookie", "location",
+  "content-range", "expires", "age", "authorization", NULL
+};
+
+
+/*-----------------------------------------------------------------
+  Connections and streams
+-----------------------------------------------------------------*/
+
+struct _h2_conn_t;
+struct _h2_body_t;
+
+typedef struct _h2_stream_t {
+  nodec_stream_t      out;            // the response body; must be first
+  struct _h2_stream_t* next;
+  struct _h2_conn_t*  conn;
+  uint32_t            id;             // 0 for the connection control stream
+  h2_fields_t         fields;
+  const char**        field_ptrs;
+  http_framed_t       framed;
+  struct _h2_body_t*  body;           // request body, or NULL if complete (or freed)
+  bool                recv_closed;    // received END_STREAM
+  bool                send_closed;    // sent END_STREAM
+  bool                headers_sent;
+  bool                reset;          // reset by either side
+  uint64_t            recv_total;     // data received
+  uint64_t            recv_acked;     // data for which we sent a window update
+  int64_t             send_window;
+  uint32_t            depends;        // priority: the stream this stream depends on
+  uint32_t            weight;         // priority: 1 to 256
+  uint64_t            vtime;          // virtual time for weighted scheduling
+  bool                waiting;        // waiting for the write lock
+  struct _h2_stream_t* wait_next;
+  channel_t*          wake;           // the strand of the stream waits here
+  bool                wake_pending;
+} h2_stream_t;
+
+typedef struct _h2_body_t {
+  nodec_bstream_t     bstream;        // must be first
+  h2_stream_t*        stream;         // NULL if the stream is gone
+} h2_body_t;
+
+typedef struct _h2_conn_t {
+  nodec_bstream_t*    client;
+  nodec_http_servefun* servefun;
+  int                 id;
+  h2_stream_t         control;        // pseudo stream used by the reader to write frames
+  h2_stream_t*        streams;
+  size_t              stream_count;
+  uint32_t            last_id;        // highest stream id received
+  bool                goaway;         // received a GOAWAY
+  h2_error_t          error;          // connection error to report
+  uint8_t*            frame;          // payload of the current frame
+  uint8_t*            hblock;         // header block being assembled from CONTINUATION frames
+  size_t              hblock_len;
+  uint32_t            hblock_id;      // non-zero while expecting a CONTINUATION
+  uint8_t             hblock_flags;
+  uint32_t            hblock_depends;
+  uint32_t            hblock_weight;
+  hpack_table_t       decoder;
+  hpack_table_t       encoder;
+  bool                encoder_resized;
+  uint64_t            recv_unacked;   // connection data without a window update
+  bool                writing;        // write lock is held
+  h2_stream_t*        waiters;        // streams waiting for the write lock
+  uint64_t            vclock;         // virtual time of the last scheduled writer
+  int64_t             send_window;
+  int64_t             peer_window;    // initial window size of the peer for new streams
+  size_t              peer_frame_size;
+  uint32_t            reset_ids[H2_RESET_RECENT];  // streams we recently reset (a ring)
+  size_t              reset_next;
+} h2_conn_t;
+
+static uint32_t h2_get32(const uint8_t* p) {
+  return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static void h2_put32(uint8_t* p, uint32_t x) {
+  p[0] = (uint8_t)(x >> 24);
+  p[1] = (uint8_t)(x >> 16);
+  p[2] = (uint8_t)(x >> 8);
+  p[3] = (uint8_t)x;
+}
+
+static void h2_frame_header(uint8_t* h, size_t len, uint8_t type, uint8_t flags, uint32_t id) {
+  h[0] = (uint8_t)(len >> 16);
+  h[1] = (uint8_t)(len >> 8);
+  h[2] = (uint8_t)len;
+  h[3] = type;
+  h[4] = flags;
+  h2_put32(h + 5, id & 0x7FFFFFFF);
+}
+
+static h2_stream_t* h2_stream_find(h2_conn_t* conn, uint32_t id) {
+  for (h2_stream_t* s = conn->streams; s != NULL; s = s->next) {
+    if (s->id == id) return s;
+  }
+  return NULL;
+}
+
+// Raise a connection error; the reader sends a GOAWAY and closes the connection
+static void h2_conn_error(h2_conn_t* conn, h2_error_t err, const char* msg) {
+  conn->error = err;
+  nodec_throw_msg(UV_EPROTO, msg);
+}
+
+
+/*-----------------------------------------------------------------
+  Waking stream strands
+  Each stream strand waits on its own channel; we emit at most
+  one pending wake up and the waiter re-checks its condition.
+-----------------------------------------------------------------*/
+
+static void h2_wake(h2_stream_t* s) {
+  if (s->wake_pending) return;
+  s->wake_pending = true;
+  channel_emit(s->wake, lh_value_null, lh_value_null, 0);
+}
+
+static void h2_wake_all(h2_conn_t* conn) {
+  for (h2_stream_t* s = conn->streams; s != NULL; s = s->next) {
+    h2_wake(s);
+  }
+}
+
+static void async_h2_wait(h2_stream_t* s) {
+  int err = channel_receive(s->wake, NULL, NULL);
+  s->wake_pending = false;
+  nodec_check(err);
+}
+
+
+/*-----------------------------------------------------------------
+  Write scheduling
+-----------------------------------------------------------------*/
+
+static bool h2_parent_waiting(h2_conn_t* conn, h2_stream_t* s) {
+  if (s->depends == 0) return false;
+  for (h2_stream_t* w = conn->waiters; w != NULL; w = w->wait_next) {
+    if (w->id == s->depends) return true;
+  }
+  return false;
+}
+
+static void h2_unwait(h2_conn_t* conn, h2_stream_t* s) {
+  for (h2_stream_t** p = &conn->waiters; *p != NULL; p = &(*p)->wait_next) {
+    if (*p == s) {
+      *p = s->wait_next;
+      break;
+    }
+  }
+  s->wait_next = NULL;
+  s->waiting = false;
+}
+
+// Pick the next writer: the connection itself first, and otherwise
+// the stream with the lowest virtual time whose parent is not waiting.
+static h2_stream_t* h2_waiters_pick(h2_conn_t* conn) {
+  h2_stream_t* best = NULL;
+  for (h2_stream_t* w = conn->waiters; w != NULL; w = w->wait_next) {
+    if (w->id == 0) {
+      best = w;
+      break;
+    }
+    if (h2_parent_waiting(conn, w)) continue;
+    if (best == NULL || w->vtime < best->vtime) best = w;
+  }
+  if (best == NULL) best = conn->waiters;  // in case of a dependency cycle
+  if (best != NULL) h2_unwait(conn, best);
+  return best;
+}
+
+static void h2_unlock(h2_conn_t* conn) {
+  h2_stream_t* next = h2_waiters_pick(conn);
+  if (next == NULL) {
+    conn->writing = false;
+  }
+  else {
+    // hand over the lock directly
+    if (next->vtime > conn->vclock) conn->vclock = next->vtime;
+    h2_wake(next);
+  }
+}
+
+static void h2_unlockv(lh_value connv) {
+  h2_unlock((h2_conn_t*)lh_ptr_value(connv));
+}
+
+static void h2_lock_abortv(lh_value sv) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  if (s->waiting) {
+    h2_unwait(s->conn, s);
+  }
+  else {
+    h2_unlock(s->conn);  // we were handed the lock already
+  }
+}
+
+static void async_h2_lock(h2_stream_t* s) {
+  h2_conn_t* conn = s->conn;
+  if (!conn->writing) {
+    conn->writing = true;
+    return;
+  }
+  if (s->vtime < conn->vclock) s->vtime = conn->vclock;
+  s->waiting = true;
+  s->wait_next = conn->waiters;
+  conn->waiters = s;
+  {on_abort(h2_lock_abortv, lh_value_ptr(s)) {
+    while (s->waiting) {
+      async_h2_wait(s);
+    }
+  }}
+}
+
+// Account for written bytes in the virtual time of a stream
+static void h2_stream_sent(h2_stream_t* s, size_t len) {
+  s->vtime += ((uint64_t)len + H2_FRAME_HEADER) * 256 / s->weight;
+}
+
+static void async_h2_write(h2_stream_t* s, uv_buf_t bufs[], size_t count) {
+  h2_conn_t* conn = s->conn;
+  async_h2_lock(s);
+  {defer(h2_unlockv, lh_value_ptr(conn)) {
+    async_write_bufs(as_stream(conn->client), bufs, count);
+  }}
+}
+
+static void async_h2_send_frame(h2_stream_t* s, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len) {
+  uint8_t header[H2_FRAME_HEADER];
+  h2_frame_header(header, len, type, flags, id);
+  uv_buf_t bufs[2] = { nodec_buf(header, H2_FRAME_HEADER), nodec_buf(payload, len) };
+  async_h2_write(s, bufs, (len > 0 ? 2 : 1));
+}
+
+static void async_h2_send_window_update(h2_stream_t* s, uint32_t id, uint64_t increment) {
+  uint8_t payload[4];
+  h2_put32(payload, (uint32_t)increment & 0x7FFFFFFF);
+  async_h2_send_frame(s, H2_WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+// Frames in flight may still arrive for a stream after we reset it; those are ignored
+static void h2_reset_remember(h2_conn_t* conn, uint32_t id) {
+  conn->reset_ids[conn->reset_next] = id;
+  conn->reset_next = (conn->reset_next + 1) % H2_RESET_RECENT;
+}
+
+static bool h2_reset_recent(h2_conn_t* conn, uint32_t id) {
+  for (size_t i = 0; i < H2_RESET_RECENT; i++) {
+    if (conn->reset_ids[i] == id) return true;
+  }
+  return false;
+}
+
+static void async_h2_send_rst(h2_stream_t* s, uint32_t id, h2_error_t err) {
+  h2_reset_remember(s->conn, id);
+  uint8_t payload[4];
+  h2_put32(payload, err);
+  async_h2_send_frame(s, H2_RST_STREAM, 0, id, payload, 4);
+}
+
+static void async_h2_send_goaway(h2_conn_t* conn, h2_error_t err) {
+  uint8_t payload[8];
+  h2_put32(payload, conn->last_id);
+  h2_put32(payload + 4, err);
+  async_h2_send_frame(&conn->control, H2_GOAWAY, 0, 0, payload, 8);
+}
+
+static void async_h2_send_settings(h2_conn_t* conn) {
+  static const uint32_t settings[3][2] = {
+    { H2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_STREAMS },
+    { H2_SETTINGS_INITIAL_WINDOW_SIZE, H2_STREAM_WINDOW },
+    { H2_SETTINGS_MAX_HEADER_LIST_SIZE, H2_MAX_HEADER_LIST }
+  };
+  uint8_t payload[3 * 6];
+  for (size_t i = 0; i < 3; i++) {
+    payload[6*i] = (uint8_t)(settings[i][0] >> 8);
+    payload[6*i + 1] = (uint8_t)settings[i][0];
+    h2_put32(payload + 6*i + 2, settings[i][1]);
+  }
+  async_h2_send_frame(&conn->control, H2_SETTINGS, 0, 0, payload, sizeof(payload));
+  async_h2_send_window_update(&conn->control, 0, H2_CONN_WINDOW - H2_WINDOW_DEFAULT);
+}
+
+
+/*-----------------------------------------------------------------
+  Sending responses
+-----------------------------------------------------------------*/
+
+static void h2_stream_check_open(h2_stream_t* s) {
+  if (s->reset) nodec_throw_msg(UV_ECONNRESET, "HTTP/2 stream was reset");
+  if (s->send_closed) nodec_throw_msg(UV_EPIPE, "HTTP/2 stream is already closed");
+}
+
+// Send data in frames that fit the flow control windows
+static void async_h2_send_data(h2_stream_t* s, uv_buf_t buf, bool end_stream) {
+  h2_conn_t* conn = s->conn;
+  size_t len = (nodec_buf_is_null(buf) ? 0 : buf.len);
+  size_t ofs = 0;
+  do {
+    h2_stream_check_open(s);
+    size_t n = len - ofs;
+    if (n > 0) {
+      while (s->send_window <= 0 || conn->send_window <= 0) {
+        async_h2_wait(s);
+        h2_stream_check_open(s);
+      }
+      if (n > conn->peer_frame_size) n = conn->peer_frame_size;
+      if ((int64_t)n > s->send_window) n = (size_t)s->send_window;
+      if ((int64_t)n > conn->send_window) n = (size_t)conn->send_window;
+      s->send_window -= n;
+      conn->send_window -= n;
+    }
+    bool last = (end_stream && ofs + n >= len);
+    uint8_t header[H2_FRAME_HEADER];
+    h2_frame_header(header, n, H2_DATA, (last ? H2_FLAG_END_STREAM : 0), s->id);
+    uv_buf_t bufs[2] = { nodec_buf(header, H2_FRAME_HEADER), nodec_buf(buf.base + ofs, n) };
+    async_h2_write(s, bufs, (n > 0 ? 2 : 1));
+    h2_stream_sent(s, n);
+    ofs += n;
+    if (last) s->send_closed = true;
+  } while (ofs < len);
+}
+
+static int64_t h2_parse_length(const char* s, size_t len) {
+  int64_t n = 0;
+  size_t i = 0;
+  while (i < len && s[i] >= '0' && s[i] <= '9') {
+    n = 10*n + (s[i] - '0');
+    i++;
+  }
+  return (i == 0 ? -1 : n);
+}
+
+// Encode the response headers; the `Field: value\r\n` lines in `head` are lower-cased in place.
+static uv_buf_t h2_encode_headers(h2_conn_t* conn, http_status_t status, uv_buf_t head, int64_t* content_length) {
+  *content_length = -1;
+  size_t hlen = (nodec_buf_is_null(head) ? 0 : head.len);
+  uv_buf_t buf = nodec_buf_alloc(2*hlen + 64);
+  uint8_t* p = (uint8_t*)buf.base;
+  if (conn->encoder_resized) {
+    hpack_encode_int(&p, 0x20, 5, conn->encoder.max_size);
+    conn->encoder_resized = false;
+  }
+  char sstatus[16];
+  snprintf(sstatus, 16, "%i", (int)status);
+  hpack_encode_field(&conn->encoder, &p, ":status", 7, sstatus, strlen(sstatus), false);
+  char* line = head.base;
+  char* end = head.base + hlen;
+  while (line < end) {
+    char* eol = (char*)memchr(line, '\n', end - line);
+    char* next = (eol == NULL ? end : eol + 1);
+    if (eol == NULL) eol = end;
+    if (eol > line && eol[-1] == '\r') eol--;
+    char* colon = (char*)memchr(line, ':', eol - line);
+    if (colon != NULL && colon > line) {
+      size_t name_len = colon - line;
+      for (size_t i = 0; i < name_len; i++) line[i] = (char)tolower(line[i]);
+      const char* value = colon + 1;
+      while (value < eol && (*value == ' ' || *value == '\t')) value++;
+      size_t value_len = eol - value;
+      if (!h2_name_in(line, name_len, h2_connection_headers)) {
+        if (name_len == 14 && memcmp(line, "content-length", 14) == 0) {
+          *content_length = h2_parse_length(value, value_len);
+        }
+        bool indexing = (value_len <= 64 && !h2_name_in(line, name_len, h2_unindexed_headers));
+        hpack_encode_field(&conn->encoder, &p, line, name_len, value, value_len, indexing);
+      }
+    }
+    line = next;
+  }
+  buf.len = (uv_buf_len_t)((char*)p - buf.base);
+  return buf;
+}
+
+// Called by `http_out_t` to send the headers and (optionally) the full body of a response
+static void async_h2_send_headers(lh_value sv, http_status_t status, uv_buf_t head, uv_buf_t body) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  h2_conn_t* conn = s->conn;
+  h2_stream_check_open(s);
+  size_t body_len = (nodec_buf_is_null(body) ? 0 : body.len);
+  int64_t content_length = -1;
+  bool end_stream = false;
+  async_h2_lock(s);
+  {defer(h2_unlockv, lh_value_ptr(conn)) {
+    // encode while holding the lock so the encoder table stays in the order of the blocks on the wire
+    uv_buf_t block = h2_encode_headers(conn, status, head, &content_length);
+    end_stream = (content_length == 0 && body_len == 0);
+    {using_buf(&block) {
+      size_t ofs = 0;
+      do {
+        size_t n = block.len - ofs;
+        if (n > conn->peer_frame_size) n = conn->peer_frame_size;
+        uint8_t flags = (ofs + n >= block.len ? H2_FLAG_END_HEADERS : 0);
+        if (ofs == 0 && end_stream) flags |= H2_FLAG_END_STREAM;
+        uint8_t header[H2_FRAME_HEADER];
+        h2_frame_header(header, n, (ofs == 0 ? H2_HEADERS : H2_CONTINUATION), flags, s->id);
+        uv_buf_t bufs[2] = { nodec_buf(header, H2_FRAME_HEADER), nodec_buf(block.base + ofs, n) };
+        async_write_bufs(as_stream(conn->client), bufs, 2);
+        h2_stream_sent(s, n);
+        ofs += n;
+      } while (ofs < block.len);
+    }}
+  }}
+  s->headers_sent = true;
+  if (end_stream) {
+    s->send_closed = true;
+  }
+  else if (body_len > 0) {
+    async_h2_send_data(s, body, content_length >= 0 && (uint64_t)content_length == body_len);
+  }
+}
+
+static void async_h2_out_write_bufs(nodec_stream_t* stream, uv_buf_t bufs[], size_t count) {
+  h2_stream_t* s = (h2_stream_t*)stream;
+  for (size_t i = 0; i < count; i++) {
+    if (!nodec_buf_is_null(bufs[i]) && bufs[i].len > 0) async_h2_send_data(s, bufs[i], false);
+  }
+}
+
+static void async_h2_out_shutdown(nodec_stream_t* stream) {
+  h2_stream_t* s = (h2_stream_t*)stream;
+  if (!s->send_closed && !s->reset) async_h2_send_data(s, nodec_buf_null(), true);
+}
+
+static size_t async_h2_out_write_queued(nodec_stream_t* stream) {
+  h2_stream_t* s = (h2_stream_t*)stream;
+  return nodec_stream_write_queued(as_stream(s->conn->client));
+}
+
+
+/*-----------------------------------------------------------------
+  Request bodies
+  Received data is buffered in the chunks of the body stream; we
+  grant the peer more credit only when the body is read, so a
+  body that is not read applies back pressure to the peer.
+-----------------------------------------------------------------*/
+
+static void async_h2_body_credit(h2_stream_t* s, bool force) {
+  uint64_t unacked = s->recv_total - s->recv_acked;
+  if (unacked == 0 || s->recv_closed || s->reset) return;
+  if (!force && unacked < H2_STREAM_WINDOW/2) return;
+  s->recv_acked = s->recv_total;
+  async_h2_send_window_update(s, s->id, unacked);
+}
+
+static bool async_h2_body_read_chunk(nodec_bstream_t* bs, nodec_chunk_read_t read_mode, size_t read_to_eof_max) {
+  h2_body_t* body = (h2_body_t*)bs;
+  if (read_mode == CREAD_NORMAL && nodec_chunks_available(bs) > 0) return false;
+  if (read_mode != CREAD_TO_EOF) read_to_eof_max = 0;
+  h2_stream_t* s = body->stream;
+  size_t start = nodec_chunks_available(bs);
+  while (s != NULL && !s->recv_closed && !s->reset) {
+    size_t available = nodec_chunks_available(bs);
+    if (read_mode == CREAD_TO_EOF ? (read_to_eof_max > 0 && available >= read_to_eof_max) : available > start) break;
+    async_h2_body_credit(s, available == start);
+    async_h2_wait(s);
+  }
+  if (s != NULL) {
+    if (s->reset) nodec_throw_msg(UV_ECONNRESET, "HTTP/2 stream was reset");
+    async_h2_body_credit(s, false);
+  }
+  return (s == NULL || s->recv_closed);
+}
+
+static uv_buf_t async_h2_body_read_bufx(nodec_stream_t* stream, bool* owned) {
+  nodec_bstream_t* bs = (nodec_bstream_t*)stream;
+  if (owned != NULL) *owned = true;
+  if (nodec_chunks_available(bs) == 0) {
+    async_h2_body_read_chunk(bs, CREAD_EVEN_IF_AVAILABLE, 0);
+  }
+  return nodec_chunks_read_buf(bs);
+}
+
+static void h2_body_free(nodec_stream_t* stream) {
+  h2_body_t* body = (h2_body_t*)stream;
+  if (body->stream != NULL) body->stream->body = NULL;
+  nodec_bstream_release(&body->bstream);
+  nodec_free(body);
+}
+
+
+/*-----------------------------------------------------------------
+  Serving a stream
+-----------------------------------------------------------------*/
+
+static h2_stream_t* h2_stream_alloc(h2_conn_t* conn, uint32_t id, h2_fields_t* fields, bool end_stream) {
+  h2_stream_t* s = nodec_zero_alloc(h2_stream_t);
+  nodec_stream_init(&s->out, NULL, &async_h2_out_write_bufs, &async_h2_out_shutdown, NULL);
+  nodec_stream_set_write_queued(&s->out, &async_h2_out_write_queued);
+  s->conn = conn;
+  s->id = id;
+  s->fields = *fields;
+  memset(fields, 0, sizeof(h2_fields_t));
+  s->field_ptrs = nodec_alloc_n(2 * s->fields.count + 1, const char*);
+  const char* p = s->fields.data;
+  for (size_t i = 0; i < 2 * s->fields.count; i++) {
+    s->field_ptrs[i] = p;
+    p += strlen(p) + 1;
+  }
+  s->recv_closed = end_stream;
+  s->send_window = conn->peer_window;
+  s->depends = conn->hblock_depends;
+  s->weight = conn->hblock_weight;
+  s->vtime = conn->vclock;
+  s->wake = channel_alloc(-1);
+  if (!end_stream) {
+    h2_body_t* body = nodec_zero_alloc(h2_body_t);
+    nodec_bstream_init(&body->bstream, &async_h2_body_read_chunk, &nodec_chunks_pushback_buf,
+      &async_h2_body_read_bufx, NULL, NULL, &h2_body_free);
+    body->stream = s;
+    s->body = body;
+  }
+  s->framed.fields = s->field_ptrs;
+  s->framed.count = s->fields.count;
+  s->framed.body = (s->body == NULL ? NULL : &s->body->bstream);  // ownership passes to the request
+  s->framed.out = &s->out;
+  s->framed.send_headers = &async_h2_send_headers;
+  s->framed.arg = lh_value_ptr(s);
+  s->next = conn->streams;
+  conn->streams = s;
+  conn->stream_count++;
+  return s;
+}
+
+static void h2_stream_freev(lh_value sv) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  h2_conn_t* conn = s->conn;
+  for (h2_stream_t** p = &conn->streams; *p != NULL; p = &(*p)->next) {
+    if (*p == s) {
+      *p = s->next;
+      conn->stream_count--;
+      break;
+    }
+  }
+  if (s->waiting) h2_unwait(conn, s);
+  if (s->body != NULL) s->body->stream = NULL;
+  h2_fields_clear(&s->fields);
+  nodec_free(s->field_ptrs);
+  channel_free(s->wake);
+  nodec_free(s);
+}
+
+static lh_value h2_stream_handlev(lh_value sv) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  http_serve_framed(s->conn->id, s->conn->servefun, &s->framed);
+  return lh_value_null;
+}
+
+// Send an error response, or reset the stream if the headers were sent already
+static void async_h2_send_error(h2_stream_t* s, http_status_t status, const char* msg) {
+  if (s->reset || s->send_closed) return;
+  if (s->headers_sent) {
+    s->reset = true;
+    async_h2_send_rst(s, s->id, H2_INTERNAL_ERROR);
+    return;
+  }
+  if (msg == NULL) msg = nodec_http_status_str(status);
+  char head[128];
+  snprintf(head, 128, "Content-Type: text/plain; charset=utf-8\r\nContent-Length: %zu\r\n", strlen(msg));
+  head[127] = 0;
+  async_h2_send_headers(lh_value_ptr(s), status, nodec_buf_str(head), nodec_buf_str(msg));
+}
+
+typedef struct _h2_error_args_t {
+  h2_stream_t*  stream;
+  http_status_t status;
+  const char*   msg;
+} h2_error_args_t;
+
+static lh_value async_h2_send_errorv(lh_value argsv) {
+  h2_error_args_t* args = (h2_error_args_t*)lh_ptr_value(argsv);
+  async_h2_send_error(args->stream, args->status, args->msg);
+  return lh_value_null;
+}
+
+static lh_value async_h2_stream_finishv(lh_value sv) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  if (s->reset) return lh_value_null;
+  if (!s->headers_sent) {
+    async_h2_send_error(s, HTTP_STATUS_INTERNAL_SERVER_ERROR, "no response was sent");
+  }
+  else if (!s->send_closed) {
+    async_h2_send_data(s, nodec_buf_null(), true);
+  }
+  if (!s->recv_closed && !s->reset) {
+    // the response is complete; tell the peer to stop sending the request body
+    s->reset = true;
+    async_h2_send_rst(s, s->id, H2_NO_ERROR);
+  }
+  return lh_value_null;
+}
+
+static lh_value async_h2_stream_servev(lh_value sv) {
+  h2_stream_t* s = (h2_stream_t*)lh_ptr_value(sv);
+  {defer(h2_stream_freev, sv) {
+    lh_exception* exn = NULL;
+    lh_try(&exn, &h2_stream_handlev, sv);
+    if (exn != NULL) {
+      // like `async_write_http_exnv`: use the HTTP status of the exception if present
+      h2_error_args_t args = { s, HTTP_STATUS_INTERNAL_SERVER_ERROR, exn->msg };
+      if (exn->code <= UV_EHTTP) args.status = (http_status_t)(UV_EHTTP - exn->code);
+      lh_exception* xexn = NULL;
+      lh_try(&xexn, &async_h2_send_errorv, lh_value_any_ptr(&args));
+      if (xexn != NULL) lh_exception_free(xexn);
+      lh_exception_free(exn);
+    }
+    lh_exception* fexn = NULL;
+    lh_try(&fexn, &async_h2_stream_finishv, sv);
+    if (fexn != NULL) lh_exception_free(fexn);
+  }}
+  return lh_value_null;
+}
+
+
+/*-----------------------------------------------------------------
+  Reading frames
+-----------------------------------------------------------------*/
+
+static bool async_h2_read(h2_conn_t* conn, uint8_t* buf, size_t len) {
+  if (len == 0) return true;
+  return (async_read_into(conn->client, nodec_buf(buf, len)) == len);
+}
+
+// Reset a stream from the reader
+static void async_h2_reset(h2_conn_t* conn, uint32_t id, h2_error_t err) {
+  h2_stream_t* s = h2_stream_find(conn, id);
+  if (s != NULL) {
+    s->reset = true;
+    h2_wake(s);
+  }
+  async_h2_send_rst(&conn->control, id, err);
+}
+
+static void async_h2_on_header_block(h2_conn_t* conn) {
+  uint32_t id = conn->hblock_id;
+  bool end_stream = ((conn->hblock_flags & H2_FLAG_END_STREAM) != 0);
+  conn->hblock_id = 0;
+  h2_fields_t fields = { NULL, 0, 0, 0 };
+  h2_error_t err = hpack_decode(&conn->decoder, conn->hblock, conn->hblock_len, &fields);
+  if (err != H2_NO_ERROR && err != H2_PROTOCOL_ERROR) {
+    h2_fields_clear(&fields);
+    h2_conn_error(conn, err, "unable to decode HTTP/2 headers");
+  }
+  h2_stream_t* s = h2_stream_find(conn, id);
+  if (s != NULL || id <= conn->last_id) {
+    // trailers of an open stream
+    h2_fields_clear(&fields);
+    if (s == NULL || s->recv_closed) h2_conn_error(conn, H2_STREAM_CLOSED, "HTTP/2 headers on a closed stream");
+    if (!end_stream || err != H2_NO_ERROR) {
+      async_h2_reset(conn, id, H2_PROTOCOL_ERROR);
+    }
+    else {
+      s->recv_closed = true;
+      h2_wake(s);
+    }
+    return;
+  }
+  conn->last_id = id;
+  if (err != H2_NO_ERROR || conn->hblock_depends == id) {
+    h2_fields_clear(&fields);
+    async_h2_reset(conn, id, H2_PROTOCOL_ERROR);
+  }
+  else if (conn->goaway || conn->stream_count >= H2_MAX_STREAMS) {
+    h2_fields_clear(&fields);
+    async_h2_reset(conn, id, H2_REFUSED_STREAM);
+  }
+  else {
+    s = h2_stream_alloc(conn, id, &fields, end_stream);
+    async_strand_create(&async_h2_stream_servev, lh_value_ptr(s), NULL);
+  }
+}
+
+static void h2_hblock_append(h2_conn_t* conn, const uint8_t* p, size_t len) {
+  if (conn->hblock_len + len > H2_MAX_HEADER_LIST) h2_conn_error(conn, H2_ENHANCE_YOUR_CALM, "HTTP/2 headers are too large");
+  memcpy(conn->hblock + conn->hblock_len, p, len);
+  conn->hblock_len += len;
+}
+
+// Remove the padding of a DATA or HEADERS frame
+static void h2_unpad(h2_conn_t* conn, uint8_t flags, const uint8_t** p, size_t* len) {
+  if ((flags & H2_FLAG_PADDED) == 0) return;
+  if (*len < 1) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 padding");
+  size_t pad = **p;
+  (*p)++;
+  (*len)--;
+  if (pad > *len) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 padding");
+  *len -= pad;
+}
+
+static void async_h2_on_headers(h2_conn_t* conn, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+  if (id == 0 || (id % 2) == 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 stream id");
+  h2_unpad(conn, flags, &p, &len);
+  conn->hblock_depends = 0;
+  conn->hblock_weight = 16;
+  if ((flags & H2_FLAG_PRIORITY) != 0) {
+    if (len < 5) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 priority");
+    conn->hblock_depends = h2_get32(p) & 0x7FFFFFFF;
+    conn->hblock_weight = (uint32_t)p[4] + 1;
+    p += 5;
+    len -= 5;
+  }
+  conn->hblock_id = id;
+  conn->hblock_flags = flags;
+  conn->hblock_len = 0;
+  h2_hblock_append(conn, p, len);
+  if ((flags & H2_FLAG_END_HEADERS) != 0) async_h2_on_header_block(conn);
+}
+
+static void async_h2_on_data(h2_conn_t* conn, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+  if (id == 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 data on stream 0");
+  size_t flow_len = len;  // padding counts for flow control
+  h2_unpad(conn, flags, &p, &len);
+  conn->recv_unacked += flow_len;
+  if (conn->recv_unacked >= H2_CONN_WINDOW/2) {
+    async_h2_send_window_update(&conn->control, 0, conn->recv_unacked);
+    conn->recv_unacked = 0;
+  }
+  h2_stream_t* s = h2_stream_find(conn, id);
+  if (s == NULL || s->recv_closed) {
+    if (id > conn->last_id) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 data on an idle stream");
+    // reset a closed stream once; ignore the data that was in flight after that
+    if ((s == NULL || !s->reset) && !h2_reset_recent(conn, id)) async_h2_reset(conn, id, H2_STREAM_CLOSED);
+    return;
+  }
+  if (s->reset) return;  // ignore data after a reset
+  if (s->recv_total - s->recv_acked + flow_len > H2_STREAM_WINDOW) {
+    async_h2_reset(conn, id, H2_FLOW_CONTROL_ERROR);
+    return;
+  }
+  s->recv_total += flow_len;
+  if (len > 0 && s->body != NULL) {
+    uv_buf_t buf = nodec_buf_alloc(len);
+    memcpy(buf.base, p, len);
+    nodec_chunks_push(&s->body->bstream, buf);
+  }
+  if ((flags & H2_FLAG_END_STREAM) != 0) s->recv_closed = true;
+  h2_wake(s);
+}
+
+static void async_h2_on_settings(h2_conn_t* conn, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+  if (id != 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 settings on a stream");
+  if ((flags & H2_FLAG_ACK) != 0) {
+    if (len != 0) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 settings acknowledgement");
+    return;
+  }
+  if (len % 6 != 0) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 settings");
+  for (size_t i = 0; i < len; i += 6) {
+    uint16_t key = (uint16_t)((p[i] << 8) | p[i + 1]);
+    uint32_t value = h2_get32(p + i + 2);
+    switch (key) {
+    case H2_SETTINGS_HEADER_TABLE_SIZE: {
+      size_t size = (value < HPACK_TABLE_SIZE ? value : HPACK_TABLE_SIZE);
+      if (size != conn->encoder.max_size) {
+        hpack_table_resize(&conn->encoder, size);
+        conn->encoder_resized = true;
+      }
+      break;
+    }
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 push setting");
+      break;
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+      if (value > H2_WINDOW_MAX) h2_conn_error(conn, H2_FLOW_CONTROL_ERROR, "invalid HTTP/2 window size");
+      int64_t delta = (int64_t)value - conn->peer_window;
+      conn->peer_window = value;
+      for (h2_stream_t* s = conn->streams; s != NULL; s = s->next) {
+        s->send_window += delta;
+      }
+      h2_wake_all(conn);
+      break;
+    }
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < H2_FRAME_SIZE || value > 0xFFFFFF) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 frame size");
+      conn->peer_frame_size = value;
+      break;
+    default:
+      break;  // ignore others
+    }
+  }
+  async_h2_send_frame(&conn->control, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+}
+
+static void async_h2_on_window_update(h2_conn_t* conn, uint32_t id, const uint8_t* p, size_t len) {
+  if (len != 4) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 window update");
+  uint32_t increment = h2_get32(p) & 0x7FFFFFFF;
+  if (id == 0) {
+    if (increment == 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 window update");
+    conn->send_window += increment;
+    if (conn->send_window > H2_WINDOW_MAX) h2_conn_error(conn, H2_FLOW_CONTROL_ERROR, "HTTP/2 window overflow");
+    h2_wake_all(conn);
+    return;
+  }
+  h2_stream_t* s = h2_stream_find(conn, id);
+  if (s == NULL) return;  // closed already
+  if (increment == 0) {
+    async_h2_reset(conn, id, H2_PROTOCOL_ERROR);
+    return;
+  }
+  s->send_window += increment;
+  if (s->send_window > H2_WINDOW_MAX) {
+    async_h2_reset(conn, id, H2_FLOW_CONTROL_ERROR);
+    return;
+  }
+  h2_wake(s);
+}
+
+static void async_h2_on_frame(h2_conn_t* conn, uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+  if (conn->hblock_id != 0 && (type != H2_CONTINUATION || id != conn->hblock_id)) {
+    h2_conn_error(conn, H2_PROTOCOL_ERROR, "expecting an HTTP/2 continuation frame");
+  }
+  switch (type) {
+  case H2_DATA:
+    async_h2_on_data(conn, flags, id, p, len);
+    break;
+  case H2_HEADERS:
+    async_h2_on_headers(conn, flags, id, p, len);
+    break;
+  case H2_CONTINUATION:
+    if (conn->hblock_id == 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "unexpected HTTP/2 continuation frame");
+    h2_hblock_append(conn, p, len);
+    if ((flags & H2_FLAG_END_HEADERS) != 0) async_h2_on_header_block(conn);
+    break;
+  case H2_PRIORITY: {
+    if (id == 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 priority on stream 0");
+    if (len != 5) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 priority");
+    uint32_t depends = h2_get32(p) & 0x7FFFFFFF;
+    h2_stream_t* s = h2_stream_find(conn, id);
+    if (depends == id) {
+      async_h2_reset(conn, id, H2_PROTOCOL_ERROR);
+    }
+    else if (s != NULL) {
+      s->depends = depends;
+      s->weight = (uint32_t)p[4] + 1;
+    }
+    break;
+  }
+  case H2_RST_STREAM: {
+    if (id == 0 || id > conn->last_id) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 reset of an idle stream");
+    if (len != 4) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 reset");
+    h2_stream_t* s = h2_stream_find(conn, id);
+    if (s != NULL) {
+      s->reset = true;
+      h2_wake(s);
+    }
+    break;
+  }
+  case H2_SETTINGS:
+    async_h2_on_settings(conn, flags, id, p, len);
+    break;
+  case H2_PUSH_PROMISE:
+    h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 push promise from a client");
+    break;
+  case H2_PING:
+    if (id != 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 ping on a stream");
+    if (len != 8) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "invalid HTTP/2 ping");
+    if ((flags & H2_FLAG_ACK) == 0) async_h2_send_frame(&conn->control, H2_PING, H2_FLAG_ACK, 0, p, 8);
+    break;
+  case H2_GOAWAY:
+    if (id != 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "HTTP/2 goaway on a stream");
+    conn->goaway = true;  // serve the open streams but accept no new ones
+    break;
+  case H2_WINDOW_UPDATE:
+    async_h2_on_window_update(conn, id, p, len);
+    break;
+  default:
+    break;  // ignore unknown frame types
+  }
+}
+
+static lh_value async_h2_readv(lh_value connv) {
+  h2_conn_t* conn = (h2_conn_t*)lh_ptr_value(connv);
+  uint8_t preface[H2_PREFACE_LEN];
+  if (!async_h2_read(conn, preface, H2_PREFACE_LEN)) return lh_value_null;
+  if (memcmp(preface, H2_PREFACE, H2_PREFACE_LEN) != 0) h2_conn_error(conn, H2_PROTOCOL_ERROR, "invalid HTTP/2 connection preface");
+  async_h2_send_settings(conn);
+  uint8_t header[H2_FRAME_HEADER];
+  while (async_h2_read(conn, header, H2_FRAME_HEADER)) {
+    size_t len = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+    uint32_t id = h2_get32(header + 5) & 0x7FFFFFFF;
+    if (len > H2_FRAME_SIZE) h2_conn_error(conn, H2_FRAME_SIZE_ERROR, "HTTP/2 frame is too large");
+    if (!async_h2_read(conn, conn->frame, len)) break;
+    async_h2_on_frame(conn, header[3], header[4], id, conn->frame, len);
+  }
+  return lh_value_null;
+}
+
+static lh_value async_h2_goawayv(lh_value connv) {
+  h2_conn_t* conn = (h2_conn_t*)lh_ptr_value(connv);
+  async_h2_send_goaway(conn, conn->error);
+  return lh_value_null;
+}
+
+static lh_value async_h2_connv(lh_value connv) {
+  h2_conn_t* conn = (h2_conn_t*)lh_ptr_value(connv);
+  lh_exception* exn = NULL;
+  lh_try(&exn, &async_h2_readv, connv);
+  // no more frames: release all waiting streams
+  for (h2_stream_t* s = conn->streams; s != NULL; s = s->next) {
+    s->reset = true;
+    h2_wake(s);
+  }
+  if (exn != NULL) {
+    if (conn->error != H2_NO_ERROR) {
+      lh_exception* gexn = NULL;
+      lh_try(&gexn, &async_h2_goawayv, connv);
+      if (gexn != NULL) lh_exception_free(gexn);
+    }
+    lh_exception_free(exn);
+  }
+  return lh_value_null;
+}
+
+
+/*-----------------------------------------------------------------
+  Connections
+-----------------------------------------------------------------*/
+
+// Read until the full preface is there, or until the data differs from it, 
+// as the preface may arrive in pieces. All data read is pushed back.
+bool async_http2_detect(nodec_bstream_t* client) {
+  uv_buf_t buf = nodec_buf_null();
+  bool h2 = false;
+  {using_buf_on_abort_free(&buf) {
+    do {
+      uv_buf_t next = async_read_buf(as_stream(client));
+      if (nodec_buf_is_null(next)) break;
+      if (nodec_buf_is_null(buf)) {
+        buf = next;
+      }
+      else {
+        buf = nodec_buf_append_into(buf, next);
+        nodec_buf_free(next);
+      }
+      size_t n = (buf.len < H2_PREFACE_LEN ? buf.len : H2_PREFACE_LEN);
+      h2 = (memcmp(buf.base, H2_PREFACE, n) == 0);
+    } while (h2 && buf.len < H2_PREFACE_LEN);
+  }}
+  if (!nodec_buf_is_null(buf)) nodec_pushback_buf(client, buf);
+  return (h2 && buf.len >= H2_PREFACE_LEN);
+}
+
+static void h2_conn_freev(lh_value connv) {
+  h2_conn_t* conn = (h2_conn_t*)lh_ptr_value(connv);
+  hpack_table_free(&conn->decoder);
+  hpack_table_free(&conn->encoder);
+  channel_free(conn->control.wake);
+  nodec_free(conn->frame);
+  nodec_free(conn->hblock);
+  nodec_free(conn);
+}
+
+void async_http2_serve(int id, nodec_bstream_t* client, nodec_http_servefun* servefun) {
+  h2_conn_t* conn = nodec_zero_alloc(h2_conn_t);
+  conn->client = client;
+  conn->servefun = servefun;
+  conn->id = id;
+  conn->control.conn = conn;
+  conn->control.weight = 256;
+  conn->control.wake = channel_alloc(-1);
+  conn->frame = nodec_alloc_n(H2_FRAME_SIZE, uint8_t);
+  conn->hblock = nodec_alloc_n(H2_MAX_HEADER_LIST, uint8_t);
+  hpack_table_init(&conn->decoder);
+  hpack_table_init(&conn->encoder);
+  conn->send_window = H2_WINDOW_DEFAULT;
+  conn->peer_window = H2_WINDOW_DEFAULT;
+  conn->peer_frame_size = H2_FRAME_SIZE;
+  {defer(h2_conn_freev, lh_value_ptr(conn)) {
+    // the reader spawns a strand per stream; we return once all are done
+    async_interleave_dynamic(&async_h2_connv, lh_value_ptr(conn));
+  }}
+}
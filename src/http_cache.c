@@ -0,0 +1,483 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+#include <ctype.h>
+
+/*-----------------------------------------------------------------
+  HTTP response cache
+  Entries are kept in a hash table on "METHOD host url" and in a list
+  ordered on last use for eviction. An entry stores the response
+  pre-serialized as a status line, the header lines, and the body,
+  such that a hit is sent in a single write. Entries are pinned
+  while they are written and only freed when they are unpinned.
+-----------------------------------------------------------------*/
+
+#define CACHE_MIN_BUCKETS   (64)
+#define CACHE_VARY_MAX      (256)     // maximal length of the `Vary` header
+
+typedef struct _cache_entry_t {
+  struct _cache_entry_t* next;        // next in the bucket
+  struct _cache_entry_t* newer;       // towards the most recently used
+  struct _cache_entry_t* older;       // towards the least recently used
+  uint32_t      hash;
+  char*         key;                  // "METHOD host url"
+  char*         vary;                 // lower-case header names from `Vary`, or NULL
+  char*         vary_values;          // the request values of the `vary` headers, each zero terminated
+  http_status_t status;
+  uv_buf_t      data;                 // status line, header lines, and body
+  size_t        lines_ofs;
+  size_t        body_ofs;
+  uint64_t      created;              // in milli seconds
+  uint64_t      expires;
+  size_t        size;                 // total size accounted in the cache
+  size_t        refs;                 // pinned while being sent
+  bool          removed;
+} cache_entry_t;
+
+struct _nodec_http_cache_t {
+  cache_entry_t**  buckets;
+  size_t           bucket_count;      // always a power of 2
+  cache_entry_t*   newest;
+  cache_entry_t*   oldest;
+  size_t           max_bytes;
+  uint64_t         default_max_age;   // in seconds
+  nodec_http_cache_stats_t stats;
+};
+
+static uint32_t cache_hash(const char* s) {
+  uint32_t h = 2166136261U;  // FNV-1a
+  for (; *s != 0; s++) {
+    h ^= (uint8_t)(*s);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static void cache_entry_free(cache_entry_t* e) {
+  nodec_free(e->key);
+  nodec_free(e->vary);
+  nodec_free(e->vary_values);
+  nodec_buf_free(e->data);
+  nodec_free(e);
+}
+
+static void cache_entry_freev(lh_value ev) {
+  cache_entry_free((cache_entry_t*)lh_ptr_value(ev));
+}
+
+static void cache_entry_unpin(lh_value ev) {
+  cache_entry_t* e = (cache_entry_t*)lh_ptr_value(ev);
+  assert(e->refs > 0);
+  e->refs--;
+  if (e->refs == 0 && e->removed) cache_entry_free(e);
+}
+
+static void cache_remove(nodec_http_cache_t* cache, cache_entry_t* e) {
+  // unlink from the bucket
+  cache_entry_t** p = &cache->buckets[e->hash & (cache->bucket_count - 1)];
+  while (*p != e) {
+    assert(*p != NULL);
+    p = &(*p)->next;
+  }
+  *p = e->next;
+  // unlink from the use list
+  if (e->newer != NULL) e->newer->older = e->older; else cache->newest = e->older;
+  if (e->older != NULL) e->older->newer = e->newer; else cache->oldest = e->newer;
+  cache->stats.entries--;
+  cache->stats.bytes -= e->size;
+  e->removed = true;
+  if (e->refs == 0) cache_entry_free(e);
+}
+
+static void cache_touch(nodec_http_cache_t* cache, cache_entry_t* e) {
+  if (cache->newest == e) return;
+  // unlink
+  e->newer->older = e->older;
+  if (e->older != NULL) e->older->newer = e->newer; else cache->oldest = e->newer;
+  // and insert as the newest
+  e->older = cache->newest;
+  e->newer = NULL;
+  cache->newest->newer = e;
+  cache->newest = e;
+}
+
+static void cache_grow(nodec_http_cache_t* cache) {
+  size_t count = 2 * cache->bucket_count;
+  cache_entry_t** buckets = nodec_zero_alloc_n(count, cache_entry_t*);
+  for (size_t i = 0; i < cache->bucket_count; i++) {
+    cache_entry_t* e = cache->buckets[i];
+    while (e != NULL) {
+      cache_entry_t* next = e->next;
+      cache_entry_t** b = &buckets[e->hash & (count - 1)];
+      e->next = *b;
+      *b = e;
+      e = next;
+    }
+  }
+  nodec_free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_count = count;
+}
+
+static void cache_insert(nodec_http_cache_t* cache, cache_entry_t* e) {
+  if (cache->stats.entries >= cache->bucket_count) cache_grow(cache);
+  cache_entry_t** b = &cache->buckets[e->hash & (cache->bucket_count - 1)];
+  e->next = *b;
+  *b = e;
+  e->older = cache->newest;
+  e->newer = NULL;
+  if (cache->newest != NULL) cache->newest->newer = e; else cache->oldest = e;
+  cache->newest = e;
+  cache->stats.entries++;
+  cache->stats.bytes += e->size;
+  // evict the least recently used entries to stay within budget
+  while (cache->stats.bytes > cache->max_bytes && cache->oldest != e) {
+    cache_remove(cache, cache->oldest);
+    cache->stats.evictions++;
+  }
+}
+
+nodec_http_cache_t* nodec_http_cache_alloc(size_t max_bytes, uint64_t default_max_age) {
+  nodec_http_cache_t* cache = nodec_zero_alloc(nodec_http_cache_t);
+  cache->bucket_count = CACHE_MIN_BUCKETS;
+  cache->buckets = nodec_zero_alloc_n(cache->bucket_count, cache_entry_t*);
+  cache->max_bytes = max_bytes;
+  cache->default_max_age = default_max_age;
+  return cache;
+}
+
+void nodec_http_cache_clear(nodec_http_cache_t* cache) {
+  while (cache->oldest != NULL) {
+    cache_remove(cache, cache->oldest);
+  }
+}
+
+void nodec_http_cache_free(nodec_http_cache_t* cache) {
+  if (cache == NULL) return;
+  nodec_http_cache_clear(cache);
+  nodec_free(cache->buckets);
+  nodec_free(cache);
+}
+
+void nodec_http_cache_freev(lh_value cachev) {
+  nodec_http_cache_free((nodec_http_cache_t*)lh_ptr_value(cachev));
+}
+
+void nodec_http_cache_stats(nodec_http_cache_t* cache, nodec_http_cache_stats_t* stats) {
+  *stats = cache->stats;
+}
+
+
+/*-----------------------------------------------------------------
+  Lookup
+-----------------------------------------------------------------*/
+
+// Call `fun` for each header name in a `Vary` value with the
+// request value of that header; stops early if `fun` returns false.
+typedef bool (cache_varyfun)(const char* value, void* arg);
+
+static bool cache_vary_foreach(const char* vary, cache_varyfun* fun, void* arg) {
+  const char* iter = NULL;
+  const char* name;
+  size_t len;
+  while ((name = http_header_next_field(vary, &len, &iter)) != NULL) {
+    char hname[CACHE_VARY_MAX];
+    if (len >= CACHE_VARY_MAX) return false;
+    memcpy(hname, name, len);
+    hname[len] = 0;
+    const char* value = http_req_header(hname);
+    if (!fun(value == NULL ? "" : value, arg)) return false;
+  }
+  return true;
+}
+
+static bool cache_vary_match_value(const char* value, void* arg) {
+  const char** expected = (const char**)arg;
+  if (strcmp(value, *expected) != 0) return false;
+  *expected += strlen(*expected) + 1;
+  return true;
+}
+
+// Does the current request have the same values for the headers in `Vary`?
+static bool cache_vary_match(const cache_entry_t* e) {
+  if (e->vary == NULL) return true;
+  const char* expected = e->vary_values;
+  return cache_vary_foreach(e->vary, &cache_vary_match_value, (void*)&expected);
+}
+
+static cache_entry_t* cache_lookup(nodec_http_cache_t* cache, const char* key, uint32_t hash) {
+  for (cache_entry_t* e = cache->buckets[hash & (cache->bucket_count - 1)]; e != NULL; e = e->next) {
+    if (e->hash == hash && strcmp(e->key, key) == 0 && cache_vary_match(e)) return e;
+  }
+  return NULL;
+}
+
+static void cache_send(cache_entry_t* e, http_method_t method) {
+  uint64_t age = (uv_now(async_loop()) - e->created) / 1000;
+  uv_buf_t body = (method == HTTP_HEAD ? nodec_buf_null() : nodec_buf(e->data.base + e->body_ofs, e->data.len - e->body_ofs));
+  e->refs++;
+  {defer(cache_entry_unpin, lh_value_ptr(e)) {
+    http_out_send_cached(http_resp(), e->status,
+      nodec_buf(e->data.base, e->lines_ofs),
+      nodec_buf(e->data.base + e->lines_ofs, e->body_ofs - e->lines_ofs),
+      age, body);
+  }}
+}
+
+
+/*-----------------------------------------------------------------
+  Store
+-----------------------------------------------------------------*/
+
+static bool cache_status_ok(http_status_t status) {
+  switch (status) {
+  case HTTP_STATUS_OK:
+  case HTTP_STATUS_NON_AUTHORITATIVE_INFORMATION:
+  case HTTP_STATUS_NO_CONTENT:
+  case HTTP_STATUS_MULTIPLE_CHOICES:
+  case HTTP_STATUS_MOVED_PERMANENTLY:
+  case HTTP_STATUS_NOT_FOUND:
+  case HTTP_STATUS_METHOD_NOT_ALLOWED:
+  case HTTP_STATUS_GONE:
+  case HTTP_STATUS_URI_TOO_LONG:
+  case HTTP_STATUS_NOT_IMPLEMENTED:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool cache_field_is(const char* field, size_t len, const char* name) {
+  size_t n = strlen(name);
+  return (len == n && nodec_strnicmp(field, name, n) == 0);
+}
+
+// Iterate through header lines `Name: value\r\n`
+static bool cache_next_line(const char** p, const char* end, const char** name, size_t* name_len, const char** value, size_t* value_len) {
+  const char* s = *p;
+  if (s >= end) return false;
+  const char* eol = s;
+  while (eol < end && *eol != '\n') eol++;
+  *p = (eol < end ? eol + 1 : end);
+  const char* colon = s;
+  while (colon < eol && *colon != ':') colon++;
+  *name = s;
+  *name_len = colon - s;
+  const char* v = (colon < eol ? colon + 1 : eol);
+  while (v < eol && *v == ' ') v++;
+  const char* vend = eol;
+  if (vend > v && vend[-1] == '\r') vend--;
+  *value = v;
+  *value_len = vend - v;
+  return true;
+}
+
+static bool cache_vary_append_value(const char* value, void* arg) {
+  uv_buf_t* buf = (uv_buf_t*)arg;
+  size_t n = strlen(value) + 1;
+  size_t len = (buf->base == NULL ? 0 : buf->len);
+  *buf = nodec_buf_ensure(*buf, len + n);
+  memcpy(buf->base + len, value, n);
+  buf->len = len + n;
+  return true;
+}
+
+static void cache_store(nodec_http_cache_t* cache, const char* key, uint32_t hash, http_method_t method, http_capture_t* cap) {
+  if (!cap->sent || cap->overflow || !cache_status_ok(cap->status)) return;
+
+  // scan the response headers
+  const char* head = cap->head.base;
+  const char* head_end = (head == NULL ? NULL : head + cap->head.len);
+  uint64_t max_age = cache->default_max_age;
+  bool     has_smax_age = false;
+  bool     shared = false;        // explicitly allowed in a shared cache
+  bool     chunked = false;
+  int64_t  content_length = -1;
+  char     vary[CACHE_VARY_MAX];
+  size_t   vary_len = 0;
+  const char* p = head;
+  const char* name;
+  const char* value;
+  size_t name_len;
+  size_t value_len;
+  while (cache_next_line(&p, head_end, &name, &name_len, &value, &value_len)) {
+    if (cache_field_is(name, name_len, "Cache-Control")) {
+      char cc[CACHE_VARY_MAX];
+      if (value_len >= CACHE_VARY_MAX) return;
+      memcpy(cc, value, value_len);
+      cc[value_len] = 0;
+      const char* iter = NULL;
+      const char* field;
+      size_t len;
+      while ((field = http_header_next_field(cc, &len, &iter)) != NULL) {
+        if (cache_field_is(field, len, "no-store") || cache_field_is(field, len, "no-cache") || cache_field_is(field, len, "private")) return;
+        if (cache_field_is(field, len, "public") || cache_field_is(field, len, "must-revalidate")) {
+          shared = true;
+        }
+        else if (len > 9 && nodec_strnicmp(field, "s-maxage=", 9) == 0) {
+          max_age = strtoull(field + 9, NULL, 10);
+          has_smax_age = true;
+          shared = true;
+        }
+        else if (len > 8 && nodec_strnicmp(field, "max-age=", 8) == 0 && !has_smax_age) {
+          max_age = strtoull(field + 8, NULL, 10);
+        }
+      }
+    }
+    else if (cache_field_is(name, name_len, "Set-Cookie")) {
+      return;
+    }
+    else if (cache_field_is(name, name_len, "Vary")) {
+      if (memchr(value, '*', value_len) != NULL) return;
+      if (vary_len + value_len + 2 >= CACHE_VARY_MAX) return;
+      if (vary_len > 0) vary[vary_len++] = ',';
+      for (size_t i = 0; i < value_len; i++) vary[vary_len++] = (char)tolower((uint8_t)value[i]);
+      vary[vary_len] = 0;
+    }
+    else if (cache_field_is(name, name_len, "Transfer-Encoding")) {
+      chunked = true;
+    }
+    else if (cache_field_is(name, name_len, "Content-Length")) {
+      content_length = strtoll(value, NULL, 10);
+    }
+  }
+  if (max_age == 0) return;
+  // a response to an authorized request is only shared if it says so (RFC 9111, 3.5)
+  if (!shared && http_req_header("Authorization") != NULL) return;
+  // a response with a content length that was not fully written is not cached
+  if (!chunked && method != HTTP_HEAD && content_length >= 0 && (uint64_t)content_length != cap->body_len) return;
+
+  // serialize: status line, header lines, and the body
+  char status_line[64];
+  size_t status_len = 0;
+  const char* sline = nodec_http_status_line(cap->status, &status_len);
+  if (sline == NULL) {
+    snprintf(status_line, sizeof(status_line), "HTTP/1.1 %i %s\r\n", cap->status, nodec_http_status_str(cap->status));
+    sline = status_line;
+    status_len = strlen(status_line);
+  }
+  char content_length_line[64];
+  content_length_line[0] = 0;
+  if (chunked) snprintf(content_length_line, sizeof(content_length_line), "Content-Length: %zu\r\n", cap->body_len);
+  uv_buf_t data = nodec_buf_alloc(status_len + (head == NULL ? 0 : cap->head.len) + strlen(content_length_line) + cap->body_len);
+  size_t ofs = 0;
+  cache_entry_t* e = NULL;
+  {using_buf_on_abort_free(&data) {
+    memcpy(data.base, sline, status_len);
+    ofs = status_len;
+    p = head;
+    while (cache_next_line(&p, head_end, &name, &name_len, &value, &value_len)) {
+      // the transfer encoding is replaced by a content length, and connection headers are per connection
+      if (cache_field_is(name, name_len, "Transfer-Encoding") || cache_field_is(name, name_len, "Connection") || cache_field_is(name, name_len, "Keep-Alive")) continue;
+      size_t n = (p - name);
+      memcpy(data.base + ofs, name, n);
+      ofs += n;
+    }
+    size_t n = strlen(content_length_line);
+    memcpy(data.base + ofs, content_length_line, n);
+    ofs += n;
+    size_t body_ofs = ofs;
+    if (cap->body_len > 0) memcpy(data.base + ofs, cap->body.base, cap->body_len);
+    data.len = ofs + cap->body_len;
+
+    e = nodec_zero_alloc(cache_entry_t);
+    e->data = data;
+    data = nodec_buf_null();
+    {on_abort(cache_entry_freev, lh_value_ptr(e)) {
+      e->hash = hash;
+      e->key = nodec_strdup(key);
+      e->status = cap->status;
+      e->lines_ofs = status_len;
+      e->body_ofs = body_ofs;
+      e->created = uv_now(async_loop());
+      e->expires = e->created + 1000 * max_age;
+      size_t vary_values_len = 0;
+      if (vary_len > 0) {
+        e->vary = nodec_strdup(vary);
+        uv_buf_t values = nodec_buf_null();
+        cache_vary_foreach(e->vary, &cache_vary_append_value, &values);
+        e->vary_values = values.base;
+        vary_values_len = values.len;
+      }
+      e->size = sizeof(cache_entry_t) + e->data.len + strlen(e->key) + 1 + (vary_len > 0 ? vary_len + 1 : 0) + vary_values_len;
+    }}
+  }}
+  if (e->size > cache->max_bytes / 4) {
+    cache_entry_free(e);
+    return;
+  }
+  // replace an existing entry for the same request
+  cache_entry_t* old = cache_lookup(cache, key, hash);
+  if (old != NULL) cache_remove(cache, old);
+  cache_insert(cache, e);
+  cache->stats.stores++;
+}
+
+
+/*-----------------------------------------------------------------
+  Serve
+-----------------------------------------------------------------*/
+
+static bool cache_req_has(const char* header, const char* directive) {
+  const char* value = http_req_header(header);
+  if (value == NULL) return false;
+  const char* iter = NULL;
+  const char* field;
+  size_t len;
+  while ((field = http_header_next_field(value, &len, &iter)) != NULL) {
+    if (cache_field_is(field, len, directive)) return true;
+  }
+  return false;
+}
+
+void http_cache_serve(nodec_http_cache_t* cache, nodec_http_servefun* servefun) {
+  http_method_t method = http_req_method();
+  if ((method != HTTP_GET && method != HTTP_HEAD) || cache_req_has("Cache-Control", "no-store")) {
+    servefun();
+    return;
+  }
+  // the host is part of the key as one server can serve several hosts;
+  // an absolute URL already includes the scheme and host
+  const char* url = http_req_url();
+  const char* host = (url[0] == '/' ? http_req_header("Host") : NULL);
+  if (host == NULL) host = "";
+  const char* mstr = nodec_http_method_str(method);
+  size_t key_len = strlen(mstr) + 1 + strlen(host) + 1 + strlen(url);
+  char* key = (char*)http_req_alloc(key_len + 1);
+  snprintf(key, key_len + 1, "%s %s %s", mstr, host, url);
+  uint32_t hash = cache_hash(key);
+
+  // lookup
+  if (!cache_req_has("Cache-Control", "no-cache") && !cache_req_has("Pragma", "no-cache")) {
+    cache_entry_t* e = cache_lookup(cache, key, hash);
+    if (e != NULL && uv_now(async_loop()) >= e->expires) {
+      cache_remove(cache, e);
+      e = NULL;
+    }
+    if (e != NULL) {
+      cache->stats.hits++;
+      cache_touch(cache, e);
+      cache_send(e, method);
+      return;
+    }
+  }
+
+  // miss: serve and capture the response
+  cache->stats.misses++;
+  http_capture_t capture;
+  memset(&capture, 0, sizeof(capture));
+  capture.max_len = cache->max_bytes / 4;
+  {defer(http_capture_clearv, lh_value_any_ptr(&capture)) {
+    http_out_capture(http_resp(), &capture);
+    servefun();
+    http_out_capture(http_resp(), NULL);
+    cache_store(cache, key, hash, method, &capture);
+  }}
+}
@@ -0,0 +1,341 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+
+/*-----------------------------------------------------------------
+  Streaming multipart/form-data (RFC 7578, RFC 2046)
+  Each part is preceded by a delimiter `\r\n--boundary`. The body
+  of a part is a stream that reads from the request body up to the
+  next delimiter. Delimiters are found with a Boyer-Moore-Horspool
+  search within a buffer; a tail of a buffer that could start a
+  delimiter is held back and joined with the next buffer, so a
+  delimiter split over two reads is found too. Memory is bounded
+  by the buffer size of the request body stream.
+-----------------------------------------------------------------*/
+
+#define MP_BOUNDARY_MAX  (70)                   // maximal boundary length (RFC 2046)
+#define MP_DELIM_MAX     (4 + MP_BOUNDARY_MAX)  // `\r\n--` + boundary
+#define MP_HEADERS_MAX   (16)                   // maximal number of part headers
+#define MP_HEADER_SIZE   (8*NODEC_KB)           // maximal total size of part headers
+
+struct _http_multipart_t {
+  nodec_bstream_t* source;                // the request body; not owned
+  uint8_t          delim[MP_DELIM_MAX];   // `\r\n--boundary`
+  size_t           delim_len;
+  size_t           skip[256];             // Horspool shift table
+  uint8_t          held[MP_DELIM_MAX];    // tail of the last read that might start a delimiter
+  size_t           held_len;
+  bool             part_done;             // found the delimiter at the end of the current part
+  bool             done;                  // found the final delimiter
+  nodec_bstream_t* part;                  // body stream of the current part
+  char*            lines[MP_HEADERS_MAX]; // header lines of the current part (split in place)
+  const char*      names[MP_HEADERS_MAX];
+  const char*      values[MP_HEADERS_MAX];
+  size_t           header_count;
+  char*            name;                  // `name` parameter of the `Content-Disposition`
+  char*            filename;              // `filename` parameter of the `Content-Disposition`
+};
+
+
+/*-----------------------------------------------------------------
+  Finding delimiters
+-----------------------------------------------------------------*/
+
+static void mp_delim_init(http_multipart_t* mp, const char* boundary, size_t len) {
+  memcpy(mp->delim, "\r\n--", 4);
+  memcpy(mp->delim + 4, boundary, len);
+  size_t m = mp->delim_len = 4 + len;
+  for (size_t c = 0; c < 256; c++) mp->skip[c] = m;
+  for (size_t j = 0; j < m - 1; j++) mp->skip[mp->delim[j]] = m - 1 - j;
+}
+
+// Return the offset of the first delimiter in `s`, or `SIZE_MAX` if not found.
+static size_t mp_find(const http_multipart_t* mp, const uint8_t* s, size_t n) {
+  const size_t m = mp->delim_len;
+  const uint8_t* d = mp->delim;
+  size_t i = 0;
+  while (i + m <= n) {
+    uint8_t c = s[i + m - 1];
+    if (c == d[m - 1] && memcmp(s + i, d, m - 1) == 0) return i;
+    i += mp->skip[c];
+  }
+  return SIZE_MAX;
+}
+
+// Return the length of the longest tail of `s` that is a proper prefix of the delimiter.
+static size_t mp_partial(const http_multipart_t* mp, const uint8_t* s, size_t n) {
+  size_t k = (n < mp->delim_len - 1 ? n : mp->delim_len - 1);
+  for (; k > 0; k--) {
+    if (s[n - k] == '\r' && memcmp(s + n - k, mp->delim, k) == 0) return k;
+  }
+  return 0;
+}
+
+
+/*-----------------------------------------------------------------
+  Part body streams
+-----------------------------------------------------------------*/
+
+typedef struct _mp_stream_t {
+  nodec_stream_t     stream;
+  http_multipart_t*  mp;
+  uv_buf_t           current;   // last read buffer if we own it but the reader does not
+} mp_stream_t;
+
+static uv_buf_t async_mp_stream_read_bufx(nodec_stream_t* stream, bool* owned) {
+  mp_stream_t* ps = (mp_stream_t*)stream;
+  http_multipart_t* mp = ps->mp;
+  nodec_bufref_free(&ps->current);
+  if (owned != NULL) *owned = false;
+  while (!mp->part_done) {
+    bool src_owned = false;
+    uv_buf_t buf = async_read_bufx(as_stream(mp->source), &src_owned);
+    if (nodec_buf_is_null(buf)) {
+      throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "multipart body ended before the final boundary");
+    }
+    if (mp->held_len > 0) {
+      // join with the held back tail
+      uv_buf_t joined = nodec_buf_alloc(mp->held_len + buf.len);
+      memcpy(joined.base, mp->held, mp->held_len);
+      memcpy(joined.base + mp->held_len, buf.base, buf.len);
+      if (src_owned) nodec_buf_free(buf);
+      buf = joined;
+      src_owned = true;
+      mp->held_len = 0;
+    }
+    size_t idx = mp_find(mp, (const uint8_t*)buf.base, buf.len);
+    if (idx != SIZE_MAX) {
+      // end of the part: push back what follows the delimiter
+      size_t next = idx + mp->delim_len;
+      if (next < buf.len) {
+        uv_buf_t rest = nodec_buf_alloc(buf.len - next);
+        memcpy(rest.base, buf.base + next, rest.len);
+        nodec_pushback_buf(mp->source, rest);
+      }
+      mp->part_done = true;
+      buf.len = (uv_buf_len_t)idx;
+    }
+    else {
+      // hold back a tail that may be the start of a delimiter
+      size_t k = mp_partial(mp, (const uint8_t*)buf.base, buf.len);
+      memcpy(mp->held, buf.base + buf.len - k, k);
+      mp->held_len = k;
+      buf.len -= (uv_buf_len_t)k;
+    }
+    if (buf.len == 0) {
+      if (src_owned) nodec_buf_free(buf);
+      continue;
+    }
+    if (owned != NULL) *owned = src_owned;
+    else if (src_owned) ps->current = buf;
+    return buf;
+  }
+  return nodec_buf_null();
+}
+
+static void async_mp_stream_free(nodec_stream_t* stream) {
+  mp_stream_t* ps = (mp_stream_t*)stream;
+  nodec_bufref_free(&ps->current);
+  nodec_free(ps);
+}
+
+static nodec_bstream_t* mp_part_alloc(http_multipart_t* mp) {
+  mp_stream_t* ps = nodec_zero_alloc(mp_stream_t);
+  nodec_stream_init(&ps->stream, &async_mp_stream_read_bufx, NULL, NULL, &async_mp_stream_free);
+  ps->mp = mp;
+  mp->part_done = false;
+  return nodec_bstream_alloc_on(&ps->stream);
+}
+
+
+/*-----------------------------------------------------------------
+  Part headers
+-----------------------------------------------------------------*/
+
+// Return the value of parameter `key` in a header value like `form-data; name="a"`,
+// with quotes and escapes removed. The result should be freed by the caller.
+static char* mp_header_param(const char* value, const char* key) {
+  if (value == NULL) return NULL;
+  size_t klen = strlen(key);
+  const char* p = strchr(value, ';');
+  while (p != NULL) {
+    p++;
+    while (*p == ' ' || *p == '\t') p++;
+    if (nodec_strnicmp(p, key, klen) == 0 && p[klen] == '=') {
+      p += klen + 1;
+      if (*p != '"') return nodec_strndup(p, strcspn(p, "; \t"));
+      char* s = nodec_alloc_n(strlen(p) + 1, char);
+      size_t n = 0;
+      for (p++; *p != 0 && *p != '"'; p++) {
+        if (*p == '\\' && p[1] != 0) p++;
+        s[n++] = *p;
+      }
+      s[n] = 0;
+      return s;
+    }
+    // skip to the next parameter
+    bool quoted = false;
+    while (*p != 0 && (quoted || *p != ';')) {
+      if (*p == '"') quoted = !quoted;
+      else if (*p == '\\' && quoted && p[1] != 0) p++;
+      p++;
+    }
+    if (*p != ';') p = NULL;
+  }
+  return NULL;
+}
+
+static void mp_part_clear(http_multipart_t* mp) {
+  if (mp->part != NULL) {
+    nodec_stream_free(as_stream(mp->part));
+    mp->part = NULL;
+  }
+  for (size_t i = 0; i < mp->header_count; i++) nodec_free(mp->lines[i]);
+  mp->header_count = 0;
+  nodec_free(mp->name); mp->name = NULL;
+  nodec_free(mp->filename); mp->filename = NULL;
+}
+
+// Split a header line in place into a trimmed name and value.
+static void mp_header_add(http_multipart_t* mp, char* line) {
+  size_t i = mp->header_count;
+  mp->lines[i] = line;
+  mp->header_count++;
+  char* colon = strchr(line, ':');
+  if (colon == NULL) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "invalid multipart header");
+  char* end = colon;
+  while (end > line && (end[-1] == ' ' || end[-1] == '\t')) end--;
+  *end = 0;
+  char* value = colon + 1;
+  while (*value == ' ' || *value == '\t') value++;
+  end = value + strlen(value);
+  while (end > value && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t')) end--;
+  *end = 0;
+  mp->names[i] = line;
+  mp->values[i] = value;
+}
+
+static void async_mp_read_headers(http_multipart_t* mp) {
+  size_t total = 0;
+  while (true) {
+    uv_buf_t line = async_read_buf_upto(mp->source, "\n", 1, MP_HEADER_SIZE - total);
+    if (nodec_buf_is_null(line)) {
+      throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "multipart body ended in the part headers");
+    }
+    total += line.len;
+    if (line.len == 0 || line.base[line.len - 1] != '\n' || total >= MP_HEADER_SIZE) {
+      nodec_buf_free(line);
+      throw_http_err(HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+    }
+    if (line.len == 1 || (line.len == 2 && line.base[0] == '\r')) {
+      nodec_buf_free(line);  // empty line ends the headers
+      return;
+    }
+    if (mp->header_count >= MP_HEADERS_MAX) {
+      nodec_buf_free(line);
+      throw_http_err(HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+    }
+    mp_header_add(mp, line.base);
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Parts
+-----------------------------------------------------------------*/
+
+http_multipart_t* http_multipart_alloc(nodec_bstream_t* body, const char* content_type) {
+  if (content_type == NULL || nodec_strnicmp(content_type, "multipart/", 10) != 0) {
+    throw_http_err(HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE);
+  }
+  char* boundary = mp_header_param(content_type, "boundary");
+  if (boundary == NULL) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "multipart content type without a boundary");
+  size_t len = strlen(boundary);
+  if (len == 0 || len > MP_BOUNDARY_MAX) {
+    nodec_free(boundary);
+    throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "invalid multipart boundary");
+  }
+  http_multipart_t* mp = nodec_zero_alloc(http_multipart_t);
+  mp->source = body;
+  mp_delim_init(mp, boundary, len);
+  nodec_free(boundary);
+  // the first delimiter has no preceding line break
+  memcpy(mp->held, "\r\n", 2);
+  mp->held_len = 2;
+  mp->done = (body == NULL);
+  return mp;
+}
+
+void http_multipart_free(http_multipart_t* mp) {
+  if (mp == NULL) return;
+  mp_part_clear(mp);
+  nodec_free(mp);
+}
+
+void http_multipart_freev(lh_value mpv) {
+  http_multipart_free((http_multipart_t*)lh_ptr_value(mpv));
+}
+
+bool async_http_multipart_next(http_multipart_t* mp) {
+  if (mp->done) return false;
+  // skip the rest of the current part, or the preamble before the first part
+  if (mp->part == NULL) mp->part = mp_part_alloc(mp);
+  bool owned = false;
+  uv_buf_t buf;
+  while (!nodec_buf_is_null(buf = async_read_bufx(as_stream(mp->part), &owned))) {
+    if (owned) nodec_buf_free(buf);
+  }
+  mp_part_clear(mp);
+  // the rest of the delimiter line: `--` for the final delimiter, or white space
+  uv_buf_t line = async_read_buf_upto(mp->source, "\n", 1, 1024);
+  if (nodec_buf_is_null(line)) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "multipart body ended after a boundary");
+  bool final = (line.len >= 2 && line.base[0] == '-' && line.base[1] == '-');
+  bool valid = (line.base[line.len - 1] == '\n');
+  nodec_buf_free(line);
+  if (final) {
+    mp->done = true;
+    return false;
+  }
+  if (!valid) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "invalid multipart boundary line");
+  async_mp_read_headers(mp);
+  const char* disposition = http_multipart_header(mp, "Content-Disposition");
+  mp->name = mp_header_param(disposition, "name");
+  mp->filename = mp_header_param(disposition, "filename");
+  mp->part = mp_part_alloc(mp);
+  return true;
+}
+
+const char* http_multipart_header(http_multipart_t* mp, const char* name) {
+  for (size_t i = 0; i < mp->header_count; i++) {
+    if (nodec_stricmp(mp->names[i], name) == 0) return mp->values[i];
+  }
+  return NULL;
+}
+
+const char* http_multipart_name(http_multipart_t* mp) {
+  return mp->name;
+}
+
+const char* http_multipart_filename(http_multipart_t* mp) {
+  return mp->filename;
+}
+
+const char* http_multipart_content_type(http_multipart_t* mp) {
+  const char* content_type = http_multipart_header(mp, "Content-Type");
+  return (content_type != NULL ? content_type : "text/plain");
+}
+
+nodec_bstream_t* http_multipart_body(http_multipart_t* mp) {
+  return (mp->done ? NULL : mp->part);
+}
+
+http_multipart_t* http_req_multipart() {
+  return http_multipart_alloc(http_req_body(), http_req_header("Content-Type"));
+}
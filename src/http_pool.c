@@ -0,0 +1,227 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2018, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+
+/*-----------------------------------------------------------------
+  Client connection pool
+  Idle client connections are kept per event loop, keyed by
+  (schema, host, port, ssl config), so repeated requests to the
+  same host avoid the DNS lookup, TCP connect, and TLS handshake.
+-----------------------------------------------------------------*/
+
+typedef struct _pool_conn_t {
+  struct _pool_conn_t* next;
+  nodec_bstream_t*  tcp;          // the underlying TCP stream
+  nodec_bstream_t*  conn;         // the connection stream; either `tcp` or a TLS stream over it
+  uint64_t          idle_since;   // loop time when the connection became idle
+} pool_conn_t;
+
+typedef struct _pool_host_t {
+  struct _pool_host_t* next;
+  char*             key;          // "schema://host:port"
+  const nodec_ssl_config_t* ssl_config;
+  pool_conn_t*      idle;         // idle connections; most recently used first
+  size_t            idle_count;
+} pool_host_t;
+
+typedef struct _http_pool_t {
+  pool_host_t*      hosts;
+  size_t            max_idle_per_host;
+  uint64_t          idle_timeout;
+  uv_timer_t*       reaper;       // periodically closes connections that were idle too long
+  http_pool_stats_t stats;
+} http_pool_t;
+
+implicit_define(http_pool)
+
+static http_pool_t* http_pool_get() {
+  return (http_pool_t*)lh_ptr_value(implicit_get(http_pool));
+}
+
+static void pool_conn_free(pool_conn_t* c) {
+  if (c->conn != NULL && c->conn != c->tcp) nodec_stream_free(as_stream(c->conn));
+  if (c->tcp != NULL) nodec_stream_free(as_stream(c->tcp));
+  nodec_free(c);
+}
+
+static void pool_conn_freev(lh_value cv) {
+  pool_conn_free((pool_conn_t*)lh_ptr_value(cv));
+}
+
+// Close an idle connection without effect operations as the reaper runs in a libuv callback
+static void pool_conn_close(pool_conn_t* c) {
+  if (c->conn != NULL && c->conn != c->tcp) nodec_stream_free(as_stream(c->conn)); // tls: just frees its state
+  if (c->tcp != NULL) nodec_uv_stream_close((nodec_uv_stream_t*)c->tcp);
+  nodec_free(c);
+}
+
+// Close all idle connections of a host that are idle since before `before` (or all if `before==0`)
+static void pool_host_reap(http_pool_t* pool, pool_host_t* host, uint64_t before) {
+  pool_conn_t** pc = &host->idle;
+  while (*pc != NULL) {
+    pool_conn_t* c = *pc;
+    if (before == 0 || c->idle_since < before) {
+      *pc = c->next;
+      host->idle_count--;
+      pool->stats.expired++;
+      pool_conn_close(c);
+    }
+    else {
+      pc = &c->next;
+    }
+  }
+}
+
+static void _reaper_cb(uv_timer_t* timer) {
+  http_pool_t* pool = (http_pool_t*)timer->data;
+  uint64_t now = uv_now(timer->loop);
+  if (now < pool->idle_timeout) return;
+  for (pool_host_t* host = pool->hosts; host != NULL; host = host->next) {
+    pool_host_reap(pool, host, now - pool->idle_timeout);
+  }
+}
+
+static void pool_reaper_start(http_pool_t* pool) {
+  if (pool->reaper != NULL || pool->idle_timeout == 0) return;
+  uint64_t interval = (pool->idle_timeout < 2000 ? 1000 : pool->idle_timeout / 2);
+  pool->reaper = nodec_timer_alloc();
+  pool->reaper->data = pool;
+  uv_unref((uv_handle_t*)pool->reaper);  // don't keep the loop alive
+  nodec_check(uv_timer_start(pool->reaper, &_reaper_cb, interval, interval));
+}
+
+lh_value _nodec_http_pool_allocv() {
+  http_pool_t* pool = nodec_zero_alloc(http_pool_t);
+  pool->max_idle_per_host = 8;
+  pool->idle_timeout = 30000;
+  return lh_value_ptr(pool);
+}
+
+void _nodec_http_pool_freev(lh_value poolv) {
+  http_pool_t* pool = (http_pool_t*)lh_ptr_value(poolv);
+  if (pool->reaper != NULL) nodec_timer_free(pool->reaper, false);
+  pool_host_t* host = pool->hosts;
+  while (host != NULL) {
+    pool_host_t* next = host->next;
+    pool_host_reap(pool, host, 0);
+    nodec_free(host->key);
+    nodec_free(host);
+    host = next;
+  }
+  nodec_free(pool);
+}
+
+void nodec_http_pool_set(size_t max_idle_per_host, uint64_t idle_timeout) {
+  http_pool_t* pool = http_pool_get();
+  pool->max_idle_per_host = max_idle_per_host;
+  if (pool->idle_timeout != idle_timeout && pool->reaper != NULL) {
+    nodec_timer_free(pool->reaper, false);
+    pool->reaper = NULL;
+  }
+  pool->idle_timeout = idle_timeout;
+  if (max_idle_per_host == 0) {
+    for (pool_host_t* host = pool->hosts; host != NULL; host = host->next) {
+      pool_host_reap(pool, host, 0);
+    }
+  }
+}
+
+void nodec_http_pool_stats(http_pool_stats_t* stats) {
+  if (stats != NULL) *stats = http_pool_get()->stats;
+}
+
+static pool_host_t* pool_host_get(http_pool_t* pool, const nodec_url_t* url, const nodec_ssl_config_t* ssl_config) {
+  const char* schema = nodec_url_schema(url);
+  const char* port = nodec_url_port_str(url);
+  char key[512];
+  snprintf(key, sizeof(key), "%s://%s:%s", (schema == NULL ? "" : schema), nodec_url_host(url), (port == NULL ? "" : port));
+  for (pool_host_t* host = pool->hosts; host != NULL; host = host->next) {
+    if (host->ssl_config == ssl_config && strcmp(host->key, key) == 0) return host;
+  }
+  pool_host_t* host = nodec_zero_alloc(pool_host_t);
+  host->key = nodec_strdup(key);
+  host->ssl_config = ssl_config;
+  host->next = pool->hosts;
+  pool->hosts = host;
+  return host;
+}
+
+static pool_conn_t* async_pool_checkout(http_pool_t* pool, pool_host_t* host, const char* url) {
+  uint64_t now = uv_now(async_loop());
+  // try to reuse an idle connection
+  while (host->idle != NULL) {
+    pool_conn_t* c = host->idle;
+    host->idle = c->next;
+    host->idle_count--;
+    c->next = NULL;
+    if (pool->idle_timeout > 0 && now - c->idle_since > pool->idle_timeout) {
+      pool->stats.expired++;
+      pool_conn_free(c);
+    }
+    else if (nodecx_uv_stream_check_idle((nodec_uv_stream_t*)c->tcp) != 0) {
+      // closed by the peer (or unexpected data)
+      pool->stats.stale++;
+      pool_conn_free(c);
+    }
+    else {
+      pool->stats.reused++;
+      return c;
+    }
+  }
+  // otherwise create a fresh connection
+  pool_conn_t* c = nodec_zero_alloc(pool_conn_t);
+  {on_abort(pool_conn_freev, lh_value_ptr(c)) {
+    nodec_bstream_t* tcp = async_tcp_connect(url);
+    if (host->ssl_config == NULL) {
+      c->tcp = c->conn = tcp;
+    }
+    else {
+      c->conn = nodec_tls_stream_alloc(tcp, host->ssl_config);  // frees `tcp` on failure
+      c->tcp = tcp;
+    }
+  }}
+  pool->stats.created++;
+  return c;
+}
+
+static void pool_checkin(http_pool_t* pool, pool_host_t* host, pool_conn_t* c) {
+  if (host->idle_count >= pool->max_idle_per_host) {
+    pool->stats.discarded++;
+    pool_conn_free(c);
+  }
+  else {
+    c->idle_since = uv_now(async_loop());
+    c->next = host->idle;
+    host->idle = c;
+    host->idle_count++;
+    pool_reaper_start(pool);
+  }
+}
+
+lh_value async_http_request_pooled(nodec_ssl_config_t* ssl_config, const char* url, http_connect_fun* connectfun, lh_value arg) {
+  lh_value result = lh_value_null;
+  http_pool_t* pool = http_pool_get();
+  nodec_url_t* u = nodec_parse_url(url);
+  {using_url(u) {
+    pool_host_t* host = pool_host_get(pool, u, ssl_config);
+    pool_conn_t* c = async_pool_checkout(pool, host, url);
+    bool reuse = false;
+    {on_abort(pool_conn_freev, lh_value_ptr(c)) {
+      result = async_http_connect_on_ex(nodec_url_host(u), c->conn, connectfun, arg, &reuse);
+    }}
+    if (reuse) {
+      pool_checkin(pool, host, c);
+    }
+    else {
+      pool_conn_free(c);
+    }
+  }}
+  return result;
+}
@@ -21,96 +21,333 @@ found in the file "license.txt" at the root of this distribution.
 #endif
 
 
+/*-----------------------------------------------------------------
+  Request arenas
+  Per-request metadata (headers, joined tokens, out headers, and
+  memory from http_req_alloc) is bump allocated from an arena that
+  is released as a whole when the request is cleared. Standard sized
+  blocks are returned to a per-loop pool so they are reused by the
+  next (keep-alive) request.
+-----------------------------------------------------------------*/
+
+#define HTTP_ARENA_BLOCK      (4*1024)
+#define HTTP_ARENA_POOL_MAX   (64)
+#define HTTP_ARENA_ALIGN      (16)
+
+typedef struct _http_arena_block_t {
+  struct _http_arena_block_t* next;
+  size_t  size;            // usable size
+  size_t  used;
+} http_arena_block_t;
+
+#define HTTP_ARENA_HEADER  ((sizeof(http_arena_block_t) + HTTP_ARENA_ALIGN - 1) & ~((size_t)HTTP_ARENA_ALIGN - 1))
+
+typedef struct _http_arena_t {
+  http_arena_block_t* blocks;   // the current block first
+} http_arena_t;
+
+typedef struct _http_arenas_t {
+  http_arena_block_t* free;     // pooled blocks of HTTP_ARENA_BLOCK size
+  size_t              count;
+} http_arenas_t;
+
+implicit_define(http_arenas)
+
+static http_arenas_t* http_arenas_get() {
+  return (http_arenas_t*)lh_ptr_value(implicit_get(http_arenas));
+}
+
+lh_value _nodec_http_arenas_allocv() {
+  return lh_value_ptr(nodec_zero_alloc(http_arenas_t));
+}
+
+void _nodec_http_arenas_freev(lh_value arenasv) {
+  http_arenas_t* arenas = (http_arenas_t*)lh_ptr_value(arenasv);
+  while (arenas->free != NULL) {
+    http_arena_block_t* block = arenas->free;
+    arenas->free = block->next;
+    nodec_free(block);
+  }
+  nodec_free(arenas);
+}
+
+static void* http_arena_alloc(http_arena_t* arena, size_t size) {
+  size = (size + HTTP_ARENA_ALIGN - 1) & ~((size_t)HTTP_ARENA_ALIGN - 1);
+  http_arena_block_t* block = arena->blocks;
+  if (block == NULL || block->used + size > block->size) {
+    if (size <= HTTP_ARENA_BLOCK - HTTP_ARENA_HEADER) {
+      http_arenas_t* arenas = http_arenas_get();
+      block = arenas->free;
+      if (block != NULL) {
+        arenas->free = block->next;
+        arenas->count--;
+      }
+      else {
+        block = (http_arena_block_t*)nodec_malloc(HTTP_ARENA_BLOCK);
+        block->size = HTTP_ARENA_BLOCK - HTTP_ARENA_HEADER;
+      }
+    }
+    else {
+      // a large allocation gets its own block
+      block = (http_arena_block_t*)nodec_malloc(HTTP_ARENA_HEADER + size);
+      block->size = size;
+    }
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  void* p = (char*)block + HTTP_ARENA_HEADER + block->used;
+  block->used += size;
+  return p;
+}
+
+static char* http_arena_strndup(http_arena_t* arena, const char* s, size_t len) {
+  char* t = (char*)http_arena_alloc(arena, len + 1);
+  memcpy(t, s, len);
+  t[len] = 0;
+  return t;
+}
+
+static char* http_arena_strdup(http_arena_t* arena, const char* s) {
+  return (s == NULL ? NULL : http_arena_strndup(arena, s, strlen(s)));
+}
+
+// Release all memory of an arena at once
+static void http_arena_reset(http_arena_t* arena) {
+  http_arena_block_t* block = arena->blocks;
+  if (block == NULL) return;
+  http_arenas_t* arenas = http_arenas_get();
+  while (block != NULL) {
+    http_arena_block_t* next = block->next;
+    if (block->size == HTTP_ARENA_BLOCK - HTTP_ARENA_HEADER && arenas->count < HTTP_ARENA_POOL_MAX) {
+      block->next = arenas->free;
+      arenas->free = block;
+      arenas->count++;
+    }
+    else {
+      nodec_free(block);
+    }
+    block = next;
+  }
+  arena->blocks = NULL;
+}
+
+
 /*-----------------------------------------------------------------
 HTTP Headers
+  Headers are indexed when they are added: well-known headers get
+  a slot by their `http_header_id_t` and all other headers are
+  chained in a small case-insensitive hash table. Duplicate headers
+  are merged into the first entry (comma separated) when added, so
+  lookups take constant time and never modify the headers.
 -----------------------------------------------------------------*/
 
+typedef enum _http_header_id_t {
+  HTTP_HDR_ACCEPT,
+  HTTP_HDR_ACCEPT_ENCODING,
+  HTTP_HDR_ACCEPT_LANGUAGE,
+  HTTP_HDR_AUTHORIZATION,
+  HTTP_HDR_CACHE_CONTROL,
+  HTTP_HDR_CONNECTION,
+  HTTP_HDR_CONTENT_ENCODING,
+  HTTP_HDR_CONTENT_LENGTH,
+  HTTP_HDR_CONTENT_TYPE,
+  HTTP_HDR_COOKIE,
+  HTTP_HDR_EXPECT,
+  HTTP_HDR_HOST,
+  HTTP_HDR_IF_MODIFIED_SINCE,
+  HTTP_HDR_IF_NONE_MATCH,
+  HTTP_HDR_ORIGIN,
+  HTTP_HDR_RANGE,
+  HTTP_HDR_REFERER,
+  HTTP_HDR_TRANSFER_ENCODING,
+  HTTP_HDR_UPGRADE,
+  HTTP_HDR_USER_AGENT,
+  HTTP_HDR_OTHER          // not a well-known header; also the count of well-known headers
+} http_header_id_t;
+
+typedef struct _http_known_header_t {
+  const char* name;
+  size_t      len;
+} http_known_header_t;
+
+// Names of the well-known headers, in the order of `http_header_id_t`.
+static const http_known_header_t http_known_headers[HTTP_HDR_OTHER] = {
+  { "Accept", 6 },
+  { "Accept-Encoding", 15 },
+  { "Accept-Language", 15 },
+  { "Authorization", 13 },
+  { "Cache-Control", 13 },
+  { "Connection", 10 },
+  { "Content-Encoding", 16 },
+  { "Content-Length", 14 },
+  { "Content-Type", 12 },
+  { "Cookie", 6 },
+  { "Expect", 6 },
+  { "Host", 4 },
+  { "If-Modified-Since", 17 },
+  { "If-None-Match", 13 },
+  { "Origin", 6 },
+  { "Range", 5 },
+  { "Referer", 7 },
+  { "Transfer-Encoding", 17 },
+  { "Upgrade", 7 },
+  { "User-Agent", 10 }
+};
+
+// Classify a header name. The length and first letter select at most one
+// candidate (only `Accept-Encoding` and `Accept-Language` need one more letter), 
+// so each header is compared just once.
+static http_header_id_t http_header_classify(const char* name, size_t len) {
+  if (len < 4 || len > 17) return HTTP_HDR_OTHER;
+  char c = (name[0] | 0x20);  // lower case
+  http_header_id_t id = HTTP_HDR_OTHER;
+  switch (len) {
+    case 4:  if (c == 'h') id = HTTP_HDR_HOST; break;
+    case 5:  if (c == 'r') id = HTTP_HDR_RANGE; break;
+    case 6:  id = (c == 'a' ? HTTP_HDR_ACCEPT : c == 'c' ? HTTP_HDR_COOKIE : 
+                   c == 'e' ? HTTP_HDR_EXPECT : c == 'o' ? HTTP_HDR_ORIGIN : HTTP_HDR_OTHER); break;
+    case 7:  id = (c == 'r' ? HTTP_HDR_REFERER : c == 'u' ? HTTP_HDR_UPGRADE : HTTP_HDR_OTHER); break;
+    case 10: id = (c == 'c' ? HTTP_HDR_CONNECTION : c == 'u' ? HTTP_HDR_USER_AGENT : HTTP_HDR_OTHER); break;
+    case 12: if (c == 'c') id = HTTP_HDR_CONTENT_TYPE; break;
+    case 13: id = (c == 'a' ? HTTP_HDR_AUTHORIZATION : c == 'c' ? HTTP_HDR_CACHE_CONTROL : 
+                   c == 'i' ? HTTP_HDR_IF_NONE_MATCH : HTTP_HDR_OTHER); break;
+    case 14: if (c == 'c') id = HTTP_HDR_CONTENT_LENGTH; break;
+    case 15: if (c == 'a') id = ((name[7] | 0x20) == 'e' ? HTTP_HDR_ACCEPT_ENCODING : HTTP_HDR_ACCEPT_LANGUAGE); break;
+    case 16: if (c == 'c') id = HTTP_HDR_CONTENT_ENCODING; break;
+    case 17: id = (c == 'i' ? HTTP_HDR_IF_MODIFIED_SINCE : c == 't' ? HTTP_HDR_TRANSFER_ENCODING : HTTP_HDR_OTHER); break;
+    default: break;
+  }
+  if (id == HTTP_HDR_OTHER || nodec_stricmp(http_known_headers[id].name, name) != 0) return HTTP_HDR_OTHER;
+  return id;
+}
+
+// Case-insensitive FNV-1a hash of a header name
+static uint32_t http_header_hash(const char* name, size_t len) {
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < len; i++) {
+    char c = name[i];
+    if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    h = (h ^ (uint8_t)c) * 16777619U;
+  }
+  return h;
+}
+
+
+#define HTTP_HEADERS_BUCKETS (32)
+#define HTTP_HEADERS_MAX     (UINT16_MAX - 1)
 
 typedef struct _http_header_t {
   const char* name;
   const char* value;
-  bool _do_free;
+  uint32_t    hash;       // case-insensitive hash of the name (for headers that are not well-known)
+  uint16_t    next;       // next entry in the hash chain (index+1, or 0 at the end)
 } http_header_t;
 
 
 typedef struct _http_headers_t {
+  http_arena_t* arena;   // allocate from here
   size_t  count;         // how many are there
   size_t  size;          // how big is our array
-  http_header_t* elems;  // realloc on demand, start with size 16 and double as more comes  
+  http_header_t* elems;  // grow on demand, start with size 16 and double as more comes  
+  uint16_t known[HTTP_HDR_OTHER];           // entry (index+1) of each well-known header, or 0
+  uint16_t buckets[HTTP_HEADERS_BUCKETS];   // hash chains (index+1) of the other headers
 } http_headers_t;
 
-static void http_headers_add(http_headers_t* headers, const char* name, const char* value, bool strdup) {
-  if (name == NULL) return;
+// Find an entry by well-known header id.
+static http_header_t* http_headers_find_id(http_headers_t* headers, http_header_id_t id) {
+  if (id >= HTTP_HDR_OTHER) return NULL;
+  uint16_t idx = headers->known[id];
+  return (idx == 0 ? NULL : &headers->elems[idx - 1]);
+}
+
+// Find an entry by name; also returns the header id and name hash.
+static http_header_t* http_headers_find(http_headers_t* headers, const char* name, http_header_id_t* id, uint32_t* hash) {
+  size_t len = strlen(name);
+  *id = http_header_classify(name, len);
+  *hash = 0;
+  if (*id != HTTP_HDR_OTHER) return http_headers_find_id(headers, *id);
+  *hash = http_header_hash(name, len);
+  for (uint16_t idx = headers->buckets[*hash % HTTP_HEADERS_BUCKETS]; idx != 0; idx = headers->elems[idx - 1].next) {
+    http_header_t* h = &headers->elems[idx - 1];
+    if (h->hash == *hash && nodec_stricmp(h->name, name) == 0) return h;
+  }
+  return NULL;
+}
+
+// Merge a duplicate header value into an existing entry by appending with a comma
+static void http_header_merge(http_headers_t* headers, http_header_t* h, const char* value) {
+  if (value == NULL || value[0] == 0) return;
+  size_t n = (h->value == NULL ? 0 : strlen(h->value));
+  size_t m = strlen(value);
+  char* newvalue = (char*)http_arena_alloc(headers->arena, n + m + 2);
+  size_t ofs = 0;
+  if (n > 0) {
+    memcpy(newvalue, h->value, n);
+    newvalue[n] = ',';
+    ofs = n + 1;
+  }
+  memcpy(newvalue + ofs, value, m + 1);
+  h->value = newvalue;
+}
+
+// Add a header; returns `false` if there are too many headers.
+static bool http_headers_add(http_headers_t* headers, const char* name, const char* value, bool strdup) {
+  if (name == NULL) return true;
+  if (value == NULL) value = "";
+  http_header_id_t id;
+  uint32_t hash;
+  http_header_t* found = http_headers_find(headers, name, &id, &hash);
+  if (found != NULL) {
+    http_header_merge(headers, found, value);
+    return true;
+  }
+  if (headers->count >= HTTP_HEADERS_MAX) return false;
   if (headers->count >= headers->size) {
     size_t newsize = (headers->size == 0 ? 16 : 2 * headers->size);
-    headers->elems = nodec_realloc_n(headers->elems, newsize, http_header_t);
+    http_header_t* elems = (http_header_t*)http_arena_alloc(headers->arena, newsize * sizeof(http_header_t));
+    if (headers->count > 0) memcpy(elems, headers->elems, headers->count * sizeof(http_header_t));
+    headers->elems = elems;
     headers->size = newsize;
   }
   http_header_t* h = &headers->elems[headers->count];
   headers->count++;
-  h->name = strdup ? nodec_strdup(name) : name;
-  h->value = strdup ? nodec_strdup(value) : value;
-  h->_do_free = strdup;
-}
-
-static void http_header_clear(http_header_t* header) {
-  if (header->_do_free) {
-    if (header->name != NULL) nodec_free(header->name);
-    if (header->value != NULL) nodec_free(header->value);
+  h->name = strdup ? http_arena_strdup(headers->arena, name) : name;
+  h->value = strdup ? http_arena_strdup(headers->arena, value) : value;
+  h->hash = hash;
+  h->next = 0;
+  uint16_t idx = (uint16_t)headers->count;
+  if (id != HTTP_HDR_OTHER) {
+    headers->known[id] = idx;
+  }
+  else {
+    uint16_t* bucket = &headers->buckets[hash % HTTP_HEADERS_BUCKETS];
+    h->next = *bucket;
+    *bucket = idx;
   }
-  memset(header, 0, sizeof(http_header_t));
+  return true;
 }
 
+// Clear the headers; the memory is released with the arena
 static void http_headers_clear(http_headers_t* headers) {
-  for (size_t i = 0; i < headers->count; i++) {
-    http_header_clear(&headers->elems[i]);
-  }
-  if (headers->elems != NULL) nodec_free(headers->elems);
+  http_arena_t* arena = headers->arena;
   memset(headers, 0, sizeof(http_headers_t));
-}
-
-
-// Find a header value and normalize if necessary by appending with commas
-static const char* http_headers_lookup_from(http_headers_t* headers, const char* name, size_t from) {
-  http_header_t* found = NULL;
-  uv_buf_t newvalue = nodec_buf_null();
-  for (size_t i = from; i < headers->count; i++) {
-    http_header_t* h = &headers->elems[i];
-    if (h->name == NULL || h->value == NULL) continue;
-    if (nodec_stricmp(name, h->name) == 0) {
-      if (found == NULL) {
-        // found first entry
-        found = h;
-      }
-      else {
-        // found another entry.. we string append into the first entry and NULL this one out
-        if (h->value != NULL && h->value[0] != 0) {
-          if (nodec_buf_is_null(newvalue)) newvalue = nodec_buf_append_into(newvalue, nodec_buf_str(found->value));
-          newvalue = nodec_buf_append_into(newvalue, nodec_buf_str(","));
-          newvalue = nodec_buf_append_into(newvalue, nodec_buf_str(h->value));
-        }
-        http_header_clear(h);  // clear the current entry
-      }
-    }
-  }
-  if (found == NULL) return NULL;
-  if (!nodec_buf_is_null(newvalue)) {
-    // update our found entry with the new appended value
-    if (found->_do_free) {
-      nodec_free(found->value);
-    }
-    else {
-      found->_do_free = true;
-      found->name = nodec_strdup(found->name);
-    }
-    found->value = newvalue.base;
-  }
-  return found->value;
+  headers->arena = arena;
 }
 
 // Lookup a specific header entry (case insensitive), returning its value or NULL if not found.
 static const char* http_headers_lookup(http_headers_t* headers, const char* name) {
-  return http_headers_lookup_from(headers, name, 0);
+  if (name == NULL) return NULL;
+  http_header_id_t id;
+  uint32_t hash;
+  http_header_t* h = http_headers_find(headers, name, &id, &hash);
+  return (h == NULL ? NULL : h->value);
+}
+
+// Lookup a well-known header, returning its value or NULL if not found.
+static const char* http_headers_lookup_id(http_headers_t* headers, http_header_id_t id) {
+  http_header_t* h = http_headers_find_id(headers, id);
+  return (h == NULL ? NULL : h->value);
 }
 
 // Iterate through all entries. `*iter` should start at 0. Returns NULL if done iterating.
@@ -121,87 +358,149 @@ static const char* http_headers_next(http_headers_t* headers, const char** value
     (*iter)++;
   }
   if (*iter >= headers->count) return NULL;
-  // normalize the entry by lookup itself directly
-  const char* name = headers->elems[*iter].name;
-  const char* _value = http_headers_lookup_from(headers, name, *iter);
-  if (value != NULL) *value = _value;
+  http_header_t* h = &headers->elems[*iter];
+  if (value != NULL) *value = h->value;
   (*iter)++;
-  return name;
+  return h->name;
 }
 
 /*-----------------------------------------------------------------
 Requests
 -----------------------------------------------------------------*/
 
+// A token (url, header field or value) that is being parsed; usually it points
+// directly into a read buffer, but if a token is split over multiple read buffers
+// it is joined into a copy in the request arena.
+typedef struct _http_span_t {
+  const char* at;         // start of the token
+  size_t      len;        // length of the token
+  const char* end;        // end of the buffer that holds the token
+  bool        joined;     // true if `at` is an arena copy (if the token was split or could not be terminated in place)
+} http_span_t;
+
 struct _http_in_t
 {
   nodec_bstream_t* stream; // the input stream
   http_parser      parser; // the request parser on the stream
   http_parser_settings parser_settings;
+  http_arena_t    arena;          // per-request metadata; released at once in `http_in_clear`
 
   bool            is_request;
+  bool            head_request;   // a response to a `HEAD` request (never has a body)
   const char*     url;            // parsed url (for client request)
   http_status_t   status;         // parsed status (for server response)
   const char*     status_info;    // status message
   uint64_t        content_length; // real content length from headers
-  http_headers_t  headers; // parsed headers; usually pointing into `prefix`
-  uv_buf_t        prefix;  // the initially read buffer that holds all initial headers
-  size_t          body_start;     // offset of the body start in the prefix buffer
+  http_headers_t  headers; // parsed headers; usually pointing into the `prefix` buffers
+  uv_buf_t*       prefix;         // the read buffers that hold the initial headers
+  size_t          prefix_count;
+  size_t          prefix_size;
+  const char*     prefix_end;     // end of the buffer that is currently parsed
 
   uv_buf_t        current_body;   // the last parsed body piece; each on_body pauses the parser so only one is needed
-  const char*     current_field;  // during header parsing, holds the last seen header field
+  http_span_t     current_field;  // during header parsing, holds the last seen header field
+  http_span_t     current_value;  // and its value
+  http_span_t     url_span;
+  nodec_url_t*    parsed_url;     // lazily parsed `url` (on the server)
+  http_span_t     status_span;
 
   bool            headers_complete;  // true if all initial headers have been parsed
   bool            complete;          // true if the whole message has been parsed
   size_t          body_len;
 
   nodec_bstream_t* body_stream;
+  bool            continue_pending;  // the client awaits `100 Continue` before sending the body
+  http_out_t*     continue_out;      // the response to send `100 Continue` on (only on a server)
 };
 
-// Terminate header fields and values by modifying the read buffer in place. (in `prefix`)
+// Terminate a body piece by modifying the read buffer in place.
 static void terminate(http_in_t* req, const char* at, size_t len) {
   ((char*)at)[len] = 0;
 }
 
+// Extend a span with a next piece of a token as delivered by the parser.
+// Trailers (after the headers are complete) are parsed from body buffers 
+// that are not kept, so their pieces are always copied.
+static void http_span_add(http_in_t* req, http_span_t* span, const char* at, size_t len) {
+  if (span->at == NULL && !req->headers_complete) {
+    span->at = at;
+    span->len = len;
+    span->end = req->prefix_end;
+  }
+  else if (!span->joined && !req->headers_complete && span->at + span->len == at) {
+    span->len += len;
+    span->end = req->prefix_end;
+  }
+  else {
+    // the token continues in a next read buffer (or is a trailer); join the pieces
+    char* joined = (char*)http_arena_alloc(&req->arena, span->len + len + 1);
+    if (span->len > 0) memcpy(joined, span->at, span->len);
+    memcpy(joined + span->len, at, len);
+    span->len += len;
+    span->joined = true;
+    span->at = joined;
+    span->end = joined + span->len + 1;
+  }
+}
+
+// Zero terminate a span in place (or copy it if there is no room) and return it as a string.
+static const char* http_span_str(http_in_t* req, http_span_t* span) {
+  if (span->at == NULL) return NULL;
+  if (span->at + span->len >= span->end) {
+    // the token ends exactly at the end of a read buffer
+    char* s = http_arena_strndup(&req->arena, span->at, span->len);
+    span->joined = true;
+    span->at = s;
+    span->end = s + span->len + 1;
+  }
+  ((char*)span->at)[span->len] = 0;
+  return span->at;
+}
+
+static void http_span_clear(http_span_t* span) {
+  memset(span, 0, sizeof(http_span_t));
+}
+
+// Add the current header field and value to the headers
+static bool http_in_add_current_header(http_in_t* req) {
+  if (req->current_field.at == NULL) return true;
+  http_span_t* value = &req->current_value;
+  // remove trailing comma and spaces
+  while (value->len > 0 && (value->at[value->len - 1] == ',' || value->at[value->len - 1] == ' ')) value->len--;
+  const char* name = http_span_str(req, &req->current_field);
+  const char* val = (value->at == NULL ? "" : http_span_str(req, value));
+  // no need to copy: trailers are already copied into the arena by `http_span_add`
+  bool ok = http_headers_add(&req->headers, name, val, false);
+  http_span_clear(&req->current_field);
+  http_span_clear(value);
+  return ok;
+}
 
 static int on_header_field(http_parser* parser, const char* at, size_t len) {
   http_in_t* req = (http_in_t*)parser->data;
-  terminate(req, at, len);
-  req->current_field = at;
+  if (req->current_value.at != NULL) {
+    // a new field starts; add the previous header
+    if (!http_in_add_current_header(req)) return 1;  // too many headers
+  }
+  http_span_add(req, &req->current_field, at, len);
   return 0;
 }
 
 static int on_header_value(http_parser* parser, const char* at, size_t len) {
   http_in_t* req = (http_in_t*)parser->data;
-  // remove trailing comma and spaces
-  while (len > 0 && (at[len - 1] == ',' || at[len - 1] == ' ')) len--;
-  terminate(req, at, len);
-  // add to the headers
-  http_headers_add(&req->headers, req->current_field, at, req->headers_complete); // allocate if the headers are complete as the buffer might have changed
-  // treat special headers
-  /*
-  if (_stricmp(req->current_field, "content-length")==0) {
-    long long len = atoll(at);
-    // printf("read content-length: %lli\n", len);
-    if (len > 0 && len <= SIZE_MAX) req->content_length = (uint64_t)len;
-  }
-  */
-  req->current_field = NULL;
+  http_span_add(req, &req->current_value, at, len);
   return 0;
 }
 
 static int on_url(http_parser* parser, const char* at, size_t len) {
   http_in_t* req = (http_in_t*)parser->data;
-  terminate(req, at, len);
-  req->url = at;
+  http_span_add(req, &req->url_span, at, len);
   return 0;
 }
 
 static int on_status(http_parser* parser, const char* at, size_t len) {
   http_in_t* req = (http_in_t*)parser->data;
-  terminate(req, at, len);
-  req->status = parser->status_code;
-  req->status_info = at;
+  http_span_add(req, &req->status_span, at, len);
   return 0;
 }
 
@@ -216,11 +515,15 @@ static int on_body(http_parser* parser, const char* at, size_t len) {
 
 static int on_headers_complete(http_parser* parser) {
   http_in_t* req = (http_in_t*)parser->data;
+  if (!http_in_add_current_header(req)) return -1;  // too many headers
+  req->url = http_span_str(req, &req->url_span);
+  req->status_info = http_span_str(req, &req->status_span);
+  req->status = parser->status_code;
   req->headers_complete = true;
   if ((parser->flags & F_CONTENTLENGTH) == F_CONTENTLENGTH) {
     req->content_length = parser->content_length;
   }
-  //http_parser_pause(parser, 1);             // and pause the parser, returning from execute! (with parser->errno set to HPE_PAUSED)
+  http_parser_pause(parser, 1);             // and pause the parser so we do not parse beyond the headers
   return 0;
 }
 
@@ -236,10 +539,17 @@ void http_in_clear(http_in_t* req) {
   if (req->body_stream != NULL && req->body_stream != req->stream) {
     nodec_stream_free(as_stream(req->body_stream));
   }
-  if (req->prefix.base != NULL) {
-    nodec_buf_free(req->prefix);
+  http_span_clear(&req->current_field);
+  http_span_clear(&req->current_value);
+  http_span_clear(&req->url_span);
+  http_span_clear(&req->status_span);
+  if (req->parsed_url != NULL) nodec_url_free(req->parsed_url);
+  for (size_t i = 0; i < req->prefix_count; i++) {
+    nodec_buf_free(req->prefix[i]);
   }
+  http_arena_reset(&req->arena);
   memset(req, 0, sizeof(http_in_t));
+  req->headers.arena = &req->arena;
   // don't free the stream, it is not owned by us
 }
 
@@ -258,32 +568,34 @@ static enum http_errno check_http_errno(http_parser* parser) {
 void http_in_init(http_in_t* in, nodec_bstream_t* stream, bool is_request)
 {
   memset(in, 0, sizeof(http_in_t));
+  in->headers.arena = &in->arena;
   in->stream = stream;
   in->is_request = is_request;
 }
 
 static nodec_bstream_t* http_in_stream_alloc(http_in_t* req);
 static nodec_stream_t* nodec_cstream_alloc(uint64_t* content_len, nodec_stream_t* s);
+static nodec_stream_t* nodec_lstream_alloc(nodec_bstream_t* source, uint64_t content_len);
+static const char* http_in_header_id(http_in_t* req, http_header_id_t id);
+static bool http_header_value_contains(const char* s, const char* pattern);
+
+// Keep a read buffer alive as the parsed headers point into it
+static void http_in_prefix_push(http_in_t* in, uv_buf_t buf) {
+  if (in->prefix_count >= in->prefix_size) {
+    size_t newsize = (in->prefix_size == 0 ? 4 : 2 * in->prefix_size);
+    uv_buf_t* prefix = (uv_buf_t*)http_arena_alloc(&in->arena, newsize * sizeof(uv_buf_t));
+    if (in->prefix_count > 0) memcpy(prefix, in->prefix, in->prefix_count * sizeof(uv_buf_t));
+    in->prefix = prefix;
+    in->prefix_size = newsize;
+  }
+  in->prefix[in->prefix_count++] = buf;
+  in->prefix_end = buf.base + buf.len;
+}
 
+// Read the headers by feeding the parser incrementally with each read buffer;
+// the parsed url and headers point directly into those buffers.
 size_t async_http_in_read_headers(http_in_t* in ) 
 {
-  // and read until the double empty line is seen  (\r\n\r\n); the end of the headers 
-  size_t headers_len = 0;
-  uv_buf_t buf = async_read_buf_upto(in->stream, "\r\n\r\n", 4, HTTP_MAX_HEADERS);
-  headers_len = (size_t)buf.len;
-  if (nodec_buf_is_null(buf) || headers_len > HTTP_MAX_HEADERS) {
-    if (!nodec_buf_is_null(buf)) nodec_buf_free(buf);
-    if (headers_len == 0) {
-      // eof; means client closed the stream; no problem
-      fprintf(stderr, "stream closed while reading headers\n");
-      return 0;
-    }
-    throw_http_err((headers_len > HTTP_MAX_HEADERS ? HTTP_STATUS_PAYLOAD_TOO_LARGE : HTTP_STATUS_BAD_REQUEST));
-  }
-  //printf("\n\nraw prefix read: %s\n\n\n", buf.base);  // only print idx length here
-
-  // only if successful initialize a request object
-  in->prefix = buf;
   http_parser_init(&in->parser, (in->is_request ? HTTP_REQUEST : HTTP_RESPONSE));
   in->parser.data = in;
   http_parser_settings_init(&in->parser_settings);
@@ -295,27 +607,79 @@ size_t async_http_in_read_headers(http_in_t* in )
   in->parser_settings.on_url = &on_url;
   in->parser_settings.on_status = &on_status;
 
-  // parse the headers
-  size_t nread = http_parser_execute(&in->parser, &in->parser_settings, in->prefix.base, 
-                    headers_len // do not use in->prefix.len because requests can be pipe-lined.
-                  );
-  check_http_errno(&in->parser);
-  assert(nread == headers_len);
+  size_t headers_len = 0;
+  while (!in->headers_complete) {
+    bool owned = false;
+    uv_buf_t buf = async_read_bufx(as_stream(in->stream), &owned);
+    if (nodec_buf_is_null(buf) || buf.len == 0) {
+      if (owned && !nodec_buf_is_null(buf)) nodec_buf_free(buf);
+      if (headers_len == 0) {
+        // eof; means client closed the stream; no problem
+        fprintf(stderr, "stream closed while reading headers\n");
+        return 0;
+      }
+      throw_http_err(HTTP_STATUS_BAD_REQUEST);
+    }
+    if (!owned) {
+      // we need to own the buffer as the headers point into it
+      uv_buf_t copy = nodec_buf_alloc(buf.len);
+      memcpy(copy.base, buf.base, buf.len);
+      buf = copy;
+    }
+    http_in_prefix_push(in, buf);
+
+    // parse as much as we can
+    size_t len = (size_t)buf.len;
+    if (headers_len + len > HTTP_MAX_HEADERS) len = HTTP_MAX_HEADERS - headers_len;
+    size_t nread = http_parser_execute(&in->parser, &in->parser_settings, buf.base, len);
+    check_http_errno(&in->parser);
+    if (in->headers_complete) {
+      // the parser pauses on the final LF of the headers; 
+      // feed that to finish the headers (and complete messages without a body)
+      http_parser_pause(&in->parser, 0);
+      if (nread < len && buf.base[nread] == '\n') {
+        nread += http_parser_execute(&in->parser, &in->parser_settings, buf.base + nread, 1);
+        check_http_errno(&in->parser);
+      }
+      // push back the rest; that is the body or a next pipelined message
+      if (nread < (size_t)buf.len) {
+        uv_buf_t rest = nodec_buf_alloc(buf.len - nread);
+        memcpy(rest.base, buf.base + nread, rest.len);
+        nodec_pushback_buf(in->stream, rest);
+      }
+    }
+    else if (headers_len + len >= HTTP_MAX_HEADERS) {
+      throw_http_err(HTTP_STATUS_PAYLOAD_TOO_LARGE);
+    }
+    headers_len += nread;
+  }
   assert(nodec_buf_is_null(in->current_body));
-  assert(in->headers_complete);
 
-  // remember where we are at in the current buffer for further body reads 
-  in->body_start = nread;
+  // and set up the body stream
   in->body_stream = in->stream;
   bool chunked = false;
-  if (http_in_header_contains(in, "Transfer-Encoding", "chunked")) {
+  if (!in->is_request && (in->head_request || in->status < 200 || in->status == 204 || in->status == 304)) {
+    // these responses never have a body, whatever their `Content-Length` says
+    in->body_stream = NULL;
+    return headers_len;
+  }
+  if (http_header_value_contains(http_in_header_id(in, HTTP_HDR_TRANSFER_ENCODING), "chunked")) {
 #ifndef NDEBUG
     fprintf(stderr, "use chunked!\n");
 #endif
     chunked = true;
     in->body_stream = nodec_bstream_alloc_on( nodec_cstream_alloc( &in->content_length, as_stream(in->body_stream)) );
   }
-  if (http_in_header_contains(in, "Content-Encoding", "gzip")) {
+  else if (in->content_length > 0) {
+    // read exactly `Content-Length` bytes so we never read into a next message
+    in->body_stream = nodec_bstream_alloc_on( nodec_lstream_alloc( in->stream, in->content_length) );
+  }
+  if (in->is_request && in->parser.http_major == 1 && in->parser.http_minor >= 1 && (chunked || in->content_length > 0)) {
+    // the client waits for a `100 Continue` before sending the body
+    const char* expect = http_in_header_id(in, HTTP_HDR_EXPECT);
+    in->continue_pending = (expect != NULL && nodec_stricmp(expect, "100-continue") == 0);
+  }
+  if (http_header_value_contains(http_in_header_id(in, HTTP_HDR_CONTENT_ENCODING), "gzip")) {
 #ifndef NDEBUG
     fprintf(stderr, "use gzip!\n");
 #endif
@@ -573,13 +937,80 @@ nodec_stream_t* nodec_cstream_alloc(uint64_t* content_len, nodec_stream_t* sourc
 }
 
 
+/*-----------------------------------------------------------------
+ Length streams: read a body of a known length
+-----------------------------------------------------------------*/
+
+typedef struct _nodec_lstream_t {
+  nodec_stream_t   stream;
+  nodec_bstream_t* source;         // the connection; not owned
+  uint64_t         remaining;      // bytes of the body not yet read
+  uv_buf_t         current;        // last read buffer if we own it but the reader does not
+} nodec_lstream_t;
+
+static uv_buf_t async_lstream_read_bufx(nodec_stream_t* stream, bool* owned) {
+  nodec_lstream_t* ls = (nodec_lstream_t*)stream;
+  nodec_bufref_free(&ls->current);
+  if (owned != NULL) *owned = false;
+  if (ls->remaining == 0) return nodec_buf_null();
+  bool src_owned = false;
+  uv_buf_t buf = async_read_bufx(as_stream(ls->source), &src_owned);
+  if (nodec_buf_is_null(buf) || buf.len == 0) {
+    if (src_owned) nodec_buf_free(buf);
+    throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "connection closed before the body was complete");
+  }
+  if (buf.len > ls->remaining) {
+    // push back what follows the body; that is the next request
+    size_t len = (size_t)ls->remaining;
+    uv_buf_t rest = nodec_buf_alloc(buf.len - len);
+    memcpy(rest.base, buf.base + len, rest.len);
+    nodec_pushback_buf(ls->source, rest);
+    buf.len = (uv_buf_len_t)len;  // no terminator: we may not own `buf`
+  }
+  ls->remaining -= buf.len;
+  if (owned != NULL) *owned = src_owned;
+  else if (src_owned) ls->current = buf;
+  return buf;
+}
+
+static void async_lstream_free(nodec_stream_t* stream) {
+  nodec_lstream_t* ls = (nodec_lstream_t*)stream;
+  nodec_bufref_free(&ls->current);
+  nodec_free(ls);
+}
+
+static nodec_stream_t* nodec_lstream_alloc(nodec_bstream_t* source, uint64_t content_len) {
+  nodec_lstream_t* ls = nodec_zero_alloc(nodec_lstream_t);
+  nodec_stream_init(&ls->stream, &async_lstream_read_bufx, NULL, NULL, &async_lstream_free);
+  ls->source = source;
+  ls->remaining = content_len;
+  return &ls->stream;
+}
+
+
 
 /*-----------------------------------------------------------------
 Reading the body of a request
 -----------------------------------------------------------------*/
 
 
+static bool http_out_send_continue(http_out_t* out);
+
+// Send `100 Continue` if the client waits for it before sending the body.
+// If the response was sent already it is too late to ask for the body; then
+// `continue_pending` stays set such that the connection is closed afterwards.
+void async_http_in_continue(http_in_t* in) {
+  if (!in->continue_pending) return;
+  if (in->continue_out != NULL && !http_out_send_continue(in->continue_out)) return;
+  in->continue_pending = false;
+}
+
+bool http_in_expects_continue(http_in_t* in) {
+  return in->continue_pending;
+}
+
 nodec_bstream_t* http_in_body(http_in_t* in) {
+  if (in->continue_pending) async_http_in_continue(in);  // the client sends the body once we ask for it
   return in->body_stream;
 }
 
@@ -593,7 +1024,7 @@ uv_buf_t async_http_in_read_body(http_in_t* req, size_t read_max) {
   //{using_bstream(stream) {
      size_t clen = http_in_content_length(req);
      if (clen > read_max) clen = read_max;
-     if (clen > 0 && http_in_header(req, "Content-Encoding") == NULL) {
+     if (clen > 0 && http_in_header_id(req, HTTP_HDR_CONTENT_ENCODING) == NULL) {
        buf = nodec_buf_alloc(clen);
        {using_buf_on_abort_free(&buf){
           size_t nread = async_read_into(stream, buf);
@@ -604,11 +1035,117 @@ uv_buf_t async_http_in_read_body(http_in_t* req, size_t read_max) {
        buf = async_read_buf_all(stream, read_max);
      }
   //}}
-  nodec_stream_free(as_stream(req->body_stream));
+  if (req->body_stream != req->stream) {
+    nodec_stream_free(as_stream(req->body_stream));  // don't free the connection itself
+  }
   req->body_stream = NULL;
   return buf;
 }
 
+// Spooling a body into memory or a temporary file
+typedef struct _http_spool_t {
+  uv_buf_t        mem;
+  size_t          mem_len;
+  uv_file         file;
+  nodec_stream_t* file_stream;    // owns `file`
+  int64_t         file_len;
+} http_spool_t;
+
+static void http_spool_freev(lh_value spoolv) {
+  http_spool_t* spool = (http_spool_t*)lh_ptr_value(spoolv);
+  nodec_bufref_free(&spool->mem);
+  if (spool->file_stream != NULL) nodec_stream_free(spool->file_stream);
+  spool->file_stream = NULL;
+}
+
+static void http_spool_write(http_spool_t* spool, uv_buf_t buf, size_t mem_max) {
+  if (spool->file_stream == NULL && spool->mem_len + buf.len <= mem_max) {
+    spool->mem = nodec_buf_ensure(spool->mem, spool->mem_len + buf.len);
+    memcpy(spool->mem.base + spool->mem_len, buf.base, buf.len);
+    spool->mem_len += buf.len;
+    return;
+  }
+  if (spool->file_stream == NULL) {
+    // too large for memory: continue in a temporary file
+    spool->file = async_fs_open_temp();
+    spool->file_stream = nodec_fs_stream_alloc(spool->file, 0);
+    if (spool->mem_len > 0) {
+      async_fs_write(spool->file, nodec_buf(spool->mem.base, spool->mem_len), 0);
+      spool->file_len = spool->mem_len;
+    }
+    nodec_bufref_free(&spool->mem);
+    spool->mem_len = 0;
+  }
+  async_fs_write(spool->file, buf, spool->file_len);
+  spool->file_len += buf.len;
+}
+
+// Read the entire body into memory if it is at most `mem_max` bytes, and
+// otherwise into a temporary file. Returns a stream over the body.
+nodec_bstream_t* async_http_in_read_body_spooled(http_in_t* req, size_t mem_max, size_t read_max) {
+  if (read_max == 0) read_max = SIZE_MAX;
+  if (req->complete || req->body_stream == NULL) return nodec_bstream_alloc_buf(nodec_buf_null());
+  if ((req->parser.flags & F_CONTENTLENGTH) != 0 && req->content_length > read_max) {
+    throw_http_err(HTTP_STATUS_PAYLOAD_TOO_LARGE);  // before sending a `100 Continue`
+  }
+  nodec_bstream_t* stream = http_in_body(req);
+  http_spool_t spool;
+  memset(&spool, 0, sizeof(spool));
+  spool.file = -1;
+  {on_abort(http_spool_freev, lh_value_any_ptr(&spool)) {
+    size_t total = 0;
+    bool owned = false;
+    uv_buf_t buf;
+    while (!nodec_buf_is_null(buf = async_read_bufx(as_stream(stream), &owned))) {
+      {using_buf_owned(owned, &buf) {
+        if (buf.len > read_max - total) throw_http_err(HTTP_STATUS_PAYLOAD_TOO_LARGE);  // cannot overflow
+        total += buf.len;
+        http_spool_write(&spool, buf, mem_max);
+      }}
+    }
+  }}
+  if (req->body_stream != req->stream) {
+    nodec_stream_free(as_stream(req->body_stream));  // don't free the connection itself
+  }
+  req->body_stream = NULL;
+  if (spool.file_stream != NULL) {
+    return nodec_bstream_alloc_on(spool.file_stream);
+  }
+  else {
+    return nodec_bstream_alloc_buf(spool.mem_len == 0 ? spool.mem : nodec_buf_fit(spool.mem, spool.mem_len));
+  }
+}
+
+// Read and discard the remaining body. 
+// Returns `true` if the connection can be used for a next message.
+bool async_http_in_drain(http_in_t* in) {
+  if (!in->headers_complete) return false;  // headers were never read
+  if (!http_should_keep_alive(&in->parser)) return false;
+  // The handler never asked for the body so no `100 Continue` was sent. The client
+  // may wait for it forever, or give up waiting and send the body anyway (RFC 7231,
+  // 5.1.1); we cannot tell whether the next bytes are that body or a next request,
+  // so the connection cannot be reused.
+  if (in->continue_pending) return false;
+  if (in->complete || in->body_stream == NULL) return true;
+  if (in->body_stream == in->stream) {
+    // no body (a `Content-Length` body has its own stream); but a response 
+    // without a length extends to the end of the stream
+    in->body_stream = NULL;
+    return (in->is_request || (in->parser.flags & F_CONTENTLENGTH) != 0);
+  }
+  else {
+    // read to the end of the body stream, one buffer at a time
+    bool owned = false;
+    uv_buf_t buf;
+    while (!nodec_buf_is_null(buf = async_read_bufx(as_stream(in->body_stream), &owned))) {
+      if (owned) nodec_buf_free(buf);
+    }
+    nodec_stream_free(as_stream(in->body_stream));
+    in->body_stream = NULL;
+    return true;
+  }
+}
+
 
 /*-----------------------------------------------------------------
 Helpers
@@ -619,6 +1156,16 @@ const char* http_in_url(http_in_t* req) {
   return req->url;
 }
 
+// Return the parsed request URL (only valid on server requests).
+// This is parsed lazily on first access using the `Host` header.
+const nodec_url_t* http_in_parsed_url(http_in_t* req) {
+  if (req->parsed_url == NULL && req->url != NULL) {
+    req->parsed_url = nodecx_parse_url_at(http_in_header_id(req, HTTP_HDR_HOST), req->url);
+    if (req->parsed_url == NULL) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "invalid url");
+  }
+  return req->parsed_url;
+}
+
 // Return the read only HTTP Status (only valid on server responses)
 http_status_t http_in_status(http_in_t* req) {
   return req->status;
@@ -645,15 +1192,22 @@ const char* http_in_header(http_in_t* req, const char* name) {
   return http_headers_lookup(&req->headers, name);
 }
 
+static const char* http_in_header_id(http_in_t* req, http_header_id_t id) {
+  return http_headers_lookup_id(&req->headers, id);
+}
+
 const char* http_in_header_next(http_in_t* req, const char** value, size_t* iter) {
   return http_headers_next(&req->headers, value, iter);
 }
 
-bool http_in_header_contains(http_in_t* req, const char* name, const char* pattern ) {
-  const char* s = http_in_header(req,name);
+static bool http_header_value_contains(const char* s, const char* pattern) {
   return (s != NULL && pattern != NULL && strstr(s, pattern) != NULL);
 }
 
+bool http_in_header_contains(http_in_t* req, const char* name, const char* pattern ) {
+  return http_header_value_contains(http_in_header(req,name), pattern);
+}
+
 const char* http_header_next_field(const char* header, size_t* len, const char** iter) {
   *len = 0;
   if (*iter == NULL) *iter = header;
@@ -680,14 +1234,24 @@ const char* http_header_next_field(const char* header, size_t* len, const char**
 -----------------------------------------------------------------*/
 struct _http_out_t {
   nodec_stream_t* stream;
+  http_arena_t*    arena;   // if not NULL, the head is allocated in the request arena
   uv_buf_t         head;
   size_t           head_offset;
   bool             status_sent;
+  const http_framed_t* framed;  // if not NULL, the headers are sent as an HTTP/2 frame
+  http_capture_t*  capture;     // if not NULL, the response is recorded for the response cache
+  size_t           flush_size;  // buffer size of a chunked body stream
+  http_in_t*       response;    // on a client, the response to this request
 };
 
 void http_out_init(http_out_t* out, nodec_stream_t* stream) {
   memset(out, 0, sizeof(http_out_t));
   out->stream = stream;
+  out->flush_size = NODEC_HTTP_FLUSH_SIZE;
+}
+
+void http_out_set_flush_size(http_out_t* out, size_t flush_size) {
+  out->flush_size = flush_size;
 }
 
 void http_out_init_server(http_out_t* out, nodec_stream_t* stream, const char* server_name) {
@@ -701,11 +1265,34 @@ void http_out_init_client(http_out_t* out, nodec_stream_t* stream, const char* h
 }
 
 
-void http_out_clear(http_out_t* out) {
-  nodec_bufref_free(&out->head);
+static void http_out_head_free(http_out_t* out) {
+  if (out->arena == NULL) {
+    nodec_bufref_free(&out->head);
+  }
+  else {
+    out->head = nodec_buf_null();  // released with the arena
+  }
   out->head_offset = 0;
 }
 
+// Ensure room for `needed` bytes in the head buffer
+static void http_out_head_ensure(http_out_t* out, size_t needed) {
+  if (out->arena == NULL) {
+    out->head = nodec_buf_ensure(out->head, needed);
+  }
+  else if (needed > out->head.len) {
+    size_t newlen = (out->head.len == 0 ? 256 : 2 * out->head.len);
+    while (newlen < needed) newlen *= 2;
+    char* p = (char*)http_arena_alloc(out->arena, newlen + 1);
+    if (out->head_offset > 0) memcpy(p, out->head.base, out->head_offset);
+    out->head = nodec_buf(p, newlen);
+  }
+}
+
+void http_out_clear(http_out_t* out) {
+  http_out_head_free(out);
+}
+
 void http_out_clearv(lh_value respv) {
   http_out_clear((http_out_t*)lh_ptr_value(respv));
 }
@@ -714,7 +1301,7 @@ void http_out_add_header(http_out_t* out, const char* field, const char* value)
   size_t n = strlen(field);
   size_t m = strlen(value);
   size_t extra = n + m + 4; // : \r\n
-  out->head = nodec_buf_ensure(out->head, out->head_offset + extra);
+  http_out_head_ensure(out, out->head_offset + extra);
   char* p = out->head.base + out->head_offset;
   size_t available = out->head.len - out->head_offset;
   nodec_strncpy(p, available, field, n);
@@ -739,37 +1326,77 @@ static void http_out_send_raw_str(http_out_t* out, const char* s) {
 }
 */
 
-static void http_out_send_raw_headers(http_out_t* out, uv_buf_t prefix, uv_buf_t postfix) {
-  uv_buf_t buf = nodec_buf(out->head.base, out->head_offset);
-  uv_buf_t bufs[3] = { prefix, buf, postfix };
+// Send the prefix buffers (status or request line, and the date), followed by the headers, 
+// the postfix, and an optional body; all in a single write.
+static void http_out_send_raw_headers(http_out_t* out, const uv_buf_t prefix[], size_t prefix_count, uv_buf_t postfix, uv_buf_t body) {
+  uv_buf_t bufs[5];
+  assert(prefix_count <= 2);
+  for (size_t i = 0; i < prefix_count; i++) bufs[i] = prefix[i];
+  size_t count = prefix_count;
+  bufs[count++] = nodec_buf(out->head.base, out->head_offset);
+  bufs[count++] = postfix;
 #ifndef NDEBUG
-  fprintf(stderr, "%s%s%s\n", prefix.base, buf.base, postfix.base);
+  for (size_t i = 0; i < count; i++) fprintf(stderr, "%.*s", (int)bufs[i].len, bufs[i].base);
+  fprintf(stderr, "\n");
 #endif
-  async_write_bufs(out->stream, bufs, 3);
-  nodec_bufref_free(&out->head);
-  out->head_offset = 0;
+  if (!nodec_buf_is_null(body) && body.len > 0) bufs[count++] = body;
+  async_write_bufs(out->stream, bufs, count);
+  http_out_head_free(out);
   out->status_sent = true;
 }
 
-static void http_out_send_headers(http_out_t* out, const char* prefix, const char* postfix) {
-  http_out_send_raw_headers(out, nodec_buf_str(prefix), nodec_buf_str(postfix));
+#define HTTP_DATE_HEADER_LEN  (6 + 29 + 2)  // "Date: " date "\r\n"
+
+// Render the Date header into `buf` (of at least HTTP_DATE_HEADER_LEN+1 bytes) using the cached date
+static uv_buf_t http_date_header(char* buf) {
+  memcpy(buf, "Date: ", 6);
+  memcpy(buf + 6, nodec_inet_date_cached(), 29);
+  memcpy(buf + 35, "\r\n", 3);
+  return nodec_buf(buf, HTTP_DATE_HEADER_LEN);
 }
 
-static void http_out_send_status_headers(http_out_t* out, http_status_t status) {
+static void http_capture_headers(http_capture_t* capture, http_out_t* out, http_status_t status, uv_buf_t body);
+
+static void http_out_send_status_headers_body(http_out_t* out, http_status_t status, uv_buf_t body) {
   // send status to a client
   if (status == 0) status = HTTP_STATUS_OK;
+  http_capture_headers(out->capture, out, status, body);
+  if (out->framed != NULL) {
+    out->framed->send_headers(out->framed->arg, status, nodec_buf(out->head.base, out->head_offset), body);
+    http_out_head_free(out);
+    out->status_sent = true;
+    return;
+  }
+  uv_buf_t prefix[2];
+  char date[HTTP_DATE_HEADER_LEN + 1];   // on the stack as the write is in progress while we are suspended
   char line[256];
-  snprintf(line, 256, "HTTP/1.1 %i %s\r\nDate: %s\r\n", status, nodec_http_status_str(status), nodec_inet_date_now());
-  line[255] = 0;
-  http_out_send_headers(out, line, "\r\n");
+  size_t len;
+  const char* sline = nodec_http_status_line(status, &len);
+  if (sline != NULL) {
+    prefix[0] = nodec_buf(sline, len);   // constant
+  }
+  else {
+    snprintf(line, 256, "HTTP/1.1 %i %s\r\n", status, nodec_http_status_str(status));
+    line[255] = 0;
+    prefix[0] = nodec_buf_str(line);
+  }
+  prefix[1] = http_date_header(date);
+  http_out_send_raw_headers(out, prefix, 2, nodec_buf_str("\r\n"), body);
+}
+
+static void http_out_send_status_headers(http_out_t* out, http_status_t status) {
+  http_out_send_status_headers_body(out, status, nodec_buf_null());
 }
 
 static void http_out_send_request_headers(http_out_t* out, http_method_t method, const char* url) {
   // send request to a server
-  char prefix[512];
-  snprintf(prefix, 512, "%s %s HTTP/1.1\r\nDate: %s\r\n", nodec_http_method_str(method), url, nodec_inet_date_now());
-  prefix[511] = 0;
-  http_out_send_headers(out, prefix, "\r\n");
+  char line[512];
+  char date[HTTP_DATE_HEADER_LEN + 1];
+  if (out->response != NULL) out->response->head_request = (method == HTTP_HEAD);
+  snprintf(line, 512, "%s %s HTTP/1.1\r\n", nodec_http_method_str(method), url);
+  line[511] = 0;
+  uv_buf_t prefix[2] = { nodec_buf_str(line), http_date_header(date) };
+  http_out_send_raw_headers(out, prefix, 2, nodec_buf_str("\r\n"), nodec_buf_null());
 }
 
 static void http_out_add_header_content_type(http_out_t* out, const char* content_type) {
@@ -803,64 +1430,209 @@ bool http_out_status_sent(http_out_t* out) {
   return out->status_sent;
 }
 
+// Send an interim `100 Continue` response (only for HTTP/1.1)
+// Returns `false` if the final response was sent already
+static bool http_out_send_continue(http_out_t* out) {
+  if (out->framed != NULL) return true;
+  if (out->status_sent) return false;
+  async_write(out->stream, "HTTP/1.1 100 Continue\r\n\r\n");
+  async_flush(out->stream);  // the client waits for it
+  return true;
+}
+
+/*-----------------------------------------------------------------
+  Capturing responses for the response cache
+-----------------------------------------------------------------*/
+
+void http_out_capture(http_out_t* out, http_capture_t* capture) {
+  if (out->capture != NULL) out->capture->out = NULL;
+  out->capture = capture;
+  if (capture != NULL) {
+    capture->out = out;
+    capture->head_start = out->head_offset;  // headers added before (like `Server`) are not part of the cached response
+  }
+}
+
+void http_capture_clear(http_capture_t* capture) {
+  if (capture->out != NULL) http_out_capture(capture->out, NULL);
+  nodec_bufref_free(&capture->head);
+  nodec_bufref_free(&capture->body);
+  capture->body_len = 0;
+}
+
+void http_capture_clearv(lh_value capturev) {
+  http_capture_clear((http_capture_t*)lh_ptr_value(capturev));
+}
+
+static void http_capture_append(http_capture_t* capture, const uv_buf_t bufs[], size_t count) {
+  if (capture == NULL || capture->overflow) return;
+  for (size_t i = 0; i < count; i++) {
+    if (nodec_buf_is_null(bufs[i]) || bufs[i].len == 0) continue;
+    if (capture->body_len + bufs[i].len > capture->max_len) {
+      // too large to cache; stop capturing
+      capture->overflow = true;
+      nodec_bufref_free(&capture->body);
+      capture->body_len = 0;
+      return;
+    }
+    capture->body = nodec_buf_ensure(capture->body, capture->body_len + bufs[i].len);
+    memcpy(capture->body.base + capture->body_len, bufs[i].base, bufs[i].len);
+    capture->body_len += bufs[i].len;
+  }
+}
+
+static void http_capture_headers(http_capture_t* capture, http_out_t* out, http_status_t status, uv_buf_t body) {
+  if (capture == NULL) return;
+  capture->status = status;
+  capture->sent = true;
+  size_t start = (capture->head_start < out->head_offset ? capture->head_start : out->head_offset);
+  capture->head = nodec_buf_alloc(out->head_offset - start);
+  if (out->head_offset > start) memcpy(capture->head.base, out->head.base + start, out->head_offset - start);
+  http_capture_append(capture, &body, 1);
+}
+
+// Send a cached response in one write; `status_line` and `lines` were captured
+// earlier, while the current headers of `out` (like `Server`) are sent as well.
+void http_out_send_cached(http_out_t* out, http_status_t status, uv_buf_t status_line, uv_buf_t lines, uint64_t age, uv_buf_t body) {
+  char extra[HTTP_DATE_HEADER_LEN + 64];
+  if (out->framed != NULL) {
+    // the head must be writable for HTTP/2 so we copy it into the request arena
+    snprintf(extra, sizeof(extra), "Age: %llu\r\n", (unsigned long long)age);
+    size_t extra_len = strlen(extra);
+    http_out_head_ensure(out, out->head_offset + lines.len + extra_len);
+    memmove(out->head.base + lines.len, out->head.base, out->head_offset);
+    memcpy(out->head.base, lines.base, lines.len);
+    memcpy(out->head.base + lines.len + out->head_offset, extra, extra_len);
+    out->head_offset += lines.len + extra_len;
+    http_out_send_status_headers_body(out, status, body);
+    return;
+  }
+  http_date_header(extra);
+  snprintf(extra + HTTP_DATE_HEADER_LEN, sizeof(extra) - HTTP_DATE_HEADER_LEN, "Age: %llu\r\n\r\n", (unsigned long long)age);
+  uv_buf_t bufs[5] = { status_line, lines, nodec_buf(out->head.base, out->head_offset), nodec_buf_str(extra), body };
+  async_write_bufs(out->stream, bufs, (nodec_buf_is_null(body) || body.len == 0 ? 4 : 5));
+  http_out_head_free(out);
+  out->status_sent = true;
+}
+
 /*-----------------------------------------------------------------
   HTTP out body stream
 -----------------------------------------------------------------*/
 
+#define HTTP_OUT_IOV_MAX  (8)   // maximal number of buffers written in a chunk without copying
+
 typedef struct _http_out_stream_t {
   nodec_stream_t    stream;
   nodec_stream_t*   source;
   bool              chunked;
+  http_capture_t*   capture;    // if not NULL, the body is recorded
+  uv_buf_t          pending;    // buffered chunk data
+  size_t            pending_len;
+  size_t            flush_size; // write out a chunk once this much data is buffered
 } http_out_stream_t;
 
+static void http_out_stream_buffer(http_out_stream_t* hs, const uv_buf_t bufs[], size_t count, size_t total) {
+  size_t needed = hs->pending_len + total;
+  if (needed < hs->pending_len) nodec_check(EOVERFLOW);
+  hs->pending = nodec_buf_ensure_ex(hs->pending, needed, hs->flush_size, 0);
+  for (size_t i = 0; i < count; i++) {
+    if (bufs[i].len == 0) continue;
+    memcpy(hs->pending.base + hs->pending_len, bufs[i].base, bufs[i].len);
+    hs->pending_len += bufs[i].len;
+  }
+}
+
+// Write the pending data followed by `bufs` as a single chunk;
+// if `last` is true, the terminating zero-length chunk is written as well.
+static void http_out_stream_write_chunk(http_out_stream_t* hs, const uv_buf_t bufs[], size_t count, size_t total, bool last) {
+  assert(count <= HTTP_OUT_IOV_MAX);
+  uv_buf_t xbufs[HTTP_OUT_IOV_MAX + 3];
+  char prefix[32];
+  size_t n = 0;
+  total += hs->pending_len;
+  if (total > 0) {
+    snprintf(prefix, sizeof(prefix), "%zX\r\n", total);  // hexadecimal chunk length
+    xbufs[n++] = nodec_buf_str(prefix);
+    if (hs->pending_len > 0) xbufs[n++] = nodec_buf(hs->pending.base, hs->pending_len);
+    for (size_t i = 0; i < count; i++) {
+      if (bufs[i].len > 0) xbufs[n++] = bufs[i];
+    }
+    xbufs[n++] = nodec_buf_str(last ? "\r\n0\r\n\r\n" : "\r\n");
+  }
+  else if (last) {
+    xbufs[n++] = nodec_buf_str("0\r\n\r\n");
+  }
+  else {
+    return;  // don't write 0-length chunks as that would terminate the stream
+  }
+  hs->pending_len = 0;
+  async_write_bufs(hs->source, xbufs, n);
+}
+
 static void _http_out_write_bufs(nodec_stream_t* stream, uv_buf_t bufs[], size_t count) {
   if (bufs == NULL || count == 0) return;
   http_out_stream_t* hs = (http_out_stream_t*)stream;
+  http_capture_append(hs->capture, bufs, count);
   if (!hs->chunked) {
     async_write_bufs(hs->source, bufs, count);
+    return;
+  }
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += bufs[i].len;
+    if (total < bufs[i].len) nodec_check(EOVERFLOW);
+  }
+  if (total == 0) return;
+  if (hs->pending_len + total < hs->flush_size) {
+    // buffer small writes
+    http_out_stream_buffer(hs, bufs, count, total);
+  }
+  else if (count > HTTP_OUT_IOV_MAX) {
+    http_out_stream_buffer(hs, bufs, count, total);
+    http_out_stream_write_chunk(hs, NULL, 0, 0, false);
   }
   else {
-    // pre and post fix the buffers, and calculate the total
-    uv_buf_t* xbufs = alloca((count + 2) * sizeof(uv_buf_t));
-    size_t total = 0;
-    for (size_t i = 0; i < count; i++) {
-      total += bufs[i].len;
-      if (total < bufs[i].len) nodec_check(EOVERFLOW);
-      xbufs[i + 1] = bufs[i];
-    }
-    // prevent terminating the stream pre-maturely and don't write 0-length chunks
-    if (total == 0) return;
-    // create pre- and postfix
-    char prefix[256];
-    snprintf(prefix, 256, "%zX\r\n", total );  // hexadecimal chunk length
-    xbufs[0] = nodec_buf(prefix, strlen(prefix));
-    xbufs[count + 1] = nodec_buf_str("\r\n");
-    // and write it out as a chunk
-    async_write_bufs(hs->source, xbufs, count + 2);
+    // write the pending data and the new buffers as one chunk without copying
+    http_out_stream_write_chunk(hs, bufs, count, total, false);
   }
 }
 
+static void _http_out_flush(nodec_stream_t* stream) {
+  http_out_stream_t* hs = (http_out_stream_t*)stream;
+  if (hs->chunked) http_out_stream_write_chunk(hs, NULL, 0, 0, false);
+  async_flush(hs->source);
+}
+
 static void _http_out_shutdown(nodec_stream_t* stream) {
   http_out_stream_t* hs = (http_out_stream_t*)stream;
   if (hs->chunked) {
-    // write out final 0 chunk
-    async_write_buf(hs->source, nodec_buf_str("0\r\n\r\n"));
+    // write out pending data and the final 0 chunk
+    http_out_stream_write_chunk(hs, NULL, 0, 0, true);
   }
 }
 
+static size_t _http_out_write_queued(nodec_stream_t* stream) {
+  http_out_stream_t* hs = (http_out_stream_t*)stream;
+  return nodec_stream_write_queued(hs->source);
+}
+
 static void _http_out_free(nodec_stream_t* stream) {
   http_out_stream_t* hs = (http_out_stream_t*)stream;
   hs->source = NULL;  // we don't own the underlying TCP stream, don't free it
+  nodec_buf_free(hs->pending);
   nodec_stream_release(&hs->stream);
   nodec_free(hs);
 }
 
-static nodec_stream_t* http_out_stream_alloc(nodec_stream_t* source, bool chunked) {
-  http_out_stream_t* hs = nodec_alloc(http_out_stream_t);
+static nodec_stream_t* http_out_stream_alloc(nodec_stream_t* source, bool chunked, size_t flush_size) {
+  http_out_stream_t* hs = nodec_zero_alloc(http_out_stream_t);
   hs->source = source;
   hs->chunked = chunked;
+  hs->flush_size = flush_size;
   nodec_stream_init(&hs->stream, NULL,
                        &_http_out_write_bufs, &_http_out_shutdown, &_http_out_free);
+  nodec_stream_set_flush(&hs->stream, &_http_out_flush);
+  nodec_stream_set_write_queued(&hs->stream, &_http_out_write_queued);
   return &hs->stream;
 }
 
@@ -874,7 +1646,14 @@ void http_out_send_status(http_out_t* out, http_status_t status) {
 nodec_stream_t* http_out_send_status_body(http_out_t* out, http_status_t status, size_t content_length, const char* content_type) {
   http_out_add_headers_body(out, content_length, content_type);
   http_out_send_status_headers(out, status);
-  return http_out_stream_alloc(out->stream, (content_length == NODEC_CHUNKED));
+  nodec_stream_t* stream = http_out_stream_alloc(out->stream, (content_length == NODEC_CHUNKED && out->framed == NULL), out->flush_size);  // HTTP/2 has its own framing
+  ((http_out_stream_t*)stream)->capture = out->capture;
+  return stream;
+}
+
+void http_out_send_status_buf(http_out_t* out, http_status_t status, uv_buf_t body, const char* content_type) {
+  http_out_add_headers_body(out, (nodec_buf_is_null(body) ? 0 : body.len), content_type);
+  http_out_send_status_headers_body(out, status, body);
 }
 
 void http_out_send_request(http_out_t* out, http_method_t method, const char* url) {
@@ -885,7 +1664,7 @@ void http_out_send_request(http_out_t* out, http_method_t method, const char* ur
 nodec_stream_t* http_out_send_request_body(http_out_t* out, http_method_t method, const char* url, size_t content_length, const char* content_type) {
   http_out_add_headers_body(out, content_length, content_type);
   http_out_send_request_headers(out, method, url);
-  return http_out_stream_alloc(out->stream, (content_length == NODEC_CHUNKED));
+  return http_out_stream_alloc(out->stream, (content_length == NODEC_CHUNKED), out->flush_size);
 }
 
 
@@ -898,57 +1677,362 @@ nodec_stream_t* http_out_send_request_body(http_out_t* out, http_method_t method
 implicit_define(http_current_req)
 implicit_define(http_current_resp)
 implicit_define(http_current_strand_id)
-implicit_define(http_current_url)
+
+/*-----------------------------------------------------------------
+  Pipelining
+  When a request has no body and the next request is already
+  buffered on the connection, the next request is served
+  concurrently on a new strand. Its response goes through an ordered
+  stream that buffers the output until all previous responses are
+  written, so responses are always sent in request order.
+  If a request fails, the responses of the requests after it are
+  dropped and the connection is closed after the error response.
+-----------------------------------------------------------------*/
+
+typedef struct _http_turn_t {
+  channel_t* ch;       // emits once the response is written
+  bool       done;     // the response is written
+  bool       failed;   // the request failed
+} http_turn_t;
+
+static void http_turn_signal(http_turn_t* turn, bool failed) {
+  if (turn == NULL || turn->done) return;
+  turn->done = true;
+  turn->failed = failed;
+  channel_emit(turn->ch, lh_value_null, lh_value_null, 0);
+}
+
+static void http_turn_await(http_turn_t* turn) {
+  if (turn == NULL || turn->done) return;
+  lh_value data;
+  channel_receive_nocancel(turn->ch, &data, NULL);
+}
+
+typedef struct _http_ordered_stream_t {
+  nodec_stream_t  stream;
+  nodec_stream_t* source;      // the connection
+  http_turn_t*    prev;        // the turn of the previous response
+  uv_buf_t        pending;     // output buffered until the previous response is written
+  size_t          pending_len;
+  bool            released;    // true once the previous response is written
+  bool            shutdown;    // shutdown was requested before being released
+} http_ordered_stream_t;
+
+static void async_ordered_release(http_ordered_stream_t* os) {
+  if (os->released || !os->prev->done) return;
+  os->released = true;
+  if (os->prev->failed) return;  // drop our output
+  if (os->pending_len > 0) {
+    async_write_buf(os->source, nodec_buf(os->pending.base, os->pending_len));
+  }
+  if (os->shutdown) async_shutdown(os->source);
+}
+
+static void async_ordered_write_bufs(nodec_stream_t* stream, uv_buf_t bufs[], size_t count) {
+  http_ordered_stream_t* os = (http_ordered_stream_t*)stream;
+  async_ordered_release(os);
+  if (os->released) {
+    if (!os->prev->failed) async_write_bufs(os->source, bufs, count);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    os->pending = nodec_buf_ensure(os->pending, os->pending_len + bufs[i].len);
+    memcpy(os->pending.base + os->pending_len, bufs[i].base, bufs[i].len);
+    os->pending_len += bufs[i].len;
+  }
+}
+
+static void async_ordered_shutdown(nodec_stream_t* stream) {
+  http_ordered_stream_t* os = (http_ordered_stream_t*)stream;
+  async_ordered_release(os);
+  if (!os->released) {
+    os->shutdown = true;
+  }
+  else if (!os->prev->failed) {
+    async_shutdown(os->source);
+  }
+}
+
+static void async_ordered_flush(nodec_stream_t* stream) {
+  // wait for our turn so the output is not held back
+  http_ordered_stream_t* os = (http_ordered_stream_t*)stream;
+  http_turn_await(os->prev);
+  async_ordered_release(os);
+  if (!os->prev->failed) async_flush(os->source);
+}
+
+static size_t async_ordered_write_queued(nodec_stream_t* stream) {
+  http_ordered_stream_t* os = (http_ordered_stream_t*)stream;
+  return nodec_stream_write_queued(os->source);
+}
+
+static void async_ordered_free(nodec_stream_t* stream) {
+  http_ordered_stream_t* os = (http_ordered_stream_t*)stream;
+  nodec_buf_free(os->pending);
+  nodec_free(os);
+}
+
+static http_ordered_stream_t* http_ordered_stream_alloc(nodec_stream_t* source, http_turn_t* prev) {
+  http_ordered_stream_t* os = nodec_zero_alloc(http_ordered_stream_t);
+  nodec_stream_init(&os->stream, NULL, &async_ordered_write_bufs, &async_ordered_shutdown, &async_ordered_free);
+  nodec_stream_set_flush(&os->stream, &async_ordered_flush);
+  nodec_stream_set_write_queued(&os->stream, &async_ordered_write_queued);
+  os->source = source;
+  os->prev = prev;
+  return os;
+}
+
+// Wait until the previous response is written and write our buffered output
+static void async_ordered_finish(http_ordered_stream_t* os) {
+  http_turn_await(os->prev);
+  async_ordered_release(os);
+}
+
+
+static lh_value async_ordered_finishv(lh_value osv) {
+  async_ordered_finish((http_ordered_stream_t*)lh_ptr_value(osv));
+  return lh_value_null;
+}
+
+static void http_ordered_stream_freev(lh_value osv) {
+  http_ordered_stream_t* os = (http_ordered_stream_t*)lh_ptr_value(osv);
+  if (os != NULL) nodec_stream_free(&os->stream);
+}
+
+
+typedef struct _http_serve_args_t {
+  int               id;
+  nodec_bstream_t*  client;
+  nodec_http_servefun* servefun;
+  int               pipeline;   // maximal number of requests served concurrently from here
+  http_turn_t*      prev;       // turn of the previous response if it is not yet written
+} http_serve_args_t;
+
+typedef struct _http_handler_args_t {
+  http_serve_args_t*     args;
+  http_in_t*             in;
+  http_ordered_stream_t* os;    // our ordered output stream or NULL
+  http_turn_t*           turn;  // our turn; signaled once our response is written (or NULL)
+} http_handler_args_t;
+
+static lh_value http_serve_handlerv(lh_value hargsv) {
+  http_handler_args_t* h = (http_handler_args_t*)lh_ptr_value(hargsv);
+  h->args->servefun();
+  // skip an unread body so the next request can be read; if the client still
+  // waits for a `100 Continue` the body is never sent and we close instead
+  if (!async_http_in_drain(h->in) && h->in->continue_pending) {
+    async_shutdown(http_resp()->stream);
+  }
+  return lh_value_null;
+}
+
+// Run the handler; then wait for the previous response, write ours, and signal the next one.
+static lh_value http_serve_orderedv(lh_value hargsv) {
+  http_handler_args_t* h = (http_handler_args_t*)lh_ptr_value(hargsv);
+  lh_exception* exn = NULL;
+  lh_try(&exn, &http_serve_handlerv, hargsv);
+  bool failed = (exn != NULL);
+  if (h->os != NULL) {
+    lh_exception* fexn = NULL;
+    lh_try(&fexn, &async_ordered_finishv, lh_value_ptr(h->os));
+    if (exn == NULL) exn = fexn; else if (fexn != NULL) lh_exception_free(fexn);
+    failed = (exn != NULL || h->os->prev->failed);
+  }
+  http_turn_signal(h->turn, failed);
+  if (exn != NULL) lh_throw(exn);
+  return lh_value_null;
+}
+
+static void http_serve(http_serve_args_t* args);
+
+static lh_value http_servev(lh_value argsv) {
+  http_serve((http_serve_args_t*)lh_ptr_value(argsv));
+  return lh_value_null;
+}
+
+// Serve a request; if the next request is already buffered, it is served concurrently
+static void http_serve(http_serve_args_t* args) {
+  {using_implicit(lh_value_int(args->id), http_current_strand_id) {
+    http_in_t http_in;
+    http_in_init(&http_in, args->client, true);
+    {using_implicit_defer(http_in_clearv, lh_value_any_ptr(&http_in), http_current_req) {
+      fprintf(stderr,"\n------------------------------\nstrand %i, read headers\n", args->id);
+      if (async_http_in_read_headers(&http_in) > 0) { // if not closed by client
+        http_ordered_stream_t* os = NULL;
+        if (args->prev != NULL) os = http_ordered_stream_alloc(as_stream(args->client), args->prev);
+        {defer(http_ordered_stream_freev, lh_value_ptr(os)) {
+          http_out_t http_out;
+          http_out_init(&http_out, (os != NULL ? &os->stream : as_stream(args->client)));
+          http_out.arena = &http_in.arena;  // response headers are request metadata too
+          http_out_add_header(&http_out, "Server", "NodeC/0.1");
+          http_in.continue_out = &http_out;
+          {using_implicit_defer(http_out_clearv, lh_value_any_ptr(&http_out), http_current_resp) {
+            http_handler_args_t hargs = { args, &http_in, os, NULL };
+            bool pipelined = (args->pipeline > 1 && http_in.complete && http_should_keep_alive(&http_in.parser)
+                              && nodec_chunks_available(args->client) > 0);
+            if (!pipelined) {
+              http_serve_orderedv(lh_value_any_ptr(&hargs));
+            }
+            else {
+              // serve the next request concurrently; it waits for our response before writing its own
+              http_turn_t turn = { channel_alloc(1), false, false };
+              {defer(channel_freev, lh_value_ptr(turn.ch)) {
+                hargs.turn = &turn;
+                http_serve_args_t next = { args->id, args->client, args->servefun, args->pipeline - 1, &turn };
+                lh_actionfun* actions[2] = { &http_serve_orderedv, &http_servev };
+                lh_value      actargs[2] = { lh_value_any_ptr(&hargs), lh_value_any_ptr(&next) };
+                lh_exception* exceptions[2] = { NULL, NULL };
+                asyncx_interleave(2, actions, actargs, exceptions);
+                if (exceptions[0] != NULL) {
+                  if (exceptions[1] != NULL) lh_exception_free(exceptions[1]);
+                  lh_throw(exceptions[0]);
+                }
+                if (exceptions[1] != NULL) lh_throw(exceptions[1]);
+              }}
+            }
+          }}
+        }}
+      }
+    }}
+  }}
+}
 
 void nodec_http_serve(int id, nodec_bstream_t* client, lh_value servefunv) {
-  nodec_http_servefun* servefun = ((nodec_http_servefun*)lh_fun_ptr_value(servefunv));
+  http_serve_args_t args = { id, client, (nodec_http_servefun*)lh_fun_ptr_value(servefunv), 1, NULL };
+  http_serve(&args);
+}
+
+void nodec_http_serve_with(int id, nodec_bstream_t* client, lh_value sargsv) {
+  http_server_args_t* sargs = (http_server_args_t*)lh_ptr_value(sargsv);
+  if (sargs->http2 && async_http2_detect(client)) {
+    async_http2_serve(id, client, sargs->servefun);
+  }
+  else {
+    http_serve_args_t args = { id, client, sargs->servefun, sargs->pipeline, NULL };
+    http_serve(&args);
+  }
+}
+
+static http_method_t http_method_parse(const char* s) {
+#define XX(num,name,string) if (strcmp(s,#string)==0) return HTTP_##name;
+  HTTP_METHOD_MAP(XX)
+#undef XX
+  throw_http_err(HTTP_STATUS_NOT_IMPLEMENTED);
+  return HTTP_GET;
+}
+
+// Initialize a request from the decoded HTTP/2 headers
+static void http_in_init_framed(http_in_t* in, const http_framed_t* framed) {
+  in->body_stream = framed->body;
+  in->complete = (framed->body == NULL);
+  in->headers_complete = true;
+  in->parser.http_major = 2;
+  in->parser.http_minor = 0;
+  const char* authority = NULL;
+  for (size_t i = 0; i < framed->count; i++) {
+    const char* name = framed->fields[2*i];
+    const char* value = framed->fields[2*i + 1];
+    if (name[0] == ':') {
+      if (strcmp(name, ":method") == 0) in->parser.method = http_method_parse(value);
+      else if (strcmp(name, ":path") == 0) in->url = http_arena_strdup(&in->arena, value);
+      else if (strcmp(name, ":authority") == 0) authority = value;
+    }
+    else if (!http_headers_add(&in->headers, name, value, true)) {
+      throw_http_err(HTTP_STATUS_PAYLOAD_TOO_LARGE);
+    }
+  }
+  if (in->url == NULL) throw_http_err_str(HTTP_STATUS_BAD_REQUEST, "missing :path");
+  if (authority != NULL && http_in_header_id(in, HTTP_HDR_HOST) == NULL) {
+    http_headers_add(&in->headers, "host", authority, true);
+  }
+  const char* clen = http_in_header_id(in, HTTP_HDR_CONTENT_LENGTH);
+  if (clen != NULL) in->content_length = strtoull(clen, NULL, 10);
+}
+
+void http_serve_framed(int id, nodec_http_servefun* servefun, const http_framed_t* framed) {
   {using_implicit(lh_value_int(id), http_current_strand_id) {
     http_in_t http_in;
-    http_in_init(&http_in, client, true);
+    http_in_init(&http_in, NULL, true);
     {using_implicit_defer(http_in_clearv, lh_value_any_ptr(&http_in), http_current_req) {
+      http_in_init_framed(&http_in, framed);
       http_out_t http_out;
-      http_out_init_server(&http_out, as_stream(client), "NodeC/0.1");
+      http_out_init(&http_out, framed->out);
+      http_out.arena = &http_in.arena;
+      http_out.framed = framed;
+      http_out_add_header(&http_out, "Server", "NodeC/0.1");
       {using_implicit_defer(http_out_clearv, lh_value_any_ptr(&http_out), http_current_resp) {
-        fprintf(stderr,"\n------------------------------\nstrand %i, read headers\n", id);
-        if (async_http_in_read_headers(&http_in) > 0) { // if not closed by client
-          char urlpath[1024];
-          snprintf(urlpath, 1024, "http://%s%s", http_in_header(&http_in, "Host"), http_in_url(&http_in));
-          const nodec_url_t* url = nodec_parse_url(urlpath);
-          {using_implicit_defer(nodec_url_freev, lh_value_ptr(url), http_current_url) {
-            servefun();
-          }}
-        }
+        servefun();
       }}
     }}
   }}
 }
 
 
+static const char* http_shed_response =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\n"
+  "Content-Length: 0\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
 void async_http_server_at(const char* host, tcp_server_config_t* config, nodec_http_servefun* servefun)
 {
-  tcp_server_config_t default_config = tcp_server_config();
-  if (config == NULL) config = &default_config;
+  tcp_server_config_t tcp_config = tcp_server_config();
+  if (config != NULL) tcp_config = *config;
+  if (tcp_config.shed_response == NULL) tcp_config.shed_response = http_shed_response;
   struct sockaddr* addr = nodec_parse_sockaddr(host);
   {using_sockaddr(addr) {
-    async_tcp_server_at(addr, config, &nodec_http_serve,
-      &async_write_http_exnv, lh_value_fun_ptr(servefun));   // by address to prevent conversion between object and function pointer
+    if (tcp_config.pipeline > 1 || tcp_config.http2) {
+      http_server_args_t sargs = { servefun, tcp_config.pipeline, tcp_config.http2 };
+      async_tcp_server_at(addr, &tcp_config, &nodec_http_serve_with,
+        &async_write_http_exnv, lh_value_any_ptr(&sargs));
+    }
+    else {
+      async_tcp_server_at(addr, &tcp_config, &nodec_http_serve,
+        &async_write_http_exnv, lh_value_fun_ptr(servefun));   // by address to prevent conversion between object and function pointer
+    }
   }}
 }
 
-lh_value async_http_connect_on(const char* host, nodec_bstream_t* connection, http_connect_fun* connectfun, lh_value arg) {
+void async_http_server_at_pipe(const char* path, tcp_server_config_t* config, nodec_http_servefun* servefun)
+{
+  tcp_server_config_t tcp_config = tcp_server_config();
+  if (config != NULL) tcp_config = *config;
+  if (tcp_config.shed_response == NULL) tcp_config.shed_response = http_shed_response;
+  if (tcp_config.pipeline > 1 || tcp_config.http2) {
+    http_server_args_t sargs = { servefun, tcp_config.pipeline, tcp_config.http2 };
+    async_pipe_server_at(path, &tcp_config, &nodec_http_serve_with,
+      &async_write_http_exnv, lh_value_any_ptr(&sargs));
+  }
+  else {
+    async_pipe_server_at(path, &tcp_config, &nodec_http_serve,
+      &async_write_http_exnv, lh_value_fun_ptr(servefun));
+  }
+}
+
+lh_value async_http_connect_on_ex(const char* host, nodec_bstream_t* connection, http_connect_fun* connectfun, lh_value arg, bool* keep_alive) {
   lh_value result;
   http_in_t in;
   http_in_init(&in, connection, false);
   {defer(http_in_clearv, lh_value_any_ptr(&in)) {
     http_out_t out;
     http_out_init_client(&out, as_stream(connection), host);
+    out.response = &in;
     {defer(http_out_clearv, lh_value_any_ptr(&out)) {
       result = connectfun(&in, &out, arg);
     }}
+    if (keep_alive != NULL) {
+      // drain the response so the connection can be reused
+      *keep_alive = async_http_in_drain(&in);
+    }
   }}
   return result;
 }
 
+lh_value async_http_connect_on(const char* host, nodec_bstream_t* connection, http_connect_fun* connectfun, lh_value arg) {
+  return async_http_connect_on_ex(host, connection, connectfun, arg, NULL);
+}
+
 lh_value async_http_connect(const char* url, http_connect_fun* connectfun, lh_value arg) {
   lh_value result = lh_value_null;
   nodec_bstream_t* conn = async_tcp_connect(url);
@@ -956,7 +2040,7 @@ lh_value async_http_connect(const char* url, http_connect_fun* connectfun, lh_va
     const nodec_url_t* u = nodec_parse_url(url);
     {using_url(u) {
       const char* host = nodec_url_host(u);
-      async_http_connect_on(host, conn, connectfun, arg);
+      result = async_http_connect_on(host, conn, connectfun, arg);
     }}
   }}
   return result;
@@ -981,7 +2065,11 @@ http_out_t* http_resp() {
 }
 
 const nodec_url_t* http_req_parsed_url() {
-  return (const nodec_url_t*)lh_ptr_value(implicit_get(http_current_url));
+  return http_in_parsed_url(http_req());
+}
+
+void* http_req_alloc(size_t size) {
+  return http_arena_alloc(&http_req()->arena, size);
 }
 
 // Responses
@@ -995,6 +2083,14 @@ void http_resp_send_status(http_status_t status) {
   http_out_send_status(resp, status);
 }
 
+void http_resp_send_continue() {
+  async_http_in_continue(http_req());
+}
+
+void http_resp_set_flush_size(size_t flush_size) {
+  http_out_set_flush_size(http_resp(), flush_size);
+}
+
 bool http_resp_status_sent() {
   return http_out_status_sent(http_resp());
 }
@@ -1015,10 +2111,8 @@ void http_resp_send_body_buf(http_status_t status, uv_buf_t buf, const char* con
     http_out_send_status(resp, status);
   }
   else {
-    nodec_stream_t* stream = http_out_send_status_body(resp, status, buf.len, content_type);
-    {using_stream(stream) {
-      async_write_buf(stream, buf);
-    }}
+    // status line, headers, and body in one write
+    http_out_send_status_buf(resp, status, buf, content_type);
   }
 }
 
@@ -1064,6 +2158,14 @@ uv_buf_t async_req_read_body(size_t read_max) {
   return async_http_in_read_body(http_req(), read_max);
 }
 
+nodec_bstream_t* async_req_read_body_spooled(size_t mem_max, size_t read_max) {
+  return async_http_in_read_body_spooled(http_req(), mem_max, read_max);
+}
+
+bool http_req_expects_continue() {
+  return http_in_expects_continue(http_req());
+}
+
 // Read the full body as a string. Only works if the body cannot contain 0 characters.
 const char* async_req_read_body_str(size_t read_max) {
   return async_req_read_body(read_max).base;
@@ -0,0 +1,450 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+
+/*-----------------------------------------------------------------
+  HTTP request router
+  Routes are inserted into a radix tree of build nodes. Compiling
+  flattens the tree into one array of nodes where the static
+  children of a node are consecutive and sorted on their first
+  character, with all labels and names in one string pool.
+  Matching walks the array and backtracks only if a static branch
+  fails, where parameters are captured as slices of the path.
+-----------------------------------------------------------------*/
+
+#define ROUTE_ANY  (~UINT64_C(0))   // method mask of a route for any method
+
+typedef struct _route_handler_t {
+  uint64_t             methods;     // bit mask of methods
+  nodec_http_servefun* servefun;
+} route_handler_t;
+
+// A node in the tree that is being built
+typedef struct _rnode_t {
+  char*             label;          // static prefix matched by this node (empty for parameters)
+  size_t            label_len;
+  char*             name;           // parameter name for `:name` and `*name` nodes
+  struct _rnode_t*  children;       // static children, sorted on the first character of their label
+  struct _rnode_t*  next;           // next sibling
+  struct _rnode_t*  param;          // `:name` child
+  struct _rnode_t*  wildcard;       // `*name` child
+  route_handler_t*  handlers;
+  size_t            handler_count;
+} rnode_t;
+
+// A compiled node
+typedef struct _route_node_t {
+  uint32_t  label;                  // offset of the label in the pool
+  uint32_t  label_len;
+  uint32_t  name;                   // offset of the parameter name in the pool
+  uint32_t  first_child;            // index of the first static child
+  uint32_t  child_count;
+  int32_t   param;                  // index of the `:name` child, or -1
+  int32_t   wildcard;               // index of the `*name` child, or -1
+  uint32_t  handlers;               // index of the first handler
+  uint32_t  handler_count;
+} route_node_t;
+
+struct _nodec_router_t {
+  rnode_t*          root;
+  size_t            node_count;
+  size_t            pool_size;
+  size_t            handler_count;
+  // compiled
+  bool              compiled;
+  route_node_t*     nodes;
+  char*             pool;
+  route_handler_t*  handlers;
+};
+
+
+/*-----------------------------------------------------------------
+  Building
+-----------------------------------------------------------------*/
+
+static rnode_t* rnode_alloc(nodec_router_t* router, const char* label, size_t label_len) {
+  rnode_t* n = nodec_zero_alloc(rnode_t);
+  n->label = nodec_alloc_n(label_len + 1, char);
+  memcpy(n->label, label, label_len);
+  n->label[label_len] = 0;
+  n->label_len = label_len;
+  router->node_count++;
+  router->pool_size += label_len + 1;
+  return n;
+}
+
+static void rnode_free(rnode_t* n) {
+  while (n != NULL) {
+    rnode_t* next = n->next;
+    rnode_free(n->children);
+    rnode_free(n->param);
+    rnode_free(n->wildcard);
+    nodec_free(n->label);
+    if (n->name != NULL) nodec_free(n->name);
+    if (n->handlers != NULL) nodec_free(n->handlers);
+    nodec_free(n);
+    n = next;
+  }
+}
+
+static void router_compiled_free(nodec_router_t* router) {
+  if (router->nodes != NULL) nodec_free(router->nodes);
+  if (router->pool != NULL) nodec_free(router->pool);
+  if (router->handlers != NULL) nodec_free(router->handlers);
+  router->nodes = NULL;
+  router->pool = NULL;
+  router->handlers = NULL;
+  router->compiled = false;
+}
+
+nodec_router_t* nodec_router_alloc() {
+  nodec_router_t* router = nodec_zero_alloc(nodec_router_t);
+  router->root = rnode_alloc(router, "", 0);
+  return router;
+}
+
+void nodec_router_free(nodec_router_t* router) {
+  if (router == NULL) return;
+  router_compiled_free(router);
+  rnode_free(router->root);
+  nodec_free(router);
+}
+
+void nodec_router_freev(lh_value routerv) {
+  nodec_router_free((nodec_router_t*)lh_ptr_value(routerv));
+}
+
+// Get (or create) the parameter or wildcard child of a node
+static rnode_t* rnode_param(nodec_router_t* router, rnode_t** child, const char* name, size_t name_len) {
+  if (name_len == 0) nodec_throw_msg(UV_EINVAL, "route parameter without a name");
+  if (*child == NULL) {
+    *child = rnode_alloc(router, "", 0);
+    (*child)->name = nodec_alloc_n(name_len + 1, char);
+    memcpy((*child)->name, name, name_len);
+    (*child)->name[name_len] = 0;
+    router->pool_size += name_len + 1;
+  }
+  else if (strlen((*child)->name) != name_len || strncmp((*child)->name, name, name_len) != 0) {
+    nodec_throw_msg(UV_EINVAL, "route parameter name conflicts with another route");
+  }
+  return *child;
+}
+
+// Get (or create) the node for a static prefix, splitting edges as needed;
+// returns the node and the length of the prefix it matched
+static rnode_t* rnode_static(nodec_router_t* router, rnode_t* node, const char* s, size_t len, size_t* matched) {
+  rnode_t** link = &node->children;
+  while (*link != NULL && (unsigned char)(*link)->label[0] < (unsigned char)s[0]) link = &(*link)->next;
+  rnode_t* c = *link;
+  if (c == NULL || c->label[0] != s[0]) {
+    rnode_t* n = rnode_alloc(router, s, len);
+    n->next = c;
+    *link = n;
+    *matched = len;
+    return n;
+  }
+  size_t k = 0;
+  while (k < len && k < c->label_len && c->label[k] == s[k]) k++;
+  if (k < c->label_len) {
+    // split the edge: `c` becomes the single child of a new node with the common prefix
+    rnode_t* m = rnode_alloc(router, c->label, k);
+    memmove(c->label, c->label + k, c->label_len - k + 1);
+    c->label_len -= k;
+    m->next = c->next;
+    c->next = NULL;
+    m->children = c;
+    *link = m;
+    c = m;
+  }
+  *matched = k;
+  return c;
+}
+
+static void rnode_add_handler(rnode_t* node, uint64_t methods, nodec_http_servefun* servefun) {
+  for (size_t i = 0; i < node->handler_count; i++) {
+    if ((node->handlers[i].methods & methods) != 0 && (node->handlers[i].methods == ROUTE_ANY) == (methods == ROUTE_ANY)) {
+      nodec_throw_msg(UV_EINVAL, "duplicate route");
+    }
+  }
+  node->handlers = nodec_realloc_n(node->handlers, node->handler_count + 1, route_handler_t);
+  size_t i = node->handler_count;
+  if (methods != ROUTE_ANY) {
+    // keep a route for any method last
+    while (i > 0 && node->handlers[i - 1].methods == ROUTE_ANY) {
+      node->handlers[i] = node->handlers[i - 1];
+      i--;
+    }
+  }
+  node->handlers[i].methods = methods;
+  node->handlers[i].servefun = servefun;
+  node->handler_count++;
+}
+
+static void router_add(nodec_router_t* router, uint64_t methods, const char* pattern, nodec_http_servefun* servefun) {
+  if (pattern == NULL || pattern[0] != '/') nodec_throw_msg(UV_EINVAL, "route pattern must start with a '/'");
+  rnode_t* node = router->root;
+  const char* p = pattern;
+  while (*p != 0) {
+    bool segment_start = (p > pattern && p[-1] == '/');
+    if (segment_start && *p == ':') {
+      size_t n = strcspn(p + 1, "/");
+      node = rnode_param(router, &node->param, p + 1, n);
+      p += n + 1;
+    }
+    else if (segment_start && *p == '*') {
+      size_t n = strlen(p + 1);
+      if (strchr(p + 1, '/') != NULL) nodec_throw_msg(UV_EINVAL, "route wildcard must be last");
+      node = rnode_param(router, &node->wildcard, p + 1, n);
+      p += n + 1;
+    }
+    else {
+      // a static run up to the next parameter or wildcard
+      size_t n = 0;
+      while (p[n] != 0 && !((p[n] == ':' || p[n] == '*') && p[n - 1] == '/')) n++;
+      if (n == 0) n = 1;
+      size_t matched;
+      node = rnode_static(router, node, p, n, &matched);
+      p += matched;
+    }
+  }
+  rnode_add_handler(node, methods, servefun);
+  router->handler_count++;
+  router_compiled_free(router);
+}
+
+void nodec_router_route(nodec_router_t* router, http_method_t method, const char* pattern, nodec_http_servefun* servefun) {
+  if ((int)method < 0 || (int)method >= 64) nodec_throw_msg(UV_EINVAL, "invalid route method");
+  router_add(router, UINT64_C(1) << method, pattern, servefun);
+}
+
+void nodec_router_route_any(nodec_router_t* router, const char* pattern, nodec_http_servefun* servefun) {
+  router_add(router, ROUTE_ANY, pattern, servefun);
+}
+
+
+/*-----------------------------------------------------------------
+  Compiling
+-----------------------------------------------------------------*/
+
+static uint32_t router_pool_add(nodec_router_t* router, size_t* pool_len, const char* s, size_t len) {
+  uint32_t ofs = (uint32_t)*pool_len;
+  memcpy(router->pool + ofs, s, len);
+  router->pool[ofs + len] = 0;
+  *pool_len += len + 1;
+  return ofs;
+}
+
+void nodec_router_compile(nodec_router_t* router) {
+  if (router->compiled) return;
+  router_compiled_free(router);
+  size_t count = router->node_count;
+  router->nodes = nodec_zero_alloc_n(count, route_node_t);
+  router->pool = nodec_alloc_n(router->pool_size + 1, char);
+  router->handlers = nodec_alloc_n(router->handler_count + 1, route_handler_t);
+  rnode_t** order = nodec_alloc_n(count, rnode_t*);
+  {using_free(order) {
+    // breadth first so the static children of each node are consecutive
+    size_t pool_len = 0;
+    size_t handler_count = 0;
+    size_t next = 1;
+    order[0] = router->root;
+    for (size_t i = 0; i < next; i++) {
+      const rnode_t* b = order[i];
+      route_node_t* n = &router->nodes[i];
+      n->label = router_pool_add(router, &pool_len, b->label, b->label_len);
+      n->label_len = (uint32_t)b->label_len;
+      n->name = (b->name == NULL ? n->label : router_pool_add(router, &pool_len, b->name, strlen(b->name)));
+      n->first_child = (uint32_t)next;
+      for (rnode_t* c = b->children; c != NULL; c = c->next) {
+        order[next++] = c;
+        n->child_count++;
+      }
+      n->param = -1;
+      n->wildcard = -1;
+      if (b->param != NULL) {
+        n->param = (int32_t)next;
+        order[next++] = b->param;
+      }
+      if (b->wildcard != NULL) {
+        n->wildcard = (int32_t)next;
+        order[next++] = b->wildcard;
+      }
+      n->handlers = (uint32_t)handler_count;
+      n->handler_count = (uint32_t)b->handler_count;
+      for (size_t h = 0; h < b->handler_count; h++) {
+        router->handlers[handler_count++] = b->handlers[h];
+      }
+    }
+    assert(next == count);
+  }}
+  router->compiled = true;
+}
+
+
+/*-----------------------------------------------------------------
+  Matching
+-----------------------------------------------------------------*/
+
+typedef struct _route_match_t {
+  const nodec_router_t* router;
+  uint64_t              method;
+  nodec_route_param_t*  params;
+  size_t                capacity;
+  size_t                count;
+  bool                  path_matched;   // matched a path but not the method
+} route_match_t;
+
+static nodec_http_servefun* route_handler_find(route_match_t* m, const route_node_t* n) {
+  if (n->handler_count == 0) return NULL;
+  m->path_matched = true;
+  const route_handler_t* h = &m->router->handlers[n->handlers];
+  for (uint32_t i = 0; i < n->handler_count; i++) {
+    if ((h[i].methods & m->method) != 0) return h[i].servefun;
+  }
+  return NULL;
+}
+
+static nodec_http_servefun* route_match_node(route_match_t* m, uint32_t index, const char* path, size_t len, size_t count) {
+  const nodec_router_t* router = m->router;
+  const route_node_t* n = &router->nodes[index];
+  if (n->label_len > len || memcmp(router->pool + n->label, path, n->label_len) != 0) return NULL;
+  path += n->label_len;
+  len -= n->label_len;
+  nodec_http_servefun* fun;
+  if (len == 0) {
+    fun = route_handler_find(m, n);
+    if (fun != NULL) {
+      m->count = count;
+      return fun;
+    }
+  }
+  else if (n->child_count > 0) {
+    // binary search the static child on the first character
+    const route_node_t* children = &router->nodes[n->first_child];
+    uint32_t lo = 0;
+    uint32_t hi = n->child_count;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      char c = router->pool[children[mid].label];
+      if (c == path[0]) {
+        fun = route_match_node(m, n->first_child + mid, path, len, count);
+        if (fun != NULL) return fun;
+        break;
+      }
+      else if ((unsigned char)c < (unsigned char)path[0]) lo = mid + 1;
+      else hi = mid;
+    }
+  }
+  if (n->param >= 0 && len > 0 && count < m->capacity) {
+    const char* end = (const char*)memchr(path, '/', len);
+    size_t seg = (end == NULL ? len : (size_t)(end - path));
+    if (seg > 0) {
+      nodec_route_param_t* p = &m->params[count];
+      p->name = router->pool + router->nodes[n->param].name;
+      p->value = path;
+      p->len = seg;
+      fun = route_match_node(m, (uint32_t)n->param, path + seg, len - seg, count + 1);
+      if (fun != NULL) return fun;
+    }
+  }
+  if (n->wildcard >= 0 && count < m->capacity) {
+    const route_node_t* w = &router->nodes[n->wildcard];
+    fun = route_handler_find(m, w);
+    if (fun != NULL) {
+      nodec_route_param_t* p = &m->params[count];
+      p->name = router->pool + w->name;
+      p->value = path;
+      p->len = len;
+      m->count = count + 1;
+      return fun;
+    }
+  }
+  return NULL;
+}
+
+static nodec_http_servefun* router_match(nodec_router_t* router, http_method_t method, const char* path, size_t path_len,
+                                         nodec_route_param_t* params, size_t* param_count, bool* path_matched)
+{
+  nodec_router_compile(router);
+  nodec_route_param_t scratch[NODEC_ROUTE_PARAMS_MAX];
+  size_t capacity = (param_count == NULL ? 0 : *param_count);
+  if (params == NULL) {
+    params = scratch;
+    capacity = NODEC_ROUTE_PARAMS_MAX;
+  }
+  route_match_t m;
+  m.router = router;
+  m.method = ((int)method >= 0 && (int)method < 64 ? UINT64_C(1) << method : 0);
+  m.params = params;
+  m.capacity = capacity;
+  m.count = 0;
+  m.path_matched = false;
+  nodec_http_servefun* fun = (path_len == 0 ? NULL : route_match_node(&m, 0, path, path_len, 0));
+  if (param_count != NULL) *param_count = (fun == NULL ? 0 : m.count);
+  if (path_matched != NULL) *path_matched = m.path_matched;
+  return fun;
+}
+
+nodec_http_servefun* nodec_router_match(nodec_router_t* router, http_method_t method, const char* path, size_t path_len,
+                                        nodec_route_param_t* params, size_t* param_count)
+{
+  return router_match(router, method, path, path_len, params, param_count, NULL);
+}
+
+
+/*-----------------------------------------------------------------
+  Serving
+-----------------------------------------------------------------*/
+
+typedef struct _route_params_t {
+  const nodec_route_param_t* params;
+  size_t count;
+} route_params_t;
+
+static implicit_define(http_route_params)
+
+bool http_router_serve(nodec_router_t* router) {
+  // use the raw URL to avoid parsing it; only absolute URLs need the parsed path
+  const char* path = http_req_url();
+  size_t path_len;
+  if (path != NULL && path[0] == '/') {
+    path_len = strcspn(path, "?#");
+  }
+  else {
+    path = http_req_path();
+    path_len = (path == NULL ? 0 : strlen(path));
+  }
+  nodec_route_param_t params[NODEC_ROUTE_PARAMS_MAX];
+  size_t count = NODEC_ROUTE_PARAMS_MAX;
+  bool path_matched = false;
+  nodec_http_servefun* servefun = router_match(router, http_req_method(), path, path_len, params, &count, &path_matched);
+  if (servefun == NULL) {
+    if (path_matched) throw_http_err(HTTP_STATUS_METHOD_NOT_ALLOWED);
+    return false;
+  }
+  route_params_t rparams = { params, count };
+  {using_implicit(lh_value_any_ptr(&rparams), http_route_params) {
+    servefun();
+  }}
+  return true;
+}
+
+const char* http_req_param(const char* name, size_t* len) {
+  const route_params_t* rparams = (const route_params_t*)lh_ptr_value(implicit_get(http_route_params));
+  if (len != NULL) *len = 0;
+  if (rparams == NULL || name == NULL) return NULL;
+  for (size_t i = 0; i < rparams->count; i++) {
+    if (strcmp(rparams->params[i].name, name) == 0) {
+      if (len != NULL) *len = rparams->params[i].len;
+      return rparams->params[i].value;
+    }
+  }
+  return NULL;
+}
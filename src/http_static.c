@@ -97,6 +97,7 @@ static lh_value http_try_send_file(uv_file file, const char* path, lh_value stat
     const char* accept_enc = http_req_header("Accept-Encoding");
     gzip = (accept_enc != NULL && strstr(accept_enc, "gzip") != NULL);
   }
+  int gzip_level = (config->gzip_level == 0 ? 6 : config->gzip_level);
   if (gzip) {
     printf("use gzip response\n");
     http_resp_add_header("Content-Encoding", "gzip");
@@ -108,11 +109,22 @@ static lh_value http_try_send_file(uv_file file, const char* path, lh_value stat
   }
   else {
     // Otherwise send the body 
-    if (gzip) {
+    if (gzip && size <= config->read_buf_size) {
+      // small enough to read in one go: compress at once and send with an exact Content-Length
+      uv_buf_t buf = async_fs_read_buf(file, size, -1);
+      {using_buf(&buf) {
+        uv_buf_t zbuf = nodec_zstream_compress_buf(buf, gzip_level, true);
+        {using_buf(&zbuf) {
+          http_resp_send_body_buf(HTTP_STATUS_OK, zbuf, content_type);
+        }}
+      }}
+      return lh_value_int(size);
+    }
+    else if (gzip) {
       // TODO: check if <filename>.gz exists and use that if possible instead of zipping at runtime
       // send zipped content in chunks (as we don't know the final length)
       stream = http_resp_send_status_body(HTTP_STATUS_OK, NODEC_CHUNKED, content_type);
-      stream = as_stream(nodec_zstream_alloc(stream,true)); // gzip'd stream
+      stream = as_stream(nodec_zstream_alloc_ex(stream,true,gzip_level,true)); // gzip'd stream
     }
     else {
       // send as one body
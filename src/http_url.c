@@ -24,6 +24,27 @@ void nodec_url_freev(lh_value urlv) {
   nodec_url_free((nodec_url_t*)lh_ptr_value(urlv));
 }
 
+// Parse the url in `nurl->urlmem` and 0-terminate all fields in place
+static int nodecx_url_parse_mem(nodec_url_t* nurl, bool onlyhost) {
+  int err = http_parser_parse_url(nurl->urlmem.base, nurl->urlmem.len, (onlyhost ? 1 : 0), &nurl->parts);
+  if (err == 0) {
+    // 0-terminate all fields in our private memory
+    for (enum http_parser_url_fields f = 0; f < UF_MAX; f++) {
+      if (((1 << f) & nurl->parts.field_set) != 0) {
+        size_t ofs = nurl->parts.field_data[f].off;
+        size_t len = nurl->parts.field_data[f].len;
+        if (f == UF_PATH) { // don't consider starting slash
+          ofs++; 
+          len--;
+        }
+        assert(ofs + len <= nurl->urlmem.len);
+        nurl->urlmem.base[ofs + len] = 0;
+      }
+    }
+  }
+  return err;
+}
+
 static nodec_url_t*  nodecx_parse_urlx(const char* url, bool onlyhost) {
   int err;
   nodec_url_t* nurl = nodec_zero_alloc(nodec_url_t);
@@ -38,22 +59,7 @@ static nodec_url_t*  nodecx_parse_urlx(const char* url, bool onlyhost) {
     }
     nurl->original = url;
     // and parse it
-    err = http_parser_parse_url(nurl->urlmem.base, nurl->urlmem.len, (onlyhost ? 1 : 0), &nurl->parts);
-    if (err == 0) {
-      // 0-terminate all fields in our private memory
-      for (enum http_parser_url_fields f = 0; f < UF_MAX; f++) {
-        if (((1 << f) & nurl->parts.field_set) != 0) {
-          size_t ofs = nurl->parts.field_data[f].off;
-          size_t len = nurl->parts.field_data[f].len;
-          if (f == UF_PATH) { // don't consider starting slash
-            ofs++; 
-            len--;
-          }
-          assert(ofs + len <= nurl->urlmem.len);
-          nurl->urlmem.base[ofs + len] = 0;
-        }
-      }
-    }
+    err = nodecx_url_parse_mem(nurl, onlyhost);
   }}
   if (err != 0) {
     nodec_url_free(nurl);
@@ -64,6 +70,28 @@ static nodec_url_t*  nodecx_parse_urlx(const char* url, bool onlyhost) {
   }
 }
 
+// Parse a request target (like `/index.html?x=1`) at a host (from the `Host` header).
+// Allocates the url memory once at the exact size; returns NULL on a parse error.
+nodec_url_t* nodecx_parse_url_at(const char* host, const char* target) {
+  if (host == NULL) host = "";
+  if (target == NULL) target = "/";
+  size_t hlen = strlen(host);
+  size_t tlen = strlen(target);
+  nodec_url_t* nurl = nodec_zero_alloc(nodec_url_t);
+  {on_abort(nodec_url_freev, lh_value_ptr(nurl)) {
+    nurl->urlmem = nodec_buf_alloc(7 + hlen + tlen);
+    memcpy(nurl->urlmem.base, "http://", 7);
+    memcpy(nurl->urlmem.base + 7, host, hlen);
+    memcpy(nurl->urlmem.base + 7 + hlen, target, tlen + 1);
+    nurl->original = target;
+  }}
+  if (nodecx_url_parse_mem(nurl, false) != 0) {
+    nodec_url_free(nurl);
+    return NULL;
+  }
+  return nurl;
+}
+
 static nodec_url_t*  nodec_parse_urlx(const char* url, bool onlyhost) {
   nodec_url_t* nurl = nodecx_parse_urlx(url, onlyhost);
   if (nurl == NULL) {
@@ -9,10 +9,20 @@ found in the file "license.txt" at the root of this distribution.
 #include "nodec-internal.h"
 #include <assert.h>
 
-static void nodec_https_serve(int id, nodec_bstream_t* client, lh_value servefunv) {
+// Protocols offered with ALPN when HTTP/2 is enabled
+static const char* https_alpn_protocols[] = { "h2", "http/1.1", NULL };
+
+static void nodec_https_serve(int id, nodec_bstream_t* client, lh_value sargsv) {
+  http_server_args_t* sargs = (http_server_args_t*)lh_ptr_value(sargsv);
   nodec_tls_stream_t* ts = (nodec_tls_stream_t*)client;
   nodec_tls_stream_handshake(ts);
-  nodec_http_serve(id, client, servefunv);
+  const char* alpn = (sargs->http2 ? nodec_tls_stream_alpn(ts) : NULL);
+  if (alpn != NULL && strcmp(alpn, "h2") == 0) {
+    async_http2_serve(id, client, sargs->servefun);
+  }
+  else {
+    nodec_http_serve_with(id, client, sargsv);
+  }
 }
 
 static void https_connection_wrap(const tcp_connection_args* args, lh_value sslv) {
@@ -21,6 +31,7 @@ static void https_connection_wrap(const tcp_connection_args* args, lh_value sslv
   {using_bstream(client) {
     tcp_connection_args targs = *args;
     targs.client = client; // overwrite encrypted client 
+    targs.reaper = NULL;   // the TLS state lives on this strand so we cannot park
     nodec_tcp_connection_wrap(&targs, lh_value_null);
   }}
 }
@@ -29,13 +40,15 @@ void async_https_server_at(const char* host, tcp_server_config_t* tcp_config, no
   tcp_server_config_t default_config = tcp_server_config();
   if (tcp_config == NULL) tcp_config = &default_config;
   tcp_config->timeout_total = 0;
+  http_server_args_t sargs = { servefun, tcp_config->pipeline, tcp_config->http2 };
+  if (sargs.http2) nodec_ssl_config_alpn(ssl_config, https_alpn_protocols);
   struct sockaddr* addr = nodec_parse_sockaddr(host);
   {using_sockaddr(addr) {
     async_tcp_server_at_ex(addr, tcp_config,
       &nodec_https_serve,
       &https_connection_wrap,
       &async_write_http_exnv,
-      lh_value_ptr(servefun),
+      lh_value_any_ptr(&sargs),
       lh_value_any_ptr(ssl_config));
   }}
 }
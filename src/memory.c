@@ -177,6 +177,7 @@ uv_buf_t nodec_buf_append_into(uv_buf_t buf1, uv_buf_t buf2) {
   uv_buf_t buf = nodec_buf_ensure_ex(buf1, needed, needed, 0);
   memcpy(buf.base + buf1.len, buf2.base, buf2.len);
   buf.base[needed] = 0;
+  buf.len = (uv_buf_len_t)needed;  // the length is the contents so we can append again
   return buf;
 }
 
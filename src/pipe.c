@@ -0,0 +1,65 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+
+/*-----------------------------------------------------------------
+  Unix domain sockets and named pipes.
+  These reuse the TCP server (accept queue, admission control, and
+  keep-alive) and read streams; only listening and connecting differ.
+-----------------------------------------------------------------*/
+
+uv_pipe_t* nodec_pipe_alloc() {
+  uv_pipe_t* pipe = nodec_zero_alloc(uv_pipe_t);
+  nodec_check(uv_pipe_init(async_loop(), pipe, 0));
+  return pipe;
+}
+
+void nodec_pipe_free(uv_pipe_t* pipe) {
+  nodec_uv_stream_free((uv_stream_t*)pipe);
+}
+
+void nodec_pipe_freev(lh_value pipe) {
+  nodec_pipe_free((uv_pipe_t*)lh_ptr_value(pipe));
+}
+
+static tcp_channel_t* nodec_pipe_listen_at(const char* path, const tcp_server_config_t* config) {
+  uv_pipe_t* pipe = nodec_pipe_alloc();
+  tcp_channel_t* ch = NULL;
+  {on_abort(nodec_pipe_freev, lh_value_ptr(pipe)) {
+    nodec_check_msg(uv_pipe_bind(pipe, path), path);
+    ch = nodec_stream_listen_ex((uv_stream_t*)pipe, config->backlog, config->accept_queue, true);
+  }}
+  return ch;
+}
+
+void async_pipe_server_at(const char* path, tcp_server_config_t* config, nodec_tcp_connection_fun_t* servefun, lh_actionfun* on_exn, lh_value arg)
+{
+  tcp_server_config_t default_config = tcp_server_config();
+  if (config == NULL) config = &default_config;
+  tcp_channel_t* ch = nodec_pipe_listen_at(path, config);
+  {using_tcp_channel(ch) {
+    async_stream_server_on(ch, config, servefun, &nodec_tcp_connection_wrap, on_exn, arg, lh_value_null);
+  }}
+}
+
+static void connect_cb(uv_connect_t* req, int status) {
+  async_req_resume((uv_req_t*)req, status >= 0 ? 0 : status);
+}
+
+nodec_bstream_t* async_pipe_connect(const char* path) {
+  uv_pipe_t* pipe = nodec_pipe_alloc();
+  {on_abort(nodec_pipe_freev, lh_value_ptr(pipe)) {
+    {using_req(uv_connect_t, req) {
+      uv_pipe_connect(req, pipe, path, &connect_cb);
+      nodec_check_msg(asyncx_await_once((uv_req_t*)req), path);
+    }}
+  }}
+  return nodec_bstream_alloc_read((uv_stream_t*)pipe);
+}
@@ -42,6 +42,10 @@ void async_write_bufs(nodec_stream_t* stream, uv_buf_t bufs[], size_t count) {
   stream->write_bufs(stream, bufs, count);
 }
 
+void async_flush(nodec_stream_t* stream) {
+  if (stream->flush != NULL) stream->flush(stream);
+}
+
 void nodec_stream_init(nodec_stream_t* stream,
   async_read_bufx_fun*  read_bufx,
   async_write_bufs_fun* write_bufs,
@@ -52,6 +56,21 @@ void nodec_stream_init(nodec_stream_t* stream,
   stream->write_bufs = write_bufs;
   stream->shutdown = shutdown;
   stream->stream_free = stream_free;
+  stream->flush = NULL;
+  stream->write_queued = NULL;
+}
+
+void nodec_stream_set_flush(nodec_stream_t* stream, async_flush_fun* flush) {
+  stream->flush = flush;
+}
+
+void nodec_stream_set_write_queued(nodec_stream_t* stream, nodec_write_queued_fun* write_queued) {
+  stream->write_queued = write_queued;
+}
+
+size_t nodec_stream_write_queued(nodec_stream_t* stream) {
+  if (stream == NULL || stream->write_queued == NULL) return 0;
+  return stream->write_queued(stream);
 }
 
 void nodec_stream_release(nodec_stream_t* stream) {
@@ -547,17 +566,61 @@ static void async_bufstream_free(nodec_stream_t* stream) {
   nodec_free(bs);
 }
 
+static size_t nodec_bufstream_write_queued(nodec_stream_t* stream) {
+  nodec_bstream_t* bs = (nodec_bstream_t*)stream;
+  return nodec_stream_write_queued(bs->source);
+}
+
 nodec_bstream_t* nodec_bstream_alloc_on(nodec_stream_t* source) {
   nodec_bstream_t* bs = nodec_zero_alloc(nodec_bstream_t);
   nodec_bstream_init(bs,
     &async_bufstream_read_chunk, &nodec_chunks_pushback_buf,
     &async_bufstream_read_bufx, &async_bufstream_write_bufs,
     &async_bufstream_shutdown, &async_bufstream_free);
+  nodec_stream_set_write_queued(&bs->stream_t, &nodec_bufstream_write_queued);
   bs->source = source;
   return bs;
 }
 
 
+/* ----------------------------------------------------------------------------
+Buffer streams: read from a buffer in memory
+-----------------------------------------------------------------------------*/
+
+static uv_buf_t async_memstream_read_bufx(nodec_stream_t* stream, bool* owned) {
+  nodec_bstream_t* bs = (nodec_bstream_t*)stream;
+  if (owned != NULL) *owned = true;
+  return chunks_read_buf(&bs->chunks);  // null at the end
+}
+
+static bool async_memstream_read_chunk(nodec_bstream_t* bs, nodec_chunk_read_t read_mode, size_t read_to_eof_max) {
+  return true;  // all data is available
+}
+
+static void nodec_memstream_free(nodec_stream_t* stream) {
+  nodec_bstream_t* bs = (nodec_bstream_t*)stream;
+  nodec_bstream_release(bs);
+  nodec_free(bs);
+}
+
+nodec_bstream_t* nodec_bstream_alloc_buf(uv_buf_t buf) {
+  nodec_bstream_t* bs = NULL;
+  {using_buf_on_abort_free(&buf) {
+    bs = nodec_zero_alloc(nodec_bstream_t);
+  }}
+  nodec_bstream_init(bs,
+    &async_memstream_read_chunk, &nodec_chunks_pushback_buf,
+    &async_memstream_read_bufx, NULL, NULL, &nodec_memstream_free);
+  uv_errno_t err = chunksx_push(&bs->chunks, buf, (nodec_buf_is_null(buf) ? 0 : buf.len));  // frees an empty buffer
+  if (err != 0) {
+    nodec_buf_free(buf);
+    nodec_memstream_free(&bs->stream_t);
+    nodec_check(err);
+  }
+  return bs;
+}
+
+
 
 
 /* ----------------------------------------------------------------------------
@@ -636,6 +699,10 @@ struct _nodec_uv_stream_t {
   volatile size_t     read_total;    // total bytes read until now (available <= total)
   volatile bool       eof;           // true if end-of-file reached
   volatile uv_errno_t err;           // !=0 on error
+  nodec_uv_stream_ready_fun* ready_fun;  // called once on new data or eof when no strand awaits the stream
+  void*           ready_arg;
+  size_t          read_high_water;  // stop reading when this much data is available but not yet consumed (0 = unlimited)
+  bool            read_paused;   // true if reading was stopped at the high water mark
 };
 
 
@@ -655,6 +722,11 @@ static void nodecx_uv_stream_push(nodec_uv_stream_t* rs, const uv_buf_t buf, siz
     if (rs->read_to_eof_max > 0) {
       rs->read_to_eof_max = (rs->read_to_eof_max < nread ? 0 : rs->read_to_eof_max - nread);      
     }
+    if (rs->read_high_water > 0 && !rs->read_paused && nodec_chunks_available(&rs->bstream_t) >= rs->read_high_water) {
+      // apply back pressure: stop reading until a reader needs more data
+      uv_read_stop(rs->stream);
+      rs->read_paused = true;
+    }
   }  
 }
 
@@ -665,6 +737,24 @@ static void nodec_uv_stream_try_resume(nodec_uv_stream_t* rs) {
   async_req_resume(req, rs->err);
 }
 
+// Resume the awaiting strand, or call the ready callback if no strand is waiting.
+// This may free the stream so it should be called last.
+static void nodec_uv_stream_signal(nodec_uv_stream_t* rs) {
+  if (rs->req != NULL) {
+    nodec_uv_stream_try_resume(rs);
+  }
+  else if (rs->ready_fun != NULL) {
+    nodec_uv_stream_ready_fun* fun = rs->ready_fun;
+    rs->ready_fun = NULL;
+    fun(rs->stream, rs->ready_arg);
+  }
+}
+
+void nodec_uv_stream_on_ready(nodec_uv_stream_t* rs, nodec_uv_stream_ready_fun* fun, void* arg) {
+  rs->ready_fun = fun;
+  rs->ready_arg = arg;
+}
+
 /*
 static void nodec_uv_stream_try_resumev(void* rsv) {
   nodec_uv_stream_try_resume((nodec_uv_stream_t*)rsv);
@@ -687,6 +777,7 @@ static  uverr_t asyncx_uv_stream_await(nodec_uv_stream_t* rs, bool wait_even_if_
   if ((wait_even_if_available || nodec_chunks_available(&rs->bstream_t) == 0) && rs->err == 0 && !rs->eof) {
     // await an event
     if (rs->req != NULL) lh_throw_str(UV_EINVAL, "only one strand can await a read stream");
+    if (rs->read_paused) nodec_uv_stream_read_restart(rs);
     uv_req_t* req = nodec_zero_alloc(uv_req_t);
     rs->req = req;
     {defer(nodec_uv_stream_freereqv, lh_value_ptr(rs)) {
@@ -710,6 +801,14 @@ uv_errno_t asyncx_uv_stream_await_available(nodec_uv_stream_t* stream, int64_t t
   return asyncx_uv_stream_await(stream, false, timeout);
 }
 
+uv_errno_t nodecx_uv_stream_check_idle(nodec_uv_stream_t* rs) {
+  if (rs == NULL) return UV_EINVAL;
+  if (rs->err != 0) return rs->err;
+  if (rs->eof) return UV_EOF;
+  if (nodec_chunks_available(&rs->bstream_t) > 0) return UV_EPROTO;  // unexpected data
+  return 0;
+}
+
 
 static void nodec_uv_stream_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
   if (handle == NULL) return;
@@ -744,7 +843,7 @@ static void _nodec_uv_stream_cb(uv_stream_t* stream, ssize_t nread, const uv_buf
       // data available
       nodecx_uv_stream_push(rs, *buf, (size_t)nread);
       if (rs->read_to_eof_max == 0 || rs->eof) {
-        nodec_uv_stream_try_resume(rs);
+        nodec_uv_stream_signal(rs);
       }
     }
     else if (nread < 0) {
@@ -755,7 +854,7 @@ static void _nodec_uv_stream_cb(uv_stream_t* stream, ssize_t nread, const uv_buf
         rs->eof = true;
       }
       uv_read_stop(stream);       // no more reading
-      nodec_uv_stream_try_resume(rs);
+      nodec_uv_stream_signal(rs);
     }
     else {
       // E_AGAIN or E_WOULDBLOCK (but not EOF)
@@ -766,10 +865,15 @@ static void _nodec_uv_stream_cb(uv_stream_t* stream, ssize_t nread, const uv_buf
 }
 
 void nodec_uv_stream_read_restart(nodec_uv_stream_t* rs) {
+  rs->read_paused = false;
   uv_errno_t err = uv_read_start(rs->stream, &nodec_uv_stream_alloc_cb, &_nodec_uv_stream_cb);
   if (err != 0 && err != UV_EALREADY) nodec_check(err);
 }
 
+void nodec_uv_stream_read_high_water(nodec_uv_stream_t* rs, size_t high_water) {
+  rs->read_high_water = high_water;
+}
+
 void nodec_uv_stream_read_start(nodec_uv_stream_t* rs, size_t alloc_init, size_t alloc_max) {
   if (rs->stream->data == NULL) {
     rs->stream->data = rs;
@@ -858,6 +962,12 @@ static void async_uv_stream_shutdownx(nodec_stream_t* stream) {
 }
 
 
+// Bytes libuv could not write yet; used as a load measure for adaptive compression.
+static size_t nodec_uv_stream_write_queued(nodec_stream_t* stream) {
+  nodec_uv_stream_t* rs = (nodec_uv_stream_t*)stream;
+  return (rs->stream != NULL ? rs->stream->write_queue_size : 0);
+}
+
 static void nodec_uv_stream_freex(nodec_stream_t* stream) {
   nodec_uv_stream_t* rs = (nodec_uv_stream_t*)stream;
   nodec_uv_stream_free(rs->stream);
@@ -866,6 +976,25 @@ static void nodec_uv_stream_freex(nodec_stream_t* stream) {
   nodec_free(rs);
 }
 
+// Free a stream that no strand awaits, like a parked or pooled idle connection.
+// Unlike nodec_stream_free this does not use the `nodec_owner_release` operation
+// so it can be called from a libuv callback outside of any handler.
+void nodec_uv_stream_close(nodec_uv_stream_t* rs) {
+  if (rs == NULL) return;
+  assert(rs->req == NULL);
+  uv_stream_t* stream = rs->stream;
+  if (stream != NULL) {
+    if (stream->data != NULL) {
+      uv_read_stop(stream);
+      stream->data = NULL;
+    }
+    if (!uv_is_closing((uv_handle_t*)stream)) uv_close((uv_handle_t*)stream, &close_handle_cb);
+    rs->stream = NULL;
+  }
+  nodec_bstream_release(&rs->bstream_t);
+  nodec_free(rs);
+}
+
 
 nodec_uv_stream_t* nodec_uv_stream_alloc(uv_stream_t* stream) {
   nodec_uv_stream_t* rs = NULL;
@@ -875,6 +1004,7 @@ nodec_uv_stream_t* nodec_uv_stream_alloc(uv_stream_t* stream) {
       &async_uv_stream_read_chunk, &nodec_chunks_pushback_buf,
       &async_uv_stream_read_bufx, &async_uv_stream_write_bufsx,
       &async_uv_stream_shutdownx, &nodec_uv_stream_freex);
+    nodec_stream_set_write_queued(&rs->bstream_t.stream_t, &nodec_uv_stream_write_queued);
     rs->stream = stream;
   }}
   return rs;
@@ -906,8 +1036,8 @@ nodec_bstream_t* nodec_bstream_alloc_read(uv_stream_t* stream) {
 
 typedef struct _nodec_zstream_t {
   nodec_bstream_t bstream;
-  z_stream        read_strm;
-  z_stream        write_strm;
+  z_stream*       read_strm;        // lazily acquired from the zstream pool
+  z_stream*       write_strm;       // lazily acquired from the zstream pool
   uv_buf_t        write_buf;
   nodec_stream_t* source;
   bool            own_source;
@@ -926,28 +1056,271 @@ static void nodec_zfree(void* opaque, void* p) {
   nodec_free(p);
 }
 
+
+/* ----------------------------------------------------------------------------
+  Pool of initialized zlib streams.
+  Initializing a deflate stream allocates about 256kb of window and hash tables
+  which is expensive if done for every (small) response. Instead we keep a pool
+  per event loop of initialized streams keyed by (deflate, level, gzip) and 
+  reuse them using `deflateReset`/`inflateReset`.
+-----------------------------------------------------------------------------*/
+
+typedef struct _zpool_entry_t {
+  z_stream  strm;                   // must be first as we cast from a `z_stream*`
+  struct _zpool_entry_t* next;
+  bool      deflate;
+  int       level;
+  bool      gzip;
+} zpool_entry_t;
+
+typedef struct _zpool_t {
+  zpool_entry_t* entries;           // most recently released first
+  size_t         size;              // estimated memory held by the pooled entries
+  size_t         max_size;
+  nodec_zadaptive_config_t adaptive;
+  uv_timer_t*    lag_timer;         // started on first use of an adaptive level
+  uint64_t       lag_last;          // loop time of the last lag sample
+  uint64_t       lag;               // smoothed event loop lag in ms
+  nodec_zlevel_stats_t stats[10];   // compression statistics per level
+} zpool_t;
+
+implicit_define(zpool)
+
+static zpool_t* zpool_get() {
+  return (zpool_t*)lh_ptr_value(implicit_get(zpool));
+}
+
+// Estimated memory use of an initialized stream (see zlib's `zconf.h` for windowBits 15 and memLevel 8)
+static size_t zpool_entry_size(bool deflate) {
+  return (deflate ? (1 << 17) + (1 << 17) + 6*1024 : (1 << 15) + 7*1024);
+}
+
+static void zpool_entry_free(zpool_entry_t* e) {
+  if (e->deflate) deflateEnd(&e->strm);
+          else inflateEnd(&e->strm);
+  nodec_free(e);
+}
+
+static void zpool_trim(zpool_t* pool, size_t max_size) {
+  zpool_entry_t** pe = &pool->entries;
+  size_t size = 0;
+  while (*pe != NULL) {
+    zpool_entry_t* e = *pe;
+    size_t esize = zpool_entry_size(e->deflate);
+    if (size + esize > max_size) {
+      *pe = e->next;
+      zpool_entry_free(e);
+    }
+    else {
+      size += esize;
+      pe = &e->next;
+    }
+  }
+  pool->size = size;
+}
+
+lh_value _nodec_zpool_allocv() {
+  zpool_t* pool = nodec_zero_alloc(zpool_t);
+  pool->max_size = 4 * 1024 * 1024;  // about 16 deflate streams
+  nodec_zadaptive_config_t adaptive = nodec_zadaptive_default_config();
+  pool->adaptive = adaptive;
+  return lh_value_ptr(pool);
+}
+
+void _nodec_zpool_freev(lh_value poolv) {
+  zpool_t* pool = (zpool_t*)lh_ptr_value(poolv);
+  zpool_trim(pool, 0);
+  if (pool->lag_timer != NULL) nodec_timer_free(pool->lag_timer, false);
+  nodec_free(pool);
+}
+
+void nodec_zstream_pool_set_max(size_t max_size) {
+  zpool_t* pool = zpool_get();
+  pool->max_size = max_size;
+  zpool_trim(pool, max_size);
+}
+
+static z_stream* zpool_acquire(bool deflate, int level, bool gzip) {
+  zpool_t* pool = zpool_get();
+  if (deflate) pool->stats[level].streams++;
+  // find a matching initialized stream
+  for (zpool_entry_t** pe = &pool->entries; *pe != NULL; pe = &(*pe)->next) {
+    zpool_entry_t* e = *pe;
+    if (e->deflate == deflate && e->gzip == gzip && (!deflate || e->level == level)) {
+      *pe = e->next;
+      e->next = NULL;
+      pool->size -= zpool_entry_size(deflate);
+      return &e->strm;
+    }
+  }
+  // otherwise initialize a fresh one
+  zpool_entry_t* e = nodec_zero_alloc(zpool_entry_t);
+  e->deflate = deflate;
+  e->level = level;
+  e->gzip = gzip;
+  e->strm.zalloc = &nodec_zalloc;
+  e->strm.zfree = &nodec_zfree;
+  e->strm.opaque = Z_NULL;
+  e->strm.avail_in = 0;
+  e->strm.next_in = Z_NULL;
+  int res;
+  if (deflate) {
+    res = deflateInit2(&e->strm, level, Z_DEFLATED, 15 + (gzip ? 16 : 0), 8, Z_DEFAULT_STRATEGY);
+  }
+  else {
+    res = inflateInit2(&e->strm, 15 + (gzip ? 32 : 0)); // read either gzip or zlib
+  }
+  if (res != Z_OK) {
+    nodec_free(e);
+    nodec_check_msg(UV_ENOMEM, (deflate ? "cannot initialize deflate" : "cannot initialize inflate"));
+  }
+  return &e->strm;
+}
+
+static void zpool_release(z_stream* strm) {
+  if (strm == NULL) return;
+  zpool_entry_t* e = (zpool_entry_t*)strm;
+  zpool_t* pool = zpool_get();
+  size_t esize = zpool_entry_size(e->deflate);
+  int res = (e->deflate ? deflateReset(strm) : inflateReset(strm));
+  if (res != Z_OK || pool->size + esize > pool->max_size) {
+    zpool_entry_free(e);
+  }
+  else {
+    e->next = pool->entries;
+    pool->entries = e;
+    pool->size += esize;
+  }
+}
+
+
+static void zpool_releasev(lh_value strmv) {
+  zpool_release((z_stream*)lh_ptr_value(strmv));
+}
+
+
+/* ----------------------------------------------------------------------------
+  Adaptive compression levels and statistics
+-----------------------------------------------------------------------------*/
+
+#define LAG_INTERVAL  (100)   // sample the event loop lag every 100ms
+
+static void _lag_timer_cb(uv_timer_t* timer) {
+  zpool_t* pool = (zpool_t*)timer->data;
+  uint64_t now = uv_now(timer->loop);
+  uint64_t late = now - pool->lag_last;
+  uint64_t sample = (late > LAG_INTERVAL ? late - LAG_INTERVAL : 0);
+  pool->lag = (3*pool->lag + sample) / 4;  // exponential moving average
+  pool->lag_last = now;
+}
+
+static void zpool_lag_start(zpool_t* pool) {
+  if (pool->lag_timer != NULL) return;
+  pool->lag_timer = nodec_timer_alloc();
+  pool->lag_timer->data = pool;
+  pool->lag_last = uv_now(async_loop());
+  uv_unref((uv_handle_t*)pool->lag_timer);  // don't keep the loop alive
+  nodec_check(uv_timer_start(pool->lag_timer, &_lag_timer_cb, LAG_INTERVAL, LAG_INTERVAL));
+}
+
+// Return the load between 0.0 and 1.0 for a measure between `low` and `high`
+static double zload(double x, double low, double high) {
+  if (x <= low) return 0.0;
+  if (x >= high || high <= low) return 1.0;
+  return (x - low) / (high - low);
+}
+
+void nodec_zstream_adaptive_set(const nodec_zadaptive_config_t* config) {
+  zpool_t* pool = zpool_get();
+  if (config != NULL) {
+    pool->adaptive = *config;
+  }
+  else {
+    nodec_zadaptive_config_t adaptive = nodec_zadaptive_default_config();
+    pool->adaptive = adaptive;
+  }
+}
+
+int nodec_zstream_adaptive_level(nodec_stream_t* stream) {
+  zpool_t* pool = zpool_get();
+  zpool_lag_start(pool);
+  const nodec_zadaptive_config_t* config = &pool->adaptive;
+  double load_lag = zload((double)pool->lag, (double)config->lag_low, (double)config->lag_high);
+  double load_queued = zload((double)nodec_stream_write_queued(stream), (double)config->queued_low, (double)config->queued_high);
+  double load = (load_lag > load_queued ? load_lag : load_queued);
+  int level = config->level_max - (int)(load * (config->level_max - config->level_min) + 0.5);
+  return (level < 1 ? 1 : (level > 9 ? 9 : level));
+}
+
+// Resolve adaptive and default levels to an actual level between 0 and 9
+static int zlevel_resolve(int level, nodec_stream_t* stream) {
+  if (level == NODEC_ZLEVEL_ADAPTIVE) return nodec_zstream_adaptive_level(stream);
+  if (level < 0 || level > 9) return 6;
+  return level;
+}
+
+static void zlevel_stats_add(int level, size_t bytes_in, size_t bytes_out, uint64_t start) {
+  nodec_zlevel_stats_t* stats = &zpool_get()->stats[level];
+  stats->bytes_in += bytes_in;
+  stats->bytes_out += bytes_out;
+  stats->elapsed_usecs += (uv_hrtime() - start) / 1000;
+}
+
+void nodec_zstream_level_stats(int level, nodec_zlevel_stats_t* stats) {
+  if (stats == NULL) return;
+  if (level < 0 || level > 9) {
+    memset(stats, 0, sizeof(nodec_zlevel_stats_t));
+  }
+  else {
+    *stats = zpool_get()->stats[level];
+  }
+}
+
+
+/* ----------------------------------------------------------------------------
+  One-shot compression of a complete buffer
+-----------------------------------------------------------------------------*/
+
+uv_buf_t nodec_zstream_compress_buf(uv_buf_t src, int compress_level, bool gzip) {
+  if (src.len > UINT_MAX) nodec_check(UV_E2BIG);
+  compress_level = zlevel_resolve(compress_level, NULL);
+  uint64_t start = uv_hrtime();
+  uv_buf_t dest = nodec_buf_null();
+  z_stream* strm = zpool_acquire(true, compress_level, gzip);
+  {defer(zpool_releasev, lh_value_ptr(strm)) {
+    // compress in one go into a buffer that is guaranteed large enough
+    dest = nodec_buf_alloc(deflateBound(strm, (uLong)src.len));
+    strm->avail_in = (uInt)src.len;
+    strm->next_in = (void*)src.base;
+    strm->avail_out = (uInt)dest.len;
+    strm->next_out = (void*)dest.base;
+    int res = deflate(strm, Z_FINISH);
+    if (res != Z_STREAM_END) {
+      nodec_buf_free(dest);
+      nodec_check_msg(UV_EINVAL, "cannot compress buffer");
+    }
+    dest = nodec_buf_fit(dest, dest.len - strm->avail_out);
+  }}
+  zlevel_stats_add(compress_level, src.len, dest.len, start);
+  return dest;
+}
+
+
+/* ----------------------------------------------------------------------------
+  (G)Zip stream implementation
+-----------------------------------------------------------------------------*/
+
 static void nodec_zstream_init_read(nodec_zstream_t* zs) {
-  if (zs->read_strm.zalloc == NULL) {
-    zs->read_strm.zalloc = &nodec_zalloc;
-    zs->read_strm.zfree = &nodec_zfree;
-    zs->read_strm.opaque = Z_NULL;
-    zs->read_strm.avail_in = 0;
-    zs->read_strm.next_in = Z_NULL;
-    int res = inflateInit2(&zs->read_strm, 15 + (zs->gzip ? 32 : 0)); // read either gzip or zlib
-    if (res != 0) nodec_check_msg(UV_ENOMEM, "cannot initialize inflate");
+  if (zs->read_strm == NULL) {
+    zs->read_strm = zpool_acquire(false, 0, zs->gzip);
   }
 }
 
 static void nodec_zstream_init_write(nodec_zstream_t* zs) {
-  if (zs->write_strm.zalloc == NULL) {
-    zs->write_strm.zalloc = &nodec_zalloc;
-    zs->write_strm.zfree = &nodec_zfree;
-    zs->write_strm.opaque = Z_NULL;
-    zs->write_strm.avail_in = 0;
-    zs->write_strm.next_in = Z_NULL;
-    int res = deflateInit2(&zs->write_strm, zs->compress_level, Z_DEFLATED, 15 + (zs->gzip ? 16 : 0), 8, Z_DEFAULT_STRATEGY);
-    if (res != 0) nodec_check_msg(UV_ENOMEM, "cannot initialize deflate");
-    zs->write_buf = nodec_buf_alloc(zs->chunk_size);
+  if (zs->write_strm == NULL) {
+    // acquire first so the buffer is not allocated again if the acquire throws
+    zs->write_strm = zpool_acquire(true, zs->compress_level, zs->gzip);
+    if (nodec_buf_is_null(zs->write_buf)) zs->write_buf = nodec_buf_alloc(zs->chunk_size);
   }
 }
 
@@ -959,23 +1332,23 @@ static bool async_zstream_read_chunks(nodec_zstream_t* zs)
   uv_buf_t src = async_read_bufx(zs->source, &owned);
   // if (nodec_buf_is_null(src)) return true;  // eof
   {using_buf_owned(owned, &src) {
-    zs->read_strm.avail_in = src.len;
-    zs->read_strm.next_in = (void*)src.base;
+    zs->read_strm->avail_in = src.len;
+    zs->read_strm->next_in = (void*)src.base;
     zs->nread += src.len;
     // decompress while data available into chunks
     do {
       uv_buf_t dest = nodec_buf_alloc(zs->chunk_size);
-      zs->read_strm.avail_out = dest.len;
-      zs->read_strm.next_out = (void*)dest.base;
-      res = inflate(&zs->read_strm, (src.len==0 ? Z_SYNC_FLUSH: Z_NO_FLUSH));
+      zs->read_strm->avail_out = dest.len;
+      zs->read_strm->next_out = (void*)dest.base;
+      res = inflate(zs->read_strm, (src.len==0 ? Z_SYNC_FLUSH: Z_NO_FLUSH));
       if (res >= Z_OK) { // can be Z_STREAM_END
-        size_t nwritten = dest.len - zs->read_strm.avail_out;
+        size_t nwritten = dest.len - zs->read_strm->avail_out;
         chunks_push(&zs->bstream.chunks, dest, nwritten);
       }
       else {
         nodec_check_msg(UV_EINVAL, "invalid gzip data");
       }
-    } while (res == Z_OK && zs->read_strm.avail_out == 0);  // while fully written buffers
+    } while (res == Z_OK && zs->read_strm->avail_out == 0);  // while fully written buffers
   }}
   return (res == Z_STREAM_END);
 }
@@ -1008,20 +1381,23 @@ static bool async_zstream_read_chunk(nodec_bstream_t* s, nodec_chunk_read_t read
 static void async_zstream_write_buf(nodec_zstream_t* zs, uv_buf_t src, int flush) {
   nodec_zstream_init_write(zs);
   zs->nwritten += src.len;
-  zs->write_strm.avail_in = src.len;
-  zs->write_strm.next_in = (void*)src.base;
+  zs->write_strm->avail_in = src.len;
+  zs->write_strm->next_in = (void*)src.base;
   int res = 0;
   do {
-    zs->write_strm.avail_out = zs->write_buf.len;
-    zs->write_strm.next_out = (void*)zs->write_buf.base;
-    res = deflate(&zs->write_strm, flush);
+    zs->write_strm->avail_out = zs->write_buf.len;
+    zs->write_strm->next_out = (void*)zs->write_buf.base;
+    uint64_t start = uv_hrtime();
+    size_t avail_in = zs->write_strm->avail_in;
+    res = deflate(zs->write_strm, flush);
+    size_t nwritten = zs->write_buf.len - zs->write_strm->avail_out;
+    zlevel_stats_add(zs->compress_level, avail_in - zs->write_strm->avail_in, nwritten, start);
     if (res >= Z_OK) {  // Z_OK || Z_STREAM_END
-      size_t nwritten = zs->write_buf.len - zs->write_strm.avail_out;
       if (nwritten > 0) {
         async_write_buf(zs->source, nodec_buf(zs->write_buf.base, nwritten));
       }
     }
-  } while (res >= Z_OK && zs->write_strm.avail_out == 0);  // while full buffers
+  } while (res >= Z_OK && zs->write_strm->avail_out == 0);  // while full buffers
 }
 
 static void async_zstream_write_bufs(nodec_stream_t* s, uv_buf_t bufs[], size_t buf_count) {
@@ -1033,6 +1409,19 @@ static void async_zstream_write_bufs(nodec_stream_t* s, uv_buf_t bufs[], size_t
   }
 }
 
+static void async_zstream_flush(nodec_stream_t* stream) {
+  nodec_zstream_t* zs = (nodec_zstream_t*)stream;
+  if (zs->write_strm != NULL) {
+    async_zstream_write_buf(zs, nodec_buf_null(), Z_SYNC_FLUSH);
+  }
+  async_flush(zs->source);
+}
+
+static size_t async_zstream_write_queued(nodec_stream_t* stream) {
+  nodec_zstream_t* zs = (nodec_zstream_t*)stream;
+  return nodec_stream_write_queued(zs->source);
+}
+
 static void async_zstream_shutdown(nodec_stream_t* stream) {
   nodec_zstream_t* zs = (nodec_zstream_t*)stream;
   if (zs->nwritten > 0) {
@@ -1043,8 +1432,8 @@ static void async_zstream_shutdown(nodec_stream_t* stream) {
 
 static void nodec_zstream_free(nodec_stream_t* stream) {
   nodec_zstream_t* zs = (nodec_zstream_t*)stream;
-  if (zs->read_strm.zalloc != NULL) inflateEnd(&zs->read_strm);
-  if (zs->write_strm.zalloc != NULL) deflateEnd(&zs->write_strm);
+  zpool_release(zs->read_strm);
+  zpool_release(zs->write_strm);
   nodec_buf_free(zs->write_buf);
   if (zs->own_source) nodec_stream_free(zs->source);
   nodec_free(zs);
@@ -1053,6 +1442,7 @@ static void nodec_zstream_free(nodec_stream_t* stream) {
 
 nodec_bstream_t* nodec_zstream_alloc_ex(nodec_stream_t* stream, bool own_stream, int compress_level, bool gzip) {
   int res = 0;
+  compress_level = zlevel_resolve(compress_level, stream);
   nodec_zstream_t* zs = nodecx_alloc(nodec_zstream_t);
   if (zs == NULL) { res = UV_ENOMEM; goto err; }
   zs->own_source = own_stream;
@@ -1067,8 +1457,10 @@ nodec_bstream_t* nodec_zstream_alloc_ex(nodec_stream_t* stream, bool own_stream,
     &async_zstream_read_chunk, &nodec_chunks_pushback_buf,
     &async_zstream_read_bufx, &async_zstream_write_bufs,
     &async_zstream_shutdown, &nodec_zstream_free);
-  memset(&zs->read_strm, 0, sizeof(z_stream));
-  memset(&zs->write_strm, 0, sizeof(z_stream));  
+  nodec_stream_set_flush(&zs->bstream.stream_t, &async_zstream_flush);
+  nodec_stream_set_write_queued(&zs->bstream.stream_t, &async_zstream_write_queued);
+  zs->read_strm = NULL;
+  zs->write_strm = NULL;
   return &zs->bstream;
 err:
   if (zs != NULL) nodec_free(zs);
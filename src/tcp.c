@@ -9,6 +9,10 @@ found in the file "license.txt" at the root of this distribution.
 #include "nodec-primitive.h"
 #include <assert.h>
 
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
 void nodec_sockname(const struct sockaddr* addr, char* buf, size_t bufsize) {
   buf[0] = 0;
   if (addr != NULL) {
@@ -55,80 +59,218 @@ void nodec_tcp_bind(uv_tcp_t* handle, const struct sockaddr* addr, unsigned int
   check_uv_err_addr(uv_tcp_bind(handle, addr, flags), addr);
 } 
 
-static void _listen_cb(uv_stream_t* server, int status) {
-#ifndef NDEBUG
-  fprintf(stderr, "connection request\n");
+/*-----------------------------------------------------------------
+  Socket options
+-----------------------------------------------------------------*/
+
+uv_errno_t nodecx_tcp_set_options(uv_tcp_t* tcp, const tcp_socket_options_t* options) {
+  tcp_socket_options_t default_options = tcp_socket_options();
+  if (options == NULL) options = &default_options;
+  uv_errno_t err = 0;
+  uv_errno_t err1;
+  if (options->nodelay) {
+    err1 = uv_tcp_nodelay(tcp, 1);
+    if (err == 0) err = err1;
+  }
+  if (options->keepalive > 0) {
+    err1 = uv_tcp_keepalive(tcp, 1, options->keepalive);
+    if (err == 0) err = err1;
+  }
+  if (options->send_buf_size > 0) {
+    int size = options->send_buf_size;
+    err1 = uv_send_buffer_size((uv_handle_t*)tcp, &size);
+    if (err == 0) err = err1;
+  }
+  if (options->recv_buf_size > 0) {
+    int size = options->recv_buf_size;
+    err1 = uv_recv_buffer_size((uv_handle_t*)tcp, &size);
+    if (err == 0) err = err1;
+  }
+  return err;
+}
+
+// Set options on a listening socket; these are best effort and 
+// silently ignored on platforms that do not support them.
+static void nodec_tcp_set_listen_options(uv_tcp_t* tcp, bool defer_accept, int fastopen) {
+  uv_os_fd_t fd;
+  if (uv_fileno((uv_handle_t*)tcp, &fd) != 0) return;
+#if defined(TCP_DEFER_ACCEPT)
+  if (defer_accept) {
+    int secs = 1;  // the kernel completes the accept anyway after a timeout 
+    setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (const void*)&secs, sizeof(secs));
+  }
 #endif
-  uv_tcp_t* client = NULL;
-  channel_t* ch = NULL;
-  int err = 0;
-  if (status != 0) {
-    err = status;
+#if defined(TCP_FASTOPEN)
+  if (fastopen > 0) {
+    setsockopt((uv_os_sock_t)fd, IPPROTO_TCP, TCP_FASTOPEN, (const void*)&fastopen, sizeof(fastopen));
   }
-  else if (server==NULL) {
-    err = UV_EINVAL;
+#endif
+}
+
+/*-----------------------------------------------------------------
+  State of the TCP servers of an event loop
+  Kept in an implicit bound by `async_main`; libuv callbacks cannot
+  use effect operations so listeners and servers keep a pointer to it.
+-----------------------------------------------------------------*/
+
+typedef struct _tcp_servers_t {
+  nodec_tcp_accept_stats_t accept_stats;
+  tcp_admission_t*         admissions;   // all active servers
+  tcp_reaper_t*            reapers;
+  nodec_tcp_idle_stats_t   idle_stats;
+} tcp_servers_t;
+
+implicit_define(tcp_servers)
+
+static tcp_servers_t* tcp_servers_get() {
+  return (tcp_servers_t*)lh_ptr_value(implicit_get(tcp_servers));
+}
+
+lh_value _nodec_tcp_servers_allocv() {
+  return lh_value_ptr(nodec_zero_alloc(tcp_servers_t));
+}
+
+void _nodec_tcp_servers_freev(lh_value serversv) {
+  tcp_servers_t* servers = (tcp_servers_t*)lh_ptr_value(serversv);
+  assert(servers->admissions == NULL && servers->reapers == NULL);
+  nodec_free(servers);
+}
+
+
+/*-----------------------------------------------------------------
+  Accepting connections
+  Accepted clients are emitted into a bounded channel. If the channel 
+  is full we stop accepting and leave the connection pending in the OS;
+  libuv stops watching the server socket until the next `uv_accept`, 
+  which we do as soon as the server takes a client from the channel.
+  This way connection bursts are queued in the OS backlog instead of
+  being reset. On Unix, libuv itself loops over `accept` and calls us
+  once for each connection; on Windows several accepts can complete
+  before we are called, so there we take all that are available.
+-----------------------------------------------------------------*/
+
+typedef struct _tcp_listener_t {
+  uv_stream_t* server;       // a `uv_tcp_t` or `uv_pipe_t`
+  channel_t*  ch;
+  bool        owns_server;
+  bool        pending;       // true if a connection is pending since the channel was full
+  tcp_servers_t* servers;
+} tcp_listener_t;
+
+void nodec_tcp_accept_stats(nodec_tcp_accept_stats_t* stats) {
+  if (stats != NULL) *stats = tcp_servers_get()->accept_stats;
+}
+
+// Accept one pending connection and emit it into the channel.
+// Returns UV_EAGAIN if there was no pending connection.
+static uv_errno_t tcp_listener_accept_one(tcp_listener_t* listener) {
+  bool is_pipe = (listener->server->type == UV_NAMED_PIPE);
+  uv_stream_t* client = (uv_stream_t*)nodecx_calloc(1, (is_pipe ? sizeof(uv_pipe_t) : sizeof(uv_tcp_t)));
+  if (client == NULL) return UV_ENOMEM;
+  uv_errno_t err = (is_pipe ? uv_pipe_init(listener->server->loop, (uv_pipe_t*)client, 0)
+                            : uv_tcp_init(listener->server->loop, (uv_tcp_t*)client));
+  if (err != 0) {
+    nodec_free(client);
+    return err;
   }
-  else if ((ch = (channel_t*)server->data) == NULL) {
-    err = UV_EINVAL;
+  err = uv_accept(listener->server, client);
+  if (err == 0) {
+    listener->servers->accept_stats.accepted++;
+    // here we emit into the channel
+    // this will either queue the element, or call a listener
+    // entering a listener is ok since that will be a resume 
+    // under an async/try handler again.
+    err = channel_emit(listener->ch, lh_value_ptr(client), lh_value_ptr(listener), 0);  
   }
-  else if (channel_is_full(ch)) {
-    err = UV_ENOSPC; // stop accepting connections if the queue is full
+  if (err != 0) {
+    // deallocate client on error
+    nodec_uv_stream_free(client);
   }
-  else {
-    client = (uv_tcp_t*)nodecx_calloc(1,sizeof(uv_tcp_t));
-    if (client == NULL) {
-      err = UV_ENOMEM;
+  return err;
+}
+
+// Accept the pending connection(s) while there is room in the channel
+static void tcp_listener_accept(tcp_listener_t* listener) {
+  listener->pending = false;
+#ifdef _WIN32
+  while (!channel_is_full(listener->ch)) {
+    uv_errno_t err = tcp_listener_accept_one(listener);
+    if (err == UV_EAGAIN) {
+      break;  // no more pending connections
     }
-    else {
-      err = uv_tcp_init(server->loop, client);
-      if (err == 0) {
-        err = uv_accept(server, (uv_stream_t*)client);
-        if (err == 0) {
-          // here we emit into the channel
-          // this will either queue the element, or call a listener
-          // entering a listener is ok since that will be a resume 
-          // under an async/try handler again.
-          // TODO: we should have a size limited queue and check the emit return value
-      #ifndef NDEBUG
-          fprintf(stderr, "connection accepted, emitted in channel\n");
-      #endif
-          err = channel_emit(ch, lh_value_ptr(client), lh_value_null, 0);  // if err==UV_NOSPC the channel was full
-        }
-      }
+    else if (err != 0) {
+      listener->servers->accept_stats.dropped++;
+      if (err == UV_ENOMEM || err == UV_ENOSPC) break;
     }
   }
-  if (err!=0) {
-    // deallocate client on error
-    if (client!=NULL) {
-      nodec_uv_stream_free((uv_stream_t*)client);
-      client = NULL;
-    }
-    fprintf(stderr, "connection error: %i: %s\n", err, uv_strerror(err));
+#else
+  uv_errno_t err = tcp_listener_accept_one(listener);
+  if (err != 0 && err != UV_EAGAIN) listener->servers->accept_stats.dropped++;
+#endif
+}
+
+static void _listen_cb(uv_stream_t* server, int status) {
+  tcp_listener_t* listener = (server == NULL ? NULL : (tcp_listener_t*)server->data);
+  if (listener == NULL) return;  // the listener was released
+  if (status != 0) {
+    listener->servers->accept_stats.dropped++;
+  }
+  else if (channel_is_full(listener->ch)) {
+    // stop accepting connections until the server receives from the channel
+    listener->pending = true;
+    listener->servers->accept_stats.deferred++;
+  }
+  else {
+    tcp_listener_accept(listener);
   }
 }
 
-// Free TCP stream associated with a tcp channel
-static void _channel_release_tcp(lh_value tcpv) {
-  uv_tcp_t* tcp = (uv_tcp_t*)lh_ptr_value(tcpv);
-  tcp->data = NULL; // is the channel itself; don't free it in the stream_free
-  nodec_tcp_free(tcp);
+// Free the listener associated with a tcp channel
+static void _channel_release_listener(lh_value listenerv) {
+  tcp_listener_t* listener = (tcp_listener_t*)lh_ptr_value(listenerv);
+  uv_stream_t* server = listener->server;
+  server->data = NULL; // is the listener; don't free it in the stream_free
+  if (listener->owns_server) nodec_uv_stream_free(server);
+  nodec_free(listener);
+}
+
+// Free an accepted client; a client that was served before (and parked) has its read stream in `data`
+static void tcp_client_free(uv_stream_t* client) {
+  nodec_uv_stream_t* rs = (nodec_uv_stream_t*)client->data;
+  if (rs != NULL) {
+    nodec_stream_free(as_stream(as_bstream(rs)));
+  }
+  else {
+    nodec_uv_stream_free(client);
+  }
 }
 
 static void _channel_release_client(lh_value data, lh_value arg, int err) {
   uv_stream_t* client = (uv_stream_t*)lh_ptr_value(data);
   if (client != NULL) {
-    nodec_uv_stream_free(client);    
+    tcp_client_free(client);
   }
 }
 
-tcp_channel_t* nodec_tcp_listen(uv_tcp_t* tcp, int backlog, bool channel_owns_tcp) {
+tcp_channel_t* nodec_stream_listen_ex(uv_stream_t* server, int backlog, int accept_queue, bool channel_owns_server) {
   if (backlog <= 0) backlog = 128;
-  nodec_check(uv_listen((uv_stream_t*)tcp, backlog, &_listen_cb));
-  tcp_channel_t* ch = (tcp_channel_t*)channel_alloc_ex(8, // TODO: should be small?
-                          (channel_owns_tcp ? &_channel_release_tcp : NULL), 
-                              lh_value_ptr(tcp), &_channel_release_client );  
-  tcp->data = ch;
-  return ch;
+  if (accept_queue <= 0) accept_queue = 64;
+  nodec_check(uv_listen(server, backlog, &_listen_cb));
+  tcp_listener_t* listener = nodec_zero_alloc(tcp_listener_t);
+  listener->server = server;
+  listener->owns_server = channel_owns_server;
+  listener->servers = tcp_servers_get();
+  listener->ch = channel_alloc_ex(accept_queue, &_channel_release_listener, lh_value_ptr(listener), &_channel_release_client);
+  server->data = listener;
+  return (tcp_channel_t*)listener->ch;
+}
+
+tcp_channel_t* nodec_tcp_listen_ex(uv_tcp_t* tcp, int backlog, int accept_queue, bool channel_owns_tcp) {
+  return nodec_stream_listen_ex((uv_stream_t*)tcp, backlog, accept_queue, channel_owns_tcp);
+}
+
+tcp_channel_t* nodec_tcp_listen(uv_tcp_t* tcp, int backlog, bool channel_owns_tcp) {
+  return nodec_tcp_listen_ex(tcp, backlog, 0, channel_owns_tcp);
 }
 
 void nodec_ip4_addr(const char* ip, int port, struct sockaddr_in* addr) {
@@ -139,12 +281,13 @@ void nodec_ip6_addr(const char* ip, int port, struct sockaddr_in6* addr) {
   nodec_check(uv_ip6_addr(ip, port, addr));
 }
 
-tcp_channel_t* nodec_tcp_listen_at(const struct sockaddr* addr, int backlog) {
+static tcp_channel_t* nodec_tcp_listen_at(const struct sockaddr* addr, const tcp_server_config_t* config) {
   uv_tcp_t* tcp = nodec_tcp_alloc();
   tcp_channel_t* ch = NULL;
   {on_abort(nodec_tcp_freev, lh_value_ptr(tcp)) {
     nodec_tcp_bind(tcp, addr, 0);
-    ch = nodec_tcp_listen(tcp, backlog, true);
+    nodec_tcp_set_listen_options(tcp, config->defer_accept, config->fastopen);
+    ch = nodec_tcp_listen_ex(tcp, config->backlog, config->accept_queue, true);
   }}
   return ch;
 }
@@ -170,8 +313,13 @@ struct sockaddr* nodec_parse_sockaddr(const char* host) {
 
 uv_stream_t* async_tcp_channel_receive(tcp_channel_t* ch) {
   lh_value data = lh_value_null;
-  channel_receive(ch, &data, NULL);
-  //printf("got a connection!\n");
+  lh_value arg = lh_value_null;
+  channel_receive(ch, &data, &arg);
+  // resume accepting if connections were left pending because the channel was full
+  tcp_listener_t* listener = (tcp_listener_t*)lh_ptr_value(arg);
+  if (listener != NULL && listener->pending) {
+    tcp_listener_accept(listener);
+  }
   return (uv_stream_t*)lh_ptr_value(data);
 }
 
@@ -180,23 +328,167 @@ static void connect_cb(uv_connect_t* req, int status) {
   async_req_resume((uv_req_t*)req, status >= 0 ? 0 : status);
 }
 
-nodec_bstream_t* async_tcp_connect_at(const struct sockaddr* addr, const char* host) {
+nodec_bstream_t* async_tcp_connect_at_ex(const struct sockaddr* addr, const char* host, const tcp_socket_options_t* options) {
   uv_tcp_t* tcp = nodec_tcp_alloc();
   {on_abort(nodec_tcp_freev, lh_value_ptr(tcp)) {
     {using_req(uv_connect_t, req) {
       nodec_check_msg(uv_tcp_connect(req, tcp, addr, &connect_cb), host);
       nodec_check_msg(asyncx_await_once((uv_req_t*)req),host);
     }}
+    nodecx_tcp_set_options(tcp, options);  // best effort
   }}
   return nodec_bstream_alloc_read( (uv_stream_t*)tcp );
 }
 
+nodec_bstream_t* async_tcp_connect_at(const struct sockaddr* addr, const char* host) {
+  return async_tcp_connect_at_ex(addr, host, NULL);
+}
+
+/*-----------------------------------------------------------------
+  Connect to multiple addresses (happy eyeballs, RFC 8305)
+  Attempts alternate between IPv6 and IPv4 addresses, starting with
+  IPv6. Each attempt starts `attempt_delay` milliseconds after the
+  previous one started, or as soon as any started one fails. The
+  first connection that succeeds wins and the other attempts are
+  canceled.
+-----------------------------------------------------------------*/
+
+typedef struct _connect_race_t {
+  const char*       host;
+  uint64_t          attempt_delay;
+  const tcp_socket_options_t* options;
+  nodec_bstream_t*  winner;
+  channel_t*        failed;   // signals that one of the started attempts failed
+} connect_race_t;
+
+typedef struct _connect_attempt_t {
+  connect_race_t*         race;
+  const struct sockaddr*  addr;
+  channel_t*              started;    // signals to the next attempt that this one started
+  struct _connect_attempt_t* prev;
+} connect_attempt_t;
+
+static void connect_attempt_failedv(lh_value racev) {
+  connect_race_t* race = (connect_race_t*)lh_ptr_value(racev);
+  channel_emit(race->failed, lh_value_null, lh_value_null, UV_ECANCELED);
+}
+
+static lh_value connect_attempt_await_failure(lh_value racev) {
+  connect_race_t* race = (connect_race_t*)lh_ptr_value(racev);
+  channel_receive(race->failed, NULL, NULL);
+  return lh_value_null;
+}
+
+static lh_value connect_attempt(lh_value attemptv) {
+  connect_attempt_t* attempt = (connect_attempt_t*)lh_ptr_value(attemptv);
+  connect_race_t* race = attempt->race;
+  if (attempt->prev != NULL) {
+    // wait until the previous attempt started, and then for the delay or the 
+    // failure of any earlier attempt (each failure starts one next attempt)
+    channel_receive(attempt->prev->started, NULL, NULL);
+    async_timeout(&connect_attempt_await_failure, lh_value_ptr(race), race->attempt_delay, NULL);
+  }
+  channel_emit(attempt->started, lh_value_null, lh_value_null, 0);
+  nodec_bstream_t* stream = NULL;
+  {on_abort(connect_attempt_failedv, lh_value_ptr(race)) {
+    stream = async_tcp_connect_at_ex(attempt->addr, race->host, race->options);
+  }}
+  if (race->winner == NULL) {
+    race->winner = stream;
+    async_scoped_cancel();  // cancel the other attempts
+  }
+  else {
+    nodec_stream_free(as_stream(stream));  // lost a close race
+  }
+  return lh_value_null;
+}
+
+static size_t connect_addrs_order(const struct addrinfo* info, const struct sockaddr** addrs, size_t max) {
+  // interleave the address families, starting with IPv6
+  size_t n = 0;
+  const struct addrinfo* ip6 = info;
+  const struct addrinfo* ip4 = info;
+  bool want_ip6 = true;
+  while (n < max) {
+    while (ip6 != NULL && ip6->ai_family != AF_INET6) ip6 = ip6->ai_next;
+    while (ip4 != NULL && ip4->ai_family != AF_INET) ip4 = ip4->ai_next;
+    if (ip6 == NULL && ip4 == NULL) break;
+    if ((want_ip6 && ip6 != NULL) || ip4 == NULL) {
+      addrs[n++] = ip6->ai_addr;
+      ip6 = ip6->ai_next;
+    }
+    else {
+      addrs[n++] = ip4->ai_addr;
+      ip4 = ip4->ai_next;
+    }
+    want_ip6 = !want_ip6;
+  }
+  return n;
+}
+
+nodec_bstream_t* async_tcp_connect_at_addrs(const struct addrinfo* info, const char* host, uint64_t attempt_delay, const tcp_socket_options_t* options) {
+  size_t max = 0;
+  for (const struct addrinfo* p = info; p != NULL; p = p->ai_next) max++;
+  connect_race_t race = { host, attempt_delay, options, NULL, NULL };
+  lh_exception* exn = NULL;
+  {using_zero_alloc_n(max + 1, const struct sockaddr*, addrs) {
+    size_t n = connect_addrs_order(info, addrs, max);
+    if (n == 0) nodec_check_msg(UV_EAI_ADDRFAMILY, host);
+    if (n == 1) {
+      race.winner = async_tcp_connect_at_ex(addrs[0], host, options);
+    }
+    else {
+      {using_channel(failed) {
+        race.failed = failed;
+        {using_zero_alloc_n(n, connect_attempt_t, attempts) {
+          {using_zero_alloc_n(n, lh_actionfun*, actions) {
+            {using_zero_alloc_n(n, lh_value, args) {
+              {using_zero_alloc_n(n, lh_exception*, exceptions) {
+                for (size_t i = 0; i < n; i++) {
+                  attempts[i].race = &race;
+                  attempts[i].addr = addrs[i];
+                  attempts[i].started = channel_alloc(-1);
+                  attempts[i].prev = (i == 0 ? NULL : &attempts[i - 1]);
+                  actions[i] = &connect_attempt;
+                  args[i] = lh_value_ptr(&attempts[i]);
+                }
+                {using_cancel_scope() {
+                  asyncx_interleave(n, actions, args, exceptions);
+                }}
+                for (size_t i = 0; i < n; i++) {
+                  channel_free(attempts[i].started);
+                  // keep the first real error in case all attempts failed
+                  if (exceptions[i] != NULL) {
+                    if (exn == NULL && race.winner == NULL && !lh_exception_is_cancel(exceptions[i])) {
+                      exn = exceptions[i];
+                    }
+                    else {
+                      lh_exception_free(exceptions[i]);
+                    }
+                  }
+                }
+              }}
+            }}
+          }}
+        }}
+      }}
+    }
+  }}
+  if (exn != NULL) lh_throw(exn);
+  if (race.winner == NULL) nodec_check_msg(UV_ECANCELED, host);
+  return race.winner;
+}
+
 nodec_bstream_t* async_tcp_connect_at_host(const char* host, const char* service) {
-  struct addrinfo* info = async_getaddrinfo(host, (service==NULL ? "http" : service), NULL);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* info = async_getaddrinfo(host, (service==NULL ? "http" : service), &hints);
   if (info==NULL) nodec_check_msg(UV_EAI_NONAME,host);
   nodec_bstream_t* tcp = NULL;
   {using_addrinfo(info) {
-    tcp = async_tcp_connect_at(info->ai_addr, host);
+    tcp = async_tcp_connect_at_addrs(info, host, NODEC_CONNECT_ATTEMPT_DELAY, NULL);
   }}
   return tcp;
 }
@@ -226,6 +518,411 @@ static lh_value async_log_tcp_exn(lh_value exnv) {
 
 
 
+/*-----------------------------------------------------------------
+  Admission control
+  At most `limit` connections are served concurrently. Further
+  connections wait in a bounded FIFO queue and are served by the
+  strands of finishing connections. When the queue is full, a
+  connection is shed: a pre-rendered response (like a `503`) is
+  written without blocking and the connection is closed. Connections
+  that wait longer than `wait_timeout` are shed too.
+  With an adaptive limit, the limit follows the ratio of the minimal
+  to the average request latency (a "gradient" limiter), plus a
+  small allowance to probe for more capacity.
+-----------------------------------------------------------------*/
+
+typedef struct _tcp_waiting_t {
+  uv_stream_t*  client;
+  uint64_t      since;             // loop time when the connection was queued
+} tcp_waiting_t;
+
+struct _tcp_admission_t {
+  struct _tcp_admission_t* next;   // all active servers of the event loop
+  tcp_servers_t* servers;
+  size_t        max_limit;
+  double        limit;             // current concurrency limit
+  size_t        active;            // connections being served
+  tcp_waiting_t* queue;            // waiting connections
+  size_t        qsize;
+  size_t        qhead;
+  size_t        qcount;
+  uint64_t      wait_timeout;
+  const char*   shed_response;
+  bool          adaptive;
+  double        latency_min;       // slowly rising minimum of the request latency in micro-seconds
+  double        latency_avg;       // moving average of the request latency in micro-seconds
+  uint64_t      admitted;
+  uint64_t      queued;
+  uint64_t      shed;
+  uint64_t      expired;
+};
+
+void nodec_tcp_admission_stats(nodec_tcp_admission_stats_t* stats) {
+  if (stats == NULL) return;
+  memset(stats, 0, sizeof(*stats));
+  for (tcp_admission_t* adm = tcp_servers_get()->admissions; adm != NULL; adm = adm->next) {
+    stats->limit += (size_t)adm->limit;
+    stats->active += adm->active;
+    stats->queue_depth += adm->qcount;
+    stats->admitted += adm->admitted;
+    stats->queued += adm->queued;
+    stats->shed += adm->shed;
+    stats->expired += adm->expired;
+  }
+}
+
+static tcp_admission_t* tcp_admission_alloc(const tcp_server_config_t* config) {
+  tcp_admission_t* adm = nodec_zero_alloc(tcp_admission_t);
+  adm->max_limit = (config->max_interleaving <= 0 ? 1 : (size_t)config->max_interleaving);
+  adm->limit = (double)adm->max_limit;
+  adm->qsize = (config->wait_queue <= 0 ? 0 : (size_t)config->wait_queue);
+  if (adm->qsize > 0) adm->queue = nodec_zero_alloc_n(adm->qsize, tcp_waiting_t);
+  adm->wait_timeout = config->wait_timeout;
+  adm->shed_response = config->shed_response;
+  adm->adaptive = config->adaptive_limit;
+  adm->servers = tcp_servers_get();
+  adm->next = adm->servers->admissions;
+  adm->servers->admissions = adm;
+  return adm;
+}
+
+static void tcp_admission_freev(lh_value admv) {
+  tcp_admission_t* adm = (tcp_admission_t*)lh_ptr_value(admv);
+  for (tcp_admission_t** p = &adm->servers->admissions; *p != NULL; p = &(*p)->next) {
+    if (*p == adm) {
+      *p = adm->next;
+      break;
+    }
+  }
+  for (size_t i = 0; i < adm->qcount; i++) {
+    tcp_client_free(adm->queue[(adm->qhead + i) % adm->qsize].client);
+  }
+  if (adm->queue != NULL) nodec_free(adm->queue);
+  nodec_free(adm);
+}
+
+static bool tcp_admission_can_admit(tcp_admission_t* adm) {
+  return ((double)adm->active < adm->limit);
+}
+
+/* Closing a shed connection: we shut down writing and discard whatever
+   the client still sends until it closes too, or until the linger timeout.
+   Closing right away with unread data resets the connection and the
+   client may never see the shed response. */
+#define TCP_LINGER_TIMEOUT  (2000)
+
+typedef struct _tcp_linger_t {
+  uv_shutdown_t req;
+  uv_stream_t*  client;
+  uv_timer_t*   timer;
+} tcp_linger_t;
+
+static void _tcp_linger_close_cb(uv_handle_t* h) {
+  nodec_free(h);
+}
+
+static void tcp_linger_close(tcp_linger_t* l) {
+  nodec_timer_free(l->timer, false);  // in a libuv callback: no owner release
+  uv_close((uv_handle_t*)l->client, &_tcp_linger_close_cb);
+  nodec_free(l);
+}
+
+static void _tcp_linger_timeout_cb(uv_timer_t* timer) {
+  tcp_linger_close((tcp_linger_t*)timer->data);
+}
+
+static void _tcp_linger_alloc_cb(uv_handle_t* h, size_t suggested, uv_buf_t* buf) {
+  static char discard[1024];
+  buf->base = discard;
+  buf->len = sizeof(discard);
+}
+
+static void _tcp_linger_read_cb(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf) {
+  if (nread < 0) tcp_linger_close((tcp_linger_t*)client->data);  // eof or error
+}
+
+static void _tcp_linger_shutdown_cb(uv_shutdown_t* req, int status) {
+  tcp_linger_t* l = (tcp_linger_t*)req->data;
+  if (status != 0 || uv_read_start(l->client, &_tcp_linger_alloc_cb, &_tcp_linger_read_cb) != 0) {
+    tcp_linger_close(l);
+  }
+}
+
+static void tcp_client_linger(uv_stream_t* client) {
+  if (client->data != NULL) {
+    // resumed from the reaper: its request was read already
+    tcp_client_free(client);
+    return;
+  }
+  tcp_linger_t* l = nodec_zero_alloc(tcp_linger_t);
+  l->client = client;
+  l->timer = nodec_timer_alloc();
+  l->timer->data = l;
+  l->req.data = l;
+  client->data = l;
+  if (uv_shutdown(&l->req, client, &_tcp_linger_shutdown_cb) != 0) {
+    tcp_linger_close(l);
+    return;
+  }
+  uv_timer_start(l->timer, &_tcp_linger_timeout_cb, TCP_LINGER_TIMEOUT, 0);
+}
+
+static void tcp_admission_shed(tcp_admission_t* adm, uv_stream_t* client) {
+  adm->shed++;
+  if (adm->shed_response != NULL) {
+    // best effort: a fresh socket has room in its send buffer for a short response
+    uv_buf_t buf = nodec_buf((void*)adm->shed_response, strlen(adm->shed_response));
+    uv_try_write(client, &buf, 1);
+  }
+  tcp_client_linger(client);
+}
+
+static bool tcp_admission_push(tcp_admission_t* adm, uv_stream_t* client) {
+  if (adm->qcount >= adm->qsize) return false;
+  tcp_waiting_t* w = &adm->queue[(adm->qhead + adm->qcount) % adm->qsize];
+  w->client = client;
+  w->since = uv_now(client->loop);
+  adm->qcount++;
+  adm->queued++;
+  return true;
+}
+
+// Shed the connections that waited longer than `wait_timeout`; the oldest are at the head.
+static void tcp_admission_expire(tcp_admission_t* adm) {
+  if (adm->wait_timeout == 0) return;
+  while (adm->qcount > 0) {
+    tcp_waiting_t* w = &adm->queue[adm->qhead];
+    if (uv_now(w->client->loop) - w->since <= adm->wait_timeout) break;
+    adm->qhead = (adm->qhead + 1) % adm->qsize;
+    adm->qcount--;
+    adm->expired++;
+    tcp_admission_shed(adm, w->client);
+  }
+}
+
+static uv_stream_t* tcp_admission_pop(tcp_admission_t* adm) {
+  tcp_admission_expire(adm);
+  if (adm->qcount == 0) return NULL;
+  uv_stream_t* client = adm->queue[adm->qhead].client;
+  adm->qhead = (adm->qhead + 1) % adm->qsize;
+  adm->qcount--;
+  return client;
+}
+
+static size_t tcp_isqrt(size_t n) {
+  size_t x = 0;
+  while ((x + 1)*(x + 1) <= n) x++;
+  return x;
+}
+
+static void tcp_admission_sample(tcp_admission_t* adm, uint64_t usecs) {
+  if (adm == NULL || !adm->adaptive) return;
+  double sample = (double)(usecs == 0 ? 1 : usecs);
+  if (adm->latency_min == 0 || sample < adm->latency_min) {
+    adm->latency_min = sample;
+  }
+  else {
+    adm->latency_min += (sample - adm->latency_min) * 0.001;  // forget an old minimum slowly
+  }
+  adm->latency_avg = (adm->latency_avg == 0 ? sample : 0.9*adm->latency_avg + 0.1*sample);
+  double gradient = adm->latency_min / adm->latency_avg;
+  if (gradient < 0.5) gradient = 0.5;
+  if (gradient > 1.0) gradient = 1.0;
+  double limit = adm->limit * gradient + (double)tcp_isqrt((size_t)adm->limit);
+  limit = 0.8*adm->limit + 0.2*limit;
+  if (limit < 1.0) limit = 1.0;
+  if (limit > (double)adm->max_limit) limit = (double)adm->max_limit;
+  adm->limit = limit;
+}
+
+
+/*-----------------------------------------------------------------
+  Idle connection reaper
+  Instead of keeping a strand awaiting each idle keep-alive connection,
+  the connection is parked here and its strand finishes. Parked
+  connections are kept in least-recently-used order; since they all
+  have the same timeout, a single timer closes the oldest ones in O(1).
+  When a request arrives on a parked connection it is emitted into the
+  server channel again to be served by a fresh strand; if the channel
+  is full, it waits in a ready list that the server loop serves after
+  its next receive. Parked connections are closed from libuv callbacks
+  so they are freed with nodec_uv_stream_close().
+-----------------------------------------------------------------*/
+
+typedef struct _tcp_parked_t {
+  struct _tcp_parked_t* prev;
+  struct _tcp_parked_t* next;
+  tcp_reaper_t*         reaper;
+  nodec_uv_stream_t*    stream;
+  uint64_t              since;       // loop time when parked
+} tcp_parked_t;
+
+typedef struct _tcp_ready_t {
+  struct _tcp_ready_t*  next;
+  uv_stream_t*          client;      // with its buffered request
+} tcp_ready_t;
+
+struct _tcp_reaper_t {
+  struct _tcp_reaper_t* next;        // all active servers of the event loop
+  tcp_servers_t*    servers;
+  tcp_parked_t*     oldest;
+  tcp_parked_t*     newest;
+  size_t            count;
+  size_t            max_count;       // 0 for unlimited
+  uint64_t          timeout;
+  uv_timer_t*       timer;
+  channel_t*        ch;              // the server channel
+  tcp_ready_t*      ready;           // connections with a request that found the channel full
+  tcp_ready_t*      ready_last;
+};
+
+static void tcp_reaper_unlink(tcp_reaper_t* r, tcp_parked_t* p) {
+  if (p->prev != NULL) p->prev->next = p->next;
+                  else r->oldest = p->next;
+  if (p->next != NULL) p->next->prev = p->prev;
+                  else r->newest = p->prev;
+  r->count--;
+}
+
+static void tcp_reaper_close(tcp_reaper_t* r, tcp_parked_t* p) {
+  tcp_reaper_unlink(r, p);
+  nodec_uv_stream_on_ready(p->stream, NULL, NULL);
+  nodec_uv_stream_close(p->stream);
+  nodec_free(p);
+}
+
+static void _reaper_timer_cb(uv_timer_t* timer);
+
+static void tcp_reaper_schedule(tcp_reaper_t* r) {
+  if (r->oldest == NULL || uv_is_active((uv_handle_t*)r->timer)) return;
+  uint64_t now = uv_now(r->timer->loop);
+  uint64_t due = r->oldest->since + r->timeout;
+  uv_timer_start(r->timer, &_reaper_timer_cb, (due > now ? due - now : 0), 0);
+}
+
+static void _reaper_timer_cb(uv_timer_t* timer) {
+  tcp_reaper_t* r = (tcp_reaper_t*)timer->data;
+  uint64_t now = uv_now(timer->loop);
+  while (r->oldest != NULL && r->oldest->since + r->timeout <= now) {
+    r->servers->idle_stats.expired++;
+    tcp_reaper_close(r, r->oldest);
+  }
+  tcp_reaper_schedule(r);
+}
+
+static void tcp_parked_ready(uv_stream_t* stream, void* arg) {
+  tcp_parked_t* p = (tcp_parked_t*)arg;
+  tcp_reaper_t* r = p->reaper;
+  nodec_uv_stream_t* rs = p->stream;
+  tcp_reaper_unlink(r, p);
+  nodec_free(p);
+  if (nodecx_uv_stream_check_idle(rs) == UV_EPROTO) {
+    // a new request: serve it again
+    r->servers->idle_stats.resumed++;
+    if (channel_emit(r->ch, lh_value_ptr(stream), lh_value_null, 0) != 0) {
+      // the channel is full; don't drop the request but wait for the server loop
+      tcp_ready_t* ready = nodec_zero_alloc(tcp_ready_t);
+      ready->client = stream;
+      if (r->ready_last != NULL) r->ready_last->next = ready;
+                            else r->ready = ready;
+      r->ready_last = ready;
+    }
+    return;
+  }
+  // closed by the client
+  nodec_uv_stream_close(rs);
+}
+
+// Return a resumed connection that could not be emitted into the server channel (or NULL)
+static uv_stream_t* tcp_reaper_pop_ready(tcp_reaper_t* r) {
+  if (r == NULL || r->ready == NULL) return NULL;
+  tcp_ready_t* ready = r->ready;
+  r->ready = ready->next;
+  if (r->ready == NULL) r->ready_last = NULL;
+  uv_stream_t* client = ready->client;
+  nodec_free(ready);
+  return client;
+}
+
+static void tcp_reaper_park(tcp_reaper_t* r, nodec_uv_stream_t* rs) {
+  if (r->max_count > 0 && r->count >= r->max_count && r->oldest != NULL) {
+    r->servers->idle_stats.evicted++;
+    tcp_reaper_close(r, r->oldest);
+  }
+  tcp_parked_t* p = nodec_zero_alloc(tcp_parked_t);
+  p->reaper = r;
+  p->stream = rs;
+  p->since = uv_now(r->timer->loop);
+  p->prev = r->newest;
+  if (r->newest != NULL) r->newest->next = p;
+                    else r->oldest = p;
+  r->newest = p;
+  r->count++;
+  r->servers->idle_stats.parked++;
+  nodec_uv_stream_on_ready(rs, &tcp_parked_ready, p);
+  tcp_reaper_schedule(r);
+}
+
+static tcp_reaper_t* tcp_reaper_alloc(const tcp_server_config_t* config, channel_t* ch) {
+  if (config->timeout == 0) return NULL;  // no keep-alive
+  tcp_reaper_t* r = nodec_zero_alloc(tcp_reaper_t);
+  r->timeout = config->timeout;
+  r->max_count = (config->max_idle <= 0 ? 0 : (size_t)config->max_idle);
+  r->ch = ch;
+  r->timer = nodec_timer_alloc();
+  r->timer->data = r;
+  r->servers = tcp_servers_get();
+  r->next = r->servers->reapers;
+  r->servers->reapers = r;
+  return r;
+}
+
+static void tcp_reaper_freev(lh_value rv) {
+  tcp_reaper_t* r = (tcp_reaper_t*)lh_ptr_value(rv);
+  if (r == NULL) return;
+  for (tcp_reaper_t** pr = &r->servers->reapers; *pr != NULL; pr = &(*pr)->next) {
+    if (*pr == r) {
+      *pr = r->next;
+      break;
+    }
+  }
+  while (r->oldest != NULL) tcp_reaper_close(r, r->oldest);
+  uv_stream_t* client;
+  while ((client = tcp_reaper_pop_ready(r)) != NULL) {
+    nodec_uv_stream_close((nodec_uv_stream_t*)client->data);
+  }
+  nodec_timer_free(r->timer, false);
+  nodec_free(r);
+}
+
+size_t nodec_tcp_idle_evict(size_t count) {
+  tcp_servers_t* servers = tcp_servers_get();
+  size_t evicted = 0;
+  while (evicted < count) {
+    // close the least recently used connection over all servers of this event loop
+    tcp_reaper_t* oldest = NULL;
+    for (tcp_reaper_t* r = servers->reapers; r != NULL; r = r->next) {
+      if (r->oldest != NULL && (oldest == NULL || r->oldest->since < oldest->oldest->since)) oldest = r;
+    }
+    if (oldest == NULL) break;
+    tcp_reaper_close(oldest, oldest->oldest);
+    evicted++;
+  }
+  servers->idle_stats.evicted += evicted;
+  return evicted;
+}
+
+void nodec_tcp_idle_stats(nodec_tcp_idle_stats_t* stats) {
+  if (stats == NULL) return;
+  tcp_servers_t* servers = tcp_servers_get();
+  *stats = servers->idle_stats;
+  stats->idle = 0;
+  for (tcp_reaper_t* r = servers->reapers; r != NULL; r = r->next) {
+    stats->idle += r->count;
+  }
+}
+
+
 typedef struct _tcp_serve_args {
   nodec_tcp_connection_wrap_t* connection_wrap;
   nodec_tcp_connection_fun_t* serve;
@@ -237,6 +934,10 @@ typedef struct _tcp_serve_args {
   uint64_t            timeout_keepalive;
   lh_actionfun*       on_exn;
   uv_stream_t*        uvclient;
+  tcp_socket_options_t socket_options;
+  tcp_admission_t*    admission;
+  tcp_reaper_t*       reaper;
+  size_t              read_high_water;
 } tcp_serve_args;
 
 
@@ -262,7 +963,10 @@ static lh_value tcp_connection_timeout(lh_value argsv) {
 static lh_value tcp_connection_keepalive(lh_value argsv) {
   tcp_connection_args* args = (tcp_connection_args*)lh_ptr_value(argsv);
   if (args->timeout_keepalive == 0) {
-    return tcp_connection_timeout(argsv);
+    uint64_t start = uv_hrtime();
+    lh_value result = tcp_connection_timeout(argsv);
+    tcp_admission_sample(args->admission, (uv_hrtime() - start) / 1000);
+    return result;
   }
   else {
     lh_value result = lh_value_null;
@@ -270,8 +974,22 @@ static lh_value tcp_connection_keepalive(lh_value argsv) {
     //nodec_check(uv_tcp_keepalive((uv_tcp_t*)args->client, 1, (unsigned)args->keepalive));
     fprintf(stderr, "use keep alive connection %i.\n", args->id);
     do {
+      uint64_t start = uv_hrtime();
       result = tcp_connection_timeout(argsv);
-      err = asyncx_uv_stream_await_available(args->uvclient, args->timeout_keepalive);
+      tcp_admission_sample(args->admission, (uv_hrtime() - start) / 1000);
+      if (args->reaper != NULL && args->parked != NULL) {
+        err = nodecx_uv_stream_check_idle(args->uvclient);
+        if (err == 0) {
+          // no request yet: park the connection and let this strand finish
+          tcp_reaper_park(args->reaper, args->uvclient);
+          *args->parked = true;
+          return result;
+        }
+        if (err == UV_EPROTO) err = 0;  // the next request is already available
+      }
+      else {
+        err = asyncx_uv_stream_await_available(args->uvclient, args->timeout_keepalive);
+      }
     } while (err == 0);
     fprintf(stderr, "closed keep alive connection %i.\n", args->id);
     return result;
@@ -298,37 +1016,127 @@ void nodec_tcp_connection_wrap(const tcp_connection_args* args, lh_value ignored
 }
 
 
-static lh_value tcp_serve_connection(lh_value argsv) {
+typedef struct _tcp_client_t {
+  nodec_uv_stream_t* stream;
+  bool               parked;
+} tcp_client_t;
+
+static void tcp_client_releasev(lh_value clientv) {
+  tcp_client_t* client = (tcp_client_t*)lh_ptr_value(clientv);
+  if (!client->parked) nodec_stream_free(as_stream(as_bstream(client->stream)));
+}
+
+static void tcp_serve_client(const tcp_serve_args* args, uv_stream_t* uvclient) {
   static int id = 0;
-  tcp_serve_args args = *((tcp_serve_args*)lh_ptr_value(argsv)); // copy by value
-  nodec_uv_stream_t* client = nodec_uv_stream_alloc(args.uvclient);    
-  {using_uv_stream(client) {
+  tcp_client_t client = { (nodec_uv_stream_t*)uvclient->data, false };  // not NULL if resumed from the reaper
+  bool resumed = (client.stream != NULL);
+  if (!resumed) {
+    if (uvclient->type == UV_TCP) nodecx_tcp_set_options((uv_tcp_t*)uvclient, &args->socket_options);  // best effort
+    client.stream = nodec_uv_stream_alloc(uvclient);
+  }
+  {defer(tcp_client_releasev, lh_value_any_ptr(&client)) {
     // TODO: what if an exception happens here?
     // TODO: make initial read allocation a parameter? Maybe needs to be enlarged for https?
-    nodec_uv_stream_read_start(client, 8 * 1024, 0); // initial allocation at 8kb (for the header)
-    tcp_connection_args cargs = { args.serve, id++, as_bstream(client), args.serve_arg, args.timeout_total, args.timeout_keepalive, args.on_exn, client };
-    (*args.connection_wrap)(&cargs, args.wrap_arg);
+    if (!resumed) {
+      nodec_uv_stream_read_high_water(client.stream, args->read_high_water);
+      nodec_uv_stream_read_start(client.stream, 8 * 1024, 0); // initial allocation at 8kb (for the header)
+    }
+    tcp_connection_args cargs = { args->serve, id++, as_bstream(client.stream), args->serve_arg, args->timeout_total, args->timeout_keepalive, args->on_exn, client.stream, args->admission, args->reaper, &client.parked };
+    (*args->connection_wrap)(&cargs, args->wrap_arg);
+  }}
+}
+
+static void tcp_admission_leavev(lh_value admv) {
+  tcp_admission_t* adm = (tcp_admission_t*)lh_ptr_value(admv);
+  adm->active--;
+}
+
+static lh_value tcp_serve_connection(lh_value argsv) {
+  tcp_serve_args args = *((tcp_serve_args*)lh_ptr_value(argsv)); // copy by value
+  tcp_admission_t* adm = args.admission;
+  {defer(tcp_admission_leavev, lh_value_ptr(adm)) {
+    uv_stream_t* uvclient = args.uvclient;
+    do {
+      tcp_serve_client(&args, uvclient);
+      // serve waiting connections on this strand as long as we are within the limit
+      uvclient = ((double)adm->active <= adm->limit ? tcp_admission_pop(adm) : NULL);
+      if (uvclient != NULL) adm->admitted++;
+    } while (uvclient != NULL);
   }}
   return lh_value_null;
 }
 
+static void tcp_serve_spawn(const tcp_serve_args* args, uv_stream_t* uvclient) {
+  tcp_serve_args sargs = *args; // copy
+  sargs.uvclient = uvclient;
+  args->admission->active++;
+  args->admission->admitted++;
+  async_strand_create(&tcp_serve_connection, lh_value_any_ptr(&sargs), NULL);
+}
+
+static void tcp_serve_admit(const tcp_serve_args* args, uv_stream_t* uvclient) {
+  tcp_admission_t* adm = args->admission;
+  tcp_admission_expire(adm);
+  if (adm->qcount == 0 && tcp_admission_can_admit(adm)) {
+    tcp_serve_spawn(args, uvclient);
+  }
+  else if (!tcp_admission_push(adm, uvclient)) {
+    // if too much concurrency and the wait queue is full, shed the connection
+    tcp_admission_shed(adm, uvclient);
+  }
+}
+
 static lh_value tcp_servev(lh_value argsv) {
   tcp_serve_args args = *((tcp_serve_args*)lh_ptr_value(argsv));
+  tcp_admission_t* adm = args.admission;
   do {
-    uv_stream_t* uvclient = async_tcp_channel_receive(args.ch);
-    if (nodec_current_strand_count() > args.max_interleaving) {
-      // if too much concurrency, close the connection immediately
-      nodec_uv_stream_free(uvclient);
+    tcp_serve_admit(&args, async_tcp_channel_receive(args.ch));
+    // resumed connections that found the channel full
+    uv_stream_t* ready;
+    while ((ready = tcp_reaper_pop_ready(args.reaper)) != NULL) {
+      tcp_serve_admit(&args, ready);
     }
-    else {
-      tcp_serve_args sargs = args; // copy
-      sargs.uvclient = uvclient;
-      async_strand_create(&tcp_serve_connection, lh_value_any_ptr(&sargs), NULL);
+    // the limit may have grown
+    while (adm->qcount > 0 && tcp_admission_can_admit(adm)) {
+      uv_stream_t* waiting = tcp_admission_pop(adm);
+      if (waiting != NULL) tcp_serve_spawn(&args, waiting);
     }
   } while (true);  // should be until termination
   return lh_value_null;
 }
 
+void async_stream_server_on(tcp_channel_t* ch,
+  const tcp_server_config_t* config,
+  nodec_tcp_connection_fun_t* servefun,
+  nodec_tcp_connection_wrap_t* wrapfun,
+  lh_actionfun* on_exn,
+  lh_value serve_arg,
+  lh_value wrap_arg)
+{
+  tcp_admission_t* admission = tcp_admission_alloc(config);
+  {defer(tcp_admission_freev, lh_value_ptr(admission)) {
+    tcp_reaper_t* reaper = tcp_reaper_alloc(config, ch);
+    {defer(tcp_reaper_freev, lh_value_ptr(reaper)) {
+      {using_zero_alloc(tcp_serve_args, sargs) {
+        sargs->connection_wrap = wrapfun;
+        sargs->wrap_arg = wrap_arg;
+        sargs->serve = servefun;
+        sargs->serve_arg = serve_arg;
+        sargs->ch = ch;
+        sargs->max_interleaving = config->max_interleaving;
+        sargs->timeout_total = config->timeout_total;
+        sargs->timeout_keepalive = config->timeout;
+        sargs->on_exn = (on_exn == NULL ? &async_log_tcp_exn : on_exn);
+        sargs->socket_options = config->socket_options;
+        sargs->admission = admission;
+        sargs->reaper = reaper;
+        sargs->read_high_water = config->read_high_water;
+        async_interleave_dynamic(&tcp_servev, lh_value_ptr(sargs));
+      }}
+    }}
+  }}
+}
+
 void async_tcp_server_at_ex(const struct sockaddr* addr, 
   tcp_server_config_t* config,
   nodec_tcp_connection_fun_t* servefun, 
@@ -339,20 +1147,9 @@ void async_tcp_server_at_ex(const struct sockaddr* addr,
 {
   tcp_server_config_t default_config = tcp_server_config();
   if (config == NULL) config = &default_config;
-  tcp_channel_t* ch = nodec_tcp_listen_at(addr, config->backlog);
+  tcp_channel_t* ch = nodec_tcp_listen_at(addr, config);
   {using_tcp_channel(ch) {
-    {using_zero_alloc(tcp_serve_args, sargs) {
-      sargs->connection_wrap = wrapfun;
-      sargs->wrap_arg = wrap_arg;
-      sargs->serve = servefun;
-      sargs->serve_arg = serve_arg;
-      sargs->ch = ch;
-      sargs->max_interleaving = config->max_interleaving;
-      sargs->timeout_total = config->timeout_total;
-      sargs->timeout_keepalive = config->timeout;
-      sargs->on_exn = (on_exn == NULL ? &async_log_tcp_exn : on_exn);
-      async_interleave_dynamic(&tcp_servev, lh_value_ptr(sargs));
-    }}
+    async_stream_server_on(ch, config, servefun, wrapfun, on_exn, serve_arg, wrap_arg);
   }}
 }
 
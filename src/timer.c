@@ -168,6 +168,7 @@ const char* nodec_inet_date( time_t now )
   static time_t inet_time = 0;
 
   if (now == inet_time) return inet_date;
+  inet_time = now;
   struct tm tm;
   nodec_gmtime(&tm, &now);
   strftime(inet_date, INET_DATE_LEN + 1, "---, %d --- %Y %H:%M:%S GMT", &tm);
@@ -182,6 +183,18 @@ const char* nodec_inet_date_now() {
   return nodec_inet_date(now);
 }
 
+const char* nodec_inet_date_cached() {
+  static time_t second = 0;             // the wall-clock second of `date`
+  static char date[INET_DATE_LEN + 1];  // a private copy: `nodec_inet_date` reuses its buffer for any time
+  time_t now;
+  time(&now);
+  if (date[0] == 0 || now != second) {
+    memcpy(date, nodec_inet_date(now), INET_DATE_LEN + 1);
+    second = now;
+  }
+  return date;
+}
+
 bool nodec_parse_inet_date(const char* date, time_t* t) {
   struct tm g;
   memset(&g, 0, sizeof(g));  
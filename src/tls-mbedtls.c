@@ -65,6 +65,10 @@ void nodec_tls_stream_handshake(nodec_tls_stream_t* ts) {
   ts->handshaked = true;
 }
 
+const char* nodec_tls_stream_alpn(nodec_tls_stream_t* ts) {
+  return mbedtls_ssl_get_alpn_protocol(&ts->ssl);
+}
+
 static bool async_tls_stream_read_chunks(nodec_tls_stream_t* ts)
 {
   uv_buf_t buf = nodec_buf_alloc(ts->read_chunk_size);
@@ -147,6 +151,11 @@ static void async_tls_stream_shutdown(nodec_stream_t* stream) {
   async_shutdown(as_stream(ts->source));
 }
 
+static size_t nodec_tls_stream_write_queued(nodec_stream_t* stream) {
+  nodec_tls_stream_t* ts = (nodec_tls_stream_t*)stream;
+  return nodec_stream_write_queued(as_stream(ts->source));
+}
+
 static void nodec_tls_stream_free(nodec_stream_t* stream) {
   nodec_tls_stream_t* ts = (nodec_tls_stream_t*)stream;
   mbedtls_ssl_free(&ts->ssl);
@@ -182,6 +191,7 @@ nodec_bstream_t* nodec_tls_stream_alloc(nodec_bstream_t* stream, const nodec_ssl
     &async_tls_stream_read_chunk, &nodec_chunks_pushback_buf,
     &async_tls_stream_read_bufx, &async_tls_stream_write_bufs,
     &async_tls_stream_shutdown, &nodec_tls_stream_free);
+  nodec_stream_set_write_queued(&ts->bstream.stream_t, &nodec_tls_stream_write_queued);
   ts->source = stream;
   ts->read_chunk_size = 14 * NODEC_KB;
   mbedtls_ssl_init(&ts->ssl);
@@ -275,6 +285,11 @@ nodec_ssl_config_t* nodec_ssl_config_server_from(const char* cert_path, const ch
 }
 
 
+void nodec_ssl_config_alpn(nodec_ssl_config_t* config, const char** protocols) {
+  int res = mbedtls_ssl_conf_alpn_protocols(&config->mbedtls_config, protocols);
+  if (res != 0) nodec_throw_tls(res, "cannot set ALPN protocols");
+}
+
 nodec_ssl_config_t* nodec_ssl_config_client() {
   nodec_ssl_config_t* config = nodec_zero_alloc(nodec_ssl_config_t);
   {on_abort(nodec_ssl_config_freev, lh_value_any_ptr(config)) {
@@ -0,0 +1,271 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "nodec.h"
+#include "nodec-primitive.h"
+#include "nodec-internal.h"
+#include <assert.h>
+
+/*-----------------------------------------------------------------
+  UDP sockets
+  Received datagrams are emitted into a channel so a strand can
+  consume them as a stream of messages; when the channel is full,
+  datagrams are dropped. Messages are allocated from a per-socket
+  pool of buffers of `max_datagram` bytes.
+  On libuv 1.40 and later we receive in batches with `recvmmsg`
+  into one large buffer and copy each datagram into a pooled message.
+-----------------------------------------------------------------*/
+
+#if (UV_VERSION_HEX >= 0x012800)
+#define UDP_USE_MMSG
+#define UDP_MMSG_COUNT    (16)
+#define UDP_MMSG_DGRAM    (64*1024)   // libuv uses a fixed 64kb per datagram in a batch
+#endif
+
+#define UDP_QUEUE_MAX     (1024)      // maximal received messages in the channel
+#define UDP_POOL_MAX      (64)        // maximal pooled messages
+
+typedef struct _udp_msg_t {
+  nodec_udp_msg_t     msg;            // must be first
+  struct _udp_msg_t*  next;           // in the pool
+} udp_msg_t;
+
+struct _nodec_udp_t {
+  uv_udp_t*         udp;
+  channel_t*        ch;               // received messages
+  size_t            max_datagram;
+  udp_msg_t*        pool;
+  size_t            pool_count;
+  char*             batch;            // buffer for batched receives (if used)
+  bool              receiving;
+  nodec_udp_stats_t stats;
+};
+
+static char* udp_msg_data(udp_msg_t* m) {
+  return (char*)(m + 1);
+}
+
+static udp_msg_t* udp_msg_from_data(char* data) {
+  return ((udp_msg_t*)data) - 1;
+}
+
+static udp_msg_t* udpx_msg_alloc(nodec_udp_t* u) {
+  udp_msg_t* m = u->pool;
+  if (m != NULL) {
+    u->pool = m->next;
+    u->pool_count--;
+  }
+  else {
+    m = (udp_msg_t*)nodecx_malloc(sizeof(udp_msg_t) + u->max_datagram);
+    if (m == NULL) return NULL;
+  }
+  memset(m, 0, sizeof(udp_msg_t));
+  m->msg.buf = nodec_buf(udp_msg_data(m), u->max_datagram);
+  return m;
+}
+
+void nodec_udp_msg_release(nodec_udp_t* u, nodec_udp_msg_t* msg) {
+  if (msg == NULL) return;
+  udp_msg_t* m = (udp_msg_t*)msg;
+  if (u == NULL || u->pool_count >= UDP_POOL_MAX) {
+    nodec_free(m);
+  }
+  else {
+    m->next = u->pool;
+    u->pool = m;
+    u->pool_count++;
+  }
+}
+
+static void _channel_release_msg(lh_value data, lh_value arg, int err) {
+  nodec_udp_msg_release((nodec_udp_t*)lh_ptr_value(arg), (nodec_udp_msg_t*)lh_ptr_value(data));
+}
+
+nodec_udp_t* nodec_udp_alloc(size_t max_datagram) {
+  nodec_udp_t* u = nodec_zero_alloc(nodec_udp_t);
+  u->max_datagram = (max_datagram == 0 ? 8 * 1024 : max_datagram);
+  u->udp = nodec_zero_alloc(uv_udp_t);
+  uv_errno_t err;
+#ifdef UDP_USE_MMSG
+  err = uv_udp_init_ex(async_loop(), u->udp, AF_UNSPEC | UV_UDP_RECVMMSG);
+#else
+  err = uv_udp_init(async_loop(), u->udp);
+#endif
+  if (err != 0) {
+    nodec_free(u->udp);
+    nodec_free(u);
+    nodec_check(err);
+  }
+  u->udp->data = u;
+  u->ch = channel_alloc_ex(UDP_QUEUE_MAX, NULL, lh_value_null, &_channel_release_msg);
+  return u;
+}
+
+void nodec_udp_free(nodec_udp_t* u) {
+  if (u == NULL) return;
+  if (u->receiving) uv_udp_recv_stop(u->udp);
+  u->udp->data = NULL;
+  nodec_handle_free((uv_handle_t*)u->udp);
+  channel_free(u->ch);
+  while (u->pool != NULL) {
+    udp_msg_t* m = u->pool;
+    u->pool = m->next;
+    nodec_free(m);
+  }
+  if (u->batch != NULL) nodec_free(u->batch);
+  nodec_free(u);
+}
+
+void nodec_udp_freev(lh_value uv) {
+  nodec_udp_free((nodec_udp_t*)lh_ptr_value(uv));
+}
+
+void nodec_udp_bind(nodec_udp_t* u, const struct sockaddr* addr, unsigned int flags) {
+  check_uv_err_addr(uv_udp_bind(u->udp, addr, flags), addr);
+}
+
+void nodec_udp_stats(nodec_udp_t* u, nodec_udp_stats_t* stats) {
+  if (stats != NULL) *stats = u->stats;
+}
+
+
+/*-----------------------------------------------------------------
+  Receiving
+-----------------------------------------------------------------*/
+
+static void _udp_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  nodec_udp_t* u = (nodec_udp_t*)handle->data;
+  *buf = nodec_buf(NULL, 0);
+  if (u == NULL) return;
+#ifdef UDP_USE_MMSG
+  if (u->batch == NULL) u->batch = (char*)nodecx_malloc(UDP_MMSG_COUNT * UDP_MMSG_DGRAM);
+  if (u->batch != NULL) {
+    *buf = nodec_buf(u->batch, UDP_MMSG_COUNT * UDP_MMSG_DGRAM);
+    return;
+  }
+#endif
+  udp_msg_t* m = udpx_msg_alloc(u);
+  if (m != NULL) *buf = m->msg.buf;
+}
+
+static void udp_emit(nodec_udp_t* u, udp_msg_t* m, ssize_t nread, const struct sockaddr* addr, unsigned flags) {
+  m->msg.buf.len = (uv_buf_len_t)nread;
+  if (addr != NULL) {
+    memcpy(&m->msg.addr, addr, (addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)));
+  }
+  if ((flags & UV_UDP_PARTIAL) != 0) u->stats.truncated++;
+  if (channel_emit(u->ch, lh_value_ptr(m), lh_value_ptr(u), 0) != 0) {
+    u->stats.dropped++;
+    nodec_udp_msg_release(u, &m->msg);
+  }
+  else {
+    u->stats.received++;
+  }
+}
+
+// Does `buf` point into the batch buffer? Each datagram of a batch
+// (`UV_UDP_MMSG_CHUNK`) is at its own offset in the batch buffer.
+static bool udp_in_batch(nodec_udp_t* u, const uv_buf_t* buf) {
+#ifdef UDP_USE_MMSG
+  return (u != NULL && u->batch != NULL && buf->base != NULL &&
+          buf->base >= u->batch && buf->base < u->batch + (UDP_MMSG_COUNT * UDP_MMSG_DGRAM));
+#else
+  return false;
+#endif
+}
+
+static void _udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags) {
+  nodec_udp_t* u = (nodec_udp_t*)handle->data;
+  bool in_batch = udp_in_batch(u, buf);
+#ifdef UDP_USE_MMSG
+  if ((flags & UV_UDP_MMSG_FREE) != 0) return;  // we keep the batch buffer
+#endif
+  if (u == NULL) {
+    if (buf->base != NULL && !in_batch) nodec_free(udp_msg_from_data(buf->base));
+    return;
+  }
+  if (nread < 0) {
+    // emit the error so a receiving strand gets it
+    channel_emit(u->ch, lh_value_null, lh_value_ptr(u), (int)nread);
+  }
+  else if (addr != NULL) {
+    // a datagram (possibly empty)
+    if (!in_batch) {
+      udp_emit(u, udp_msg_from_data(buf->base), nread, addr, flags);
+      return;
+    }
+    // copy a datagram out of the batch buffer
+    udp_msg_t* m = udpx_msg_alloc(u);
+    if (m == NULL) {
+      u->stats.dropped++;
+    }
+    else {
+      if ((size_t)nread > u->max_datagram) {
+        nread = (ssize_t)u->max_datagram;
+        flags |= UV_UDP_PARTIAL;
+      }
+      memcpy(udp_msg_data(m), buf->base, (size_t)nread);
+      udp_emit(u, m, nread, addr, flags);
+    }
+    return;
+  }
+  // nothing received (or an error): return the buffer
+  if (buf->base != NULL && !in_batch) nodec_udp_msg_release(u, &udp_msg_from_data(buf->base)->msg);
+}
+
+static void nodec_udp_recv_start(nodec_udp_t* u) {
+  if (u->receiving) return;
+  nodec_check(uv_udp_recv_start(u->udp, &_udp_alloc_cb, &_udp_recv_cb));
+  u->receiving = true;
+}
+
+channel_t* nodec_udp_channel(nodec_udp_t* u) {
+  nodec_udp_recv_start(u);
+  return u->ch;
+}
+
+nodec_udp_msg_t* async_udp_recv(nodec_udp_t* u) {
+  nodec_udp_recv_start(u);
+  lh_value data = lh_value_null;
+  int err = channel_receive(u->ch, &data, NULL);
+  nodec_check(err);
+  return (nodec_udp_msg_t*)lh_ptr_value(data);
+}
+
+
+/*-----------------------------------------------------------------
+  Sending
+-----------------------------------------------------------------*/
+
+static void _udp_send_cb(uv_udp_send_t* req, int status) {
+  async_req_resume((uv_req_t*)req, status >= 0 ? 0 : status);
+}
+
+static void async_udp_send_queued(nodec_udp_t* u, uv_buf_t buf, const struct sockaddr* addr) {
+  {using_req(uv_udp_send_t, req) {
+    nodec_check(uv_udp_send(req, u->udp, &buf, 1, addr, &_udp_send_cb));
+    nodec_check(asyncx_await_once((uv_req_t*)req));
+  }}
+}
+
+void async_udp_send(nodec_udp_t* u, uv_buf_t buf, const struct sockaddr* addr) {
+  async_udp_send_many(u, &buf, 1, addr);
+}
+
+void async_udp_send_many(nodec_udp_t* u, const uv_buf_t bufs[], size_t count, const struct sockaddr* addr) {
+  for (size_t i = 0; i < count; i++) {
+    // try to send directly without allocating a request;
+    // only if the socket buffer is full we queue and await the send
+    int res = uv_udp_try_send(u->udp, &bufs[i], 1, addr);
+    if (res == UV_EAGAIN) {
+      async_udp_send_queued(u, bufs[i], addr);
+    }
+    else if (res < 0) {
+      nodec_check(res);
+    }
+    u->stats.sent++;
+  }
+}
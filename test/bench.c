@@ -0,0 +1,391 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2018, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <nodec.h>
+
+/*-----------------------------------------------------------------
+  TCP loopback latency
+  Each round trip sends a small request in two writes (header and body)
+  and gets a response in two writes. Without TCP_NODELAY the second
+  write is delayed by Nagle's algorithm until the first is acknowledged.
+-----------------------------------------------------------------*/
+
+#define TCP_BENCH_HOST    "127.0.0.1:8089"
+#define TCP_BENCH_ROUNDS  1000
+#define TCP_BENCH_HEAD    16
+#define TCP_BENCH_BODY    48
+
+static tcp_socket_options_t tcp_bench_options;
+
+static void tcp_bench_write_msg(nodec_bstream_t* stream, char* msg) {
+  async_write_buf(as_stream(stream), nodec_buf(msg, TCP_BENCH_HEAD));
+  async_write_buf(as_stream(stream), nodec_buf(msg + TCP_BENCH_HEAD, TCP_BENCH_BODY));
+}
+
+static void tcp_bench_echo(int id, nodec_bstream_t* client, lh_value arg) {
+  char msg[TCP_BENCH_HEAD + TCP_BENCH_BODY];
+  while (async_read_into(client, nodec_buf(msg, sizeof(msg))) == sizeof(msg)) {
+    tcp_bench_write_msg(client, msg);
+  }
+}
+
+static void tcp_bench_server() {
+  struct sockaddr* addr = nodec_parse_sockaddr(TCP_BENCH_HOST);
+  {using_free(addr) {
+    tcp_server_config_t config = tcp_server_config();
+    config.socket_options = tcp_bench_options;
+    config.timeout = 0;
+    async_tcp_server_at(addr, &config, &tcp_bench_echo, NULL, lh_value_null);
+  }}
+}
+
+static void tcp_bench_client() {
+  async_wait(10);  // give the server time to start listening
+  struct sockaddr* addr = nodec_parse_sockaddr(TCP_BENCH_HOST);
+  {using_free(addr) {
+    nodec_bstream_t* conn = async_tcp_connect_at_ex(addr, TCP_BENCH_HOST, &tcp_bench_options);
+    {using_bstream(conn) {
+      char msg[TCP_BENCH_HEAD + TCP_BENCH_BODY];
+      memset(msg, 'x', sizeof(msg));
+      uint64_t start = uv_hrtime();
+      for (int i = 0; i < TCP_BENCH_ROUNDS; i++) {
+        tcp_bench_write_msg(conn, msg);
+        if (async_read_into(conn, nodec_buf(msg, sizeof(msg))) != sizeof(msg)) {
+          nodec_throw_msg(UV_EOF, "connection closed early");
+        }
+      }
+      double usecs = (double)(uv_hrtime() - start) / 1000.0;
+      printf("  nodelay=%-5s: %d round trips, %8.1f us per round trip\n",
+        (tcp_bench_options.nodelay ? "true" : "false"), TCP_BENCH_ROUNDS, usecs / TCP_BENCH_ROUNDS);
+    }}
+  }}
+}
+
+static void bench_tcp_latency(bool nodelay) {
+  tcp_socket_options_t options = tcp_socket_options();
+  options.nodelay = nodelay;
+  tcp_bench_options = options;
+  async_firstof(&tcp_bench_server, &tcp_bench_client);
+}
+
+static void bench_tcp() {
+  printf("tcp loopback latency:\n");
+  bench_tcp_latency(false);
+  bench_tcp_latency(true);
+}
+
+
+/*-----------------------------------------------------------------
+  Unix domain socket (or named pipe) latency
+  The same round trips as the TCP benchmark, for comparing
+  co-located traffic over loopback TCP versus a local socket.
+-----------------------------------------------------------------*/
+
+#ifdef _WIN32
+#define PIPE_BENCH_PATH   "\\\\.\\pipe\\nodec-bench"
+#else
+#define PIPE_BENCH_PATH   "/tmp/nodec-bench.sock"
+#endif
+
+static void pipe_bench_server() {
+  tcp_server_config_t config = tcp_server_config();
+  config.timeout = 0;
+  async_pipe_server_at(PIPE_BENCH_PATH, &config, &tcp_bench_echo, NULL, lh_value_null);
+}
+
+static void pipe_bench_client() {
+  async_wait(10);  // give the server time to start listening
+  nodec_bstream_t* conn = async_pipe_connect(PIPE_BENCH_PATH);
+  {using_bstream(conn) {
+    char msg[TCP_BENCH_HEAD + TCP_BENCH_BODY];
+    memset(msg, 'x', sizeof(msg));
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < TCP_BENCH_ROUNDS; i++) {
+      tcp_bench_write_msg(conn, msg);
+      if (async_read_into(conn, nodec_buf(msg, sizeof(msg))) != sizeof(msg)) {
+        nodec_throw_msg(UV_EOF, "connection closed early");
+      }
+    }
+    double usecs = (double)(uv_hrtime() - start) / 1000.0;
+    printf("  %-14s: %d round trips, %8.1f us per round trip\n", "unix socket", TCP_BENCH_ROUNDS, usecs / TCP_BENCH_ROUNDS);
+  }}
+}
+
+static void bench_pipe() {
+  printf("local socket latency (compare with tcp nodelay=true):\n");
+  async_firstof(&pipe_bench_server, &pipe_bench_client);
+}
+
+
+/*-----------------------------------------------------------------
+  HTTP pipelining
+  The client writes a batch of GET requests at once and then reads
+  all the responses. With `pipeline` larger than 1 the server starts
+  handling the next buffered request while the previous response
+  is still being written.
+-----------------------------------------------------------------*/
+
+#define HTTP_BENCH_HOST     "127.0.0.1:8090"
+#define HTTP_BENCH_BATCHES  200
+#define HTTP_BENCH_BATCH    16
+#define HTTP_BENCH_BODY     "pong!"
+
+static int http_bench_pipeline = 1;
+
+static void http_bench_serve() {
+  http_resp_send_body_str(HTTP_STATUS_OK, HTTP_BENCH_BODY, "text/plain");
+}
+
+static void http_bench_server() {
+  tcp_server_config_t config = tcp_server_config();
+  config.pipeline = http_bench_pipeline;
+  async_http_server_at(HTTP_BENCH_HOST, &config, &http_bench_serve);
+}
+
+static void http_bench_client() {
+  async_wait(10);  // give the server time to start listening
+  nodec_bstream_t* conn = async_tcp_connect(HTTP_BENCH_HOST);
+  {using_bstream(conn) {
+    char batch[HTTP_BENCH_BATCH * 64];
+    size_t len = 0;
+    for (int i = 0; i < HTTP_BENCH_BATCH; i++) {
+      len += snprintf(batch + len, sizeof(batch) - len, "GET /%i HTTP/1.1\r\nHost: localhost\r\n\r\n", i);
+    }
+    uint64_t start = uv_hrtime();
+    for (int b = 0; b < HTTP_BENCH_BATCHES; b++) {
+      async_write_buf(as_stream(conn), nodec_buf(batch, len));
+      for (int i = 0; i < HTTP_BENCH_BATCH; i++) {
+        uv_buf_t resp = async_read_buf_upto(conn, HTTP_BENCH_BODY, strlen(HTTP_BENCH_BODY), 0);
+        if (nodec_buf_is_null(resp)) nodec_throw_msg(UV_EOF, "connection closed early");
+        nodec_buf_free(resp);
+      }
+    }
+    double usecs = (double)(uv_hrtime() - start) / 1000.0;
+    int total = HTTP_BENCH_BATCHES * HTTP_BENCH_BATCH;
+    printf("  pipeline=%-2i: %d requests, %8.1f us per request, %8.0f requests/s\n",
+      http_bench_pipeline, total, usecs / total, total / (usecs / 1e6));
+  }}
+}
+
+static void bench_http_pipelined(int pipeline) {
+  http_bench_pipeline = pipeline;
+  async_firstof(&http_bench_server, &http_bench_client);
+}
+
+static void bench_http_pipeline() {
+  printf("http pipelined requests (batches of %d):\n", HTTP_BENCH_BATCH);
+  bench_http_pipelined(1);
+  bench_http_pipelined(8);
+}
+
+
+/*-----------------------------------------------------------------
+  Streaming responses
+  A chunked response body is written as many small writes. Without
+  buffering every write becomes a chunk and a write to the socket;
+  with a flush size the writes are combined into large chunks.
+-----------------------------------------------------------------*/
+
+#define STREAM_BENCH_HOST       "127.0.0.1:8091"
+#define STREAM_BENCH_REQUESTS   20
+#define STREAM_BENCH_WRITES     10000
+#define STREAM_BENCH_LINE       "a small line of streamed output\n"
+
+static size_t stream_bench_flush_size = NODEC_HTTP_FLUSH_SIZE;
+
+static void stream_bench_serve() {
+  http_resp_set_flush_size(stream_bench_flush_size);
+  nodec_stream_t* body = http_resp_send_status_body(HTTP_STATUS_OK, NODEC_CHUNKED, "text/plain");
+  {using_stream(body) {
+    for (int i = 0; i < STREAM_BENCH_WRITES; i++) {
+      async_write(body, STREAM_BENCH_LINE);
+    }
+  }}
+}
+
+static void stream_bench_server() {
+  async_http_server_at(STREAM_BENCH_HOST, NULL, &stream_bench_serve);
+}
+
+static void stream_bench_client() {
+  async_wait(10);  // give the server time to start listening
+  nodec_bstream_t* conn = async_tcp_connect(STREAM_BENCH_HOST);
+  {using_bstream(conn) {
+    const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    size_t total = 0;
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < STREAM_BENCH_REQUESTS; i++) {
+      async_write(as_stream(conn), request);
+      uv_buf_t resp = async_read_buf_upto(conn, "\r\n0\r\n\r\n", 7, 0);
+      if (nodec_buf_is_null(resp)) nodec_throw_msg(UV_EOF, "connection closed early");
+      total += resp.len;
+      nodec_buf_free(resp);
+    }
+    double secs = (double)(uv_hrtime() - start) / 1e9;
+    printf("  flush=%-6zu: %8.1f ms per response, %8.1f MB/s  (%zu bytes)\n",
+      stream_bench_flush_size, 1000.0 * secs / STREAM_BENCH_REQUESTS, (double)total / (secs * 1024 * 1024), total);
+  }}
+}
+
+static void bench_stream_flushed(size_t flush_size) {
+  stream_bench_flush_size = flush_size;
+  async_firstof(&stream_bench_server, &stream_bench_client);
+}
+
+static void bench_stream() {
+  printf("streaming chunked responses (%d writes of %zu bytes):\n", STREAM_BENCH_WRITES, strlen(STREAM_BENCH_LINE));
+  bench_stream_flushed(0);
+  bench_stream_flushed(NODEC_HTTP_FLUSH_SIZE);
+}
+
+
+/*-----------------------------------------------------------------
+  Response status and date rendering
+  Compares formatting the status line and Date header with snprintf
+  and the system clock on every response against the pre-rendered
+  status lines and the loop-cached date.
+-----------------------------------------------------------------*/
+
+#define HEAD_BENCH_ROUNDS  1000000
+
+static void bench_headers() {
+  static const http_status_t statuses[4] = { HTTP_STATUS_OK, HTTP_STATUS_NOT_FOUND, HTTP_STATUS_NOT_MODIFIED, HTTP_STATUS_OK };
+  char buf[256];
+  size_t total = 0;
+  printf("status line and date rendering:\n");
+
+  uint64_t start = uv_hrtime();
+  for (int i = 0; i < HEAD_BENCH_ROUNDS; i++) {
+    http_status_t status = statuses[i % 4];
+    total += snprintf(buf, sizeof(buf), "HTTP/1.1 %i %s\r\nDate: %s\r\n", status, nodec_http_status_str(status), nodec_inet_date_now());
+  }
+  double secs = (double)(uv_hrtime() - start) / 1e9;
+  printf("  %-12s: %10.0f headers/s\n", "snprintf", HEAD_BENCH_ROUNDS / secs);
+
+  start = uv_hrtime();
+  for (int i = 0; i < HEAD_BENCH_ROUNDS; i++) {
+    size_t len;
+    const char* line = nodec_http_status_line(statuses[i % 4], &len);
+    memcpy(buf, line, len);
+    memcpy(buf + len, "Date: ", 6);
+    memcpy(buf + len + 6, nodec_inet_date_cached(), 29);
+    memcpy(buf + len + 35, "\r\n", 2);
+    total += len + 37;
+  }
+  secs = (double)(uv_hrtime() - start) / 1e9;
+  printf("  %-12s: %10.0f headers/s  (%zu bytes)\n", "pre-rendered", HEAD_BENCH_ROUNDS / secs, total);
+}
+
+
+/*-----------------------------------------------------------------
+  Request routing
+  Dispatches paths across 1000 routes with a compiled router and
+  compares with trying each route pattern in turn, as a chain of
+  string comparisons in a hand-written server function would do.
+-----------------------------------------------------------------*/
+
+#define ROUTE_BENCH_COUNT   1000
+#define ROUTE_BENCH_ROUNDS  1000000
+
+static void route_bench_serve() { }
+
+static void route_bench_pattern(char* buf, size_t size, int i) {
+  switch (i % 4) {
+  case 0: snprintf(buf, size, "/api/v1/resource%d/:id", i); break;
+  case 1: snprintf(buf, size, "/api/v1/resource%d/:id/items/:item", i); break;
+  case 2: snprintf(buf, size, "/static%d/*path", i); break;
+  default: snprintf(buf, size, "/pages/page%d", i); break;
+  }
+}
+
+static void route_bench_path(char* buf, size_t size, int i) {
+  switch (i % 4) {
+  case 0: snprintf(buf, size, "/api/v1/resource%d/%d", i, 7 * i); break;
+  case 1: snprintf(buf, size, "/api/v1/resource%d/%d/items/x%d", i, 7 * i, i); break;
+  case 2: snprintf(buf, size, "/static%d/css/site.css", i); break;
+  default: snprintf(buf, size, "/pages/page%d", i); break;
+  }
+}
+
+// match a pattern segment by segment
+static bool route_bench_linear_match(const char* pattern, const char* path) {
+  while (*pattern != 0) {
+    if (*pattern == '*') return true;
+    if (*pattern == ':') {
+      if (*path == 0 || *path == '/') return false;
+      while (*pattern != 0 && *pattern != '/') pattern++;
+      while (*path != 0 && *path != '/') path++;
+    }
+    else if (*pattern++ != *path++) {
+      return false;
+    }
+  }
+  return (*path == 0);
+}
+
+static void bench_router() {
+  static char patterns[ROUTE_BENCH_COUNT][64];
+  static char paths[ROUTE_BENCH_COUNT][64];
+  printf("dispatch across %d routes:\n", ROUTE_BENCH_COUNT);
+  nodec_router_t* router = nodec_router_alloc();
+  {using_router(router) {
+    for (int i = 0; i < ROUTE_BENCH_COUNT; i++) {
+      route_bench_pattern(patterns[i], 64, i);
+      route_bench_path(paths[i], 64, i);
+      nodec_router_route(router, HTTP_GET, patterns[i], &route_bench_serve);
+    }
+    uint64_t start = uv_hrtime();
+    nodec_router_compile(router);
+    printf("  %-12s: %10.1f us\n", "compile", (double)(uv_hrtime() - start) / 1000.0);
+
+    size_t found = 0;
+    start = uv_hrtime();
+    for (int i = 0; i < ROUTE_BENCH_ROUNDS; i++) {
+      const char* path = paths[(i * 7919) % ROUTE_BENCH_COUNT];
+      nodec_route_param_t params[NODEC_ROUTE_PARAMS_MAX];
+      size_t count = NODEC_ROUTE_PARAMS_MAX;
+      if (nodec_router_match(router, HTTP_GET, path, strlen(path), params, &count) != NULL) found++;
+    }
+    double secs = (double)(uv_hrtime() - start) / 1e9;
+    printf("  %-12s: %10.0f dispatches/s  (%zu matched)\n", "radix tree", ROUTE_BENCH_ROUNDS / secs, found);
+
+    found = 0;
+    int rounds = ROUTE_BENCH_ROUNDS / 100;
+    start = uv_hrtime();
+    for (int i = 0; i < rounds; i++) {
+      const char* path = paths[(i * 7919) % ROUTE_BENCH_COUNT];
+      for (int r = 0; r < ROUTE_BENCH_COUNT; r++) {
+        if (route_bench_linear_match(patterns[r], path)) {
+          found++;
+          break;
+        }
+      }
+    }
+    secs = (double)(uv_hrtime() - start) / 1e9;
+    printf("  %-12s: %10.0f dispatches/s  (%zu matched)\n", "linear", rounds / secs, found);
+  }}
+}
+
+
+/*-----------------------------------------------------------------
+  Main
+-----------------------------------------------------------------*/
+
+static void entry() {
+  bench_tcp();
+  bench_pipe();
+  bench_http_pipeline();
+  bench_stream();
+  bench_headers();
+  bench_router();
+}
+
+int main() {
+  async_main(entry);
+  return 0;
+}
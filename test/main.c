@@ -144,6 +144,41 @@ static void test_tcp() {
   async_http_server_at(host, NULL, &test_http_serve);
 }
 
+// serves HTTP/1.1 and HTTP/2 with prior knowledge, e.g. `curl --http2-prior-knowledge`
+static void test_http2() {
+  tcp_server_config_t config = tcp_server_config();
+  config.http2 = true;
+  const char* host = "127.0.0.1:8080";
+  printf("serving at: %s\n", host);
+  async_http_server_at(host, &config, &test_http_serve);
+}
+
+// upload with e.g. `curl -F "file=@big.bin" -F "note=hi" http://127.0.0.1:8080`
+static void test_upload_serve() {
+  http_multipart_t* form = http_req_multipart();
+  {using_http_multipart(form) {
+    while (async_http_multipart_next(form)) {
+      size_t total = 0;
+      bool owned = false;
+      uv_buf_t buf;
+      while (!nodec_buf_is_null(buf = async_read_bufx(as_stream(http_multipart_body(form)), &owned))) {
+        total += buf.len;
+        if (owned) nodec_buf_free(buf);
+      }
+      const char* filename = http_multipart_filename(form);
+      printf("part %s: %s, %s, %zu bytes\n", http_multipart_name(form), (filename != NULL ? filename : "(field)"),
+              http_multipart_content_type(form), total);
+    }
+  }}
+  http_resp_send_ok();
+}
+
+static void test_upload() {
+  const char* host = "127.0.0.1:8080";
+  printf("serving at: %s\n", host);
+  async_http_server_at(host, NULL, &test_upload_serve);
+}
+
 static void test_https() {
   //tcp_server_config_t config = tcp_server_config();
   //config.max_interleaving = 500;
@@ -274,6 +309,63 @@ void test_as_client() {
   }}
 }
 
+/*-----------------------------------------------------------------
+  Happy eyeballs: connect to ::1 and 127.0.0.1
+-----------------------------------------------------------------*/
+
+static void eyeballs_serve(int id, nodec_bstream_t* client, lh_value arg) {
+  async_write(as_stream(client), (const char*)lh_ptr_value(arg));
+}
+
+static lh_value eyeballs_server(lh_value hostv) {
+  const char* host = (const char*)lh_ptr_value(hostv);
+  struct sockaddr* addr = nodec_parse_sockaddr(host);
+  {using_free(addr) {
+    async_tcp_server_at(addr, NULL, &eyeballs_serve, NULL, hostv);
+  }}
+  return lh_value_null;
+}
+
+static void eyeballs_servers() {
+  lh_actionfun* actions[2] = { &eyeballs_server, &eyeballs_server };
+  lh_value args[2] = { lh_value_ptr("[::1]:8091"), lh_value_ptr("127.0.0.1:8091") };
+  async_interleave(2, actions, args);
+}
+
+static void eyeballs_connect(const char* host6, const char* host4) {
+  struct sockaddr* addr6 = nodec_parse_sockaddr(host6);
+  {using_free(addr6) {
+    struct sockaddr* addr4 = nodec_parse_sockaddr(host4);
+    {using_free(addr4) {
+      struct addrinfo info4 = { 0 };
+      info4.ai_family = AF_INET;
+      info4.ai_addr = addr4;
+      struct addrinfo info6 = { 0 };
+      info6.ai_family = AF_INET6;
+      info6.ai_addr = addr6;
+      info6.ai_next = &info4;
+      uint64_t start = uv_hrtime();
+      nodec_bstream_t* conn = async_tcp_connect_at_addrs(&info6, "localhost", NODEC_CONNECT_ATTEMPT_DELAY, NULL);
+      {using_bstream(conn) {
+        char* s = async_read_all(conn, 1024);
+        {using_free(s) {
+          printf("try %s, %s: connected to %s in %.1fms\n", host6, host4, s, (double)(uv_hrtime() - start) / 1.0e6);
+        }}
+      }}
+    }}
+  }}
+}
+
+static void eyeballs_client() {
+  async_wait(10);  // give the servers time to start listening
+  eyeballs_connect("[::1]:8091", "127.0.0.1:8091");   // IPv6 first
+  eyeballs_connect("[::1]:8092", "127.0.0.1:8091");   // IPv6 refused: IPv4 starts right away
+}
+
+static void test_happy_eyeballs() {
+  async_firstof(&eyeballs_servers, &eyeballs_client);
+}
+
 /*-----------------------------------------------------------------
  test url parsing
 -----------------------------------------------------------------*/
@@ -330,7 +422,10 @@ static void entry() {
   //test_connect();
   //test_tcp_tty();
   //test_url();
+  //test_happy_eyeballs();
   //test_https();
+  //test_http2();
+  //test_upload();
 }
 
 int main() {
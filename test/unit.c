@@ -0,0 +1,791 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <nodec.h>
+#include <nodec-primitive.h>
+#include <nodec-internal.h>
+
+/*-----------------------------------------------------------------
+  Automated tests; `make unit` runs all of them and exits
+  with a non-zero code on the first failed check.
+-----------------------------------------------------------------*/
+
+static size_t unit_checks = 0;
+
+#define unit_check(cond) \
+  do { \
+    unit_checks++; \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1); \
+    } \
+  } while(0)
+
+static void unit_run(const char* name, void (*test)()) {
+  printf("test %s ... ", name);
+  fflush(stdout);
+  test();
+  printf("ok\n");
+}
+
+
+/*-----------------------------------------------------------------
+  Happy eyeballs: connect while the first address never answers
+-----------------------------------------------------------------*/
+
+#define EYEBALLS_DELAY  (250)
+
+static void eyeballs_serve(int id, nodec_bstream_t* client, lh_value arg) {
+  async_write(as_stream(client), "ok");
+}
+
+static void eyeballs_server() {
+  struct sockaddr* addr = nodec_parse_sockaddr("127.0.0.1:8095");
+  {using_free(addr) {
+    async_tcp_server_at(addr, NULL, &eyeballs_serve, NULL, lh_value_null);
+  }}
+}
+
+// Connect to `hosts` (IPv6 first) and return the milliseconds it took.
+static double eyeballs_connect(size_t n, const char* hosts[]) {
+  struct addrinfo infos[4];
+  struct sockaddr* addrs[4];
+  memset(infos, 0, sizeof(infos));
+  for (size_t i = 0; i < n; i++) {
+    addrs[i] = nodec_parse_sockaddr(hosts[i]);
+    infos[i].ai_family = addrs[i]->sa_family;
+    infos[i].ai_addr = addrs[i];
+    infos[i].ai_next = (i + 1 < n ? &infos[i + 1] : NULL);
+  }
+  double elapsed = 0;
+  uint64_t start = uv_hrtime();
+  nodec_bstream_t* conn = async_tcp_connect_at_addrs(&infos[0], "localhost", EYEBALLS_DELAY, NULL);
+  {using_bstream(conn) {
+    char* s = async_read_all(conn, 1024);
+    {using_free(s) {
+      elapsed = (double)(uv_hrtime() - start) / 1.0e6;
+      unit_check(s != NULL && strcmp(s, "ok") == 0);
+    }}
+  }}
+  for (size_t i = 0; i < n; i++) nodec_free(addrs[i]);
+  return elapsed;
+}
+
+static void eyeballs_client() {
+  async_wait(10);  // give the server time to start listening
+  // `100::1` is in the discard-only prefix (RFC 6666) and never answers;
+  // without racing we would wait for the system connect timeout.
+  const char* hosts1[2] = { "[100::1]:8095", "127.0.0.1:8095" };
+  unit_check(eyeballs_connect(2, hosts1) < 4 * EYEBALLS_DELAY);
+  // the second attempt is refused while the first still hangs:
+  // the third starts right away instead of after another delay
+  const char* hosts2[3] = { "[100::1]:8095", "127.0.0.1:8096", "127.0.0.1:8095" };
+  unit_check(eyeballs_connect(3, hosts2) < 2 * EYEBALLS_DELAY);
+}
+
+static void test_happy_eyeballs() {
+  async_firstof(&eyeballs_server, &eyeballs_client);
+}
+
+
+/*-----------------------------------------------------------------
+  UDP: datagrams that arrive together are received in one batch
+  (with `recvmmsg`) and each must be copied from its own offset
+-----------------------------------------------------------------*/
+
+#define UDP_TEST_COUNT  (12)
+
+static void test_udp_batch() {
+  struct sockaddr* addr = nodec_parse_sockaddr("127.0.0.1:8097");
+  {using_free(addr) {
+    nodec_udp_t* receiver = nodec_udp_alloc(0);
+    {using_udp(receiver) {
+      nodec_udp_bind(receiver, addr, 0);
+      nodec_udp_t* sender = nodec_udp_alloc(0);
+      {using_udp(sender) {
+        // send all before receiving starts so they are queued together
+        char data[UDP_TEST_COUNT][16];
+        uv_buf_t bufs[UDP_TEST_COUNT];
+        for (size_t i = 0; i < UDP_TEST_COUNT; i++) {
+          snprintf(data[i], 16, "datagram %zu", i);
+          bufs[i] = nodec_buf(data[i], strlen(data[i]));
+        }
+        async_udp_send_many(sender, bufs, UDP_TEST_COUNT, addr);
+        for (size_t i = 0; i < UDP_TEST_COUNT; i++) {
+          nodec_udp_msg_t* msg = async_udp_recv(receiver);
+          unit_check(msg->buf.len == bufs[i].len && memcmp(msg->buf.base, data[i], bufs[i].len) == 0);
+          nodec_udp_msg_release(receiver, msg);
+        }
+        nodec_udp_stats_t stats;
+        nodec_udp_stats(receiver, &stats);
+        unit_check(stats.received == UDP_TEST_COUNT && stats.dropped == 0 && stats.truncated == 0);
+      }}
+    }}
+  }}
+}
+
+
+/*-----------------------------------------------------------------
+  HPACK: the examples of RFC 7541 Appendix C.3 to C.6, with and
+  without Huffman coding, and with eviction from the dynamic table
+-----------------------------------------------------------------*/
+
+typedef struct _hpack_case_t {
+  const char* block;    // the header block in hex
+  const char* fields;   // the decoded fields as `name: value` lines
+  const char* table;    // the dynamic table afterwards, newest first
+  size_t      size;     // the size of the dynamic table afterwards
+} hpack_case_t;
+
+static size_t unit_unhex(const char* hex, uint8_t* out) {
+  size_t n = 0;
+  for (const char* p = hex; p[0] != 0 && p[1] != 0; ) {
+    if (*p == ' ') { p++; continue; }
+    unsigned int b;
+    sscanf(p, "%2x", &b);
+    out[n++] = (uint8_t)b;
+    p += 2;
+  }
+  return n;
+}
+
+static void hpack_lines(char* dst, size_t max, const char* name, const char* value) {
+  size_t n = strlen(dst);
+  snprintf(dst + n, max - n, "%s: %s\n", name, value);
+}
+
+static void hpack_check(size_t max_size, const hpack_case_t cases[], size_t count) {
+  hpack_table_t* t = hpack_decoder_alloc(max_size);
+  for (size_t i = 0; i < count; i++) {
+    uint8_t block[256];
+    size_t len = unit_unhex(cases[i].block, block);
+    char* fields = NULL;
+    size_t nfields = 0;
+    unit_check(hpack_decoder_decode(t, block, len, &fields, &nfields) == 0);
+    char lines[512] = "";
+    const char* f = fields;
+    for (size_t j = 0; j < nfields; j++) {
+      const char* value = f + strlen(f) + 1;
+      hpack_lines(lines, sizeof(lines), f, value);
+      f = value + strlen(value) + 1;
+    }
+    nodec_free(fields);
+    unit_check(strcmp(lines, cases[i].fields) == 0);
+    char table[512] = "";
+    const char* name;
+    const char* value;
+    for (size_t j = 0; hpack_decoder_entry(t, j, &name, &value); j++) {
+      hpack_lines(table, sizeof(table), name, value);
+    }
+    unit_check(strcmp(table, cases[i].table) == 0);
+    unit_check(hpack_decoder_size(t) == cases[i].size);
+  }
+  hpack_decoder_free(t);
+}
+
+#define HPACK_REQ1  ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+#define HPACK_REQ2  HPACK_REQ1 "cache-control: no-cache\n"
+#define HPACK_REQ3  ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"
+#define HPACK_REQ_TABLE1  ":authority: www.example.com\n"
+#define HPACK_REQ_TABLE2  "cache-control: no-cache\n" HPACK_REQ_TABLE1
+#define HPACK_REQ_TABLE3  "custom-key: custom-value\n" HPACK_REQ_TABLE2
+
+static const hpack_case_t hpack_requests[3] = {   // C.3
+  { "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", HPACK_REQ1, HPACK_REQ_TABLE1, 57 },
+  { "8286 84be 5808 6e6f 2d63 6163 6865", HPACK_REQ2, HPACK_REQ_TABLE2, 110 },
+  { "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", HPACK_REQ3, HPACK_REQ_TABLE3, 164 }
+};
+
+static const hpack_case_t hpack_requests_huffman[3] = {   // C.4
+  { "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", HPACK_REQ1, HPACK_REQ_TABLE1, 57 },
+  { "8286 84be 5886 a8eb 1064 9cbf", HPACK_REQ2, HPACK_REQ_TABLE2, 110 },
+  { "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", HPACK_REQ3, HPACK_REQ_TABLE3, 164 }
+};
+
+#define HPACK_DATE1       "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+#define HPACK_DATE2       "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+#define HPACK_LOCATION    "location: https://www.example.com\n"
+#define HPACK_COOKIE      "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n"
+#define HPACK_RESP1       ":status: 302\ncache-control: private\n" HPACK_DATE1 HPACK_LOCATION
+#define HPACK_RESP2       ":status: 307\ncache-control: private\n" HPACK_DATE1 HPACK_LOCATION
+#define HPACK_RESP3       ":status: 200\ncache-control: private\n" HPACK_DATE2 HPACK_LOCATION "content-encoding: gzip\n" HPACK_COOKIE
+#define HPACK_RESP_TABLE1 HPACK_LOCATION HPACK_DATE1 "cache-control: private\n:status: 302\n"
+#define HPACK_RESP_TABLE2 ":status: 307\n" HPACK_LOCATION HPACK_DATE1 "cache-control: private\n"
+#define HPACK_RESP_TABLE3 HPACK_COOKIE "content-encoding: gzip\n" HPACK_DATE2
+
+static const hpack_case_t hpack_responses[3] = {   // C.5; a 256 byte table so entries are evicted
+  { "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+    HPACK_RESP1, HPACK_RESP_TABLE1, 222 },
+  { "4803 3330 37c1 c0bf", HPACK_RESP2, HPACK_RESP_TABLE2, 222 },
+  { "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31",
+    HPACK_RESP3, HPACK_RESP_TABLE3, 215 }
+};
+
+static const hpack_case_t hpack_responses_huffman[3] = {   // C.6
+  { "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+    HPACK_RESP1, HPACK_RESP_TABLE1, 222 },
+  { "4883 640e ffc1 c0bf", HPACK_RESP2, HPACK_RESP_TABLE2, 222 },
+  { "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+    HPACK_RESP3, HPACK_RESP_TABLE3, 215 }
+};
+
+static void test_hpack() {
+  hpack_check(4096, hpack_requests, 3);
+  hpack_check(4096, hpack_requests_huffman, 3);
+  hpack_check(256, hpack_responses, 3);
+  hpack_check(256, hpack_responses_huffman, 3);
+}
+
+
+/*-----------------------------------------------------------------
+  HTTP/2 frames: a request with prior knowledge where the preface
+  arrives in pieces, data on a closed stream, and invalid frames
+-----------------------------------------------------------------*/
+
+#define H2_TEST_HOST  "127.0.0.1:8098"
+
+typedef struct _h2_test_frame_t {
+  uint8_t  type;
+  uint8_t  flags;
+  uint32_t id;
+  size_t   len;
+  uint8_t  payload[16384];
+} h2_test_frame_t;
+
+static void h2_test_serve() {
+  http_resp_send_body_str(HTTP_STATUS_OK, "hello", "text/plain");
+}
+
+static void h2_test_server() {
+  tcp_server_config_t config = tcp_server_config();
+  config.http2 = true;
+  async_http_server_at(H2_TEST_HOST, &config, &h2_test_serve);
+}
+
+// Send a frame header that announces `len` bytes followed by `payload`
+static void h2_test_send_ex(nodec_bstream_t* conn, size_t len, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t payload_len) {
+  uint8_t h[9] = { (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len, type, flags,
+                   (uint8_t)(id >> 24), (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id };
+  uv_buf_t bufs[2] = { nodec_buf(h, 9), nodec_buf(payload, payload_len) };
+  async_write_bufs(as_stream(conn), bufs, (payload_len > 0 ? 2 : 1));
+}
+
+static void h2_test_send(nodec_bstream_t* conn, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len) {
+  h2_test_send_ex(conn, len, type, flags, id, payload, len);
+}
+
+// Read the next frame but skip settings and window updates; returns `false` on the end of the connection
+static bool h2_test_recv(nodec_bstream_t* conn, h2_test_frame_t* f) {
+  do {
+    uint8_t h[9];
+    if (async_read_into(conn, nodec_buf(h, 9)) != 9) return false;
+    f->len = ((size_t)h[0] << 16) | ((size_t)h[1] << 8) | h[2];
+    f->type = h[3];
+    f->flags = h[4];
+    f->id = (((uint32_t)h[5] << 24) | ((uint32_t)h[6] << 16) | ((uint32_t)h[7] << 8) | h[8]) & 0x7FFFFFFF;
+    unit_check(f->len <= sizeof(f->payload));
+    if (f->len > 0 && async_read_into(conn, nodec_buf(f->payload, f->len)) != f->len) return false;
+  } while (f->type == 4 /* SETTINGS */ || f->type == 8 /* WINDOW_UPDATE */);
+  return true;
+}
+
+static nodec_bstream_t* h2_test_connect(const struct sockaddr* addr) {
+  nodec_bstream_t* conn = async_tcp_connect_at(addr, H2_TEST_HOST);
+  // send the preface in two pieces such that detection has to wait for the rest
+  async_write(as_stream(conn), "PRI * HTTP/2.0\r\n");
+  async_wait(20);
+  async_write(as_stream(conn), "\r\nSM\r\n\r\n");
+  h2_test_send(conn, 4 /* SETTINGS */, 0, 0, NULL, 0);
+  return conn;
+}
+
+// Send a frame and expect the server to close the connection with `error`
+static void h2_test_goaway(const struct sockaddr* addr, size_t len, uint8_t type, uint8_t flags, const uint8_t* payload, size_t payload_len, uint8_t error) {
+  nodec_bstream_t* conn = h2_test_connect(addr);
+  {using_bstream(conn) {
+    h2_test_frame_t* f = nodec_alloc(h2_test_frame_t);
+    {using_free(f) {
+      h2_test_send_ex(conn, len, type, flags, 1, payload, payload_len);
+      unit_check(h2_test_recv(conn, f));
+      unit_check(f->type == 7 /* GOAWAY */ && f->len == 8 && f->payload[7] == error);
+      unit_check(!h2_test_recv(conn, f));
+    }}
+  }}
+}
+
+static void h2_test_client() {
+  async_wait(10);  // give the server time to start listening
+  struct sockaddr* addr = nodec_parse_sockaddr(H2_TEST_HOST);
+  {using_free(addr) {
+    nodec_bstream_t* conn = h2_test_connect(addr);
+    {using_bstream(conn) {
+      h2_test_frame_t* f = nodec_alloc(h2_test_frame_t);
+      hpack_table_t* decoder = hpack_decoder_alloc(4096);
+      {using_free(f) {
+        // GET / as in RFC 7541 C.3.1, with END_STREAM | END_HEADERS
+        uint8_t block[64];
+        size_t block_len = unit_unhex(hpack_requests[0].block, block);
+        h2_test_send(conn, 1 /* HEADERS */, 0x05, 1, block, block_len);
+        unit_check(h2_test_recv(conn, f));
+        unit_check(f->type == 1 && f->id == 1 && (f->flags & 0x04) != 0);
+        char* fields = NULL;
+        size_t count = 0;
+        unit_check(hpack_decoder_decode(decoder, f->payload, f->len, &fields, &count) == 0);
+        unit_check(count > 0 && strcmp(fields, ":status") == 0 && strcmp(fields + 8, "200") == 0);
+        nodec_free(fields);
+        unit_check(h2_test_recv(conn, f));
+        unit_check(f->type == 0 /* DATA */ && f->id == 1 && f->len == 5 && memcmp(f->payload, "hello", 5) == 0);
+        // data on the closed stream is reset once; the data in flight after that is ignored
+        for (int i = 0; i < 3; i++) h2_test_send(conn, 0 /* DATA */, 0, 1, "data", 4);
+        h2_test_send(conn, 6 /* PING */, 0, 0, "pingpong", 8);
+        unit_check(h2_test_recv(conn, f));
+        unit_check(f->type == 3 /* RST_STREAM */ && f->id == 1 && f->len == 4 && f->payload[3] == 5 /* STREAM_CLOSED */);
+        unit_check(h2_test_recv(conn, f));
+        unit_check(f->type == 6 && f->flags == 0x01 && f->len == 8 && memcmp(f->payload, "pingpong", 8) == 0);
+      }}
+      hpack_decoder_free(decoder);
+    }}
+    // padding larger than the frame
+    const uint8_t padded[4] = { 10, 0x82, 0x86, 0x84 };
+    h2_test_goaway(addr, 4, 1 /* HEADERS */, 0x08 | 0x05, padded, 4, 1 /* PROTOCOL_ERROR */);
+    // a frame larger than the maximal frame size is refused from its header
+    h2_test_goaway(addr, 16385, 0 /* DATA */, 0, NULL, 0, 6 /* FRAME_SIZE_ERROR */);
+  }}
+}
+
+static void test_http2_frames() {
+  async_firstof(&h2_test_server, &h2_test_client);
+}
+
+
+/*-----------------------------------------------------------------
+  Router: static segments take precedence over parameters, and
+  parameters over wildcards, backtracking when a path fails later
+-----------------------------------------------------------------*/
+
+static int route_served = 0;  // gives each route a distinct body
+static void route_root()       { route_served = 1; }
+static void route_users()      { route_served = 2; }
+static void route_users_new()  { route_served = 3; }
+static void route_user()       { route_served = 4; }
+static void route_user_post()  { route_served = 5; }
+static void route_user_posts() { route_served = 6; }
+static void route_post()       { route_served = 7; }
+static void route_user_rest()  { route_served = 8; }
+static void route_files()      { route_served = 9; }
+static void route_readme()     { route_served = 10; }
+
+typedef struct _route_case_t {
+  http_method_t        method;
+  const char*          path;
+  nodec_http_servefun* servefun;  // `NULL` if nothing should match
+  const char*          params;    // expected parameters as `name=value;` pairs
+} route_case_t;
+
+static const route_case_t route_cases[] = {
+  { HTTP_GET, "/", &route_root, "" },
+  { HTTP_GET, "/users", &route_users, "" },
+  { HTTP_GET, "/users/new", &route_users_new, "" },
+  { HTTP_GET, "/users/newer", &route_user, "id=newer;" },
+  { HTTP_GET, "/users/42", &route_user, "id=42;" },
+  { HTTP_POST, "/users/42", &route_user_post, "id=42;" },
+  { HTTP_DELETE, "/users/42", NULL, "" },
+  { HTTP_GET, "/users/42/posts", &route_user_posts, "id=42;" },
+  { HTTP_GET, "/users/new/posts", &route_user_posts, "id=new;" },
+  { HTTP_GET, "/users/42/posts/7", &route_post, "id=42;post=7;" },
+  { HTTP_GET, "/users/42/likes/7", &route_user_rest, "id=42;rest=likes/7;" },
+  { HTTP_DELETE, "/users/42/posts", &route_user_rest, "id=42;rest=posts;" },
+  { HTTP_GET, "/files/readme", &route_readme, "" },
+  { HTTP_PUT, "/files/readme", &route_files, "path=readme;" },
+  { HTTP_GET, "/files/readme.txt", &route_files, "path=readme.txt;" },
+  { HTTP_GET, "/files/docs/a.txt", &route_files, "path=docs/a.txt;" },
+  { HTTP_GET, "/files/", &route_files, "path=;" },
+  { HTTP_GET, "/users/", NULL, "" },
+  { HTTP_GET, "/user", NULL, "" },
+  { HTTP_GET, "/nothing", NULL, "" },
+};
+
+typedef struct _route_add_t {
+  nodec_router_t* router;
+  const char*     pattern;
+} route_add_t;
+
+static lh_value route_addv(lh_value argv) {
+  route_add_t* arg = (route_add_t*)lh_ptr_value(argv);
+  nodec_router_route(arg->router, HTTP_GET, arg->pattern, &route_root);
+  return lh_value_null;
+}
+
+// Adding `pattern` must fail with `UV_EINVAL`
+static void route_check_invalid(nodec_router_t* router, const char* pattern) {
+  route_add_t arg = { router, pattern };
+  lh_exception* exn = NULL;
+  lh_try(&exn, &route_addv, lh_value_ptr(&arg));
+  unit_check(exn != NULL && exn->code == UV_EINVAL);
+  lh_exception_free(exn);
+}
+
+static void test_router() {
+  nodec_router_t* router = nodec_router_alloc();
+  {using_router(router) {
+    nodec_router_route(router, HTTP_GET, "/", &route_root);
+    nodec_router_route(router, HTTP_GET, "/users", &route_users);
+    nodec_router_route(router, HTTP_GET, "/users/:id", &route_user);
+    nodec_router_route(router, HTTP_POST, "/users/:id", &route_user_post);
+    nodec_router_route(router, HTTP_GET, "/users/new", &route_users_new);
+    nodec_router_route(router, HTTP_GET, "/users/:id/posts", &route_user_posts);
+    nodec_router_route(router, HTTP_GET, "/users/:id/posts/:post", &route_post);
+    nodec_router_route_any(router, "/users/:id/*rest", &route_user_rest);
+    nodec_router_route_any(router, "/files/*path", &route_files);
+    nodec_router_route(router, HTTP_GET, "/files/readme", &route_readme);
+    route_check_invalid(router, "/users/:id");       // duplicate
+    route_check_invalid(router, "/users/:name/x");   // conflicting parameter name
+    route_check_invalid(router, "/files/*path/x");   // wildcard not last
+    route_check_invalid(router, "users");            // relative
+    nodec_router_compile(router);
+    for (size_t i = 0; i < sizeof(route_cases) / sizeof(route_cases[0]); i++) {
+      const route_case_t* c = &route_cases[i];
+      nodec_route_param_t params[NODEC_ROUTE_PARAMS_MAX];
+      size_t count = NODEC_ROUTE_PARAMS_MAX;
+      nodec_http_servefun* fun = nodec_router_match(router, c->method, c->path, strlen(c->path), params, &count);
+      unit_check(fun == c->servefun);
+      char found[128] = "";
+      for (size_t j = 0; j < count; j++) {
+        size_t n = strlen(found);
+        snprintf(found + n, sizeof(found) - n, "%s=%.*s;", params[j].name, (int)params[j].len, params[j].value);
+      }
+      unit_check(strcmp(found, c->params) == 0);
+    }
+    // the path does not need to be zero terminated
+    unit_check(nodec_router_match(router, HTTP_GET, "/users/42?x=1", 9, NULL, NULL) == &route_user);
+  }}
+}
+
+
+/*-----------------------------------------------------------------
+  Response cache: the key includes the host, `Vary` headers must
+  match, and authorized responses are only shared when allowed
+-----------------------------------------------------------------*/
+
+#define CACHE_TEST_HOST  "127.0.0.1:8099"
+
+static nodec_http_cache_t* cache_test;
+static size_t cache_rendered = 0;
+
+static void cache_test_render() {
+  cache_rendered++;
+  const char* path = http_req_path();
+  if (strcmp(path, "/lang") == 0) {
+    const char* lang = http_req_header("Accept-Language");
+    http_resp_add_header("Cache-Control", "max-age=60");
+    http_resp_add_header("Vary", "Accept-Language");
+    http_resp_send_body_str(HTTP_STATUS_OK, (lang == NULL ? "none" : lang), "text/plain");
+  }
+  else if (strcmp(path, "/public") == 0) {
+    http_resp_add_header("Cache-Control", "public, max-age=60");
+    http_resp_send_body_str(HTTP_STATUS_OK, "public", "text/plain");
+  }
+  else {
+    http_resp_add_header("Cache-Control", "max-age=60");
+    http_resp_send_body_str(HTTP_STATUS_OK, http_req_header("Host"), "text/plain");
+  }
+}
+
+static void cache_test_serve() {
+  http_cache_serve(cache_test, &cache_test_render);
+}
+
+static void cache_test_server() {
+  async_http_server_at(CACHE_TEST_HOST, NULL, &cache_test_serve);
+}
+
+// Request `path` and check the body; returns whether the response came from the cache
+static bool cache_test_get(const struct sockaddr* addr, const char* path, const char* headers, const char* body) {
+  size_t rendered = cache_rendered;
+  nodec_bstream_t* conn = async_tcp_connect_at(addr, CACHE_TEST_HOST);
+  {using_bstream(conn) {
+    async_printf(as_stream(conn), "GET %s HTTP/1.1\r\n%sConnection: close\r\n\r\n", path, headers);
+    char* response = async_read_all(conn, 4096);
+    {using_free(response) {
+      const char* content = strstr(response, "\r\n\r\n");
+      unit_check(strncmp(response, "HTTP/1.1 200", 12) == 0);
+      unit_check(content != NULL && strcmp(content + 4, body) == 0);
+    }}
+  }}
+  return (cache_rendered == rendered);
+}
+
+static void cache_test_client() {
+  async_wait(10);  // give the server time to start listening
+  struct sockaddr* addr = nodec_parse_sockaddr(CACHE_TEST_HOST);
+  {using_free(addr) {
+    // hit and miss, where each host has its own entry
+    unit_check(!cache_test_get(addr, "/page", "Host: a.com\r\n", "a.com"));
+    unit_check(cache_test_get(addr, "/page", "Host: a.com\r\n", "a.com"));
+    unit_check(!cache_test_get(addr, "/page", "Host: b.com\r\n", "b.com"));
+    unit_check(cache_test_get(addr, "/page", "Host: b.com\r\n", "b.com"));
+    unit_check(cache_test_get(addr, "/page", "Host: a.com\r\n", "a.com"));
+    // a different value for a `Vary` header is a miss
+    unit_check(!cache_test_get(addr, "/lang", "Host: a.com\r\nAccept-Language: en\r\n", "en"));
+    unit_check(cache_test_get(addr, "/lang", "Host: a.com\r\nAccept-Language: en\r\n", "en"));
+    unit_check(!cache_test_get(addr, "/lang", "Host: a.com\r\nAccept-Language: nl\r\n", "nl"));
+    unit_check(!cache_test_get(addr, "/lang", "Host: a.com\r\n", "none"));
+    unit_check(cache_test_get(addr, "/lang", "Host: a.com\r\nAccept-Language: nl\r\n", "nl"));
+    unit_check(cache_test_get(addr, "/lang", "Host: a.com\r\nAccept-Language: en\r\n", "en"));
+    // an authorized response is only stored if it is public
+    unit_check(!cache_test_get(addr, "/page", "Host: c.com\r\nAuthorization: Basic dXNlcjpwdw==\r\n", "c.com"));
+    unit_check(!cache_test_get(addr, "/page", "Host: c.com\r\nAuthorization: Basic dXNlcjpwdw==\r\n", "c.com"));
+    unit_check(!cache_test_get(addr, "/page", "Host: c.com\r\n", "c.com"));
+    unit_check(!cache_test_get(addr, "/public", "Host: c.com\r\nAuthorization: Basic dXNlcjpwdw==\r\n", "public"));
+    unit_check(cache_test_get(addr, "/public", "Host: c.com\r\nAuthorization: Basic dXNlcjpwdw==\r\n", "public"));
+    nodec_http_cache_stats_t stats;
+    nodec_http_cache_stats(cache_test, &stats);
+    unit_check(stats.hits == 7 && stats.misses == 9 && stats.stores == 7 && stats.entries == 7);
+  }}
+}
+
+static void test_http_cache() {
+  cache_test = nodec_http_cache_alloc(1024*1024, 0);
+  {using_http_cache(cache_test) {
+    async_firstof(&cache_test_server, &cache_test_client);
+  }}
+}
+
+
+/*-----------------------------------------------------------------
+  Expect: 100-continue with a body that is spooled to a file, and
+  a handler that ignores the body which closes the connection
+-----------------------------------------------------------------*/
+
+#define CONTINUE_TEST_HOST  "127.0.0.1:8100"
+#define CONTINUE_MEM_MAX    (1024)
+#define CONTINUE_BODY_LEN   (64*1024)
+#define CONTINUE_RESPONSE   "HTTP/1.1 100 Continue\r\n\r\n"
+
+static void continue_test_serve() {
+  if (strcmp(http_req_path(), "/upload") == 0) {
+    // echo the body that is larger than fits in memory
+    nodec_bstream_t* body = async_req_read_body_spooled(CONTINUE_MEM_MAX, 0);
+    {using_bstream(body) {
+      uv_buf_t buf = async_read_buf_all(body, 0);
+      {using_buf(&buf) {
+        http_resp_send_body_buf(HTTP_STATUS_OK, buf, "text/plain");
+      }}
+    }}
+  }
+  else if (strcmp(http_req_path(), "/late") == 0) {
+    // asking for the body after responding is too late for a `100 Continue`
+    http_resp_send_body_str(HTTP_STATUS_OK, "late", "text/plain");
+    http_req_body();
+  }
+  else {
+    http_resp_send_body_str(HTTP_STATUS_OK, "ignored", "text/plain");
+  }
+}
+
+// Send a request that expects `100 Continue` but whose body is never asked for
+static void continue_test_unasked(const struct sockaddr* addr, const char* path, const char* body) {
+  nodec_bstream_t* conn = async_tcp_connect_at(addr, CONTINUE_TEST_HOST);
+  {using_bstream(conn) {
+    async_printf(as_stream(conn), "POST %s HTTP/1.1\r\nHost: test\r\nExpect: 100-continue\r\nContent-Length: 10\r\n\r\n", path);
+    char* response = async_read_all(conn, 4096);
+    {using_free(response) {
+      const char* content = strstr(response, "\r\n\r\n");
+      unit_check(strncmp(response, "HTTP/1.1 200", 12) == 0);
+      unit_check(content != NULL && strcmp(content + 4, body) == 0);
+    }}
+  }}
+}
+
+static void continue_test_server() {
+  async_http_server_at(CONTINUE_TEST_HOST, NULL, &continue_test_serve);
+}
+
+static void continue_test_client() {
+  async_wait(10);  // give the server time to start listening
+  struct sockaddr* addr = nodec_parse_sockaddr(CONTINUE_TEST_HOST);
+  {using_free(addr) {
+    char* body = nodec_alloc_n(CONTINUE_BODY_LEN + 1, char);
+    {using_free(body) {
+      for (size_t i = 0; i < CONTINUE_BODY_LEN; i++) body[i] = (char)('a' + (i % 26));
+      body[CONTINUE_BODY_LEN] = 0;
+      nodec_bstream_t* conn = async_tcp_connect_at(addr, CONTINUE_TEST_HOST);
+      {using_bstream(conn) {
+        async_printf(as_stream(conn), "POST /upload HTTP/1.1\r\nHost: test\r\nExpect: 100-continue\r\n"
+                                      "Content-Length: %i\r\nConnection: close\r\n\r\n", CONTINUE_BODY_LEN);
+        // only send the body once the server asks for it
+        char cont[sizeof(CONTINUE_RESPONSE)];
+        unit_check(async_read_into(conn, nodec_buf(cont, sizeof(cont) - 1)) == sizeof(cont) - 1);
+        unit_check(memcmp(cont, CONTINUE_RESPONSE, sizeof(cont) - 1) == 0);
+        async_write(as_stream(conn), body);
+        char* response = async_read_all(conn, 2 * CONTINUE_BODY_LEN);
+        {using_free(response) {
+          const char* content = strstr(response, "\r\n\r\n");
+          unit_check(strncmp(response, "HTTP/1.1 200", 12) == 0);
+          unit_check(content != NULL && strcmp(content + 4, body) == 0);
+        }}
+      }}
+    }}
+    // the body is never asked for (or only after the response): the server responds
+    // without a `100 Continue` and closes the connection even though the client
+    // wants to keep it alive
+    continue_test_unasked(addr, "/ignore", "ignored");
+    continue_test_unasked(addr, "/late", "late");
+  }}
+}
+
+static void test_http_continue() {
+  async_firstof(&continue_test_server, &continue_test_client);
+}
+
+
+/*-----------------------------------------------------------------
+  Multipart: parse a body that arrives in small pieces such that
+  delimiters are split over reads
+-----------------------------------------------------------------*/
+
+// A stream over a string that returns it in chunks of `chunk` bytes, or of random sizes if 0
+typedef struct _chunk_stream_t {
+  nodec_stream_t stream;
+  const char*    data;
+  size_t         len;
+  size_t         pos;
+  size_t         chunk;
+} chunk_stream_t;
+
+static uv_buf_t async_chunk_stream_read_bufx(nodec_stream_t* stream, bool* owned) {
+  chunk_stream_t* cs = (chunk_stream_t*)stream;
+  if (owned != NULL) *owned = false;
+  if (cs->pos >= cs->len) return nodec_buf_null();
+  size_t n = (cs->chunk > 0 ? cs->chunk : 1 + (size_t)rand() % 23);
+  if (n > cs->len - cs->pos) n = cs->len - cs->pos;
+  uv_buf_t buf = nodec_buf(cs->data + cs->pos, n);
+  cs->pos += n;
+  return buf;
+}
+
+static void chunk_stream_free(nodec_stream_t* stream) {
+  nodec_free(stream);
+}
+
+static nodec_bstream_t* chunk_stream_alloc(const char* data, size_t chunk) {
+  chunk_stream_t* cs = nodec_zero_alloc(chunk_stream_t);
+  nodec_stream_init(&cs->stream, &async_chunk_stream_read_bufx, NULL, NULL, &chunk_stream_free);
+  cs->data = data;
+  cs->len = strlen(data);
+  cs->chunk = chunk;
+  return nodec_bstream_alloc_on(&cs->stream);
+}
+
+#define MP_TEST_TYPE  "multipart/form-data; boundary=\"XyZ\""
+
+static const char* mp_test_body =
+  "a preamble that mentions --XyZ and is ignored\r\n"
+  "--XyZ\r\n"
+  "Content-Disposition: form-data; name=\"a\"\r\n"
+  "\r\n"
+  "alpha\r\n"
+  "--XyZ \t \r\n"   // transport padding
+  "Content-Disposition: form-data; name=\"empty\"\r\n"
+  "\r\n"
+  "\r\n"
+  "--XyZ\r\n"
+  "Content-Disposition: form-data; name=\"file\"; filename=\"f.txt\"\r\n"
+  "Content-Type: application/octet-stream\r\n"
+  "\r\n"
+  "data\r\n--XyX\r\n--Xy\r\n-\r\n"  // prefixes of the delimiter
+  "\r\n--XyZ--\r\n"
+  "an epilogue";
+
+static const char* mp_test_expected = "a=alpha;empty=;file(f.txt)=data\r\n--XyX\r\n--Xy\r\n-\r\n;";
+
+// Read all parts as `name=body;` (or `name(filename)=body;`)
+static void mp_test_parse(const char* data, size_t chunk, char* result, size_t result_max) {
+  result[0] = 0;
+  nodec_bstream_t* body = chunk_stream_alloc(data, chunk);
+  {using_bstream(body) {
+    http_multipart_t* mp = http_multipart_alloc(body, MP_TEST_TYPE);
+    {using_http_multipart(mp) {
+      while (async_http_multipart_next(mp)) {
+        size_t n = strlen(result);
+        const char* filename = http_multipart_filename(mp);
+        if (filename == NULL) snprintf(result + n, result_max - n, "%s=", http_multipart_name(mp));
+        else snprintf(result + n, result_max - n, "%s(%s)=", http_multipart_name(mp), filename);
+        uv_buf_t buf = async_read_buf_all(http_multipart_body(mp), 0);
+        n = strlen(result);
+        if (!nodec_buf_is_null(buf)) {
+          unit_check(n + buf.len + 1 < result_max);
+          memcpy(result + n, buf.base, buf.len);
+          n += buf.len;
+          nodec_buf_free(buf);
+        }
+        snprintf(result + n, result_max - n, ";");
+      }
+    }}
+  }}
+}
+
+typedef struct _mp_test_args_t {
+  const char* data;
+  size_t      chunk;
+} mp_test_args_t;
+
+static lh_value mp_test_parsev(lh_value argsv) {
+  mp_test_args_t* args = (mp_test_args_t*)lh_ptr_value(argsv);
+  char result[256];
+  mp_test_parse(args->data, args->chunk, result, sizeof(result));
+  return lh_value_null;
+}
+
+// Parsing must fail with a `400 Bad Request`
+static void mp_test_invalid(const char* data, size_t chunk) {
+  mp_test_args_t args = { data, chunk };
+  lh_exception* exn = NULL;
+  lh_try(&exn, &mp_test_parsev, lh_value_any_ptr(&args));
+  unit_check(exn != NULL && exn->code == UV_EHTTP - HTTP_STATUS_BAD_REQUEST);
+  lh_exception_free(exn);
+}
+
+static void test_multipart() {
+  char result[256];
+  mp_test_parse(mp_test_body, 1, result, sizeof(result));
+  unit_check(strcmp(result, mp_test_expected) == 0);
+  mp_test_parse(mp_test_body, strlen(mp_test_body), result, sizeof(result));
+  unit_check(strcmp(result, mp_test_expected) == 0);
+  for (unsigned int seed = 1; seed <= 32; seed++) {
+    srand(seed);
+    mp_test_parse(mp_test_body, 0, result, sizeof(result));
+    unit_check(strcmp(result, mp_test_expected) == 0);
+  }
+  // without the final boundary
+  const char* missing[3] = {
+    "--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nalpha",
+    "--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nalpha\r\n--XyZ",
+    "--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nalpha\r\n--XyZ\r\nContent-Disposition: form-data; name=\"b\"\r\n"
+  };
+  for (size_t i = 0; i < 3; i++) {
+    mp_test_invalid(missing[i], 1);
+    mp_test_invalid(missing[i], strlen(missing[i]));
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Main
+-----------------------------------------------------------------*/
+
+static void entry() {
+  unit_run("happy eyeballs", &test_happy_eyeballs);
+  unit_run("udp batch", &test_udp_batch);
+  unit_run("hpack", &test_hpack);
+  unit_run("http2 frames", &test_http2_frames);
+  unit_run("router", &test_router);
+  unit_run("http cache", &test_http_cache);
+  unit_run("http continue", &test_http_continue);
+  unit_run("multipart", &test_multipart);
+  printf("all %zu checks passed\n", unit_checks);
+}
+
+int main() {
+  async_main(entry);
+  return 0;
+}